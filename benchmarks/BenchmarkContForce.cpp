@@ -0,0 +1,325 @@
+/**
+ * This program measures how the cost of evaluating a ContForce scales with the size of its groups,
+ * the number of disconnected fragments in each group, and the number of groups.  It builds synthetic
+ * configurations, times the evaluation on every available platform, and writes the results to
+ * standard output as JSON.  Progress is reported on standard error.
+ *
+ * memoryKB is the largest increase in the resident memory of the process during a configuration,
+ * relative to just before it was built, sampled after creating the Context and after every
+ * evaluation.  It only counts host memory, and memory freed by earlier configurations but kept by
+ * the allocator can be reused without being counted, so it is an estimate.
+ *
+ * Usage: BenchmarkContForce [options]
+ *
+ *   --platform NAME       only benchmark this platform.  May be given more than once.
+ *   --max-particles N     skip configurations with more than N particles (default 1000000)
+ *   --time-limit T        once one evaluation takes more than T seconds, skip the larger
+ *                         configurations of the same series on that platform (default 10)
+ *   --min-time T          repeat each evaluation until at least T seconds have passed (default 0.5)
+ *   --host                compute the force on the host on platforms that support device kernels
+ */
+
+#include "ContForce.h"
+#include "openmm/Context.h"
+#include "openmm/OpenMMException.h"
+#include "openmm/Platform.h"
+#include "openmm/State.h"
+#include "openmm/System.h"
+#include "openmm/VerletIntegrator.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+    #include <windows.h>
+    #include <psapi.h>
+#elif defined(__APPLE__)
+    #include <mach/mach.h>
+#else
+    #include <cstdio>
+    #include <unistd.h>
+#endif
+
+using namespace ContForcePlugin;
+using namespace OpenMM;
+using namespace std;
+
+extern "C" void registerExampleReferenceKernelFactories();
+#ifdef BENCHMARK_CPU
+extern "C" void registerContForceCpuKernelFactories();
+#endif
+#ifdef BENCHMARK_CUDA
+extern "C" void registerContForceCudaKernelFactories();
+#endif
+#ifdef BENCHMARK_OPENCL
+extern "C" void registerContForceOpenCLKernelFactories();
+#endif
+
+struct Options {
+    vector<string> platforms;
+    long long maxParticles = 1000000;
+    double timeLimit = 10.0;
+    double minTime = 0.5;
+    bool hostComputation = false;
+};
+
+struct Configuration {
+    string series;
+    int numGroups, groupSize, numFragments;
+};
+
+struct Result {
+    int steps;
+    double secondsPerEvaluation;
+    long long memoryKB;
+};
+
+static string escape(const string& text) {
+    string escaped;
+    for (char c : text) {
+        if (c == '"' || c == '\\')
+            escaped += '\\';
+        escaped += c;
+    }
+    return escaped;
+}
+
+/**
+ * Get the amount of memory the process currently has resident, in kB, or -1 if it is not known.
+ */
+static long long getCurrentMemoryKB() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return (long long) (counters.WorkingSetSize/1024);
+    return -1;
+#elif defined(__APPLE__)
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t) &info, &count) != KERN_SUCCESS)
+        return -1;
+    return (long long) (info.resident_size/1024);
+#else
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm == NULL)
+        return -1;
+    long long size, resident;
+    int numRead = fscanf(statm, "%lld %lld", &size, &resident);
+    fclose(statm);
+    if (numRead != 2)
+        return -1;
+    return resident*(sysconf(_SC_PAGESIZE)/1024);
+#endif
+}
+
+/**
+ * Tracks the largest increase in resident memory over a baseline taken when it is created.
+ */
+class MemoryTracker {
+public:
+    MemoryTracker() : baseline(getCurrentMemoryKB()), maxIncrease(0) {
+    }
+    void sample() {
+        long long current = getCurrentMemoryKB();
+        maxIncrease = max(maxIncrease, current-baseline);
+    }
+    long long getMaxIncreaseKB() const {
+        return (baseline < 0 ? -1 : maxIncrease);
+    }
+private:
+    long long baseline, maxIncrease;
+};
+
+/**
+ * Build the positions for a configuration.  Each fragment is a small lattice of particles closer
+ * than the cutoff, and fragments are further apart than the cutoff, so every group has exactly
+ * the requested number of components.  Groups are placed side by side.
+ */
+static void createPositions(const Configuration& config, double cutoff, mt19937& rng, vector<Vec3>& positions) {
+    uniform_real_distribution<double> jitter(-0.05*cutoff, 0.05*cutoff);
+    double spacing = 0.5*cutoff;
+    int fragmentSize = (config.groupSize+config.numFragments-1)/config.numFragments;
+    int side = (int) ceil(cbrt((double) fragmentSize));
+    double fragmentExtent = side*spacing;
+    double fragmentStride = fragmentExtent+2*cutoff;
+    double groupStride = fragmentExtent+2*cutoff;
+    int groupsPerRow = (int) ceil(sqrt((double) config.numGroups));
+    positions.resize((size_t) config.numGroups*config.groupSize);
+    for (int group = 0; group < config.numGroups; group++) {
+        Vec3 groupOffset(0, (group%groupsPerRow)*groupStride, (group/groupsPerRow)*groupStride);
+        for (int i = 0; i < config.groupSize; i++) {
+            int fragment = i%config.numFragments;
+            int site = i/config.numFragments;
+            Vec3 pos(fragment*fragmentStride+(site%side)*spacing, ((site/side)%side)*spacing, (site/(side*side))*spacing);
+            positions[(size_t) group*config.groupSize+i] = groupOffset+pos+Vec3(jitter(rng), jitter(rng), jitter(rng));
+        }
+    }
+}
+
+static Result runBenchmark(Platform& platform, const Configuration& config, const Options& options, double& firstEvaluationTime) {
+    MemoryTracker memory;
+    const double cutoff = 1.0;
+    mt19937 rng(1234);
+    System system;
+    int numParticles = config.numGroups*config.groupSize;
+    for (int i = 0; i < numParticles; i++)
+        system.addParticle(1.0);
+    ContForce* force = new ContForce();
+    vector<int> idxs(config.groupSize);
+    for (int group = 0; group < config.numGroups; group++) {
+        for (int i = 0; i < config.groupSize; i++)
+            idxs[i] = group*config.groupSize+i;
+        force->addBond(idxs, config.groupSize, cutoff, 10.0);
+    }
+    force->setUseDeviceKernels(!options.hostComputation);
+    system.addForce(force);
+
+    // Alternate between two sets of positions, so no evaluation can reuse the previous results.
+
+    vector<Vec3> positions[2];
+    createPositions(config, cutoff, rng, positions[0]);
+    uniform_real_distribution<double> displacement(-0.01*cutoff, 0.01*cutoff);
+    positions[1] = positions[0];
+    for (Vec3& pos : positions[1])
+        pos += Vec3(displacement(rng), displacement(rng), displacement(rng));
+    VerletIntegrator integrator(0.001);
+    Context context(system, integrator, platform);
+    memory.sample();
+
+    // The first evaluation includes one time setup, such as compiling kernels.
+
+    context.setPositions(positions[0]);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    context.getState(State::Forces | State::Energy);
+    firstEvaluationTime = chrono::duration<double>(chrono::steady_clock::now()-start).count();
+    memory.sample();
+    Result result;
+    result.steps = 0;
+    double totalTime = 0.0;
+    while (result.steps < 3 || (totalTime < options.minTime && result.steps < 1000)) {
+        context.setPositions(positions[(result.steps+1)%2]);
+        start = chrono::steady_clock::now();
+        context.getState(State::Forces | State::Energy);
+        totalTime += chrono::duration<double>(chrono::steady_clock::now()-start).count();
+        memory.sample();
+        result.steps++;
+    }
+    result.secondsPerEvaluation = totalTime/result.steps;
+    result.memoryKB = memory.getMaxIncreaseKB();
+    return result;
+}
+
+static void parseOptions(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool hasValue = (i+1 < argc);
+        if (arg == "--platform" && hasValue)
+            options.platforms.push_back(argv[++i]);
+        else if (arg == "--max-particles" && hasValue)
+            options.maxParticles = atoll(argv[++i]);
+        else if (arg == "--time-limit" && hasValue)
+            options.timeLimit = atof(argv[++i]);
+        else if (arg == "--min-time" && hasValue)
+            options.minTime = atof(argv[++i]);
+        else if (arg == "--host")
+            options.hostComputation = true;
+        else
+            throw OpenMMException("Unknown or incomplete option: "+arg);
+    }
+}
+
+/**
+ * List the configurations to benchmark.  Within a series the configurations are ordered from
+ * smallest to largest, so a series can be abandoned once it becomes too slow.
+ */
+static void createConfigurations(const Options& options, vector<Configuration>& configs) {
+    vector<long long> sizes = {10, 100, 1000, 10000, 100000, 1000000};
+    for (int fragments : {1, 10, 100})
+        for (long long size : sizes)
+            if (fragments <= size && size <= options.maxParticles)
+                configs.push_back({"single group, "+to_string(fragments)+" fragments", 1, (int) size, fragments});
+    for (int groupSize : {10, 100})
+        for (int fragments : {1, 2})
+            for (long long size : sizes)
+                if (size > groupSize && size <= options.maxParticles)
+                    configs.push_back({"groups of "+to_string(groupSize)+", "+to_string(fragments)+" fragments",
+                                       (int) (size/groupSize), groupSize, fragments});
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        Options options;
+        parseOptions(argc, argv, options);
+        registerExampleReferenceKernelFactories();
+#ifdef BENCHMARK_CPU
+        registerContForceCpuKernelFactories();
+#endif
+#ifdef BENCHMARK_CUDA
+        registerContForceCudaKernelFactories();
+#endif
+#ifdef BENCHMARK_OPENCL
+        registerContForceOpenCLKernelFactories();
+#endif
+        vector<Configuration> configs;
+        createConfigurations(options, configs);
+        vector<string> entries, skipped;
+        for (int p = 0; p < Platform::getNumPlatforms(); p++) {
+            Platform& platform = Platform::getPlatform(p);
+            string name = platform.getName();
+            if (options.platforms.size() > 0 && find(options.platforms.begin(), options.platforms.end(), name) == options.platforms.end())
+                continue;
+            vector<string> slowSeries;
+            for (const Configuration& config : configs) {
+                if (find(slowSeries.begin(), slowSeries.end(), config.series) != slowSeries.end())
+                    continue;
+                int numParticles = config.numGroups*config.groupSize;
+                cerr << name << ": " << config.series << ", " << numParticles << " particles" << endl;
+                double firstEvaluationTime;
+                Result result;
+                try {
+                    result = runBenchmark(platform, config, options, firstEvaluationTime);
+                }
+                catch (const exception& e) {
+                    // The platform may be unusable on this machine, or may not support ContForce.
+
+                    skipped.push_back("{\"platform\": \""+escape(name)+"\", \"reason\": \""+escape(e.what())+"\"}");
+                    cerr << "  skipped: " << e.what() << endl;
+                    break;
+                }
+                if (result.secondsPerEvaluation > options.timeLimit)
+                    slowSeries.push_back(config.series);
+                stringstream entry;
+                entry.precision(6);
+                entry << "{\"platform\": \"" << escape(name) << "\", \"series\": \"" << escape(config.series)
+                      << "\", \"deviceKernels\": " << (options.hostComputation ? "false" : "true")
+                      << ", \"groups\": " << config.numGroups << ", \"groupSize\": " << config.groupSize
+                      << ", \"fragments\": " << config.numFragments << ", \"particles\": " << numParticles
+                      << ", \"steps\": " << result.steps << ", \"firstEvaluationSeconds\": " << firstEvaluationTime
+                      << ", \"secondsPerEvaluation\": " << result.secondsPerEvaluation
+                      << ", \"nsPerParticle\": " << 1e9*result.secondsPerEvaluation/numParticles
+                      << ", \"evaluationsPerSecond\": " << 1.0/result.secondsPerEvaluation
+                      << ", \"particlesPerSecond\": " << numParticles/result.secondsPerEvaluation
+                      << ", \"memoryKB\": " << result.memoryKB << "}";
+                entries.push_back(entry.str());
+            }
+        }
+        cout << "{\n  \"benchmarks\": [";
+        for (int i = 0; i < entries.size(); i++)
+            cout << (i == 0 ? "\n    " : ",\n    ") << entries[i];
+        cout << "\n  ],\n  \"skipped\": [";
+        for (int i = 0; i < skipped.size(); i++)
+            cout << (i == 0 ? "\n    " : ",\n    ") << skipped[i];
+        cout << "\n  ]\n}" << endl;
+    }
+    catch (const exception& e) {
+        cerr << "exception: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -3,7 +3,7 @@ import simtk.openmm.app as omma
 import openmm.unit as unit
 import numpy as np
 
-from contforceplugin import ContForce
+from contforceplugin import ContForce, ContinuityReporter, readContinuityLog
 
 openmm_path = sys.argv[1]
 plugins_path = osp.join(openmm_path,'lib','plugins')
@@ -50,7 +50,10 @@ simulation.context.setPositions(pos)
 simulation.minimizeEnergy()
 
 simulation.reporters.append(omma.PDBReporter('output.pdb', 100))
+continuity = ContinuityReporter('continuity.bin', 100, force)
+simulation.reporters.append(continuity)
 simulation.step(20000)
+continuity.close()
 state = simulation.context.getState(getPositions=True,getVelocities=True)
 
 pos = np.array(state.getPositions().value_in_unit(unit.nanometer))
@@ -60,3 +63,6 @@ connections = np.array(dmat < d+0.2, dtype=int)
 
 print("Final connection matrix:")
 print(connections)
+
+step, time, numComponents, numPairs, minDistances = readContinuityLog('continuity.bin')[-1]
+print(f"Components at step {step}: {numComponents[0]}")
@@ -34,6 +34,7 @@
 
 #include "openmm/Context.h"
 #include "openmm/Force.h"
+#include <iosfwd>
 #include <vector>
 #include "internal/windowsExportExample.h"
 
@@ -60,7 +61,19 @@ public:
      * @param k         the force constant for the bond, measured in kJ/mol/nm^4
      * @return the index of the bond that was added
      */
-    int addBond(std::vector<int> idxs , int npart, double length, double k);
+    int addBond(const std::vector<int>& idxs , int npart, double length, double k);
+    /**
+     * Add many bond terms to the force at once.  The particles of all bonds are given in one list,
+     * one bond after another.
+     *
+     * @param idxs      the indices of the particles in every bond, one bond after another
+     * @param npart     the number of particles in each bond
+     * @param length    the equilibrium length of each bond, measured in nm
+     * @param k         the force constant for each bond, measured in kJ/mol/nm^4
+     * @return the index of the first bond that was added
+     */
+    int addBonds(const std::vector<int>& idxs, const std::vector<int>& npart, const std::vector<double>& length,
+                 const std::vector<double>& k);
     /**
      * Get the force field parameters for a bond term.
      * 
@@ -80,30 +93,240 @@ public:
      * @param length    the equilibrium length of the bond, measured in nm
      * @param k         the harmonic force constant for the bond, measured in kJ/mol/nm^4
      */
-    void setBondParameters(int index, std::vector<int> idxs, int npart, double length, double k);
+    void setBondParameters(int index, const std::vector<int>& idxs, int npart, double length, double k);
+    /**
+     * Set the force field parameters for many bond terms at once.  The particles of all bonds are given
+     * in one list, in the same order as the bonds.
+     *
+     * @param indices   the indices of the bonds for which to set parameters
+     * @param idxs      the indices of the particles in every bond, one bond after another
+     * @param npart     the number of particles in each bond
+     * @param length    the equilibrium length of each bond, measured in nm
+     * @param k         the harmonic force constant for each bond, measured in kJ/mol/nm^4
+     */
+    void setBondParametersBulk(const std::vector<int>& indices, const std::vector<int>& idxs, const std::vector<int>& npart,
+                               const std::vector<double>& length, const std::vector<double>& k);
     /**
      * Update the per-bond parameters in a Context to match those stored in this Force object.  This method provides
      * an efficient method to update certain parameters in an existing Context without needing to reinitialize it.
      * Simply call setBondParameters() to modify this object's parameters, then call updateParametersInState()
      * to copy them over to the Context.
      * 
-     * The only information this method updates is the values of per-bond parameters.  The set of particles involved
-     * in a bond cannot be changed, nor can new bonds be added.
+     * This method updates the per-bond parameters, including the particles in each bond, the skin distance,
+     * the hierarchical group size, and the update interval.  New bonds cannot be added and existing ones cannot be removed.  The restrained
+     * pairs already selected in the Context are kept until the next selection, except in bonds whose particles
+     * have changed: their pairs are selected again the next time the force is computed.
      */
     void updateParametersInContext(OpenMM::Context& context);
     /**
-     * Returns true if the force uses periodic boundary conditions and false otherwise. Your force should implement this
-     * method appropriately to ensure that `System.usesPeriodicBoundaryConditions()` works for all systems containing
-     * your force.
+     * Get whether GPU platforms evaluate this force entirely on the device.  If false, the positions are
+     * downloaded every step and the components and restrained pairs are found on the host.  The Reference
+     * platform always computes on the host.
+     */
+    bool getUseDeviceKernels() const {
+        return useDeviceKernels;
+    }
+    /**
+     * Set whether GPU platforms evaluate this force entirely on the device.  If false, the positions are
+     * downloaded every step and the components and restrained pairs are found on the host.  The Reference
+     * platform always computes on the host.  This takes effect when a Context is created.
+     */
+    void setUseDeviceKernels(bool use) {
+        useDeviceKernels = use;
+    }
+    /**
+     * Get whether GPU platforms that compute this force on the host select the restrained pairs one
+     * step late.  If true, the pairs are selected from the previous step's positions while the device
+     * computes the current step, and the device then restrains them at their current separations.
+     * This takes the host calculation off the critical path at the cost of applying each selection
+     * one step later.  It has no effect when the force is evaluated entirely on the device, or on the
+     * Reference and CPU platforms.
+     */
+    bool getUsePipelinedSelection() const {
+        return usePipelinedSelection;
+    }
+    /**
+     * Set whether GPU platforms that compute this force on the host select the restrained pairs one
+     * step late.  If true, the pairs are selected from the previous step's positions while the device
+     * computes the current step, and the device then restrains them at their current separations.
+     * This takes the host calculation off the critical path at the cost of applying each selection
+     * one step later.  It has no effect when the force is evaluated entirely on the device, or on the
+     * Reference and CPU platforms.  This takes effect when a Context is created.
+     */
+    void setUsePipelinedSelection(bool use) {
+        usePipelinedSelection = use;
+    }
+    /**
+     * Get whether the CUDA platform finds the pairs of particles closer than the cutoff from the neighbor
+     * list it already builds for a NonbondedForce, instead of searching every group.  This is only done
+     * when the force is evaluated entirely on the device, the System contains a NonbondedForce with a cutoff
+     * at least as large as the cutoff of every bond with more than 64 particles, that NonbondedForce is
+     * computed in the same evaluation, and the platform runs on a single device.  Otherwise every group is
+     * searched as usual.
+     */
+    bool getUseNonbondedNeighborList() const {
+        return useNonbondedNeighborList;
+    }
+    /**
+     * Set whether the CUDA platform finds the pairs of particles closer than the cutoff from the neighbor
+     * list it already builds for a NonbondedForce, instead of searching every group.  This is only done
+     * when the force is evaluated entirely on the device, the System contains a NonbondedForce with a cutoff
+     * at least as large as the cutoff of every bond with more than 64 particles, that NonbondedForce is
+     * computed in the same evaluation, and the platform runs on a single device.  Otherwise every group is
+     * searched as usual.  This takes effect when a Context is created.
+     */
+    void setUseNonbondedNeighborList(bool use) {
+        useNonbondedNeighborList = use;
+    }
+    /**
+     * Get the skin distance used to reuse neighbor lists between steps, measured in nm.  Each group's
+     * list of nearby particle pairs is built with the cutoff extended by this distance, and is searched
+     * again only after some particle has moved more than half of it.  A value of 0 means the pairs are
+     * found from scratch on every step.
+     */
+    double getSkinDistance() const {
+        return skinDistance;
+    }
+    /**
+     * Set the skin distance used to reuse neighbor lists between steps, measured in nm.  Each group's
+     * list of nearby particle pairs is built with the cutoff extended by this distance, and is searched
+     * again only after some particle has moved more than half of it.  A value of 0 means the pairs are
+     * found from scratch on every step.  This takes effect when a Context is created or
+     * updateParametersInContext() is called.
+     */
+    void setSkinDistance(double distance);
+    /**
+     * Get the number of particles above which a group is labeled in two levels when the force is computed
+     * on the host.  The particles of such a group are clustered into supernodes whenever its neighbor
+     * list is built, and on the steps in between only the pairs of particles near the cutoff that join
+     * different supernodes are checked, instead of every pair in the list.  This selects exactly the same
+     * pairs.  It is only done when the skin distance is greater than 0.  A value of 0 means no group is
+     * labeled this way.
+     */
+    int getHierarchicalGroupSize() const {
+        return hierarchicalGroupSize;
+    }
+    /**
+     * Set the number of particles above which a group is labeled in two levels when the force is computed
+     * on the host.  The particles of such a group are clustered into supernodes whenever its neighbor
+     * list is built, and on the steps in between only the pairs of particles near the cutoff that join
+     * different supernodes are checked, instead of every pair in the list.  This selects exactly the same
+     * pairs.  It is only done when the skin distance is greater than 0.  A value of 0 means no group is
+     * labeled this way.  The default value is 100000.  This takes effect when a Context is created or
+     * updateParametersInContext() is called.
+     */
+    void setHierarchicalGroupSize(int size);
+    /**
+     * Get how often the restrained pairs are selected, measured in time steps.  Components are found and
+     * the closest pairs between them are chosen once every this many steps.
+     * On the steps in between, the pairs chosen last time are restrained at their current separations.
+     */
+    int getUpdateInterval() const {
+        return updateInterval;
+    }
+    /**
+     * Set how often the restrained pairs are selected, measured in time steps.  Components are found and
+     * the closest pairs between them are chosen once every this many steps.
+     * On the steps in between, the pairs chosen last time are restrained at their current separations.
+     * The default value of 1 selects them on every step.  This takes effect when a Context is created or
+     * updateParametersInContext() is called.
+     */
+    void setUpdateInterval(int interval);
+    /**
+     * Get how many times a group's neighbor list has been reused instead of rebuilt since the Context
+     * was created.  This is useful for choosing the skin distance.  It is always 0 when the skin
+     * distance is 0 or the force is evaluated by device kernels.
+     *
+     * @param context    the Context to query
+     */
+    long long getNumCacheHits(OpenMM::Context& context);
+    /**
+     * Get statistics about a bond from the last time the force was evaluated in a Context.  This
+     * reads them directly from the Context without retrieving a State.
+     *
+     * @param context        the Context to query
+     * @param index          the index of the bond to get statistics for
+     * @param numComponents  on exit, the number of components the particles in the bond were split into
+     *                       when the restrained pairs were last selected.  This is 1 if they were all
+     *                       connected, and 0 if the pairs have never been selected.
+     * @param particle1      on exit, the first particle of each restrained pair
+     * @param particle2      on exit, the second particle of each restrained pair
+     * @param distances      on exit, the distance between the particles of each restrained pair, measured
+     *                       in nm
+     */
+    void getBondStatistics(OpenMM::Context& context, int index, int& numComponents, std::vector<int>& particle1,
+                           std::vector<int>& particle2, std::vector<double>& distances);
+    /**
+     * Get a short summary of every bond from the last time the force was evaluated in a Context.  This
+     * is much cheaper than calling getBondStatistics() for every bond: on platforms that evaluate the
+     * force with device kernels, the summaries are reduced on the device and only a few values per bond
+     * are downloaded.  It is meant to be called often, for example by a reporter.
+     *
+     * @param context        the Context to query
+     * @param numComponents  on exit, the number of components the particles in each bond were split into
+     *                       when the restrained pairs were last selected, as reported by getBondStatistics()
+     * @param numPairs       on exit, the number of restrained pairs of each bond
+     * @param minDistances   on exit, the shortest distance between the particles of a restrained pair of
+     *                       each bond, measured in nm, or -1 if the bond has no restrained pairs
+     */
+    void getBondSummaries(OpenMM::Context& context, std::vector<int>& numComponents, std::vector<int>& numPairs,
+                          std::vector<double>& minDistances);
+    /**
+     * Get the total time spent in each phase of the calculation since the Context was created, measured
+     * in seconds.  Times that a platform does not measure are reported as 0.  On the CUDA platform
+     * the device kernels are timed with events, and the distances are computed by the same kernels
+     * that label the components, so their time is included in labelingTime.
+     *
+     * @param context        the Context to query
+     * @param distanceTime   on exit, the time spent finding the pairs of particles closer than the cutoff
+     * @param labelingTime   on exit, the time spent labeling the components they form
+     * @param selectionTime  on exit, the time spent finding the closest pairs between components
+     * @param uploadTime     on exit, the time spent copying forces and pairs computed on the host to the device
+     */
+    void getPhaseTimes(OpenMM::Context& context, double& distanceTime, double& labelingTime, double& selectionTime,
+                       double& uploadTime);
+    /**
+     * Write the state of this force in a Context to a stream: the pairs each bond restrains and the step
+     * they were selected at.  Context::createCheckpoint() does not save it, since OpenMM checkpoints do
+     * not include the state of forces, so call this right after it to let a checkpoint be restored
+     * without selecting the pairs again.
+     *
+     * @param context  the Context whose state should be saved
+     * @param stream   the stream to write the state to
+     */
+    void createCheckpoint(OpenMM::Context& context, std::ostream& stream);
+    /**
+     * Read the state of this force in a Context from a stream written by createCheckpoint().  Call this
+     * right after Context::loadCheckpoint().  An exception is thrown if the state was saved for a force
+     * with different bonds.
+     *
+     * @param context  the Context whose state should be restored
+     * @param stream   the stream to read the state from
+     */
+    void loadCheckpoint(OpenMM::Context& context, std::istream& stream);
+    /**
+     * Set whether this force should apply periodic boundary conditions when calculating the distances
+     * between particles.  If true, every distance is measured to the nearest periodic image, so the
+     * cutoff of every bond plus the skin distance must be less than half the periodic box size.  The
+     * default is false.  This takes effect when a Context is created.
+     */
+    void setUsesPeriodicBoundaryConditions(bool periodic) {
+        usePeriodic = periodic;
+    }
+    /**
+     * Returns whether or not this force makes use of periodic boundary conditions.
      */
     bool usesPeriodicBoundaryConditions() const {
-        return false;
+        return usePeriodic;
     }
 protected:
     OpenMM::ForceImpl* createImpl() const;
 private:
     class BondInfo;
     std::vector<BondInfo> bonds;
+    bool useDeviceKernels, usePipelinedSelection, useNonbondedNeighborList, usePeriodic;
+    double skinDistance;
+    int updateInterval, hierarchicalGroupSize;
 };
 
 /**
@@ -120,7 +343,7 @@ public:
 	    npart = 0;
 		length = k = 0.0;
     }
-  BondInfo(std::vector<int> idxs, int npart, double length, double k) :
+  BondInfo(const std::vector<int>& idxs, int npart, double length, double k) :
 	idxs(idxs), npart(npart), length(length), k(k) {
   }
 };
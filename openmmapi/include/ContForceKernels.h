@@ -36,7 +36,9 @@
 #include "openmm/KernelImpl.h"
 #include "openmm/Platform.h"
 #include "openmm/System.h"
+#include <iosfwd>
 #include <string>
+#include <vector>
 
 namespace ContForcePlugin {
 
@@ -70,6 +72,47 @@ public:
      * @param force      the ContForce to copy the parameters from
      */
     virtual void copyParametersToContext(OpenMM::ContextImpl& context, const ContForce& force) = 0;
+    /**
+     * Get how many times a group's neighbor list has been reused instead of rebuilt.
+     */
+    virtual long long getNumCacheHits() const = 0;
+    /**
+     * Get statistics about a group from the last time the force was evaluated.
+     *
+     * @param group          the index of the group
+     * @param numComponents  on exit, the number of components the group was split into when its pairs were last selected
+     * @param particle1      on exit, the first particle of each restrained pair
+     * @param particle2      on exit, the second particle of each restrained pair
+     * @param distances      on exit, the distance between the particles of each restrained pair
+     */
+    virtual void getGroupStatistics(int group, int& numComponents, std::vector<int>& particle1, std::vector<int>& particle2,
+                                    std::vector<double>& distances) = 0;
+    /**
+     * Get a summary of every group from the last time the force was evaluated.  See ContForce::getBondSummaries().
+     *
+     * @param numComponents  on exit, the number of components each group was split into when its pairs were last selected
+     * @param numPairs       on exit, the number of restrained pairs of each group
+     * @param minDistances   on exit, the shortest distance of a restrained pair of each group, or -1 if it has none
+     */
+    virtual void getGroupSummaries(std::vector<int>& numComponents, std::vector<int>& numPairs, std::vector<double>& minDistances) = 0;
+    /**
+     * Get the total time in seconds spent in each phase of the calculation.  See ContForce::getPhaseTimes().
+     */
+    virtual void getPhaseTimes(double& distanceTime, double& labelingTime, double& selectionTime, double& uploadTime) = 0;
+    /**
+     * Write the state kept between steps, such as the pairs selected most recently, to a checkpoint.
+     *
+     * @param context    the context this kernel is used in
+     * @param stream     the stream to write the checkpoint to
+     */
+    virtual void createCheckpoint(OpenMM::ContextImpl& context, std::ostream& stream) = 0;
+    /**
+     * Load the state written to a checkpoint by createCheckpoint().
+     *
+     * @param context    the context this kernel is used in
+     * @param stream     the stream to read the checkpoint from
+     */
+    virtual void loadCheckpoint(OpenMM::ContextImpl& context, std::istream& stream) = 0;
 };
 
 } // namespace ContForcePlugin
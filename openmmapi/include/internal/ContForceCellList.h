@@ -0,0 +1,104 @@
+#ifndef OPENMM_CONTFORCECELLLIST_H_
+#define OPENMM_CONTFORCECELLLIST_H_
+
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2014 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+
+#include "internal/ContForcePeriodicBox.h"
+#include "internal/windowsExportExample.h"
+#include "openmm/Vec3.h"
+#include <utility>
+#include <vector>
+
+namespace ContForcePlugin {
+
+/**
+ * This class finds all pairs of particles in a ContForce group that are closer than the
+ * cutoff distance.  Particles are binned into a grid of cells whose width equals the cutoff,
+ * so only particles in the same or adjacent cells are compared.  Only occupied cells are
+ * stored, which keeps memory proportional to the number of particles no matter how widely
+ * the group is spread out.
+ *
+ * In a periodic box the particles are wrapped into the box and binned by their fractional
+ * coordinates, with at least the cutoff between opposite faces of a cell.  Cells on opposite sides
+ * of the box are adjacent, and each pair of adjacent cells records the box vector shift that takes
+ * the second cell to the image next to the first.
+ *
+ * Platforms can provide faster ways of comparing the particles in neighboring cells by
+ * subclassing this and overriding findNeighbors() and clone().
+ */
+
+class OPENMM_EXPORT_EXAMPLE ContForceCellList {
+public:
+    virtual ~ContForceCellList() {
+    }
+    /**
+     * Create a new, empty cell list of the same type as this one.  The caller takes ownership of it.
+     */
+    virtual ContForceCellList* clone() const;
+    /**
+     * Allocate enough memory for groups of up to a given number of particles, so that
+     * later calls only need to allocate memory if the list of pairs grows.
+     */
+    virtual void reserve(int numParticles);
+    /**
+     * Find all pairs of particles that are closer than a cutoff distance.
+     *
+     * @param positions  the positions of the particles in the group
+     * @param box        the periodic box the particles are in
+     * @param cutoff     the cutoff distance
+     * @param pairs      on exit, every pair (i, j) with i < j whose separation is less than cutoff
+     */
+    virtual void findNeighbors(const std::vector<OpenMM::Vec3>& positions, const ContForcePeriodicBox& box, double cutoff,
+                               std::vector<std::pair<int, int> >& pairs);
+protected:
+    /**
+     * Sort the particles by the cell containing them and list every pair of occupied cells that
+     * are adjacent.  On exit, sortedParticles[cellStart[c]] to sortedParticles[cellStart[c+1]-1] are
+     * the (key, particle) entries of cell c, and cellPairs holds each pair of adjacent cells (c1, c2)
+     * with c1 <= c2 exactly once, including every cell paired with itself.  The particle whose entry
+     * is sortedParticles[i] is at sortedPositions[i], wrapped into the box if it is periodic, and
+     * the particles of c2 must be displaced by pairShifts[k] to lie next to those of c1.  In a small
+     * periodic box two cells can be adjacent through more than one image, and a cell can be adjacent
+     * to an image of itself, so a pair of cells may appear several times with different shifts.
+     */
+    void buildCells(const std::vector<OpenMM::Vec3>& positions, const ContForcePeriodicBox& box, double cutoff);
+    std::vector<std::pair<long long, int> > sortedParticles;
+    std::vector<OpenMM::Vec3> sortedPositions, pairShifts;
+    std::vector<long long> cellKeys;
+    std::vector<int> cellStart;
+    std::vector<std::pair<int, int> > cellPairs;
+};
+
+} // namespace ContForcePlugin
+
+#endif /*OPENMM_CONTFORCECELLLIST_H_*/
@@ -0,0 +1,111 @@
+#ifndef OPENMM_CONTFORCECHECKPOINT_H_
+#define OPENMM_CONTFORCECHECKPOINT_H_
+
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2014 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+
+
+#include "openmm/OpenMMException.h"
+#include <iostream>
+#include <vector>
+
+namespace ContForcePlugin {
+
+/**
+ * This class writes the state the kernels keep between steps to a Context checkpoint and reads it
+ * back.  Values are stored in binary, like the rest of a checkpoint, so it can only be loaded on the
+ * same kind of computer and platform it was created on.  Every read is checked, so a checkpoint that
+ * is truncated or was created for a different force causes an exception instead of corrupt state.
+ */
+
+class ContForceCheckpoint {
+public:
+    /**
+     * Write a value.
+     */
+    template <class T>
+    static void write(std::ostream& stream, const T& value) {
+        stream.write((const char*) &value, sizeof(T));
+    }
+    /**
+     * Write a vector of values, preceded by its size.
+     */
+    template <class T>
+    static void write(std::ostream& stream, const std::vector<T>& values) {
+        int size = values.size();
+        write(stream, size);
+        if (size > 0)
+            stream.write((const char*) &values[0], size*sizeof(T));
+    }
+    /**
+     * Read a value written by write().
+     */
+    template <class T>
+    static void read(std::istream& stream, T& value) {
+        stream.read((char*) &value, sizeof(T));
+        checkStream(stream);
+    }
+    /**
+     * Read a vector of values written by write().
+     */
+    template <class T>
+    static void read(std::istream& stream, std::vector<T>& values) {
+        int size;
+        read(stream, size);
+        if (size < 0)
+            throw OpenMM::OpenMMException("ContForce: the checkpoint is corrupt");
+        values.resize(size);
+        if (size > 0)
+            stream.read((char*) &values[0], size*sizeof(T));
+        checkStream(stream);
+    }
+    /**
+     * Read a value and check that it equals the one expected.  This is used for the sizes recorded
+     * in a checkpoint, which must match the force it is loaded into.
+     */
+    template <class T>
+    static void readExpected(std::istream& stream, const T& expected) {
+        T value;
+        read(stream, value);
+        if (!(value == expected))
+            throw OpenMM::OpenMMException("ContForce: the checkpoint was created for a different force");
+    }
+private:
+    static void checkStream(std::istream& stream) {
+        if (!stream)
+            throw OpenMM::OpenMMException("ContForce: the checkpoint ended unexpectedly");
+    }
+};
+
+} // namespace ContForcePlugin
+
+#endif /*OPENMM_CONTFORCECHECKPOINT_H_*/
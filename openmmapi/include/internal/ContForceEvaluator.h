@@ -0,0 +1,228 @@
+#ifndef OPENMM_CONTFORCEEVALUATOR_H_
+#define OPENMM_CONTFORCEEVALUATOR_H_
+
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2014 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+
+
+#include "ContForce.h"
+#include "internal/ContForceGroups.h"
+#include "internal/ContForcePairSelector.h"
+#include "internal/ContForcePeriodicBox.h"
+#include "internal/ContForceSharedNeighbors.h"
+#include "internal/windowsExportExample.h"
+#include "openmm/Vec3.h"
+#include "openmm/internal/ThreadPool.h"
+#include <atomic>
+#include <iosfwd>
+#include <utility>
+#include <vector>
+
+namespace ContForcePlugin {
+
+/**
+ * This class computes a ContForce from positions in host memory.  It is shared by the kernels
+ * that evaluate the force on the CPU.  The groups are spread over the threads of a ThreadPool:
+ * each thread repeatedly takes the next unprocessed group, largest groups first, so a few large
+ * groups do not leave the other threads idle.  Every thread accumulates its own energy and forces,
+ * which are combined once all groups are done.
+ *
+ * Groups that share most of their particles, such as nested groups with different cutoffs, are
+ * found when the force is initialized.  Each such set of groups is processed by one thread, which
+ * searches their particles for neighbors only once (see ContForceSharedNeighbors).  This is not
+ * done when there would be fewer sets and remaining groups than threads.
+ *
+ * The results of the last evaluation are kept along with the positions of the members.  If an
+ * evaluation finds every member where it was, the pairs are not selected again, and the cached energy
+ * and forces are returned if they include everything that was requested.
+ *
+ * If the force uses periodic boundary conditions, every separation is measured to the nearest
+ * periodic image, both when selecting pairs and when computing the restraints.
+ */
+
+class OPENMM_EXPORT_EXAMPLE ContForceEvaluator {
+public:
+    ContForceEvaluator();
+    /**
+     * Copy the groups from a ContForce and allocate memory.
+     *
+     * @param force         the ContForce to evaluate
+     * @param numThreads    the number of threads in the ThreadPool that will be passed to evaluate()
+     * @param cellListType  the type of cell list to search for neighbors with.  See ContForcePairSelector::setNumGroups().
+     */
+    void initialize(const ContForce& force, int numThreads, const ContForceCellList& cellListType=ContForceCellList());
+    /**
+     * Copy changed parameters and members from a ContForce.  The pairs selected most recently are
+     * kept for the groups whose members are unchanged, but the cached results are discarded.  The
+     * state kept for the other groups is discarded, and their pairs are selected again on the next
+     * call to evaluate() even if it is not asked to select pairs.
+     */
+    void updateParameters(const ContForce& force);
+    /**
+     * Get the indices of the groups whose members were changed by the last call to updateParameters().
+     */
+    const std::vector<int>& getChangedGroups() const {
+        return changedGroups;
+    }
+    /**
+     * Get the groups being evaluated.
+     */
+    const ContForceGroups& getGroups() const {
+        return groups;
+    }
+    /**
+     * Get how many times a group's neighbor list has been reused instead of rebuilt.
+     */
+    long long getNumCacheHits() const {
+        return selector.getNumCacheHits();
+    }
+    /**
+     * Get the pairs restrained in a group by the last call to evaluate(), as indices of particles
+     * within the group.
+     */
+    const std::vector<std::pair<int, int> >& getRestrainedPairs(int group) const {
+        return restrainedPairs[group];
+    }
+    /**
+     * Get the statistics for a group from the last call to evaluate().
+     *
+     * @param group          the index of the group
+     * @param numComponents  on exit, the number of components the group was split into when its pairs
+     *                       were last selected
+     * @param particle1      on exit, the first particle of each restrained pair
+     * @param particle2      on exit, the second particle of each restrained pair
+     * @param distances      on exit, the distance between the particles of each restrained pair
+     */
+    void getGroupStatistics(int group, int& numComponents, std::vector<int>& particle1, std::vector<int>& particle2,
+                            std::vector<double>& distances) const;
+    /**
+     * Get a summary of every group from the last call to evaluate().  See ContForce::getBondSummaries().
+     *
+     * @param numComponents  on exit, the number of components each group was split into when its pairs
+     *                       were last selected
+     * @param numPairs       on exit, the number of restrained pairs of each group
+     * @param minDistances   on exit, the shortest distance of a restrained pair of each group, or -1 if
+     *                       it has none
+     */
+    void getGroupSummaries(std::vector<int>& numComponents, std::vector<int>& numPairs, std::vector<double>& minDistances) const;
+    /**
+     * Get the total time in seconds spent in each phase of selecting pairs.  See ContForcePairSelector::getPhaseTimes().
+     */
+    void getPhaseTimes(double& distanceTime, double& labelingTime, double& selectionTime) const {
+        selector.getPhaseTimes(distanceTime, labelingTime, selectionTime);
+    }
+    /**
+     * Compute the energy and forces.
+     *
+     * @param positions      the positions of all particles
+     * @param boxVectors     the periodic box vectors.  This is ignored unless the force uses periodic
+     *                       boundary conditions.
+     * @param selectPairs    if true, select new pairs to restrain.  Otherwise the pairs selected last time
+     *                       are restrained at their current separations.
+     * @param includeForces  true if forces should be calculated
+     * @param includeEnergy  true if the energy should be calculated
+     * @param threads        the thread pool to spread the groups over
+     * @param forces         on exit, the forces as (particle, force) entries.  A particle may appear in
+     *                       more than one entry, and particles that feel no force are omitted.
+     * @return the potential energy
+     */
+    double evaluate(const std::vector<OpenMM::Vec3>& positions, const OpenMM::Vec3* boxVectors, bool selectPairs, bool includeForces,
+                    bool includeEnergy, OpenMM::ThreadPool& threads, std::vector<std::pair<int, OpenMM::Vec3> >& forces);
+    /**
+     * Write the pairs selected most recently for every group, and the spanning trees kept for
+     * selecting them again, to a checkpoint.
+     */
+    void createCheckpoint(std::ostream& stream) const;
+    /**
+     * Load the state written by createCheckpoint().  Later evaluations restrain and select the same
+     * pairs as they would have when the checkpoint was created.  The cached results are discarded,
+     * so the next evaluation computes the force again.
+     */
+    void loadCheckpoint(std::istream& stream);
+private:
+    class EvaluateTask;
+    struct ThreadData {
+        std::vector<OpenMM::Vec3> groupPos;
+    };
+    void evaluateGroup(int group, const std::vector<OpenMM::Vec3>& positions, bool selectPairs, bool includeForces,
+                       bool includeEnergy, int thread, ContForceSharedNeighbors* shared=NULL, int sharedIndex=0);
+    /**
+     * Evaluate all the groups in a set of overlapping groups on one thread, so they can share the
+     * search for the pairs closer than the cutoff.
+     */
+    void evaluateSharedGroups(int set, const std::vector<OpenMM::Vec3>& positions, bool selectPairs, bool includeForces,
+                              bool includeEnergy, int thread);
+    /**
+     * Record the members' positions for the next evaluation and return whether they are unchanged.
+     */
+    bool updateCachedPositions(const std::vector<OpenMM::Vec3>& positions);
+    /**
+     * Set the box for the next evaluation, checking that it is large enough, and return whether it is unchanged.
+     */
+    bool updateBox(const OpenMM::Vec3* boxVectors);
+    /**
+     * Find the largest cutoff of any group.
+     */
+    void findMaxCutoff();
+    /**
+     * Find the sets of groups whose particles overlap enough that they should share the search for
+     * the pairs closer than the cutoff.
+     */
+    void findSharedGroups();
+    /**
+     * Order the groups from largest to smallest and allocate the memory that depends on their sizes.
+     */
+    void sortGroups();
+    ContForceGroups groups;
+    ContForcePairSelector selector;
+    std::vector<std::vector<std::pair<int, int> > > restrainedPairs;
+    std::vector<std::vector<double> > restrainedDistances;
+    std::vector<int> numComponents;
+    std::vector<double> groupEnergy;
+    std::vector<std::vector<std::pair<int, OpenMM::Vec3> > > groupForces;
+    std::vector<int> groupOrder;
+    std::vector<ContForceSharedNeighbors> sharedNeighbors;
+    std::vector<int> sharedSet;
+    std::vector<int> changedGroups;
+    std::vector<char> mustSelectPairs;
+    std::vector<ThreadData> threadData;
+    std::atomic<int> nextGroup;
+    ContForcePeriodicBox box;
+    std::vector<OpenMM::Vec3> cachedPositions;
+    std::vector<std::pair<int, OpenMM::Vec3> > cachedForces;
+    double cachedEnergy, maxCutoff, skinDistance;
+    bool usePeriodic, hasCachedPositions, hasCachedForces, hasCachedEnergy, pairsMatchCache;
+};
+
+} // namespace ContForcePlugin
+
+#endif /*OPENMM_CONTFORCEEVALUATOR_H_*/
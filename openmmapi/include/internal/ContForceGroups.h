@@ -0,0 +1,115 @@
+#ifndef OPENMM_CONTFORCEGROUPS_H_
+#define OPENMM_CONTFORCEGROUPS_H_
+
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2014 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+
+
+#include "ContForce.h"
+#include "internal/windowsExportExample.h"
+#include <vector>
+
+namespace ContForcePlugin {
+
+/**
+ * This class stores the groups of a ContForce in the form the kernels use.  The members of all
+ * groups are kept in one flat array, with the members of group g occupying the range from
+ * getGroupStart(g) to getGroupStart(g+1).
+ */
+
+class OPENMM_EXPORT_EXAMPLE ContForceGroups {
+public:
+    ContForceGroups();
+    /**
+     * Copy the members and parameters of every group from a ContForce.
+     */
+    void initialize(const ContForce& force);
+    /**
+     * Copy the parameters and members of every group from a ContForce.  This throws an exception if
+     * the number of groups has changed.
+     *
+     * @param force          the ContForce to copy the groups from
+     * @param changedGroups  on exit, the indices of the groups whose members have changed, in increasing order
+     */
+    void updateParameters(const ContForce& force, std::vector<int>& changedGroups);
+    /**
+     * Get the number of groups.
+     */
+    int getNumGroups() const {
+        return cutoffs.size();
+    }
+    /**
+     * Get the index of a group's first member in the array returned by getAtoms().  Passing
+     * getNumGroups() gives the total number of members.
+     */
+    int getGroupStart(int group) const {
+        return groupStart[group];
+    }
+    /**
+     * Get the number of particles in a group.
+     */
+    int getGroupSize(int group) const {
+        return groupStart[group+1]-groupStart[group];
+    }
+    /**
+     * Get the number of particles in the largest group.
+     */
+    int getMaxGroupSize() const {
+        return maxGroupSize;
+    }
+    /**
+     * Get the particle index of every member of every group.
+     */
+    const std::vector<int>& getAtoms() const {
+        return atoms;
+    }
+    /**
+     * Get the cutoff distance (d) of a group.
+     */
+    double getCutoff(int group) const {
+        return cutoffs[group];
+    }
+    /**
+     * Get the force constant (k) of a group.
+     */
+    double getForceConstant(int group) const {
+        return forceConstants[group];
+    }
+private:
+    std::vector<int> groupStart, atoms;
+    std::vector<double> cutoffs, forceConstants;
+    int maxGroupSize;
+};
+
+} // namespace ContForcePlugin
+
+#endif /*OPENMM_CONTFORCEGROUPS_H_*/
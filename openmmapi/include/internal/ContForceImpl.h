@@ -35,6 +35,7 @@
 #include "ContForce.h"
 #include "openmm/internal/ForceImpl.h"
 #include "openmm/Kernel.h"
+#include <iosfwd>
 #include <utility>
 #include <set>
 #include <string>
@@ -51,19 +52,26 @@ class OPENMM_EXPORT_EXAMPLE ContForceImpl : public OpenMM::ForceImpl {
 public:
     ContForceImpl(const ContForce& owner);
     ~ContForceImpl();
-    void initialize(OpenMM::ContextImpl& context);
-    const ContForce& getOwner() const {
+    void initialize(OpenMM::ContextImpl& context) override;
+    const ContForce& getOwner() const override {
         return owner;
     }
-    void updateContextState(OpenMM::ContextImpl& context, bool& forcesInvalid) {
+    void updateContextState(OpenMM::ContextImpl& context, bool& forcesInvalid) override {
         // This force field doesn't update the state directly.
     }
-    double calcForcesAndEnergy(OpenMM::ContextImpl& context, bool includeForces, bool includeEnergy, int groups);
-    std::map<std::string, double> getDefaultParameters() {
+    double calcForcesAndEnergy(OpenMM::ContextImpl& context, bool includeForces, bool includeEnergy, int groups) override;
+    std::map<std::string, double> getDefaultParameters() override {
         return std::map<std::string, double>(); // This force field doesn't define any parameters.
     }
-    std::vector<std::string> getKernelNames();
+    std::vector<std::string> getKernelNames() override;
     void updateParametersInContext(OpenMM::ContextImpl& context);
+    long long getNumCacheHits();
+    void getBondStatistics(int index, int& numComponents, std::vector<int>& particle1, std::vector<int>& particle2,
+                           std::vector<double>& distances);
+    void getBondSummaries(std::vector<int>& numComponents, std::vector<int>& numPairs, std::vector<double>& minDistances);
+    void getPhaseTimes(double& distanceTime, double& labelingTime, double& selectionTime, double& uploadTime);
+    void createCheckpoint(OpenMM::ContextImpl& context, std::ostream& stream);
+    void loadCheckpoint(OpenMM::ContextImpl& context, std::istream& stream);
 private:
     const ContForce& owner;
     OpenMM::Kernel kernel;
@@ -0,0 +1,105 @@
+#ifndef OPENMM_CONTFORCEKDTREE_H_
+#define OPENMM_CONTFORCEKDTREE_H_
+
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2014 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+
+#include "internal/ContForcePeriodicBox.h"
+#include "internal/windowsExportExample.h"
+#include "openmm/Vec3.h"
+#include <utility>
+#include <vector>
+
+namespace ContForcePlugin {
+
+/**
+ * This class selects the particle pairs that a ContForce restrains once a group has been
+ * split into components.  It performs one Boruvka round over the components: each component
+ * finds the closest particle outside itself.  A k-d tree over the group, whose nodes record
+ * when all their particles share a component, lets each query skip the querying component
+ * and everything farther than the best pair found so far, so no distance matrix is needed.
+ *
+ * Ties are broken the same way as a scan over all (inside, outside) pairs in index order:
+ * the pair with the lowest inside index wins, then the lowest outside index.
+ *
+ * In a periodic box the tree is built over the particles wrapped into the box, and each particle
+ * queries it from its own position and from the 26 neighboring images of it.
+ */
+
+class OPENMM_EXPORT_EXAMPLE ContForceKdTree {
+public:
+    /**
+     * Allocate enough memory for groups of up to a given number of particles, so that
+     * later calls do not need to allocate any.
+     */
+    void reserve(int numParticles);
+    /**
+     * Find the closest pair of particles between each component and the rest of the group.
+     *
+     * @param positions       the positions of the particles in the group
+     * @param box             the periodic box the particles are in
+     * @param componentIndex  the component each particle belongs to
+     * @param numComponents   the number of components
+     * @param pairs           on exit, the selected pairs (i, j) with i < j, sorted and without
+     *                        duplicates, since two components may select the same pair
+     */
+    void findClosestPairs(const std::vector<OpenMM::Vec3>& positions, const ContForcePeriodicBox& box, const std::vector<int>& componentIndex,
+                          int numComponents, std::vector<std::pair<int, int> >& pairs);
+private:
+    struct Node {
+        OpenMM::Vec3 boxMin, boxMax;
+        int start, end, firstChild, secondChild, component;
+    };
+    struct Candidate {
+        double dist2;
+        int inside, outside;
+        bool operator<(const Candidate& other) const {
+            if (dist2 != other.dist2)
+                return dist2 < other.dist2;
+            if (inside != other.inside)
+                return inside < other.inside;
+            return outside < other.outside;
+        }
+    };
+    void build(const std::vector<OpenMM::Vec3>& positions, const std::vector<int>& componentIndex);
+    int buildNode(int start, int end, const std::vector<OpenMM::Vec3>& positions, const std::vector<int>& componentIndex);
+    void findClosest(int particle, const OpenMM::Vec3& pos, int component, Candidate& best);
+    std::vector<Node> nodes;
+    std::vector<int> order, stack;
+    std::vector<OpenMM::Vec3> wrappedPos, sortedPos;
+    std::vector<int> sortedComponent;
+    std::vector<Candidate> best;
+};
+
+} // namespace ContForcePlugin
+
+#endif /*OPENMM_CONTFORCEKDTREE_H_*/
@@ -0,0 +1,90 @@
+#ifndef OPENMM_CONTFORCELABELER_H_
+#define OPENMM_CONTFORCELABELER_H_
+
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2014 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+
+#include "internal/windowsExportExample.h"
+#include <vector>
+
+namespace ContForcePlugin {
+
+/**
+ * This class assigns the particles of a ContForce group to connected components.
+ * It is a disjoint-set forest with path compression and union by rank, so labeling
+ * a group takes nearly linear time in the number of sub-cutoff pairs that are merged.
+ * It is shared by all platforms that evaluate the force on the host.
+ */
+
+class OPENMM_EXPORT_EXAMPLE ContForceLabeler {
+public:
+    /**
+     * Allocate enough memory for groups of up to a given number of particles, so that
+     * later calls do not need to allocate any.
+     */
+    void reserve(int numParticles);
+    /**
+     * Reset the labeler so that every particle is in its own set.
+     *
+     * @param numParticles  the number of particles in the group
+     */
+    void reset(int numParticles);
+    /**
+     * Find the representative of the set containing a particle.
+     *
+     * @param particle  the index of the particle within the group
+     * @return the index of the particle representing its set
+     */
+    int find(int particle);
+    /**
+     * Merge the sets containing two particles.
+     *
+     * @param particle1  the index of the first particle within the group
+     * @param particle2  the index of the second particle within the group
+     * @return true if the particles were previously in different sets
+     */
+    bool merge(int particle1, int particle2);
+    /**
+     * Get the connected component of every particle.  Components are numbered in order
+     * of their lowest particle index, so particle 0 is always in component 0.
+     *
+     * @param componentIndex  on exit, the component index of each particle
+     * @return the number of components
+     */
+    int getComponents(std::vector<int>& componentIndex);
+private:
+    std::vector<int> parent, rank;
+};
+
+} // namespace ContForcePlugin
+
+#endif /*OPENMM_CONTFORCELABELER_H_*/
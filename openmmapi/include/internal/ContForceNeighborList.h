@@ -0,0 +1,88 @@
+#ifndef OPENMM_CONTFORCENEIGHBORLIST_H_
+#define OPENMM_CONTFORCENEIGHBORLIST_H_
+
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2014 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+
+
+#include "internal/ContForceCellList.h"
+#include "internal/ContForcePeriodicBox.h"
+#include "internal/windowsExportExample.h"
+#include "openmm/Vec3.h"
+#include <utility>
+#include <vector>
+
+namespace ContForcePlugin {
+
+/**
+ * This class finds the pairs of particles in a ContForce group that are closer than the cutoff
+ * distance, reusing its work from one step to the next.  When the list is built it records every
+ * pair within the cutoff plus a skin distance.  As long as no particle has moved more than half
+ * the skin since then, every pair that is now within the cutoff must be on that list, so it is
+ * enough to check those pairs instead of searching the whole group again.  The list is also
+ * rebuilt whenever the periodic box changes.
+ */
+
+class OPENMM_EXPORT_EXAMPLE ContForceNeighborList {
+public:
+    ContForceNeighborList();
+    /**
+     * Find all pairs of particles that are closer than a cutoff distance.
+     *
+     * @param cellList   the cell list used to search the group when the list must be rebuilt
+     * @param positions  the positions of the particles in the group
+     * @param box        the periodic box the particles are in
+     * @param cutoff     the cutoff distance
+     * @param skin       the extra distance to include when the list is built.  If this is 0, the
+     *                   pairs are found from scratch on every call.
+     * @param pairs      on exit, every pair (i, j) with i < j whose separation is less than cutoff
+     * @return true if the pairs were found from the list built on an earlier call, false if the
+     *         list had to be rebuilt
+     */
+    bool findNeighbors(ContForceCellList& cellList, const std::vector<OpenMM::Vec3>& positions, const ContForcePeriodicBox& box,
+                       double cutoff, double skin, std::vector<std::pair<int, int> >& pairs);
+    /**
+     * Discard the current list, so it will be rebuilt on the next call to findNeighbors().
+     */
+    void invalidate();
+private:
+    bool needsRebuild(const std::vector<OpenMM::Vec3>& positions, const ContForcePeriodicBox& box, double listCutoff, double skin) const;
+    std::vector<OpenMM::Vec3> referencePositions;
+    ContForcePeriodicBox referenceBox;
+    std::vector<std::pair<int, int> > candidates;
+    double currentListCutoff;
+    bool isValid;
+};
+
+} // namespace ContForcePlugin
+
+#endif /*OPENMM_CONTFORCENEIGHBORLIST_H_*/
@@ -0,0 +1,175 @@
+#ifndef OPENMM_CONTFORCEPAIRSELECTOR_H_
+#define OPENMM_CONTFORCEPAIRSELECTOR_H_
+
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2014 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+
+
+#include "internal/ContForceKdTree.h"
+#include "internal/ContForceLabeler.h"
+#include "internal/ContForceNeighborList.h"
+#include "internal/ContForcePeriodicBox.h"
+#include "internal/ContForceSharedNeighbors.h"
+#include "internal/ContForceSpanningTree.h"
+#include "internal/ContForceSupernodes.h"
+#include "internal/windowsExportExample.h"
+#include "openmm/Vec3.h"
+#include <chrono>
+#include <iosfwd>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace ContForcePlugin {
+
+/**
+ * This class selects the pairs of particles a ContForce restrains in each of its groups.  It
+ * splits a group into the components formed by particles closer than the cutoff, then picks the
+ * closest pair joining each component to the rest of the group.  State that can be reused on later
+ * steps, such as neighbor lists and spanning trees, is kept separately for every group.
+ *
+ * Different groups may be processed at the same time by different threads.  Each thread is given
+ * its own workspace for the temporary data used while selecting pairs.
+ */
+
+class OPENMM_EXPORT_EXAMPLE ContForcePairSelector {
+public:
+    ContForcePairSelector();
+    /**
+     * Set the number of groups, discarding any state kept for them.
+     *
+     * @param numGroups     the number of groups
+     * @param maxGroupSize  the number of particles in the largest group.  Memory for groups of this
+     *                      size is allocated now, so selecting pairs does not need to allocate any
+     *                      once the lists of pairs have reached their typical sizes.
+     * @param numThreads    the number of threads that may select pairs at the same time
+     * @param cellListType  every workspace gets its own cell list, created by calling clone() on this one
+     */
+    void setNumGroups(int numGroups, int maxGroupSize, int numThreads=1, const ContForceCellList& cellListType=ContForceCellList());
+    /**
+     * Discard the state kept for a group, such as its neighbor list, spanning tree and supernodes.  This must be
+     * called whenever the members of the group change.
+     */
+    void resetGroup(int group);
+    /**
+     * Set the skin distance used when building neighbor lists.  See ContForce::setSkinDistance().
+     */
+    void setSkinDistance(double distance);
+    /**
+     * Set the size above which groups are labeled with supernodes.  See ContForce::setHierarchicalGroupSize().
+     */
+    void setHierarchicalGroupSize(int size);
+    /**
+     * Select the pairs to restrain in a group.
+     *
+     * @param group      the index of the group
+     * @param positions  the positions of the particles in the group
+     * @param box        the periodic box the particles are in
+     * @param cutoff     the cutoff distance for the group
+     * @param pairs      on exit, the pairs (i, j) with i < j to restrain, given as indices within the group.
+     *                   This is empty if the group is connected.
+     * @param thread     the index of the calling thread, which selects the workspace to use
+     * @return the number of components the group was split into
+     */
+    int selectPairs(int group, const std::vector<OpenMM::Vec3>& positions, const ContForcePeriodicBox& box, double cutoff,
+                    std::vector<std::pair<int, int> >& pairs, int thread=0);
+    /**
+     * Select the pairs to restrain in a group whose particles overlap other groups.  This is the same
+     * as selectPairs(), except that the pairs closer than the cutoff are taken from a search shared
+     * with the overlapping groups, which is only done once for all of them.  Groups that are labeled
+     * with supernodes keep their own search.
+     *
+     * @param group        the index of the group
+     * @param positions    the positions of the particles in the group
+     * @param box          the periodic box the particles are in
+     * @param cutoff       the cutoff distance for the group
+     * @param shared       the search shared by the group and the ones it overlaps
+     * @param sharedIndex  the index of the group in shared.getGroups()
+     * @param pairs        on exit, the pairs (i, j) with i < j to restrain, given as indices within the group
+     * @param thread       the index of the calling thread, which selects the workspace to use
+     * @return the number of components the group was split into
+     */
+    int selectSharedPairs(int group, const std::vector<OpenMM::Vec3>& positions, const ContForcePeriodicBox& box, double cutoff,
+                          ContForceSharedNeighbors& shared, int sharedIndex, std::vector<std::pair<int, int> >& pairs, int thread=0);
+    /**
+     * Get how many times a group's neighbor list or supernodes have been reused instead of rebuilt.
+     */
+    long long getNumCacheHits() const;
+    /**
+     * Get the total time in seconds spent in each phase of selecting pairs, summed over all threads.
+     *
+     * @param distanceTime   on exit, the time spent checking spanning trees and finding neighbors
+     * @param labelingTime   on exit, the time spent labeling components
+     * @param selectionTime  on exit, the time spent finding the closest pairs between components
+     */
+    void getPhaseTimes(double& distanceTime, double& labelingTime, double& selectionTime) const;
+    /**
+     * Write the spanning trees of all groups to a checkpoint.  Neighbor lists and supernodes are not
+     * written: they are rebuilt the first time they are needed, which selects the same pairs.
+     */
+    void createCheckpoint(std::ostream& stream) const;
+    /**
+     * Load the spanning trees written by createCheckpoint() and discard the neighbor lists and supernodes.
+     */
+    void loadCheckpoint(std::istream& stream);
+private:
+    struct Workspace {
+        std::shared_ptr<ContForceCellList> cellList;
+        ContForceLabeler labeler;
+        ContForceKdTree kdTree;
+        std::vector<std::pair<int, int> > neighbors;
+        std::vector<int> componentIndex;
+        long long numCacheHits;
+        double distanceTime, labelingTime, selectionTime;
+    };
+    bool usesSupernodes(const std::vector<OpenMM::Vec3>& positions) const;
+    /**
+     * Label the components formed by the pairs in the workspace's list of neighbors and record the
+     * pairs that joined them as the group's spanning tree.
+     */
+    int labelNeighbors(int group, int numParticles, Workspace& ws, std::chrono::steady_clock::time_point& start);
+    /**
+     * Find the closest pair joining each component to another one.
+     */
+    void findClosestPairs(const std::vector<OpenMM::Vec3>& positions, const ContForcePeriodicBox& box, int numComponents,
+                          std::vector<std::pair<int, int> >& pairs, Workspace& ws, std::chrono::steady_clock::time_point& start);
+    std::vector<ContForceNeighborList> neighborLists;
+    std::vector<ContForceSpanningTree> spanningTrees;
+    std::vector<ContForceSupernodes> supernodes;
+    std::vector<Workspace> workspaces;
+    double skinDistance;
+    int hierarchicalGroupSize;
+};
+
+} // namespace ContForcePlugin
+
+#endif /*OPENMM_CONTFORCEPAIRSELECTOR_H_*/
@@ -0,0 +1,145 @@
+#ifndef OPENMM_CONTFORCEPERIODICBOX_H_
+#define OPENMM_CONTFORCEPERIODICBOX_H_
+
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2014 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+
+#include "internal/windowsExportExample.h"
+#include "openmm/Vec3.h"
+#include <cmath>
+
+namespace ContForcePlugin {
+
+/**
+ * This class describes the periodic box a ContForce is evaluated in, or the absence of one.  The box
+ * vectors must be in OpenMM's reduced form: a along x, b in the xy plane, and c with a positive z
+ * component.
+ *
+ * Particles can be wrapped into the parallelepiped spanned by the box vectors, which is described by
+ * fractional coordinates between 0 and 1 along each vector.  Searches that bin the wrapped particles
+ * by their fractional coordinates only need to know which periodic image the neighboring bin is in,
+ * not the image of every pair.
+ */
+
+class OPENMM_EXPORT_EXAMPLE ContForcePeriodicBox {
+public:
+    /**
+     * Create an object for a non-periodic system.
+     */
+    ContForcePeriodicBox();
+    /**
+     * Create an object for a periodic box.
+     *
+     * @param a   the first box vector
+     * @param b   the second box vector
+     * @param c   the third box vector
+     */
+    ContForcePeriodicBox(const OpenMM::Vec3& a, const OpenMM::Vec3& b, const OpenMM::Vec3& c);
+    /**
+     * Get whether the system is periodic.
+     */
+    bool isPeriodic() const {
+        return periodic;
+    }
+    /**
+     * Get one of the box vectors.
+     */
+    const OpenMM::Vec3& getBoxVector(int index) const {
+        return boxVectors[index];
+    }
+    /**
+     * Get the distance between the two faces of the box that do not contain a box vector, which is the
+     * width of the box measured perpendicular to them.
+     */
+    double getWidth(int index) const {
+        return widths[index];
+    }
+    /**
+     * Get whether this describes the same box as another object.
+     */
+    bool operator==(const ContForcePeriodicBox& other) const {
+        if (periodic != other.periodic)
+            return false;
+        return (!periodic || (boxVectors[0] == other.boxVectors[0] && boxVectors[1] == other.boxVectors[1] && boxVectors[2] == other.boxVectors[2]));
+    }
+    bool operator!=(const ContForcePeriodicBox& other) const {
+        return !(*this == other);
+    }
+    /**
+     * Get the displacement pos1-pos2 to the nearest periodic image of pos2.
+     */
+    OpenMM::Vec3 getDelta(const OpenMM::Vec3& pos1, const OpenMM::Vec3& pos2) const {
+        OpenMM::Vec3 delta = pos1-pos2;
+        if (periodic) {
+            delta -= boxVectors[2]*floor(delta[2]*invBoxSize[2]+0.5);
+            delta -= boxVectors[1]*floor(delta[1]*invBoxSize[1]+0.5);
+            delta -= boxVectors[0]*floor(delta[0]*invBoxSize[0]+0.5);
+        }
+        return delta;
+    }
+    /**
+     * Get the fractional coordinates of a position along the box vectors, without wrapping them.
+     */
+    OpenMM::Vec3 getFractional(const OpenMM::Vec3& pos) const {
+        double z = pos[2]*invBoxSize[2];
+        double y = (pos[1]-z*boxVectors[2][1])*invBoxSize[1];
+        double x = (pos[0]-y*boxVectors[1][0]-z*boxVectors[2][0])*invBoxSize[0];
+        return OpenMM::Vec3(x, y, z);
+    }
+    /**
+     * Wrap a position into the parallelepiped spanned by the box vectors.
+     *
+     * @param pos         the position to wrap
+     * @param fractional  on exit, the fractional coordinates of the wrapped position, each in [0, 1)
+     * @return the wrapped position
+     */
+    OpenMM::Vec3 wrap(const OpenMM::Vec3& pos, OpenMM::Vec3& fractional) const {
+        fractional = getFractional(pos);
+        OpenMM::Vec3 wrapped = pos;
+        for (int i = 2; i >= 0; i--) {
+            double image = floor(fractional[i]);
+            fractional[i] -= image;
+            if (fractional[i] >= 1.0)
+                fractional[i] = 0.0;
+            wrapped -= boxVectors[i]*image;
+        }
+        return wrapped;
+    }
+private:
+    bool periodic;
+    OpenMM::Vec3 boxVectors[3];
+    double invBoxSize[3], widths[3];
+};
+
+} // namespace ContForcePlugin
+
+#endif /*OPENMM_CONTFORCEPERIODICBOX_H_*/
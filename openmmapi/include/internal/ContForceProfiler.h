@@ -0,0 +1,106 @@
+#ifndef OPENMM_CONTFORCEPROFILER_H_
+#define OPENMM_CONTFORCEPROFILER_H_
+
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2014 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+
+#ifdef CONTFORCE_USE_NVTX
+#include <nvtx3/nvToolsExt.h>
+#endif
+#ifdef CONTFORCE_USE_ITT
+#include <ittnotify.h>
+#endif
+
+namespace ContForcePlugin {
+
+/**
+ * This class marks the phases of the calculation so profilers can attribute time to them.  Ranges
+ * are reported as NVTX ranges when the plugin is built with CONTFORCE_PROFILING_NVTX, and as ITT
+ * tasks when it is built with CONTFORCE_PROFILING_ITT.  Otherwise these methods do nothing and are
+ * compiled away.  Ranges on a thread must be properly nested.
+ */
+
+class ContForceProfiler {
+public:
+    /**
+     * Begin a range on the calling thread.
+     *
+     * @param name   the name of the range.  This must be a string literal or otherwise outlive the program.
+     */
+    static void pushRange(const char* name) {
+#ifdef CONTFORCE_USE_NVTX
+        nvtxRangePushA(name);
+#endif
+#ifdef CONTFORCE_USE_ITT
+        __itt_task_begin(getDomain(), __itt_null, __itt_null, __itt_string_handle_create(name));
+#endif
+    }
+    /**
+     * End the range begun most recently on the calling thread.
+     */
+    static void popRange() {
+#ifdef CONTFORCE_USE_NVTX
+        nvtxRangePop();
+#endif
+#ifdef CONTFORCE_USE_ITT
+        __itt_task_end(getDomain());
+#endif
+    }
+private:
+#ifdef CONTFORCE_USE_ITT
+    static __itt_domain* getDomain() {
+        static __itt_domain* domain = __itt_domain_create("ContForce");
+        return domain;
+    }
+#endif
+};
+
+/**
+ * This marks a range that lasts until the object goes out of scope.
+ */
+
+class ContForceProfileRange {
+public:
+    explicit ContForceProfileRange(const char* name) {
+        ContForceProfiler::pushRange(name);
+    }
+    ~ContForceProfileRange() {
+        ContForceProfiler::popRange();
+    }
+private:
+    ContForceProfileRange(const ContForceProfileRange&);
+    ContForceProfileRange& operator=(const ContForceProfileRange&);
+};
+
+} // namespace ContForcePlugin
+
+#endif /*OPENMM_CONTFORCEPROFILER_H_*/
@@ -0,0 +1,114 @@
+#ifndef OPENMM_CONTFORCESHAREDNEIGHBORS_H_
+#define OPENMM_CONTFORCESHAREDNEIGHBORS_H_
+
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2014 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+#include "internal/ContForceCellList.h"
+#include "internal/ContForceGroups.h"
+#include "internal/ContForceNeighborList.h"
+#include "internal/ContForcePeriodicBox.h"
+#include "internal/windowsExportExample.h"
+#include "openmm/Vec3.h"
+#include <utility>
+#include <vector>
+
+namespace ContForcePlugin {
+
+/**
+ * This class finds the pairs closer than the cutoff for several ContForce groups that share
+ * particles, such as nested groups with different cutoffs.  The particles of all the groups are
+ * merged into one sorted list without duplicates, which is searched once at the largest of their
+ * cutoffs.  The pairs of each group are then found by keeping the pairs whose particles both belong
+ * to it and are closer than its own cutoff, so the groups only pay for the search once.
+ */
+
+class OPENMM_EXPORT_EXAMPLE ContForceSharedNeighbors {
+public:
+    ContForceSharedNeighbors();
+    /**
+     * Set the groups that share the search.
+     *
+     * @param groups         the groups of the ContForce
+     * @param sharingGroups  the indices of the groups that share the search
+     */
+    void initialize(const ContForceGroups& groups, const std::vector<int>& sharingGroups);
+    /**
+     * Get the indices of the groups that share the search.
+     */
+    const std::vector<int>& getGroups() const {
+        return groupIndices;
+    }
+    /**
+     * Gather the positions of the shared particles.  They are only searched the first time
+     * findNeighbors() is called afterward.
+     *
+     * @param groups     the groups of the ContForce, which give the cutoff of each group
+     * @param positions  the positions of all particles
+     */
+    void setPositions(const ContForceGroups& groups, const std::vector<OpenMM::Vec3>& positions);
+    /**
+     * Find the pairs of shared particles closer than the largest cutoff, unless they have already
+     * been found since the last call to setPositions().
+     *
+     * @param cellList   the cell list used to search the particles when the list must be rebuilt
+     * @param box        the periodic box the particles are in
+     * @param skin       the skin distance of the neighbor list.  See ContForceNeighborList.
+     * @return true if the pairs were found on this call from a list built earlier
+     */
+    bool findNeighbors(ContForceCellList& cellList, const ContForcePeriodicBox& box, double skin);
+    /**
+     * Get the pairs closer than a group's cutoff whose particles both belong to the group.  This must
+     * be called after findNeighbors().
+     *
+     * @param index   the index of the group in the list returned by getGroups()
+     * @param cutoff  the cutoff distance of the group
+     * @param pairs   on exit, every pair (i, j) with i < j, given as indices within the group, whose
+     *                separation is less than cutoff
+     */
+    void getGroupNeighbors(int index, double cutoff, std::vector<std::pair<int, int> >& pairs) const;
+    /**
+     * Discard the neighbor list, so the particles are searched from scratch the next time.
+     */
+    void invalidate();
+private:
+    std::vector<int> groupIndices, atoms;
+    std::vector<std::vector<int> > memberIndex;
+    std::vector<OpenMM::Vec3> positions;
+    std::vector<std::pair<int, int> > neighbors;
+    std::vector<double> neighborDist2;
+    ContForceNeighborList neighborList;
+    double maxCutoff;
+    bool hasNeighbors;
+};
+
+} // namespace ContForcePlugin
+
+#endif /*OPENMM_CONTFORCESHAREDNEIGHBORS_H_*/
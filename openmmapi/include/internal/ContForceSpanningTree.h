@@ -0,0 +1,95 @@
+#ifndef OPENMM_CONTFORCESPANNINGTREE_H_
+#define OPENMM_CONTFORCESPANNINGTREE_H_
+
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2014 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+
+
+#include "internal/ContForcePeriodicBox.h"
+#include "internal/windowsExportExample.h"
+#include "openmm/Vec3.h"
+#include <iosfwd>
+#include <utility>
+#include <vector>
+
+namespace ContForcePlugin {
+
+/**
+ * This class records a spanning tree of a ContForce group: the pairs whose merges joined the
+ * group's particles into a single component.  As long as every edge of the tree is still shorter
+ * than the cutoff, the group is certainly still connected, which takes only one distance per
+ * particle to check instead of a full search.
+ */
+
+class OPENMM_EXPORT_EXAMPLE ContForceSpanningTree {
+public:
+    ContForceSpanningTree();
+    /**
+     * Discard all edges.  The tree is incomplete until markComplete() is called.
+     */
+    void reset();
+    /**
+     * Add an edge to the tree.
+     *
+     * @param particle1  the index within the group of the first particle
+     * @param particle2  the index within the group of the second particle
+     */
+    void addEdge(int particle1, int particle2);
+    /**
+     * Mark the tree as complete, meaning its edges connect every particle in the group.
+     */
+    void markComplete();
+    /**
+     * Get whether the tree is complete and all its edges are shorter than a cutoff distance, which
+     * proves the group is connected.
+     *
+     * @param positions  the positions of the particles in the group
+     * @param box        the periodic box the particles are in
+     * @param cutoff     the cutoff distance
+     */
+    bool isIntact(const std::vector<OpenMM::Vec3>& positions, const ContForcePeriodicBox& box, double cutoff) const;
+    /**
+     * Write the tree to a checkpoint.
+     */
+    void createCheckpoint(std::ostream& stream) const;
+    /**
+     * Replace the tree with one written by createCheckpoint().
+     */
+    void loadCheckpoint(std::istream& stream);
+private:
+    std::vector<std::pair<int, int> > edges;
+    bool isComplete;
+};
+
+} // namespace ContForcePlugin
+
+#endif /*OPENMM_CONTFORCESPANNINGTREE_H_*/
@@ -0,0 +1,107 @@
+#ifndef OPENMM_CONTFORCESUPERNODES_H_
+#define OPENMM_CONTFORCESUPERNODES_H_
+
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2014 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+
+
+#include "internal/ContForceCellList.h"
+#include "internal/ContForceLabeler.h"
+#include "internal/ContForcePeriodicBox.h"
+#include "internal/windowsExportExample.h"
+#include "openmm/Vec3.h"
+#include <utility>
+#include <vector>
+
+namespace ContForcePlugin {
+
+/**
+ * This class labels the components of a large ContForce group in two levels.  When it is built,
+ * every pair closer than the cutoff plus a skin distance is found, and the particles joined by pairs
+ * closer than the cutoff minus the skin are merged into supernodes.  As long as no particle has moved
+ * more than half the skin since then, those pairs are still within the cutoff, so every supernode is
+ * still connected.  The only pairs whose state can have changed are the ones near the cutoff that
+ * join different supernodes, so labeling the group only needs to check those pairs and merge the
+ * supernodes they join.  Once some particle has moved too far, or the periodic box has changed,
+ * the supernodes are built again.
+ */
+
+class OPENMM_EXPORT_EXAMPLE ContForceSupernodes {
+public:
+    ContForceSupernodes();
+    /**
+     * Build the supernodes again if the particles have moved too far since they were built.
+     *
+     * @param cellList    the cell list used to search the group when the supernodes are built
+     * @param labeler     the labeler used to merge the particles into supernodes
+     * @param positions   the positions of the particles in the group
+     * @param box         the periodic box the particles are in
+     * @param cutoff      the cutoff distance
+     * @param skin        the skin distance, which must be greater than 0
+     * @param candidates  workspace for the pairs found when the supernodes are built
+     * @return true if the supernodes built on an earlier call were reused, false if they were built again
+     */
+    bool update(ContForceCellList& cellList, ContForceLabeler& labeler, const std::vector<OpenMM::Vec3>& positions,
+                const ContForcePeriodicBox& box, double cutoff, double skin, std::vector<std::pair<int, int> >& candidates);
+    /**
+     * Get the connected component of every particle.  This must be called after update() with the
+     * same positions.  Components are numbered in order of their lowest particle index, as by
+     * ContForceLabeler::getComponents().
+     *
+     * @param labeler         the labeler used to merge the supernodes
+     * @param positions       the positions of the particles in the group
+     * @param box             the periodic box the particles are in
+     * @param cutoff          the cutoff distance
+     * @param componentIndex  on exit, the component index of each particle.  This is only set if there
+     *                        is more than one component.
+     * @return the number of components
+     */
+    int findComponents(ContForceLabeler& labeler, const std::vector<OpenMM::Vec3>& positions, const ContForcePeriodicBox& box,
+                       double cutoff, std::vector<int>& componentIndex);
+    /**
+     * Discard the supernodes, so they will be built again on the next call to update().
+     */
+    void invalidate();
+private:
+    bool needsRebuild(const std::vector<OpenMM::Vec3>& positions, const ContForcePeriodicBox& box, double cutoff, double skin) const;
+    std::vector<OpenMM::Vec3> referencePositions;
+    ContForcePeriodicBox referenceBox;
+    std::vector<int> supernode, supernodeComponent;
+    std::vector<std::pair<int, int> > boundaryPairs;
+    double currentCutoff, currentSkin;
+    int numSupernodes;
+    bool isValid;
+};
+
+} // namespace ContForcePlugin
+
+#endif /*OPENMM_CONTFORCESUPERNODES_H_*/
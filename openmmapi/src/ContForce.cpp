@@ -38,14 +38,45 @@ using namespace ContForcePlugin;
 using namespace OpenMM;
 using namespace std;
 
-ContForce::ContForce() {
+ContForce::ContForce() : useDeviceKernels(true), usePipelinedSelection(false), useNonbondedNeighborList(true), usePeriodic(false), skinDistance(0.0), updateInterval(1), hierarchicalGroupSize(100000) {
 }
 
-int ContForce::addBond(std::vector<int> idxs, int npart, double length, double k) {
+int ContForce::addBond(const std::vector<int>& idxs, int npart, double length, double k) {
     bonds.push_back(BondInfo(idxs, npart, length, k));
     return bonds.size()-1;
 }
 
+/**
+ * Check that the arrays describing many bonds have consistent sizes.
+ */
+static void checkBulkSizes(int numBonds, const vector<int>& idxs, const vector<int>& npart, const vector<double>& length,
+                           const vector<double>& k) {
+    if (npart.size() != numBonds || length.size() != numBonds || k.size() != numBonds)
+        throw OpenMMException("ContForce: the arrays of bond parameters must all have the same length");
+    long long total = 0;
+    for (int i = 0; i < numBonds; i++) {
+        if (npart[i] < 0)
+            throw OpenMMException("ContForce: the number of particles in a bond cannot be negative");
+        total += npart[i];
+    }
+    if (total != idxs.size())
+        throw OpenMMException("ContForce: the number of particle indices does not match the numbers of particles in the bonds");
+}
+
+int ContForce::addBonds(const std::vector<int>& idxs, const std::vector<int>& npart, const std::vector<double>& length,
+                        const std::vector<double>& k) {
+    int numBonds = npart.size();
+    checkBulkSizes(numBonds, idxs, npart, length, k);
+    int first = bonds.size();
+    bonds.reserve(first+numBonds);
+    vector<int>::const_iterator start = idxs.begin();
+    for (int i = 0; i < numBonds; i++) {
+        bonds.push_back(BondInfo(vector<int>(start, start+npart[i]), npart[i], length[i], k[i]));
+        start += npart[i];
+    }
+    return first;
+}
+
 void ContForce::getBondParameters(int index, std::vector<int>& idxs, int& npart, double& length, double& k) const {
     ASSERT_VALID_INDEX(index, bonds);
     idxs = bonds[index].idxs;
@@ -54,7 +85,7 @@ void ContForce::getBondParameters(int index, std::vector<int>& idxs, int& npart,
     k = bonds[index].k;
 }
 
-void ContForce::setBondParameters(int index, std::vector<int> idxs, int npart, double length, double k) {
+void ContForce::setBondParameters(int index, const std::vector<int>& idxs, int npart, double length, double k) {
     ASSERT_VALID_INDEX(index, bonds);
     bonds[index].idxs = idxs;
     bonds[index].npart = npart;
@@ -62,6 +93,41 @@ void ContForce::setBondParameters(int index, std::vector<int> idxs, int npart, d
     bonds[index].k = k;
 }
 
+void ContForce::setBondParametersBulk(const std::vector<int>& indices, const std::vector<int>& idxs, const std::vector<int>& npart,
+                                      const std::vector<double>& length, const std::vector<double>& k) {
+    int numBonds = indices.size();
+    checkBulkSizes(numBonds, idxs, npart, length, k);
+    for (int i = 0; i < numBonds; i++)
+        ASSERT_VALID_INDEX(indices[i], bonds);
+    vector<int>::const_iterator start = idxs.begin();
+    for (int i = 0; i < numBonds; i++) {
+        BondInfo& bond = bonds[indices[i]];
+        bond.idxs.assign(start, start+npart[i]);
+        bond.npart = npart[i];
+        bond.length = length[i];
+        bond.k = k[i];
+        start += npart[i];
+    }
+}
+
+void ContForce::setSkinDistance(double distance) {
+    if (distance < 0)
+        throw OpenMMException("ContForce: the skin distance cannot be negative");
+    skinDistance = distance;
+}
+
+void ContForce::setHierarchicalGroupSize(int size) {
+    if (size < 0)
+        throw OpenMMException("ContForce: the hierarchical group size cannot be negative");
+    hierarchicalGroupSize = size;
+}
+
+void ContForce::setUpdateInterval(int interval) {
+    if (interval < 1)
+        throw OpenMMException("ContForce: the update interval must be at least 1");
+    updateInterval = interval;
+}
+
 ForceImpl* ContForce::createImpl() const {
     return new ContForceImpl(*this);
 }
@@ -69,3 +135,30 @@ ForceImpl* ContForce::createImpl() const {
 void ContForce::updateParametersInContext(Context& context) {
     dynamic_cast<ContForceImpl&>(getImplInContext(context)).updateParametersInContext(getContextImpl(context));
 }
+
+long long ContForce::getNumCacheHits(Context& context) {
+    return dynamic_cast<ContForceImpl&>(getImplInContext(context)).getNumCacheHits();
+}
+
+void ContForce::getBondStatistics(Context& context, int index, int& numComponents, vector<int>& particle1,
+                                  vector<int>& particle2, vector<double>& distances) {
+    ASSERT_VALID_INDEX(index, bonds);
+    dynamic_cast<ContForceImpl&>(getImplInContext(context)).getBondStatistics(index, numComponents, particle1, particle2, distances);
+}
+
+void ContForce::getBondSummaries(Context& context, vector<int>& numComponents, vector<int>& numPairs, vector<double>& minDistances) {
+    dynamic_cast<ContForceImpl&>(getImplInContext(context)).getBondSummaries(numComponents, numPairs, minDistances);
+}
+
+void ContForce::getPhaseTimes(Context& context, double& distanceTime, double& labelingTime, double& selectionTime,
+                              double& uploadTime) {
+    dynamic_cast<ContForceImpl&>(getImplInContext(context)).getPhaseTimes(distanceTime, labelingTime, selectionTime, uploadTime);
+}
+
+void ContForce::createCheckpoint(Context& context, ostream& stream) {
+    dynamic_cast<ContForceImpl&>(getImplInContext(context)).createCheckpoint(getContextImpl(context), stream);
+}
+
+void ContForce::loadCheckpoint(Context& context, istream& stream) {
+    dynamic_cast<ContForceImpl&>(getImplInContext(context)).loadCheckpoint(getContextImpl(context), stream);
+}
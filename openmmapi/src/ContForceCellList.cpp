@@ -0,0 +1,186 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2014 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+
+#include "internal/ContForceCellList.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace ContForcePlugin;
+using namespace OpenMM;
+using namespace std;
+
+// Cell coordinates are packed into a single key with this many bits per axis.  Particles
+// further out than that share the outermost cell, which costs time but not correctness.
+
+static const int CELL_BITS = 21;
+static const long long MAX_CELL = (1LL<<CELL_BITS)-1;
+
+static long long packCell(long long x, long long y, long long z) {
+    return (((z<<CELL_BITS)+y)<<CELL_BITS)+x;
+}
+
+ContForceCellList* ContForceCellList::clone() const {
+    return new ContForceCellList();
+}
+
+void ContForceCellList::reserve(int numParticles) {
+    sortedParticles.reserve(numParticles);
+    sortedPositions.reserve(numParticles);
+    cellKeys.reserve(numParticles);
+    cellStart.reserve(numParticles+1);
+    cellPairs.reserve(14*numParticles);
+    pairShifts.reserve(14*numParticles);
+}
+
+void ContForceCellList::buildCells(const vector<Vec3>& positions, const ContForcePeriodicBox& box, double cutoff) {
+    int numParticles = positions.size();
+
+    // Sort the particles by the cell containing them.  Without a periodic box the grid starts at the
+    // lowest coordinates and is unbounded.  With one, the box is divided into a whole number of cells
+    // along each box vector.
+
+    long long numCells[3] = {MAX_CELL+1, MAX_CELL+1, MAX_CELL+1};
+    bool periodic = box.isPeriodic();
+    if (periodic)
+        for (int j = 0; j < 3; j++)
+            numCells[j] = max(1LL, min(MAX_CELL+1, (long long) floor(box.getWidth(j)/cutoff)));
+    Vec3 minPos = positions[0];
+    for (int i = 1; i < numParticles; i++)
+        for (int j = 0; j < 3; j++)
+            minPos[j] = min(minPos[j], positions[i][j]);
+    double invCutoff = 1.0/cutoff;
+    sortedParticles.resize(numParticles);
+    for (int i = 0; i < numParticles; i++) {
+        long long cell[3];
+        if (periodic) {
+            Vec3 fractional;
+            box.wrap(positions[i], fractional);
+            for (int j = 0; j < 3; j++)
+                cell[j] = min(numCells[j]-1, (long long) floor(fractional[j]*numCells[j]));
+        }
+        else {
+            for (int j = 0; j < 3; j++)
+                cell[j] = (long long) min((double) MAX_CELL, floor((positions[i][j]-minPos[j])*invCutoff));
+        }
+        sortedParticles[i] = make_pair(packCell(cell[0], cell[1], cell[2]), i);
+    }
+    sort(sortedParticles.begin(), sortedParticles.end());
+    cellKeys.clear();
+    cellStart.clear();
+    for (int i = 0; i < numParticles; i++) {
+        if (i == 0 || sortedParticles[i].first != sortedParticles[i-1].first) {
+            cellKeys.push_back(sortedParticles[i].first);
+            cellStart.push_back(i);
+        }
+    }
+    int numOccupied = cellKeys.size();
+    cellStart.push_back(numParticles);
+
+    // Store the positions in the same order, wrapped the same way as when they were binned.
+
+    sortedPositions.resize(numParticles);
+    for (int i = 0; i < numParticles; i++) {
+        const Vec3& pos = positions[sortedParticles[i].second];
+        Vec3 fractional;
+        sortedPositions[i] = (periodic ? box.wrap(pos, fractional) : pos);
+    }
+
+    // Pair each cell with itself and with the 13 neighboring cells that follow it, so every
+    // pair of adjacent cells is listed exactly once.  In a periodic box, neighbors past the edge
+    // wrap around to the other side.
+
+    cellPairs.clear();
+    pairShifts.clear();
+    for (int cell = 0; cell < numOccupied; cell++) {
+        long long key = cellKeys[cell];
+        long long x = key&MAX_CELL;
+        long long y = (key>>CELL_BITS)&MAX_CELL;
+        long long z = key>>(2*CELL_BITS);
+        for (int dz = 0; dz <= 1; dz++)
+            for (int dy = (dz == 0 ? 0 : -1); dy <= 1; dy++)
+                for (int dx = (dz == 0 && dy == 0 ? 0 : -1); dx <= 1; dx++) {
+                    long long n[3] = {x+dx, y+dy, z+dz};
+                    Vec3 shift;
+                    bool valid = true;
+                    for (int j = 0; j < 3; j++) {
+                        if (n[j] >= 0 && n[j] < numCells[j])
+                            continue;
+                        if (!periodic) {
+                            valid = false;
+                            break;
+                        }
+                        int image = (n[j] < 0 ? -1 : 1);
+                        n[j] -= image*numCells[j];
+                        shift += box.getBoxVector(j)*image;
+                    }
+                    if (!valid)
+                        continue;
+                    int neighbor = cell;
+                    if (dx != 0 || dy != 0 || dz != 0) {
+                        long long neighborKey = packCell(n[0], n[1], n[2]);
+                        vector<long long>::iterator first = (periodic ? cellKeys.begin() : cellKeys.begin()+cell+1);
+                        vector<long long>::iterator found = lower_bound(first, cellKeys.end(), neighborKey);
+                        if (found == cellKeys.end() || *found != neighborKey)
+                            continue;
+                        neighbor = found-cellKeys.begin();
+                    }
+                    cellPairs.push_back(make_pair(cell, neighbor));
+                    pairShifts.push_back(shift);
+                }
+    }
+}
+
+void ContForceCellList::findNeighbors(const vector<Vec3>& positions, const ContForcePeriodicBox& box, double cutoff, vector<pair<int, int> >& pairs) {
+    pairs.clear();
+    int numParticles = positions.size();
+    if (numParticles < 2 || cutoff <= 0)
+        return;
+    buildCells(positions, box, cutoff);
+    double cutoff2 = cutoff*cutoff;
+    for (int k = 0; k < cellPairs.size(); k++) {
+        int cell = cellPairs[k].first;
+        int neighbor = cellPairs[k].second;
+        Vec3 shift = pairShifts[k];
+        bool sameImage = (neighbor == cell && shift == Vec3());
+        for (int i = cellStart[cell]; i < cellStart[cell+1]; i++) {
+            int p1 = sortedParticles[i].second;
+            for (int j = (sameImage ? i+1 : cellStart[neighbor]); j < cellStart[neighbor+1]; j++) {
+                int p2 = sortedParticles[j].second;
+                if (p1 == p2)
+                    continue;
+                Vec3 delta = sortedPositions[i]-sortedPositions[j]-shift;
+                if (delta.dot(delta) < cutoff2)
+                    pairs.push_back(p1 < p2 ? make_pair(p1, p2) : make_pair(p2, p1));
+            }
+        }
+    }
+}
@@ -0,0 +1,437 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2014 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+
+
+#include "internal/ContForceEvaluator.h"
+#include "internal/ContForceCheckpoint.h"
+#include "openmm/OpenMMException.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace ContForcePlugin;
+using namespace OpenMM;
+using namespace std;
+
+class ContForceEvaluator::EvaluateTask : public ThreadPool::Task {
+public:
+    EvaluateTask(ContForceEvaluator& owner, const vector<Vec3>& positions, bool selectPairs, bool includeForces, bool includeEnergy) :
+            owner(owner), positions(positions), selectPairs(selectPairs), includeForces(includeForces), includeEnergy(includeEnergy) {
+    }
+    void execute(ThreadPool& threads, int threadIndex) {
+        // The sets of overlapping groups come first, since each of them is processed as a unit.
+
+        int numSets = owner.sharedNeighbors.size();
+        int numItems = numSets+owner.groupOrder.size();
+        while (true) {
+            int next = owner.nextGroup++;
+            if (next >= numItems)
+                break;
+            if (next < numSets)
+                owner.evaluateSharedGroups(next, positions, selectPairs, includeForces, includeEnergy, threadIndex);
+            else
+                owner.evaluateGroup(owner.groupOrder[next-numSets], positions, selectPairs, includeForces, includeEnergy, threadIndex);
+        }
+    }
+    ContForceEvaluator& owner;
+    const vector<Vec3>& positions;
+    bool selectPairs, includeForces, includeEnergy;
+};
+
+static bool isLarger(const pair<int, int>& group1, const pair<int, int>& group2) {
+    if (group1.first != group2.first)
+        return group1.first > group2.first;
+    return group1.second < group2.second;
+}
+
+ContForceEvaluator::ContForceEvaluator() : nextGroup(0), cachedEnergy(0), maxCutoff(0), skinDistance(0), usePeriodic(false), hasCachedPositions(false),
+        hasCachedForces(false), hasCachedEnergy(false), pairsMatchCache(false) {
+}
+
+void ContForceEvaluator::initialize(const ContForce& force, int numThreads, const ContForceCellList& cellListType) {
+    groups.initialize(force);
+    int numGroups = groups.getNumGroups();
+    selector.setNumGroups(numGroups, groups.getMaxGroupSize(), numThreads, cellListType);
+    skinDistance = force.getSkinDistance();
+    selector.setSkinDistance(skinDistance);
+    selector.setHierarchicalGroupSize(force.getHierarchicalGroupSize());
+    usePeriodic = force.usesPeriodicBoundaryConditions();
+    box = ContForcePeriodicBox();
+    findMaxCutoff();
+    restrainedPairs.clear();
+    restrainedPairs.resize(numGroups);
+    restrainedDistances.clear();
+    restrainedDistances.resize(numGroups);
+    numComponents.clear();
+    numComponents.resize(numGroups, 0);
+    groupEnergy.clear();
+    groupEnergy.resize(numGroups, 0.0);
+    groupForces.clear();
+    groupForces.resize(numGroups);
+    mustSelectPairs.clear();
+    mustSelectPairs.resize(numGroups, 0);
+    changedGroups.clear();
+    threadData.resize(numThreads);
+    findSharedGroups();
+    sortGroups();
+    hasCachedPositions = hasCachedForces = hasCachedEnergy = pairsMatchCache = false;
+}
+
+void ContForceEvaluator::updateParameters(const ContForce& force) {
+    groups.updateParameters(force, changedGroups);
+    skinDistance = force.getSkinDistance();
+    selector.setSkinDistance(skinDistance);
+    selector.setHierarchicalGroupSize(force.getHierarchicalGroupSize());
+    findMaxCutoff();
+    hasCachedPositions = hasCachedForces = hasCachedEnergy = pairsMatchCache = false;
+    if (changedGroups.size() == 0)
+        return;
+
+    // The pairs selected for a group whose members changed no longer mean anything.
+
+    for (int i = 0; i < changedGroups.size(); i++) {
+        int group = changedGroups[i];
+        selector.resetGroup(group);
+        restrainedPairs[group].clear();
+        restrainedDistances[group].clear();
+        numComponents[group] = 0;
+        mustSelectPairs[group] = 1;
+    }
+    findSharedGroups();
+    sortGroups();
+}
+
+void ContForceEvaluator::findSharedGroups() {
+    int numGroups = groups.getNumGroups();
+    const vector<int>& atoms = groups.getAtoms();
+    int numAtoms = 0;
+    for (int atom : atoms)
+        numAtoms = max(numAtoms, atom+1);
+
+    // A group that lists a particle more than once keeps its own search, since a shared particle
+    // can only stand for one of its members.
+
+    vector<int> lastGroup(numAtoms, -1);
+    vector<char> canShare(numGroups, 1);
+    for (int group = 0; group < numGroups; group++)
+        for (int i = groups.getGroupStart(group); i < groups.getGroupStart(group+1); i++) {
+            if (lastGroup[atoms[i]] == group)
+                canShare[group] = 0;
+            lastGroup[atoms[i]] = group;
+        }
+
+    // Join the groups that have a particle in common into sets.
+
+    vector<int> setParent(numGroups);
+    for (int group = 0; group < numGroups; group++)
+        setParent[group] = group;
+    auto findSet = [&] (int group) {
+        while (setParent[group] != group)
+            group = setParent[group] = setParent[setParent[group]];
+        return group;
+    };
+    vector<int> firstGroup(numAtoms, -1);
+    for (int group = 0; group < numGroups; group++) {
+        if (!canShare[group])
+            continue;
+        for (int i = groups.getGroupStart(group); i < groups.getGroupStart(group+1); i++) {
+            int atom = atoms[i];
+            if (firstGroup[atom] == -1)
+                firstGroup[atom] = group;
+            else
+                setParent[findSet(group)] = findSet(firstGroup[atom]);
+        }
+    }
+
+    // Every group in a set filters all the pairs found for the set, so a set is only worth sharing
+    // if its groups have most of their particles in common.  Share it when the particles of all its
+    // groups add up to at least half the number of groups times the number of distinct particles.
+
+    vector<int> setGroups(numGroups, 0), setMembers(numGroups, 0), setAtoms(numGroups, 0);
+    for (int group = 0; group < numGroups; group++) {
+        if (!canShare[group])
+            continue;
+        int set = findSet(group);
+        setGroups[set]++;
+        setMembers[set] += groups.getGroupSize(group);
+    }
+    for (int atom = 0; atom < numAtoms; atom++)
+        if (firstGroup[atom] != -1)
+            setAtoms[findSet(firstGroup[atom])]++;
+    vector<vector<int> > sets(numGroups);
+    int numItems = numGroups;
+    for (int group = 0; group < numGroups; group++) {
+        int set = findSet(group);
+        if (canShare[group] && setGroups[set] > 1 && (long long) setGroups[set]*setAtoms[set] <= 2LL*setMembers[set]) {
+            if (sets[set].size() > 0)
+                numItems--;
+            sets[set].push_back(group);
+        }
+    }
+    sharedNeighbors.clear();
+    sharedSet.assign(numGroups, -1);
+
+    // A set is processed by a single thread.  If that would leave some threads with nothing to do,
+    // the groups are better off searching separately in parallel.
+
+    if (threadData.size() > 1 && numItems < threadData.size())
+        return;
+    for (int set = 0; set < numGroups; set++) {
+        if (sets[set].size() == 0)
+            continue;
+        for (int group : sets[set])
+            sharedSet[group] = sharedNeighbors.size();
+        sharedNeighbors.push_back(ContForceSharedNeighbors());
+        sharedNeighbors.back().initialize(groups, sets[set]);
+    }
+}
+
+void ContForceEvaluator::sortGroups() {
+    // Process the largest groups first to balance the work between threads.  The groups that share
+    // their search are processed with their sets instead.
+
+    int numGroups = groups.getNumGroups();
+    vector<pair<int, int> > sizes;
+    for (int i = 0; i < numGroups; i++)
+        if (sharedSet[i] == -1)
+            sizes.push_back(make_pair(groups.getGroupSize(i), i));
+    sort(sizes.begin(), sizes.end(), isLarger);
+    groupOrder.resize(sizes.size());
+    for (int i = 0; i < sizes.size(); i++)
+        groupOrder[i] = sizes[i].second;
+    for (int i = 0; i < threadData.size(); i++)
+        threadData[i].groupPos.reserve(groups.getMaxGroupSize());
+    cachedPositions.resize(groups.getAtoms().size());
+}
+
+void ContForceEvaluator::findMaxCutoff() {
+    maxCutoff = 0;
+    for (int i = 0; i < groups.getNumGroups(); i++)
+        maxCutoff = max(maxCutoff, groups.getCutoff(i));
+}
+
+bool ContForceEvaluator::updateBox(const Vec3* boxVectors) {
+    if (!usePeriodic)
+        return true;
+    // The neighbor lists hold every pair closer than the cutoff plus the skin, and each of those pairs
+    // must have a unique nearest image.
+
+    double maxDistance = 2*(maxCutoff+skinDistance);
+    if (boxVectors[0][0] < maxDistance || boxVectors[1][1] < maxDistance || boxVectors[2][2] < maxDistance)
+        throw OpenMMException("ContForce: the cutoff distance plus the skin distance cannot be greater than half the periodic box size");
+    ContForcePeriodicBox newBox(boxVectors[0], boxVectors[1], boxVectors[2]);
+    bool unchanged = (newBox == box);
+    box = newBox;
+    return unchanged;
+}
+
+bool ContForceEvaluator::updateCachedPositions(const vector<Vec3>& positions) {
+    const vector<int>& atoms = groups.getAtoms();
+    bool unchanged = hasCachedPositions;
+    for (int i = 0; i < atoms.size(); i++) {
+        const Vec3& pos = positions[atoms[i]];
+        if (unchanged && pos == cachedPositions[i])
+            continue;
+        unchanged = false;
+        cachedPositions[i] = pos;
+    }
+    hasCachedPositions = true;
+    return unchanged;
+}
+
+void ContForceEvaluator::createCheckpoint(ostream& stream) const {
+    int numGroups = groups.getNumGroups();
+    ContForceCheckpoint::write(stream, numGroups);
+    for (int i = 0; i < numGroups; i++) {
+        ContForceCheckpoint::write(stream, restrainedPairs[i]);
+        ContForceCheckpoint::write(stream, restrainedDistances[i]);
+    }
+    ContForceCheckpoint::write(stream, numComponents);
+    ContForceCheckpoint::write(stream, mustSelectPairs);
+    selector.createCheckpoint(stream);
+}
+
+void ContForceEvaluator::loadCheckpoint(istream& stream) {
+    int numGroups = groups.getNumGroups();
+    ContForceCheckpoint::readExpected(stream, numGroups);
+    for (int i = 0; i < numGroups; i++) {
+        ContForceCheckpoint::read(stream, restrainedPairs[i]);
+        ContForceCheckpoint::read(stream, restrainedDistances[i]);
+    }
+    ContForceCheckpoint::read(stream, numComponents);
+    ContForceCheckpoint::read(stream, mustSelectPairs);
+    if (numComponents.size() != numGroups || mustSelectPairs.size() != numGroups)
+        throw OpenMMException("ContForce: the checkpoint was created for a different force");
+    selector.loadCheckpoint(stream);
+    for (int i = 0; i < sharedNeighbors.size(); i++)
+        sharedNeighbors[i].invalidate();
+    hasCachedPositions = hasCachedForces = hasCachedEnergy = pairsMatchCache = false;
+}
+
+void ContForceEvaluator::getGroupStatistics(int group, int& numComponents, vector<int>& particle1, vector<int>& particle2,
+                                            vector<double>& distances) const {
+    const vector<int>& atoms = groups.getAtoms();
+    int start = groups.getGroupStart(group);
+    const vector<pair<int, int> >& restrained = restrainedPairs[group];
+    numComponents = this->numComponents[group];
+    particle1.resize(restrained.size());
+    particle2.resize(restrained.size());
+    for (int i = 0; i < restrained.size(); i++) {
+        particle1[i] = atoms[start+restrained[i].first];
+        particle2[i] = atoms[start+restrained[i].second];
+    }
+    distances = restrainedDistances[group];
+}
+
+void ContForceEvaluator::getGroupSummaries(vector<int>& numComponents, vector<int>& numPairs, vector<double>& minDistances) const {
+    int numGroups = restrainedPairs.size();
+    numComponents = this->numComponents;
+    numPairs.resize(numGroups);
+    minDistances.resize(numGroups);
+    for (int group = 0; group < numGroups; group++) {
+        const vector<double>& distances = restrainedDistances[group];
+        numPairs[group] = distances.size();
+        minDistances[group] = (distances.empty() ? -1.0 : *min_element(distances.begin(), distances.end()));
+    }
+}
+
+double ContForceEvaluator::evaluate(const vector<Vec3>& positions, const Vec3* boxVectors, bool selectPairs, bool includeForces,
+                                    bool includeEnergy, ThreadPool& threads, vector<pair<int, Vec3> >& forces) {
+    // If no member has moved and the box is the same, the pairs selected from these positions are
+    // selected again and the cached results can be used.
+
+    bool boxUnchanged = updateBox(boxVectors);
+    if (updateCachedPositions(positions) && boxUnchanged && (pairsMatchCache || !selectPairs)) {
+        selectPairs = false;
+        if ((hasCachedForces || !includeForces) && (hasCachedEnergy || !includeEnergy)) {
+            forces.clear();
+            if (includeForces)
+                forces = cachedForces;
+            return (includeEnergy ? cachedEnergy : 0.0);
+        }
+    }
+    else {
+        pairsMatchCache = selectPairs;
+        hasCachedForces = hasCachedEnergy = false;
+    }
+    if (groups.getNumGroups() == 1)
+        evaluateGroup(0, positions, selectPairs, includeForces, includeEnergy, 0);
+    else if (groups.getNumGroups() > 1) {
+        nextGroup = 0;
+        EvaluateTask task(*this, positions, selectPairs, includeForces, includeEnergy);
+        threads.execute(task);
+        threads.waitForThreads();
+    }
+
+    // Combine the results in the order of the groups, so they do not depend on which thread
+    // evaluated each group.
+
+    double energy = 0;
+    forces.clear();
+    for (int group = 0; group < groups.getNumGroups(); group++) {
+        energy += groupEnergy[group];
+        forces.insert(forces.end(), groupForces[group].begin(), groupForces[group].end());
+    }
+    if (includeForces) {
+        cachedForces = forces;
+        hasCachedForces = true;
+    }
+    if (includeEnergy) {
+        cachedEnergy = energy;
+        hasCachedEnergy = true;
+    }
+    return energy;
+}
+
+void ContForceEvaluator::evaluateSharedGroups(int set, const vector<Vec3>& positions, bool selectPairs, bool includeForces,
+                                              bool includeEnergy, int thread) {
+    ContForceSharedNeighbors& shared = sharedNeighbors[set];
+    const vector<int>& members = shared.getGroups();
+    bool anySelected = selectPairs;
+    for (int group : members)
+        anySelected |= (mustSelectPairs[group] != 0);
+    if (anySelected)
+        shared.setPositions(groups, positions);
+    for (int i = 0; i < members.size(); i++)
+        evaluateGroup(members[i], positions, selectPairs, includeForces, includeEnergy, thread, &shared, i);
+}
+
+void ContForceEvaluator::evaluateGroup(int group, const vector<Vec3>& positions, bool selectPairs, bool includeForces,
+                                       bool includeEnergy, int thread, ContForceSharedNeighbors* shared, int sharedIndex) {
+    ThreadData& data = threadData[thread];
+    const vector<int>& atoms = groups.getAtoms();
+    int start = groups.getGroupStart(group);
+    int numParticles = groups.getGroupSize(group);
+    double length = groups.getCutoff(group);
+    double k = groups.getForceConstant(group);
+
+    // Gather the positions of the particles in this group.
+
+    data.groupPos.resize(numParticles);
+    for (int i = 0; i < numParticles; i++)
+        data.groupPos[i] = positions[atoms[start+i]];
+
+    // For each component, find the closest pair joining it to the rest of the group.
+
+    if (selectPairs || mustSelectPairs[group]) {
+        if (shared == NULL)
+            numComponents[group] = selector.selectPairs(group, data.groupPos, box, length, restrainedPairs[group], thread);
+        else
+            numComponents[group] = selector.selectSharedPairs(group, data.groupPos, box, length, *shared, sharedIndex,
+                                                              restrainedPairs[group], thread);
+        mustSelectPairs[group] = 0;
+    }
+    const vector<pair<int, int> >& restrained = restrainedPairs[group];
+    vector<double>& distances = restrainedDistances[group];
+    distances.resize(restrained.size());
+    double& energy = groupEnergy[group];
+    vector<pair<int, Vec3> >& forces = groupForces[group];
+    energy = 0;
+    forces.clear();
+
+    // Add the restraint force to each selected pair.
+
+    for (int i = 0; i < restrained.size(); i++) {
+        int p1 = restrained[i].first;
+        int p2 = restrained[i].second;
+        Vec3 delta = box.getDelta(data.groupPos[p1], data.groupPos[p2]);
+        double r = sqrt(delta.dot(delta));
+        double dr = r-length;
+        distances[i] = r;
+        if (includeEnergy)
+            energy += k*dr*dr;
+        if (includeForces) {
+            double dEdR = (r > 0 ? 2*k*dr/r : 0);
+            forces.push_back(make_pair(atoms[start+p1], -delta*dEdR));
+            forces.push_back(make_pair(atoms[start+p2], delta*dEdR));
+        }
+    }
+}
@@ -0,0 +1,103 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2014 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+
+
+#include "internal/ContForceGroups.h"
+#include "openmm/OpenMMException.h"
+#include <algorithm>
+
+using namespace ContForcePlugin;
+using namespace OpenMM;
+using namespace std;
+
+ContForceGroups::ContForceGroups() : maxGroupSize(0) {
+    groupStart.push_back(0);
+}
+
+void ContForceGroups::initialize(const ContForce& force) {
+    int numGroups = force.getNumBonds();
+    groupStart.resize(numGroups+1);
+    atoms.clear();
+    cutoffs.resize(numGroups);
+    forceConstants.resize(numGroups);
+    maxGroupSize = 0;
+    vector<int> idxs;
+    int npart;
+    for (int i = 0; i < numGroups; i++) {
+        force.getBondParameters(i, idxs, npart, cutoffs[i], forceConstants[i]);
+        if (npart < 0 || npart > idxs.size())
+            throw OpenMMException("ContForce: a bond has fewer particle indices than its number of particles");
+        groupStart[i] = atoms.size();
+        atoms.insert(atoms.end(), idxs.begin(), idxs.begin()+npart);
+        maxGroupSize = max(maxGroupSize, npart);
+    }
+    groupStart[numGroups] = atoms.size();
+}
+
+void ContForceGroups::updateParameters(const ContForce& force, vector<int>& changedGroups) {
+    int numGroups = getNumGroups();
+    if (force.getNumBonds() != numGroups)
+        throw OpenMMException("updateParametersInContext: The number of bonds has changed");
+    changedGroups.clear();
+    vector<int> idxs;
+    int npart;
+    for (int i = 0; i < numGroups; i++) {
+        force.getBondParameters(i, idxs, npart, cutoffs[i], forceConstants[i]);
+        if (npart < 0 || npart > idxs.size())
+            throw OpenMMException("ContForce: a bond has fewer particle indices than its number of particles");
+        if (npart != getGroupSize(i) || !equal(idxs.begin(), idxs.begin()+npart, atoms.begin()+groupStart[i]))
+            changedGroups.push_back(i);
+    }
+    if (changedGroups.size() == 0)
+        return;
+
+    // Rebuild the flat list of members, copying the groups that have not changed.
+
+    vector<int> oldAtoms;
+    oldAtoms.swap(atoms);
+    vector<int> oldStart = groupStart;
+    int nextChanged = 0;
+    maxGroupSize = 0;
+    for (int i = 0; i < numGroups; i++) {
+        groupStart[i] = atoms.size();
+        if (nextChanged < changedGroups.size() && changedGroups[nextChanged] == i) {
+            double cutoff, forceConstant;
+            force.getBondParameters(i, idxs, npart, cutoff, forceConstant);
+            atoms.insert(atoms.end(), idxs.begin(), idxs.begin()+npart);
+            nextChanged++;
+        }
+        else
+            atoms.insert(atoms.end(), oldAtoms.begin()+oldStart[i], oldAtoms.begin()+oldStart[i+1]);
+        maxGroupSize = max(maxGroupSize, (int) atoms.size()-groupStart[i]);
+    }
+    groupStart[numGroups] = atoms.size();
+}
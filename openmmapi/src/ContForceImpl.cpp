@@ -34,6 +34,7 @@
 #endif
 #include "internal/ContForceImpl.h"
 #include "ContForceKernels.h"
+#include "internal/ContForceProfiler.h"
 #include "openmm/OpenMMException.h"
 #include "openmm/internal/ContextImpl.h"
 #include <cmath>
@@ -57,8 +58,10 @@ void ContForceImpl::initialize(ContextImpl& context) {
 }
 
 double ContForceImpl::calcForcesAndEnergy(ContextImpl& context, bool includeForces, bool includeEnergy, int groups) {
-    if ((groups&(1<<owner.getForceGroup())) != 0)
+    if ((groups&(1<<owner.getForceGroup())) != 0) {
+        ContForceProfileRange range("ContForce");
         return kernel.getAs<CalcContForceKernel>().execute(context, includeForces, includeEnergy);
+    }
     return 0.0;
 }
 
@@ -71,3 +74,28 @@ std::vector<std::string> ContForceImpl::getKernelNames() {
 void ContForceImpl::updateParametersInContext(ContextImpl& context) {
     kernel.getAs<CalcContForceKernel>().copyParametersToContext(context, owner);
 }
+
+long long ContForceImpl::getNumCacheHits() {
+    return kernel.getAs<CalcContForceKernel>().getNumCacheHits();
+}
+
+void ContForceImpl::getBondStatistics(int index, int& numComponents, vector<int>& particle1, vector<int>& particle2,
+                                      vector<double>& distances) {
+    kernel.getAs<CalcContForceKernel>().getGroupStatistics(index, numComponents, particle1, particle2, distances);
+}
+
+void ContForceImpl::getBondSummaries(vector<int>& numComponents, vector<int>& numPairs, vector<double>& minDistances) {
+    kernel.getAs<CalcContForceKernel>().getGroupSummaries(numComponents, numPairs, minDistances);
+}
+
+void ContForceImpl::getPhaseTimes(double& distanceTime, double& labelingTime, double& selectionTime, double& uploadTime) {
+    kernel.getAs<CalcContForceKernel>().getPhaseTimes(distanceTime, labelingTime, selectionTime, uploadTime);
+}
+
+void ContForceImpl::createCheckpoint(ContextImpl& context, ostream& stream) {
+    kernel.getAs<CalcContForceKernel>().createCheckpoint(context, stream);
+}
+
+void ContForceImpl::loadCheckpoint(ContextImpl& context, istream& stream) {
+    kernel.getAs<CalcContForceKernel>().loadCheckpoint(context, stream);
+}
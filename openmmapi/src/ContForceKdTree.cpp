@@ -0,0 +1,199 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2014 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+
+#include "internal/ContForceKdTree.h"
+#include <algorithm>
+#include <limits>
+
+using namespace ContForcePlugin;
+using namespace OpenMM;
+using namespace std;
+
+static const int MAX_LEAF_SIZE = 8;
+
+namespace {
+    // Orders particle indices by one coordinate, for splitting a node at its median.
+    struct CompareCoordinate {
+        const vector<Vec3>& positions;
+        int axis;
+        CompareCoordinate(const vector<Vec3>& positions, int axis) : positions(positions), axis(axis) {
+        }
+        bool operator()(int a, int b) const {
+            return positions[a][axis] < positions[b][axis];
+        }
+    };
+}
+
+static double boxDistance2(const Vec3& pos, const Vec3& boxMin, const Vec3& boxMax) {
+    double dist2 = 0;
+    for (int i = 0; i < 3; i++) {
+        double d = max(0.0, max(boxMin[i]-pos[i], pos[i]-boxMax[i]));
+        dist2 += d*d;
+    }
+    return dist2;
+}
+
+void ContForceKdTree::reserve(int numParticles) {
+    // Leaves hold at least MAX_LEAF_SIZE/2 particles, which bounds the number of nodes.  The
+    // stack never holds more than two nodes per level of the tree.
+
+    nodes.reserve(2*numParticles/(MAX_LEAF_SIZE/2)+1);
+    stack.reserve(128);
+    order.reserve(numParticles);
+    wrappedPos.reserve(numParticles);
+    sortedPos.reserve(numParticles);
+    sortedComponent.reserve(numParticles);
+    best.reserve(numParticles);
+}
+
+void ContForceKdTree::build(const vector<Vec3>& positions, const vector<int>& componentIndex) {
+    int numParticles = positions.size();
+    order.resize(numParticles);
+    for (int i = 0; i < numParticles; i++)
+        order[i] = i;
+    nodes.clear();
+    buildNode(0, numParticles, positions, componentIndex);
+
+    // Store the particles in tree order so each leaf is contiguous in memory.
+
+    sortedPos.resize(numParticles);
+    sortedComponent.resize(numParticles);
+    for (int i = 0; i < numParticles; i++) {
+        sortedPos[i] = positions[order[i]];
+        sortedComponent[i] = componentIndex[order[i]];
+    }
+}
+
+int ContForceKdTree::buildNode(int start, int end, const vector<Vec3>& positions, const vector<int>& componentIndex) {
+    int index = nodes.size();
+    nodes.push_back(Node());
+    Node node;
+    node.start = start;
+    node.end = end;
+    node.firstChild = node.secondChild = -1;
+    node.boxMin = node.boxMax = positions[order[start]];
+    node.component = componentIndex[order[start]];
+    for (int i = start+1; i < end; i++) {
+        const Vec3& pos = positions[order[i]];
+        for (int j = 0; j < 3; j++) {
+            node.boxMin[j] = min(node.boxMin[j], pos[j]);
+            node.boxMax[j] = max(node.boxMax[j], pos[j]);
+        }
+        if (componentIndex[order[i]] != node.component)
+            node.component = -1;
+    }
+
+    if (end-start > MAX_LEAF_SIZE) {
+        Vec3 size = node.boxMax-node.boxMin;
+        int axis = (size[0] > size[1] ? (size[0] > size[2] ? 0 : 2) : (size[1] > size[2] ? 1 : 2));
+        int middle = (start+end)/2;
+        nth_element(order.begin()+start, order.begin()+middle, order.begin()+end, CompareCoordinate(positions, axis));
+        node.firstChild = buildNode(start, middle, positions, componentIndex);
+        node.secondChild = buildNode(middle, end, positions, componentIndex);
+    }
+    nodes[index] = node;
+    return index;
+}
+
+void ContForceKdTree::findClosest(int particle, const Vec3& pos, int component, Candidate& best) {
+    stack.clear();
+    stack.push_back(0);
+    while (stack.size() > 0) {
+        const Node& node = nodes[stack.back()];
+        stack.pop_back();
+
+        // Skip nodes that are entirely inside the querying component or too far away to hold
+        // a better pair.  Equally distant nodes must still be searched to resolve ties.
+
+        if (node.component == component || boxDistance2(pos, node.boxMin, node.boxMax) > best.dist2)
+            continue;
+        if (node.firstChild == -1) {
+            for (int i = node.start; i < node.end; i++) {
+                if (sortedComponent[i] == component)
+                    continue;
+                Vec3 delta = pos-sortedPos[i];
+                Candidate candidate = {delta.dot(delta), particle, order[i]};
+                if (candidate < best)
+                    best = candidate;
+            }
+            continue;
+        }
+
+        // Visit the nearer child first so the bound tightens as quickly as possible.
+
+        int nearer = node.firstChild;
+        int farther = node.secondChild;
+        if (boxDistance2(pos, nodes[farther].boxMin, nodes[farther].boxMax) < boxDistance2(pos, nodes[nearer].boxMin, nodes[nearer].boxMax))
+            swap(nearer, farther);
+        stack.push_back(farther);
+        stack.push_back(nearer);
+    }
+}
+
+void ContForceKdTree::findClosestPairs(const vector<Vec3>& positions, const ContForcePeriodicBox& box, const vector<int>& componentIndex,
+                                       int numComponents, vector<pair<int, int> >& pairs) {
+    pairs.clear();
+    if (numComponents < 2)
+        return;
+    Candidate none = {numeric_limits<double>::max(), -1, -1};
+    best.assign(numComponents, none);
+    if (!box.isPeriodic()) {
+        build(positions, componentIndex);
+        for (int i = 0; i < (int) positions.size(); i++)
+            findClosest(i, positions[i], componentIndex[i], best[componentIndex[i]]);
+    }
+    else {
+        int numParticles = positions.size();
+        wrappedPos.resize(numParticles);
+        for (int i = 0; i < numParticles; i++) {
+            Vec3 fractional;
+            wrappedPos[i] = box.wrap(positions[i], fractional);
+        }
+        build(wrappedPos, componentIndex);
+
+        // Query the unshifted image first, so the bound is already tight for the others.
+
+        vector<Vec3> shifts(1, Vec3());
+        for (int i = -1; i <= 1; i++)
+            for (int j = -1; j <= 1; j++)
+                for (int k = -1; k <= 1; k++)
+                    if (i != 0 || j != 0 || k != 0)
+                        shifts.push_back(box.getBoxVector(0)*i+box.getBoxVector(1)*j+box.getBoxVector(2)*k);
+        for (int i = 0; i < numParticles; i++)
+            for (int j = 0; j < shifts.size(); j++)
+                findClosest(i, wrappedPos[i]+shifts[j], componentIndex[i], best[componentIndex[i]]);
+    }
+    for (int i = 0; i < numComponents; i++)
+        pairs.push_back(make_pair(min(best[i].inside, best[i].outside), max(best[i].inside, best[i].outside)));
+    sort(pairs.begin(), pairs.end());
+    pairs.erase(unique(pairs.begin(), pairs.end()), pairs.end());
+}
@@ -0,0 +1,96 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2014 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+
+#include "internal/ContForceLabeler.h"
+
+using namespace ContForcePlugin;
+using namespace std;
+
+void ContForceLabeler::reserve(int numParticles) {
+    parent.reserve(numParticles);
+    rank.reserve(numParticles);
+}
+
+void ContForceLabeler::reset(int numParticles) {
+    parent.resize(numParticles);
+    rank.assign(numParticles, 0);
+    for (int i = 0; i < numParticles; i++)
+        parent[i] = i;
+}
+
+int ContForceLabeler::find(int particle) {
+    int root = particle;
+    while (parent[root] != root)
+        root = parent[root];
+
+    // Point every particle along the path directly at the root.
+
+    while (parent[particle] != root) {
+        int next = parent[particle];
+        parent[particle] = root;
+        particle = next;
+    }
+    return root;
+}
+
+bool ContForceLabeler::merge(int particle1, int particle2) {
+    int root1 = find(particle1);
+    int root2 = find(particle2);
+    if (root1 == root2)
+        return false;
+    if (rank[root1] < rank[root2])
+        parent[root1] = root2;
+    else if (rank[root1] > rank[root2])
+        parent[root2] = root1;
+    else {
+        parent[root2] = root1;
+        rank[root1]++;
+    }
+    return true;
+}
+
+int ContForceLabeler::getComponents(vector<int>& componentIndex) {
+    int numParticles = parent.size();
+    componentIndex.assign(numParticles, -1);
+
+    // Number the components in the order their lowest-index particle is encountered.
+    // The root of each set records the component number as soon as it is assigned.
+
+    int numComponents = 0;
+    for (int i = 0; i < numParticles; i++) {
+        int root = find(i);
+        if (componentIndex[root] == -1)
+            componentIndex[root] = numComponents++;
+        componentIndex[i] = componentIndex[root];
+    }
+    return numComponents;
+}
@@ -0,0 +1,86 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2014 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+
+
+#include "internal/ContForceNeighborList.h"
+
+using namespace ContForcePlugin;
+using namespace OpenMM;
+using namespace std;
+
+ContForceNeighborList::ContForceNeighborList() : currentListCutoff(0), isValid(false) {
+}
+
+void ContForceNeighborList::invalidate() {
+    isValid = false;
+}
+
+bool ContForceNeighborList::needsRebuild(const vector<Vec3>& positions, const ContForcePeriodicBox& box, double listCutoff, double skin) const {
+    if (!isValid || listCutoff != currentListCutoff || positions.size() != referencePositions.size() || box != referenceBox)
+        return true;
+    double maxDisplacement2 = 0.25*skin*skin;
+    for (int i = 0; i < positions.size(); i++) {
+        Vec3 delta = positions[i]-referencePositions[i];
+        if (delta.dot(delta) > maxDisplacement2)
+            return true;
+    }
+    return false;
+}
+
+bool ContForceNeighborList::findNeighbors(ContForceCellList& cellList, const vector<Vec3>& positions, const ContForcePeriodicBox& box,
+                                          double cutoff, double skin, vector<pair<int, int> >& pairs) {
+    if (skin <= 0) {
+        isValid = false;
+        cellList.findNeighbors(positions, box, cutoff, pairs);
+        return false;
+    }
+    double listCutoff = cutoff+skin;
+    bool reused = !needsRebuild(positions, box, listCutoff, skin);
+    if (!reused) {
+        cellList.findNeighbors(positions, box, listCutoff, candidates);
+        referencePositions = positions;
+        referenceBox = box;
+        currentListCutoff = listCutoff;
+        isValid = true;
+    }
+
+    // Keep the candidates that are within the cutoff now.
+
+    pairs.clear();
+    double cutoff2 = cutoff*cutoff;
+    for (int i = 0; i < candidates.size(); i++) {
+        Vec3 delta = box.getDelta(positions[candidates[i].second], positions[candidates[i].first]);
+        if (delta.dot(delta) < cutoff2)
+            pairs.push_back(candidates[i]);
+    }
+    return reused;
+}
@@ -0,0 +1,219 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2014 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+
+
+#include "internal/ContForcePairSelector.h"
+#include "internal/ContForceProfiler.h"
+#include <chrono>
+
+using namespace ContForcePlugin;
+using namespace OpenMM;
+using namespace std;
+
+static double secondsSince(chrono::steady_clock::time_point& start) {
+    chrono::steady_clock::time_point end = chrono::steady_clock::now();
+    double seconds = chrono::duration<double>(end-start).count();
+    start = end;
+    return seconds;
+}
+
+ContForcePairSelector::ContForcePairSelector() : workspaces(1), skinDistance(0.0), hierarchicalGroupSize(0) {
+    workspaces[0].cellList.reset(new ContForceCellList());
+    workspaces[0].numCacheHits = 0;
+    workspaces[0].distanceTime = workspaces[0].labelingTime = workspaces[0].selectionTime = 0.0;
+}
+
+void ContForcePairSelector::setNumGroups(int numGroups, int maxGroupSize, int numThreads, const ContForceCellList& cellListType) {
+    neighborLists.clear();
+    neighborLists.resize(numGroups);
+    spanningTrees.clear();
+    spanningTrees.resize(numGroups);
+    supernodes.clear();
+    supernodes.resize(numGroups);
+    workspaces.clear();
+    workspaces.resize(numThreads);
+    for (int i = 0; i < numThreads; i++) {
+        Workspace& ws = workspaces[i];
+        ws.cellList.reset(cellListType.clone());
+        ws.cellList->reserve(maxGroupSize);
+        ws.labeler.reserve(maxGroupSize);
+        ws.kdTree.reserve(maxGroupSize);
+        ws.componentIndex.reserve(maxGroupSize);
+        ws.numCacheHits = 0;
+        ws.distanceTime = ws.labelingTime = ws.selectionTime = 0.0;
+    }
+}
+
+void ContForcePairSelector::resetGroup(int group) {
+    neighborLists[group] = ContForceNeighborList();
+    spanningTrees[group] = ContForceSpanningTree();
+    supernodes[group] = ContForceSupernodes();
+}
+
+void ContForcePairSelector::createCheckpoint(ostream& stream) const {
+    for (int i = 0; i < spanningTrees.size(); i++)
+        spanningTrees[i].createCheckpoint(stream);
+}
+
+void ContForcePairSelector::loadCheckpoint(istream& stream) {
+    for (int i = 0; i < spanningTrees.size(); i++) {
+        neighborLists[i] = ContForceNeighborList();
+        supernodes[i].invalidate();
+        spanningTrees[i].loadCheckpoint(stream);
+    }
+}
+
+void ContForcePairSelector::setSkinDistance(double distance) {
+    skinDistance = distance;
+}
+
+void ContForcePairSelector::setHierarchicalGroupSize(int size) {
+    hierarchicalGroupSize = size;
+}
+
+long long ContForcePairSelector::getNumCacheHits() const {
+    long long hits = 0;
+    for (int i = 0; i < workspaces.size(); i++)
+        hits += workspaces[i].numCacheHits;
+    return hits;
+}
+
+void ContForcePairSelector::getPhaseTimes(double& distanceTime, double& labelingTime, double& selectionTime) const {
+    distanceTime = labelingTime = selectionTime = 0.0;
+    for (int i = 0; i < workspaces.size(); i++) {
+        distanceTime += workspaces[i].distanceTime;
+        labelingTime += workspaces[i].labelingTime;
+        selectionTime += workspaces[i].selectionTime;
+    }
+}
+
+bool ContForcePairSelector::usesSupernodes(const vector<Vec3>& positions) const {
+    return (hierarchicalGroupSize > 0 && positions.size() >= hierarchicalGroupSize && skinDistance > 0);
+}
+
+int ContForcePairSelector::selectPairs(int group, const vector<Vec3>& positions, const ContForcePeriodicBox& box, double cutoff,
+                                       vector<pair<int, int> >& pairs, int thread) {
+    pairs.clear();
+    Workspace& ws = workspaces[thread];
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    ContForceProfiler::pushRange("ContForce neighbors");
+    int numComponents;
+    if (usesSupernodes(positions)) {
+        // Only the pairs near the cutoff between supernodes need to be checked.
+
+        if (supernodes[group].update(*ws.cellList, ws.labeler, positions, box, cutoff, skinDistance, ws.neighbors))
+            ws.numCacheHits++;
+        ContForceProfiler::popRange();
+        ws.distanceTime += secondsSince(start);
+        ContForceProfiler::pushRange("ContForce labeling");
+        numComponents = supernodes[group].findComponents(ws.labeler, positions, box, cutoff, ws.componentIndex);
+        ContForceProfiler::popRange();
+        ws.labelingTime += secondsSince(start);
+        if (numComponents <= 1)
+            return numComponents;
+    }
+    else {
+        // If the spanning tree found on an earlier step still holds, the group is connected.
+
+        if (spanningTrees[group].isIntact(positions, box, cutoff)) {
+            ContForceProfiler::popRange();
+            ws.distanceTime += secondsSince(start);
+            return 1;
+        }
+
+        // List the pairs closer than the cutoff and label the components they form, keeping the
+        // pairs that joined them.
+
+        if (neighborLists[group].findNeighbors(*ws.cellList, positions, box, cutoff, skinDistance, ws.neighbors))
+            ws.numCacheHits++;
+        ContForceProfiler::popRange();
+        ws.distanceTime += secondsSince(start);
+        numComponents = labelNeighbors(group, positions.size(), ws, start);
+        if (numComponents <= 1)
+            return numComponents;
+    }
+    findClosestPairs(positions, box, numComponents, pairs, ws, start);
+    return numComponents;
+}
+
+int ContForcePairSelector::selectSharedPairs(int group, const vector<Vec3>& positions, const ContForcePeriodicBox& box, double cutoff,
+                                             ContForceSharedNeighbors& shared, int sharedIndex, vector<pair<int, int> >& pairs, int thread) {
+    if (usesSupernodes(positions))
+        return selectPairs(group, positions, box, cutoff, pairs, thread);
+    pairs.clear();
+    Workspace& ws = workspaces[thread];
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    ContForceProfiler::pushRange("ContForce neighbors");
+    if (spanningTrees[group].isIntact(positions, box, cutoff)) {
+        ContForceProfiler::popRange();
+        ws.distanceTime += secondsSince(start);
+        return 1;
+    }
+
+    // The first group that needs its pairs searches the shared particles, and the others only
+    // filter what it found.
+
+    if (shared.findNeighbors(*ws.cellList, box, skinDistance))
+        ws.numCacheHits++;
+    shared.getGroupNeighbors(sharedIndex, cutoff, ws.neighbors);
+    ContForceProfiler::popRange();
+    ws.distanceTime += secondsSince(start);
+    int numComponents = labelNeighbors(group, positions.size(), ws, start);
+    if (numComponents > 1)
+        findClosestPairs(positions, box, numComponents, pairs, ws, start);
+    return numComponents;
+}
+
+int ContForcePairSelector::labelNeighbors(int group, int numParticles, Workspace& ws, chrono::steady_clock::time_point& start) {
+    ContForceProfiler::pushRange("ContForce labeling");
+    ws.labeler.reset(numParticles);
+    spanningTrees[group].reset();
+    for (int i = 0; i < ws.neighbors.size(); i++)
+        if (ws.labeler.merge(ws.neighbors[i].first, ws.neighbors[i].second))
+            spanningTrees[group].addEdge(ws.neighbors[i].first, ws.neighbors[i].second);
+    int numComponents = ws.labeler.getComponents(ws.componentIndex);
+    if (numComponents <= 1)
+        spanningTrees[group].markComplete();
+    ContForceProfiler::popRange();
+    ws.labelingTime += secondsSince(start);
+    return numComponents;
+}
+
+void ContForcePairSelector::findClosestPairs(const vector<Vec3>& positions, const ContForcePeriodicBox& box, int numComponents,
+                                             vector<pair<int, int> >& pairs, Workspace& ws, chrono::steady_clock::time_point& start) {
+    // For each component, find the closest pair joining it to another one.
+
+    ContForceProfiler::pushRange("ContForce pair search");
+    ws.kdTree.findClosestPairs(positions, box, ws.componentIndex, numComponents, pairs);
+    ContForceProfiler::popRange();
+    ws.selectionTime += secondsSince(start);
+}
@@ -0,0 +1,57 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2014 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+
+
+#include "internal/ContForcePeriodicBox.h"
+
+using namespace ContForcePlugin;
+using namespace OpenMM;
+using namespace std;
+
+ContForcePeriodicBox::ContForcePeriodicBox() : periodic(false) {
+    for (int i = 0; i < 3; i++) {
+        invBoxSize[i] = 0.0;
+        widths[i] = 0.0;
+    }
+}
+
+ContForcePeriodicBox::ContForcePeriodicBox(const Vec3& a, const Vec3& b, const Vec3& c) : periodic(true) {
+    boxVectors[0] = a;
+    boxVectors[1] = b;
+    boxVectors[2] = c;
+    double volume = a[0]*b[1]*c[2];
+    for (int i = 0; i < 3; i++) {
+        invBoxSize[i] = 1.0/boxVectors[i][i];
+        Vec3 normal = boxVectors[(i+1)%3].cross(boxVectors[(i+2)%3]);
+        widths[i] = volume/sqrt(normal.dot(normal));
+    }
+}
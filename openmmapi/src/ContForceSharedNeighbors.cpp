@@ -0,0 +1,105 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2014 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+
+
+#include "internal/ContForceSharedNeighbors.h"
+#include <algorithm>
+
+using namespace ContForcePlugin;
+using namespace OpenMM;
+using namespace std;
+
+ContForceSharedNeighbors::ContForceSharedNeighbors() : maxCutoff(0), hasNeighbors(false) {
+}
+
+void ContForceSharedNeighbors::initialize(const ContForceGroups& groups, const vector<int>& sharingGroups) {
+    groupIndices = sharingGroups;
+    const vector<int>& groupAtoms = groups.getAtoms();
+    atoms.clear();
+    for (int group : groupIndices)
+        atoms.insert(atoms.end(), groupAtoms.begin()+groups.getGroupStart(group), groupAtoms.begin()+groups.getGroupStart(group+1));
+    sort(atoms.begin(), atoms.end());
+    atoms.erase(unique(atoms.begin(), atoms.end()), atoms.end());
+
+    // Record where each shared particle appears in each group, or -1 if it is not in it.
+
+    memberIndex.resize(groupIndices.size());
+    for (int i = 0; i < groupIndices.size(); i++) {
+        int start = groups.getGroupStart(groupIndices[i]);
+        memberIndex[i].assign(atoms.size(), -1);
+        for (int j = 0; j < groups.getGroupSize(groupIndices[i]); j++) {
+            int shared = lower_bound(atoms.begin(), atoms.end(), groupAtoms[start+j])-atoms.begin();
+            memberIndex[i][shared] = j;
+        }
+    }
+    positions.resize(atoms.size());
+    invalidate();
+}
+
+void ContForceSharedNeighbors::invalidate() {
+    neighborList.invalidate();
+    hasNeighbors = false;
+}
+
+void ContForceSharedNeighbors::setPositions(const ContForceGroups& groups, const vector<Vec3>& positions) {
+    for (int i = 0; i < atoms.size(); i++)
+        this->positions[i] = positions[atoms[i]];
+    maxCutoff = 0;
+    for (int group : groupIndices)
+        maxCutoff = max(maxCutoff, groups.getCutoff(group));
+    hasNeighbors = false;
+}
+
+bool ContForceSharedNeighbors::findNeighbors(ContForceCellList& cellList, const ContForcePeriodicBox& box, double skin) {
+    if (hasNeighbors)
+        return false;
+    bool reused = neighborList.findNeighbors(cellList, positions, box, maxCutoff, skin, neighbors);
+    neighborDist2.resize(neighbors.size());
+    for (int i = 0; i < neighbors.size(); i++) {
+        Vec3 delta = box.getDelta(positions[neighbors[i].second], positions[neighbors[i].first]);
+        neighborDist2[i] = delta.dot(delta);
+    }
+    hasNeighbors = true;
+    return reused;
+}
+
+void ContForceSharedNeighbors::getGroupNeighbors(int index, double cutoff, vector<pair<int, int> >& pairs) const {
+    const vector<int>& member = memberIndex[index];
+    double cutoff2 = cutoff*cutoff;
+    pairs.clear();
+    for (int i = 0; i < neighbors.size(); i++) {
+        int member1 = member[neighbors[i].first];
+        int member2 = member[neighbors[i].second];
+        if (member1 != -1 && member2 != -1 && neighborDist2[i] < cutoff2)
+            pairs.push_back(member1 < member2 ? make_pair(member1, member2) : make_pair(member2, member1));
+    }
+}
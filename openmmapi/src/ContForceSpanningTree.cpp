@@ -0,0 +1,77 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2014 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+
+
+#include "internal/ContForceSpanningTree.h"
+#include "internal/ContForceCheckpoint.h"
+
+using namespace ContForcePlugin;
+using namespace OpenMM;
+using namespace std;
+
+ContForceSpanningTree::ContForceSpanningTree() : isComplete(false) {
+}
+
+void ContForceSpanningTree::reset() {
+    edges.clear();
+    isComplete = false;
+}
+
+void ContForceSpanningTree::addEdge(int particle1, int particle2) {
+    edges.push_back(make_pair(particle1, particle2));
+}
+
+void ContForceSpanningTree::markComplete() {
+    isComplete = true;
+}
+
+bool ContForceSpanningTree::isIntact(const vector<Vec3>& positions, const ContForcePeriodicBox& box, double cutoff) const {
+    if (!isComplete)
+        return false;
+    double cutoff2 = cutoff*cutoff;
+    for (int i = 0; i < edges.size(); i++) {
+        Vec3 delta = box.getDelta(positions[edges[i].second], positions[edges[i].first]);
+        if (!(delta.dot(delta) < cutoff2))
+            return false;
+    }
+    return true;
+}
+
+void ContForceSpanningTree::createCheckpoint(ostream& stream) const {
+    ContForceCheckpoint::write(stream, isComplete);
+    ContForceCheckpoint::write(stream, edges);
+}
+
+void ContForceSpanningTree::loadCheckpoint(istream& stream) {
+    ContForceCheckpoint::read(stream, isComplete);
+    ContForceCheckpoint::read(stream, edges);
+}
@@ -0,0 +1,115 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2014 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+
+
+#include "internal/ContForceSupernodes.h"
+
+using namespace ContForcePlugin;
+using namespace OpenMM;
+using namespace std;
+
+ContForceSupernodes::ContForceSupernodes() : currentCutoff(0), currentSkin(0), numSupernodes(0), isValid(false) {
+}
+
+void ContForceSupernodes::invalidate() {
+    isValid = false;
+}
+
+bool ContForceSupernodes::needsRebuild(const vector<Vec3>& positions, const ContForcePeriodicBox& box, double cutoff, double skin) const {
+    if (!isValid || cutoff != currentCutoff || skin != currentSkin || positions.size() != referencePositions.size() || box != referenceBox)
+        return true;
+    double maxDisplacement2 = 0.25*skin*skin;
+    for (int i = 0; i < positions.size(); i++) {
+        Vec3 delta = positions[i]-referencePositions[i];
+        if (delta.dot(delta) > maxDisplacement2)
+            return true;
+    }
+    return false;
+}
+
+bool ContForceSupernodes::update(ContForceCellList& cellList, ContForceLabeler& labeler, const vector<Vec3>& positions,
+                                 const ContForcePeriodicBox& box, double cutoff, double skin, vector<pair<int, int> >& candidates) {
+    if (!needsRebuild(positions, box, cutoff, skin))
+        return true;
+
+    // Until some particle moves more than half the skin, no separation changes by more than the skin.
+    // Pairs closer than cutoff-skin therefore stay within the cutoff, and pairs not found within
+    // cutoff+skin stay outside it.
+
+    cellList.findNeighbors(positions, box, cutoff+skin, candidates);
+    double firmCutoff2 = (cutoff > skin ? (cutoff-skin)*(cutoff-skin) : 0.0);
+    labeler.reset(positions.size());
+    for (int i = 0; i < candidates.size(); i++) {
+        Vec3 delta = box.getDelta(positions[candidates[i].second], positions[candidates[i].first]);
+        if (delta.dot(delta) < firmCutoff2)
+            labeler.merge(candidates[i].first, candidates[i].second);
+    }
+    numSupernodes = labeler.getComponents(supernode);
+
+    // Every pair joining two supernodes is near the cutoff, since closer pairs were merged.
+
+    boundaryPairs.clear();
+    for (int i = 0; i < candidates.size(); i++)
+        if (supernode[candidates[i].first] != supernode[candidates[i].second])
+            boundaryPairs.push_back(candidates[i]);
+    referencePositions = positions;
+    referenceBox = box;
+    currentCutoff = cutoff;
+    currentSkin = skin;
+    isValid = true;
+    return false;
+}
+
+int ContForceSupernodes::findComponents(ContForceLabeler& labeler, const vector<Vec3>& positions, const ContForcePeriodicBox& box,
+                                        double cutoff, vector<int>& componentIndex) {
+    // Supernodes are numbered in order of their lowest particles, so numbering the components in
+    // order of their lowest supernodes also numbers them in order of their lowest particles.
+
+    labeler.reset(numSupernodes);
+    double cutoff2 = cutoff*cutoff;
+    for (int i = 0; i < boundaryPairs.size(); i++) {
+        int node1 = supernode[boundaryPairs[i].first];
+        int node2 = supernode[boundaryPairs[i].second];
+        if (labeler.find(node1) == labeler.find(node2))
+            continue;
+        Vec3 delta = box.getDelta(positions[boundaryPairs[i].second], positions[boundaryPairs[i].first]);
+        if (delta.dot(delta) < cutoff2)
+            labeler.merge(node1, node2);
+    }
+    int numComponents = labeler.getComponents(supernodeComponent);
+    if (numComponents > 1) {
+        componentIndex.resize(positions.size());
+        for (int i = 0; i < positions.size(); i++)
+            componentIndex[i] = supernodeComponent[supernode[i]];
+    }
+    return numComponents;
+}
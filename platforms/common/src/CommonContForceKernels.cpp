@@ -0,0 +1,656 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2014 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+
+#include "CommonContForceKernels.h"
+#include "CommonContForceKernelSources.h"
+#include "internal/ContForceCheckpoint.h"
+#include "internal/ContForceProfiler.h"
+#include "openmm/OpenMMException.h"
+#include "openmm/common/ContextSelector.h"
+#include "openmm/internal/ContextImpl.h"
+#include <algorithm>
+#include <chrono>
+#include <map>
+
+using namespace ContForcePlugin;
+using namespace OpenMM;
+using namespace std;
+
+class CommonCalcContForceKernel::ReorderListener : public ComputeContext::ReorderListener {
+public:
+    ReorderListener(CommonCalcContForceKernel& owner) : owner(owner) {
+    }
+    void execute() {
+        owner.hasSortedIndices = false;
+    }
+private:
+    CommonCalcContForceKernel& owner;
+};
+
+/**
+ * The number of threads that summarize each group for getGroupSummaries().  It must be a power of two.
+ */
+static const int SummaryBlockSize = 128;
+
+/**
+ * Set the four arguments of a kernel that describe the periodic box, starting at a given index.
+ */
+static void setPeriodicBoxArgs(ComputeContext& cc, ComputeKernel kernel, int index) {
+    Vec3 a, b, c;
+    cc.getPeriodicBoxVectors(a, b, c);
+    if (cc.getUseDoublePrecision()) {
+        kernel->setArg(index++, mm_double4(1.0/a[0], 1.0/b[1], 1.0/c[2], 0.0));
+        kernel->setArg(index++, mm_double4(a[0], a[1], a[2], 0.0));
+        kernel->setArg(index++, mm_double4(b[0], b[1], b[2], 0.0));
+        kernel->setArg(index, mm_double4(c[0], c[1], c[2], 0.0));
+    }
+    else {
+        kernel->setArg(index++, mm_float4((float) (1.0/a[0]), (float) (1.0/b[1]), (float) (1.0/c[2]), 0.0f));
+        kernel->setArg(index++, mm_float4((float) a[0], (float) a[1], (float) a[2], 0.0f));
+        kernel->setArg(index++, mm_float4((float) b[0], (float) b[1], (float) b[2], 0.0f));
+        kernel->setArg(index, mm_float4((float) c[0], (float) c[1], (float) c[2], 0.0f));
+    }
+}
+
+/**
+ * Write the contents of an array to a checkpoint.
+ */
+static void writeArray(ostream& stream, ComputeArray& array) {
+    vector<char> data(array.getSize()*array.getElementSize());
+    if (data.size() > 0)
+        array.download(&data[0]);
+    ContForceCheckpoint::write(stream, data);
+}
+
+/**
+ * Read the contents of an array written by writeArray().
+ */
+static void readArray(istream& stream, ComputeArray& array) {
+    vector<char> data;
+    ContForceCheckpoint::read(stream, data);
+    if (data.size() != array.getSize()*array.getElementSize())
+        throw OpenMMException("ContForce: the checkpoint was created for a different force");
+    if (data.size() > 0)
+        array.upload(&data[0]);
+}
+
+void CommonCalcContForceKernel::initialize(const System& system, const ContForce& force) {
+    evaluator.initialize(force, cc.getThreadPool().getNumThreads());
+    const ContForceGroups& groups = evaluator.getGroups();
+    int numBonds = groups.getNumGroups();
+    updateInterval = force.getUpdateInterval();
+    useDeviceKernels = force.getUseDeviceKernels();
+    ContextSelector selector(cc);
+    map<string, string> defines;
+    defines["NUM_ATOMS"] = cc.intToString(cc.getNumAtoms());
+    defines["PADDED_NUM_ATOMS"] = cc.intToString(cc.getPaddedNumAtoms());
+    if (!useDeviceKernels) {
+        int elementSize = (cc.getUseDoublePrecision() ? sizeof(double) : sizeof(float));
+        contForces.initialize(cc, 3*system.getNumParticles(), elementSize, "contForces");
+        hostForces.resize(system.getNumParticles());
+        ComputeProgram program = cc.compileProgram(CommonContForceKernelSources::ContForce, defines);
+        addForcesKernel = program->createKernel("addForces");
+        addForcesKernel->addArg(contForces);
+        addForcesKernel->addArg(cc.getLongForceBuffer());
+        addForcesKernel->addArg(cc.getAtomIndexArray());
+        return;
+    }
+
+    // The members of all groups are stored in one list, in the same order as in ContForceGroups,
+    // but each group's slot has room for more members so they can be changed in place.
+
+    if (groups.getGroupStart(numBonds) == 0)
+        return;
+    layoutGroups();
+
+    // If the System is periodic, reordering the atoms moves each one into the box on its own.  A force
+    // that is not periodic must undo that, or a group crossing a face of the box would be torn apart.
+
+    useCellOffsets = (system.usesPeriodicBoundaryConditions() && !force.usesPeriodicBoundaryConditions());
+    sortedIndex.initialize<int>(cc, numMembers, "contSortedIndex");
+    memberGroup.initialize<int>(cc, numMembers, "contMemberGroup");
+    memberCellOffset.initialize<mm_int4>(cc, useCellOffsets ? numMembers : 1, "contMemberCellOffset");
+    groupStart.initialize<int>(cc, numBonds+1, "contGroupStart");
+    groupEnd.initialize<int>(cc, numBonds, "contGroupEnd");
+    parent.initialize<int>(cc, numMembers, "contParent");
+    nearestOutside.initialize<int>(cc, numMembers, "contNearestOutside");
+    nearestDist.initialize<int>(cc, numMembers, "contNearestDist");
+    bestDist.initialize<int>(cc, numMembers, "contBestDist");
+    bestInside.initialize<int>(cc, numMembers, "contBestInside");
+    componentCount.initialize<int>(cc, numBonds, "contComponentCount");
+    treeEdge.initialize<mm_int2>(cc, numMembers, "contTreeEdge");
+    needsLabel.initialize<int>(cc, numBonds, "contNeedsLabel");
+    groupSummary.initialize<mm_int2>(cc, numBonds, "contGroupSummary");
+    if (cc.getUseDoublePrecision()) {
+        groupParams.initialize<mm_double2>(cc, numBonds, "contGroupParams");
+        memberPos.initialize<mm_double4>(cc, numMembers, "contMemberPos");
+        pairDistance.initialize<double>(cc, numMembers, "contPairDistance");
+        groupMinDistance.initialize<double>(cc, numBonds, "contGroupMinDistance");
+    }
+    else {
+        groupParams.initialize<mm_float2>(cc, numBonds, "contGroupParams");
+        memberPos.initialize<mm_float4>(cc, numMembers, "contMemberPos");
+        pairDistance.initialize<float>(cc, numMembers, "contPairDistance");
+        groupMinDistance.initialize<float>(cc, numBonds, "contGroupMinDistance");
+    }
+    uploadGroupParams();
+    cc.addReorderListener(new ReorderListener(*this));
+
+    // Create the kernels.  The number of members is passed as an argument rather than defined, so
+    // the layout can change without recompiling them.  The periodic box is set before every launch.
+
+    defines["NUM_BONDS"] = cc.intToString(numBonds);
+    defines["NO_PAIR"] = "0x7FFFFFFF";
+    defines["SUMMARY_BLOCK_SIZE"] = cc.intToString(SummaryBlockSize);
+    if (force.usesPeriodicBoundaryConditions())
+        defines["USE_PERIODIC"] = "1";
+    if (useCellOffsets)
+        defines["USE_CELL_OFFSETS"] = "1";
+    ComputeProgram program = cc.compileProgram(CommonContForceKernelSources::ContForceConnectivity, defines);
+    gatherPositionsKernel = program->createKernel("gatherPositions");
+    gatherPositionsKernel->addArg(cc.getPosq());
+    gatherPositionsKernel->addArg(sortedIndex);
+    gatherPositionsKernel->addArg(memberCellOffset);
+    gatherPositionsKernel->addArg(memberPos);
+    gatherPositionsKernel->addArg(numMembers);
+    gatherPositionsKernel->addArg();
+    gatherPositionsKernel->addArg();
+    gatherPositionsKernel->addArg();
+    gatherPositionsKernel->addArg();
+    checkSpanningTreesKernel = program->createKernel("checkSpanningTrees");
+    checkSpanningTreesKernel->addArg(memberPos);
+    checkSpanningTreesKernel->addArg(memberGroup);
+    checkSpanningTreesKernel->addArg(groupParams);
+    checkSpanningTreesKernel->addArg(treeEdge);
+    checkSpanningTreesKernel->addArg(needsLabel);
+    checkSpanningTreesKernel->addArg(numMembers);
+    checkSpanningTreesKernel->addArg();
+    checkSpanningTreesKernel->addArg();
+    checkSpanningTreesKernel->addArg();
+    checkSpanningTreesKernel->addArg();
+    initComponentsKernel = program->createKernel("initComponents");
+    initComponentsKernel->addArg(memberGroup);
+    initComponentsKernel->addArg(needsLabel);
+    initComponentsKernel->addArg(parent);
+    initComponentsKernel->addArg(treeEdge);
+    initComponentsKernel->addArg(bestDist);
+    initComponentsKernel->addArg(bestInside);
+    initComponentsKernel->addArg(componentCount);
+    initComponentsKernel->addArg(numMembers);
+    linkNeighborsKernel = program->createKernel("linkNeighbors");
+    linkNeighborsKernel->addArg(memberPos);
+    linkNeighborsKernel->addArg(memberGroup);
+    linkNeighborsKernel->addArg(groupEnd);
+    linkNeighborsKernel->addArg(groupParams);
+    linkNeighborsKernel->addArg(needsLabel);
+    linkNeighborsKernel->addArg(parent);
+    linkNeighborsKernel->addArg(treeEdge);
+    linkNeighborsKernel->addArg(numMembers);
+    linkNeighborsKernel->addArg();
+    linkNeighborsKernel->addArg();
+    linkNeighborsKernel->addArg();
+    linkNeighborsKernel->addArg();
+    flattenComponentsKernel = program->createKernel("flattenComponents");
+    flattenComponentsKernel->addArg(parent);
+    flattenComponentsKernel->addArg(memberGroup);
+    flattenComponentsKernel->addArg(needsLabel);
+    flattenComponentsKernel->addArg(componentCount);
+    flattenComponentsKernel->addArg(numMembers);
+    findClosestPairsKernel = program->createKernel("findClosestPairs");
+    findClosestPairsKernel->addArg(memberPos);
+    findClosestPairsKernel->addArg(memberGroup);
+    findClosestPairsKernel->addArg(groupStart);
+    findClosestPairsKernel->addArg(groupEnd);
+    findClosestPairsKernel->addArg(componentCount);
+    findClosestPairsKernel->addArg(parent);
+    findClosestPairsKernel->addArg(nearestOutside);
+    findClosestPairsKernel->addArg(nearestDist);
+    findClosestPairsKernel->addArg(bestDist);
+    findClosestPairsKernel->addArg(needsLabel);
+    findClosestPairsKernel->addArg(numMembers);
+    findClosestPairsKernel->addArg();
+    findClosestPairsKernel->addArg();
+    findClosestPairsKernel->addArg();
+    findClosestPairsKernel->addArg();
+    findClosestInsideKernel = program->createKernel("findClosestInside");
+    findClosestInsideKernel->addArg(memberGroup);
+    findClosestInsideKernel->addArg(componentCount);
+    findClosestInsideKernel->addArg(parent);
+    findClosestInsideKernel->addArg(nearestDist);
+    findClosestInsideKernel->addArg(bestDist);
+    findClosestInsideKernel->addArg(bestInside);
+    findClosestInsideKernel->addArg(numMembers);
+    applyRestraintsKernel = program->createKernel("applyRestraints");
+    applyRestraintsKernel->addArg(memberPos);
+    applyRestraintsKernel->addArg(sortedIndex);
+    applyRestraintsKernel->addArg(memberGroup);
+    applyRestraintsKernel->addArg(groupParams);
+    applyRestraintsKernel->addArg(parent);
+    applyRestraintsKernel->addArg(nearestOutside);
+    applyRestraintsKernel->addArg(bestInside);
+    applyRestraintsKernel->addArg(pairDistance);
+    applyRestraintsKernel->addArg(cc.getLongForceBuffer());
+    applyRestraintsKernel->addArg(cc.getEnergyBuffer());
+    applyRestraintsKernel->addArg();
+    applyRestraintsKernel->addArg();
+    applyRestraintsKernel->addArg(numMembers);
+    applyRestraintsKernel->addArg();
+    applyRestraintsKernel->addArg();
+    applyRestraintsKernel->addArg();
+    applyRestraintsKernel->addArg();
+    summarizeGroupsKernel = program->createKernel("summarizeGroups");
+    summarizeGroupsKernel->addArg(pairDistance);
+    summarizeGroupsKernel->addArg(groupStart);
+    summarizeGroupsKernel->addArg(groupEnd);
+    summarizeGroupsKernel->addArg(componentCount);
+    summarizeGroupsKernel->addArg(groupSummary);
+    summarizeGroupsKernel->addArg(groupMinDistance);
+    uploadLayout();
+}
+
+void CommonCalcContForceKernel::layoutGroups() {
+    const ContForceGroups& groups = evaluator.getGroups();
+    int numBonds = groups.getNumGroups();
+    deviceGroupStart.resize(numBonds+1);
+    deviceGroupEnd.resize(numBonds);
+    deviceGroupStart[0] = 0;
+    for (int i = 0; i < numBonds; i++) {
+        int size = groups.getGroupSize(i);
+        deviceGroupStart[i+1] = deviceGroupStart[i]+size+max(4, size/8);
+    }
+    numMembers = deviceGroupStart[numBonds];
+    memberAtom.resize(numMembers);
+    memberGroupIndex.resize(numMembers);
+    for (int i = 0; i < numBonds; i++)
+        fillSlot(i);
+}
+
+void CommonCalcContForceKernel::fillSlot(int group) {
+    // The unused part of the slot is marked with a group of -1, which every kernel skips.
+
+    const ContForceGroups& groups = evaluator.getGroups();
+    int start = deviceGroupStart[group];
+    int size = groups.getGroupSize(group);
+    const int* atoms = &groups.getAtoms()[groups.getGroupStart(group)];
+    for (int i = start; i < deviceGroupStart[group+1]; i++) {
+        bool isMember = (i-start < size);
+        memberAtom[i] = (isMember ? atoms[i-start] : -1);
+        memberGroupIndex[i] = (isMember ? group : -1);
+    }
+    deviceGroupEnd[group] = start+size;
+}
+
+void CommonCalcContForceKernel::uploadLayout() {
+    int numBonds = deviceGroupEnd.size();
+    if (sortedIndex.getSize() != numMembers) {
+        sortedIndex.resize(numMembers);
+        memberGroup.resize(numMembers);
+        memberPos.resize(numMembers);
+        if (useCellOffsets)
+            memberCellOffset.resize(numMembers);
+        parent.resize(numMembers);
+        nearestOutside.resize(numMembers);
+        nearestDist.resize(numMembers);
+        bestDist.resize(numMembers);
+        bestInside.resize(numMembers);
+        treeEdge.resize(numMembers);
+        pairDistance.resize(numMembers);
+    }
+    memberGroup.upload(memberGroupIndex);
+    groupStart.upload(deviceGroupStart);
+    groupEnd.upload(deviceGroupEnd);
+    needsLabel.upload(vector<int>(numBonds, 1));
+    componentCount.upload(vector<int>(numBonds, 0));
+    gatherPositionsKernel->setArg(4, numMembers);
+    checkSpanningTreesKernel->setArg(5, numMembers);
+    initComponentsKernel->setArg(7, numMembers);
+    linkNeighborsKernel->setArg(7, numMembers);
+    flattenComponentsKernel->setArg(4, numMembers);
+    findClosestPairsKernel->setArg(10, numMembers);
+    findClosestInsideKernel->setArg(6, numMembers);
+    applyRestraintsKernel->setArg(12, numMembers);
+    memberCellOffsets.clear();
+    hasSortedIndices = false;
+}
+
+void CommonCalcContForceKernel::uploadGroupParams() {
+    const ContForceGroups& groups = evaluator.getGroups();
+    if (cc.getUseDoublePrecision()) {
+        vector<mm_double2> params(groups.getNumGroups());
+        for (int i = 0; i < groups.getNumGroups(); i++)
+            params[i] = mm_double2(groups.getCutoff(i), groups.getForceConstant(i));
+        groupParams.upload(params);
+    }
+    else {
+        vector<mm_float2> params(groups.getNumGroups());
+        for (int i = 0; i < groups.getNumGroups(); i++)
+            params[i] = mm_float2((float) groups.getCutoff(i), (float) groups.getForceConstant(i));
+        groupParams.upload(params);
+    }
+}
+
+void CommonCalcContForceKernel::updateSortedIndices() {
+    // Find where each member's atom is stored now that the atoms may have been reordered.
+
+    const vector<int>& order = cc.getAtomIndex();
+    atomPosition.resize(order.size());
+    for (int i = 0; i < order.size(); i++)
+        atomPosition[order[i]] = i;
+    vector<int> sorted(numMembers);
+    for (int i = 0; i < numMembers; i++)
+        sorted[i] = (memberAtom[i] == -1 ? 0 : atomPosition[memberAtom[i]]);
+    sortedIndex.upload(sorted);
+    hasSortedIndices = true;
+}
+
+void CommonCalcContForceKernel::updateCellOffsets() {
+    // Setting the positions resets the offsets without reordering the atoms, so they are compared on
+    // every evaluation instead of only being updated by updateSortedIndices().
+
+    const vector<mm_int4>& offsets = cc.getPosCellOffsets();
+    bool changed = (memberCellOffsets.size() != numMembers);
+    memberCellOffsets.resize(numMembers);
+    for (int i = 0; i < numMembers; i++) {
+        mm_int4 offset(0, 0, 0, 0);
+        if (memberAtom[i] != -1)
+            offset = offsets[atomPosition[memberAtom[i]]];
+        mm_int4& current = memberCellOffsets[i];
+        if (offset.x != current.x || offset.y != current.y || offset.z != current.z) {
+            current = offset;
+            changed = true;
+        }
+    }
+    if (changed)
+        memberCellOffset.upload(memberCellOffsets);
+}
+
+bool CommonCalcContForceKernel::shouldSelectPairs(ContextImpl& context) {
+    long long step = context.getStepCount();
+    if (updateInterval == 1 || lastSelectionStep < 0 || step < lastSelectionStep || step-lastSelectionStep >= updateInterval) {
+        lastSelectionStep = step;
+        return true;
+    }
+    return false;
+}
+
+double CommonCalcContForceKernel::execute(ContextImpl& context, bool includeForces, bool includeEnergy) {
+    if (useDeviceKernels)
+        return executeOnDevice(context, includeForces, includeEnergy);
+    return executeOnHost(context, includeForces, includeEnergy);
+}
+
+double CommonCalcContForceKernel::executeOnDevice(ContextImpl& context, bool includeForces, bool includeEnergy) {
+    if (numMembers == 0)
+        return 0.0;
+    ContextSelector selector(cc);
+    if (!hasSortedIndices)
+        updateSortedIndices();
+    if (useCellOffsets)
+        updateCellOffsets();
+    setPeriodicBoxArgs(cc, gatherPositionsKernel, 5);
+    gatherPositionsKernel->execute(numMembers);
+    bool selectPairs = shouldSelectPairs(context);
+    if (selectPairs || hasChangedGroups) {
+        hasChangedGroups = false;
+        ContForceProfileRange range("ContForce select pairs on device");
+        int numBonds = evaluator.getGroups().getNumGroups();
+        setPeriodicBoxArgs(cc, checkSpanningTreesKernel, 6);
+        setPeriodicBoxArgs(cc, linkNeighborsKernel, 8);
+        setPeriodicBoxArgs(cc, findClosestPairsKernel, 11);
+        checkSpanningTreesKernel->execute(numMembers);
+        initComponentsKernel->execute(max(numMembers, numBonds));
+        linkNeighborsKernel->execute(numMembers);
+        flattenComponentsKernel->execute(numMembers);
+        findClosestPairsKernel->execute(max(numMembers, numBonds));
+        findClosestInsideKernel->execute(numMembers);
+    }
+    ContForceProfileRange range("ContForce restraints on device");
+    applyRestraintsKernel->setArg(10, (int) includeForces);
+    applyRestraintsKernel->setArg(11, (int) includeEnergy);
+    setPeriodicBoxArgs(cc, applyRestraintsKernel, 13);
+    applyRestraintsKernel->execute(numMembers);
+    return 0.0;
+}
+
+double CommonCalcContForceKernel::executeOnHost(ContextImpl& context, bool includeForces, bool includeEnergy) {
+    ContForceProfiler::pushRange("ContForce positions");
+    context.getPositions(pos);
+    ContForceProfiler::popRange();
+    Vec3 boxVectors[3];
+    context.getPeriodicBoxVectors(boxVectors[0], boxVectors[1], boxVectors[2]);
+    double energy = evaluator.evaluate(pos, boxVectors, shouldSelectPairs(context), includeForces, includeEnergy, cc.getThreadPool(), groupForces);
+    if (includeForces && groupForces.size() > 0) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (int i = 0; i < groupForces.size(); i++)
+            hostForces[groupForces[i].first] += groupForces[i].second;
+        ContextSelector selector(cc);
+        ContForceProfiler::pushRange("ContForce upload");
+        if (cc.getUseDoublePrecision()) {
+            vector<double> forces(3*hostForces.size());
+            for (int i = 0; i < hostForces.size(); i++)
+                for (int j = 0; j < 3; j++)
+                    forces[3*i+j] = hostForces[i][j];
+            contForces.upload(forces);
+        }
+        else {
+            vector<float> forces(3*hostForces.size());
+            for (int i = 0; i < hostForces.size(); i++)
+                for (int j = 0; j < 3; j++)
+                    forces[3*i+j] = (float) hostForces[i][j];
+            contForces.upload(forces);
+        }
+        for (int i = 0; i < groupForces.size(); i++)
+            hostForces[groupForces[i].first] = Vec3();
+        ContForceProfiler::popRange();
+        uploadTime += chrono::duration<double>(chrono::steady_clock::now()-start).count();
+        ContForceProfileRange range("ContForce add forces");
+        addForcesKernel->execute(cc.getNumAtoms());
+    }
+    return energy;
+}
+
+void CommonCalcContForceKernel::copyParametersToContext(ContextImpl& context, const ContForce& force) {
+    evaluator.updateParameters(force);
+    updateInterval = force.getUpdateInterval();
+    if (!useDeviceKernels || numMembers == 0)
+        return;
+    ContextSelector selector(cc);
+    uploadGroupParams();
+    const vector<int>& changed = evaluator.getChangedGroups();
+    if (changed.size() == 0)
+        return;
+
+    // If a group no longer fits in its slot, lay out all of them again.  Otherwise only the
+    // changed slots need to be uploaded.
+
+    const ContForceGroups& groups = evaluator.getGroups();
+    bool fits = true;
+    for (int i = 0; i < changed.size(); i++)
+        if (groups.getGroupSize(changed[i]) > deviceGroupStart[changed[i]+1]-deviceGroupStart[changed[i]])
+            fits = false;
+    if (!fits) {
+        layoutGroups();
+        uploadLayout();
+    }
+    else {
+        int one = 1, zero = 0;
+        for (int i = 0; i < changed.size(); i++) {
+            int group = changed[i];
+            int start = deviceGroupStart[group];
+            int slotSize = deviceGroupStart[group+1]-start;
+            fillSlot(group);
+            memberGroup.uploadSubArray(&memberGroupIndex[start], start, slotSize);
+            groupEnd.uploadSubArray(&deviceGroupEnd[group], group, 1);
+            needsLabel.uploadSubArray(&one, group, 1);
+            componentCount.uploadSubArray(&zero, group, 1);
+        }
+        hasSortedIndices = false;
+    }
+
+    // The changed groups have no pairs yet, so they must be selected the next time the force is
+    // computed.  There is no way to select only some groups, so all of them are.
+
+    hasChangedGroups = true;
+}
+
+void CommonCalcContForceKernel::getGroupStatistics(int group, int& numComponents, vector<int>& particle1, vector<int>& particle2,
+                                                   vector<double>& distances) {
+    if (!useDeviceKernels || numMembers == 0) {
+        evaluator.getGroupStatistics(group, numComponents, particle1, particle2, distances);
+        return;
+    }
+
+    // Every root that applies a pair has recorded its distance.  Download what is needed to
+    // find those pairs in the group.
+
+    ContextSelector selector(cc);
+    vector<int> counts, inside, outside;
+    vector<double> r;
+    componentCount.download(counts);
+    bestInside.download(inside);
+    nearestOutside.download(outside);
+    if (cc.getUseDoublePrecision())
+        pairDistance.download(r);
+    else {
+        vector<float> rFloat;
+        pairDistance.download(rFloat);
+        r.assign(rFloat.begin(), rFloat.end());
+    }
+    numComponents = counts[group];
+    particle1.clear();
+    particle2.clear();
+    distances.clear();
+    if (numComponents < 2)
+        return;
+    const vector<int>& atoms = memberAtom;
+    for (int member = deviceGroupStart[group]; member < deviceGroupEnd[group]; member++) {
+        if (r[member] < 0)
+            continue;
+        int member1 = inside[member];
+        int member2 = outside[member1];
+        particle1.push_back(atoms[min(member1, member2)]);
+        particle2.push_back(atoms[max(member1, member2)]);
+        distances.push_back(r[member]);
+    }
+}
+
+void CommonCalcContForceKernel::getGroupSummaries(vector<int>& numComponents, vector<int>& numPairs, vector<double>& minDistances) {
+    if (!useDeviceKernels || numMembers == 0) {
+        evaluator.getGroupSummaries(numComponents, numPairs, minDistances);
+        return;
+    }
+    ContextSelector selector(cc);
+    int numBonds = deviceGroupEnd.size();
+    summarizeGroupsKernel->execute(min(numBonds, cc.getNumThreadBlocks())*SummaryBlockSize, SummaryBlockSize);
+    vector<mm_int2> summary;
+    groupSummary.download(summary);
+    if (cc.getUseDoublePrecision())
+        groupMinDistance.download(minDistances);
+    else {
+        vector<float> rFloat;
+        groupMinDistance.download(rFloat);
+        minDistances.assign(rFloat.begin(), rFloat.end());
+    }
+    numComponents.resize(numBonds);
+    numPairs.resize(numBonds);
+    for (int i = 0; i < numBonds; i++) {
+        numComponents[i] = summary[i].x;
+        numPairs[i] = summary[i].y;
+    }
+}
+
+void CommonCalcContForceKernel::getPhaseTimes(double& distanceTime, double& labelingTime, double& selectionTime, double& uploadTime) {
+    evaluator.getPhaseTimes(distanceTime, labelingTime, selectionTime);
+    uploadTime = this->uploadTime;
+}
+
+void CommonCalcContForceKernel::createCheckpoint(ContextImpl& context, ostream& stream) {
+    ContForceCheckpoint::write(stream, lastSelectionStep);
+    evaluator.createCheckpoint(stream);
+    if (!useDeviceKernels || numMembers == 0)
+        return;
+
+    // The arrays are indexed by the slots of the members, so the layout is written too.
+
+    ContextSelector selector(cc);
+    ContForceCheckpoint::write(stream, hasChangedGroups);
+    ContForceCheckpoint::write(stream, deviceGroupStart);
+    writeArray(stream, parent);
+    writeArray(stream, nearestOutside);
+    writeArray(stream, nearestDist);
+    writeArray(stream, bestDist);
+    writeArray(stream, bestInside);
+    writeArray(stream, componentCount);
+    writeArray(stream, treeEdge);
+    writeArray(stream, needsLabel);
+    writeArray(stream, pairDistance);
+}
+
+void CommonCalcContForceKernel::loadCheckpoint(ContextImpl& context, istream& stream) {
+    ContForceCheckpoint::read(stream, lastSelectionStep);
+    evaluator.loadCheckpoint(stream);
+    if (!useDeviceKernels || numMembers == 0)
+        return;
+
+    // The groups may have been laid out differently if their members changed before the checkpoint
+    // was created, so they are moved to the slots recorded in it.
+
+    ContextSelector selector(cc);
+    vector<int> savedGroupStart;
+    ContForceCheckpoint::read(stream, hasChangedGroups);
+    ContForceCheckpoint::read(stream, savedGroupStart);
+    const ContForceGroups& groups = evaluator.getGroups();
+    int numBonds = groups.getNumGroups();
+    if (savedGroupStart.size() != numBonds+1)
+        throw OpenMMException("ContForce: the checkpoint was created for a different force");
+    for (int i = 0; i < numBonds; i++)
+        if (groups.getGroupSize(i) > savedGroupStart[i+1]-savedGroupStart[i])
+            throw OpenMMException("ContForce: the checkpoint was created for a different force");
+    if (savedGroupStart != deviceGroupStart) {
+        deviceGroupStart = savedGroupStart;
+        numMembers = deviceGroupStart[numBonds];
+        memberAtom.resize(numMembers);
+        memberGroupIndex.resize(numMembers);
+        for (int i = 0; i < numBonds; i++)
+            fillSlot(i);
+        uploadLayout();
+    }
+    readArray(stream, parent);
+    readArray(stream, nearestOutside);
+    readArray(stream, nearestDist);
+    readArray(stream, bestDist);
+    readArray(stream, bestInside);
+    readArray(stream, componentCount);
+    readArray(stream, treeEdge);
+    readArray(stream, needsLabel);
+    readArray(stream, pairDistance);
+}
@@ -0,0 +1,183 @@
+#ifndef COMMON_CONTFORCE_KERNELS_H_
+#define COMMON_CONTFORCE_KERNELS_H_
+
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2014 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+
+#include "ContForceKernels.h"
+#include "internal/ContForceEvaluator.h"
+#include "openmm/common/ComputeArray.h"
+#include "openmm/common/ComputeContext.h"
+#include <vector>
+
+namespace ContForcePlugin {
+
+/**
+ * This kernel is invoked by ContForce to calculate the forces acting on the system and the energy of the system.
+ * It is written for OpenMM's common compute framework, so it can be used by any platform built on it.
+ */
+class CommonCalcContForceKernel : public CalcContForceKernel {
+public:
+    CommonCalcContForceKernel(std::string name, const OpenMM::Platform& platform, OpenMM::ComputeContext& cc) :
+            CalcContForceKernel(name, platform), cc(cc), numMembers(0), hasSortedIndices(false), hasChangedGroups(false), useCellOffsets(false), updateInterval(1),
+            lastSelectionStep(-1), uploadTime(0.0) {
+    }
+    /**
+     * Initialize the kernel.
+     *
+     * @param system     the System this kernel will be applied to
+     * @param force      the ContForce this kernel will be used for
+     */
+    void initialize(const OpenMM::System& system, const ContForce& force);
+    /**
+     * Execute the kernel to calculate the forces and/or energy.
+     *
+     * @param context        the context in which to execute this kernel
+     * @param includeForces  true if forces should be calculated
+     * @param includeEnergy  true if the energy should be calculated
+     * @return the potential energy due to the force
+     */
+    double execute(OpenMM::ContextImpl& context, bool includeForces, bool includeEnergy);
+    /**
+     * Copy changed parameters over to a context.
+     *
+     * @param context    the context to copy parameters to
+     * @param force      the ContForce to copy the parameters from
+     */
+    void copyParametersToContext(OpenMM::ContextImpl& context, const ContForce& force);
+    /**
+     * Get how many times a group's neighbor list has been reused instead of rebuilt.
+     */
+    long long getNumCacheHits() const {
+        return evaluator.getNumCacheHits();
+    }
+    /**
+     * Get statistics about a group from the last time the force was evaluated.  When the force is
+     * computed on the device, they are downloaded from it.
+     */
+    void getGroupStatistics(int group, int& numComponents, std::vector<int>& particle1, std::vector<int>& particle2,
+                            std::vector<double>& distances);
+    /**
+     * Get a summary of every group from the last time the force was evaluated.  When the force is
+     * computed on the device, the summaries are reduced there and only they are downloaded.
+     */
+    void getGroupSummaries(std::vector<int>& numComponents, std::vector<int>& numPairs, std::vector<double>& minDistances);
+    /**
+     * Get the total time in seconds spent in each phase of the calculation.  The device kernels are
+     * not timed, so all times are 0 when the force is computed on the device.
+     */
+    void getPhaseTimes(double& distanceTime, double& labelingTime, double& selectionTime, double& uploadTime);
+    /**
+     * Write the state kept between steps to a checkpoint.  When the force is computed on the device,
+     * this includes the component labels, spanning trees and selected pairs stored there.
+     */
+    void createCheckpoint(OpenMM::ContextImpl& context, std::ostream& stream);
+    /**
+     * Load the state written to a checkpoint by createCheckpoint().  The groups are laid out on the
+     * device the same way they were when it was created.
+     */
+    void loadCheckpoint(OpenMM::ContextImpl& context, std::istream& stream);
+private:
+    class ReorderListener;
+    /**
+     * Compute the force with kernels that work directly on the device's positions.
+     */
+    double executeOnDevice(OpenMM::ContextImpl& context, bool includeForces, bool includeEnergy);
+    /**
+     * Download the positions, compute the force on the host and upload it.
+     */
+    double executeOnHost(OpenMM::ContextImpl& context, bool includeForces, bool includeEnergy);
+    /**
+     * Decide whether new pairs should be selected on this step, or the ones selected earlier
+     * restrained again.
+     */
+    bool shouldSelectPairs(OpenMM::ContextImpl& context);
+    /**
+     * Give every group a slot in the list of members, with room for it to grow.
+     */
+    void layoutGroups();
+    /**
+     * Copy a group's atoms into its slot and mark the unused part of the slot.
+     */
+    void fillSlot(int group);
+    /**
+     * Size the arrays to the current layout, upload it and pass the number of members to the kernels.
+     */
+    void uploadLayout();
+    void uploadGroupParams();
+    void updateSortedIndices();
+    /**
+     * Upload the offsets of the cells the members' atoms were moved from into the periodic box if any
+     * of them has changed.
+     */
+    void updateCellOffsets();
+    OpenMM::ComputeContext& cc;
+    bool useDeviceKernels;
+    int numMembers;
+    bool hasSortedIndices, hasChangedGroups, useCellOffsets;
+    std::vector<int> deviceGroupStart, deviceGroupEnd, memberAtom, memberGroupIndex, atomPosition;
+    std::vector<OpenMM::mm_int4> memberCellOffsets;
+    OpenMM::ComputeArray contForces;
+    OpenMM::ComputeArray sortedIndex;
+    OpenMM::ComputeArray memberGroup;
+    OpenMM::ComputeArray memberPos;
+    OpenMM::ComputeArray memberCellOffset;
+    OpenMM::ComputeArray groupStart;
+    OpenMM::ComputeArray groupEnd;
+    OpenMM::ComputeArray groupParams;
+    OpenMM::ComputeArray parent;
+    OpenMM::ComputeArray nearestOutside;
+    OpenMM::ComputeArray nearestDist;
+    OpenMM::ComputeArray bestDist;
+    OpenMM::ComputeArray bestInside;
+    OpenMM::ComputeArray componentCount;
+    OpenMM::ComputeArray treeEdge;
+    OpenMM::ComputeArray needsLabel;
+    OpenMM::ComputeArray pairDistance;
+    OpenMM::ComputeArray groupSummary;
+    OpenMM::ComputeArray groupMinDistance;
+    OpenMM::ComputeKernel addForcesKernel;
+    OpenMM::ComputeKernel gatherPositionsKernel, checkSpanningTreesKernel, initComponentsKernel, linkNeighborsKernel, flattenComponentsKernel;
+    OpenMM::ComputeKernel findClosestPairsKernel, findClosestInsideKernel, applyRestraintsKernel;
+    OpenMM::ComputeKernel summarizeGroupsKernel;
+    int updateInterval;
+    long long lastSelectionStep;
+    double uploadTime;
+    ContForceEvaluator evaluator;
+    std::vector<OpenMM::Vec3> pos;
+    std::vector<OpenMM::Vec3> hostForces;
+    std::vector<std::pair<int, OpenMM::Vec3> > groupForces;
+};
+
+} // namespace ContForcePlugin
+
+#endif /*COMMON_CONTFORCE_KERNELS_H_*/
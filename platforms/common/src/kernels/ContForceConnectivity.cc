@@ -0,0 +1,356 @@
+/**
+ * These kernels evaluate the continuity force without leaving the device.  They are written for
+ * OpenMM's common compute framework, so the same source compiles for every GPU platform.  The members
+ * of all groups are stored one after another, so a member is identified by its index into that flat
+ * list.  Every group has a slot from groupStart[g] to groupStart[g+1] with room for more members than
+ * it has, so its members can change without moving the other groups.  Its members occupy the range
+ * groupStart[g] to groupEnd[g], and the rest of the slot is marked by a memberGroup of -1.
+ *
+ * Components are tracked with a concurrent union-find forest in which a member's parent never has a
+ * higher index than the member itself.  The root of a component is therefore its lowest member once
+ * all links have been made.
+ *
+ * Every successful link is recorded as an edge of a spanning tree, stored on the root that was hooked.
+ * If a group ends up with a single component, the next selection only checks that those edges are
+ * still shorter than the cutoff.  needsLabel flags the groups for which that check failed or that were
+ * not connected, and only those groups are labeled again.
+ *
+ * The labeling and selection kernels only use 32 bit atomics, so they do not need a 64 bit
+ * minimum or compare-and-swap.  The closest pair of each component is therefore found in two passes:
+ * the first finds the shortest distance and the second the lowest inside member at that distance.
+ * applyRestraints() is the exception: it adds its forces to the fixed point force buffer with 64 bit
+ * ATOMIC_ADD, like every force computed by the common compute framework, so it needs exactly the
+ * atomics the platform already requires for its own forces.
+ *
+ * If USE_PERIODIC is defined, every separation is measured to the nearest periodic image.  The box
+ * is passed to every kernel that measures one, and ignored otherwise.
+ *
+ * Each evaluation starts with gatherPositions(), which copies the position of every member to
+ * memberPos.  The other kernels read that instead of the atoms' positions.
+ */
+
+#ifdef __OPENCL_VERSION__
+    #define ATOMIC_CAS(dest, compare, value) atomic_cmpxchg(dest, compare, value)
+    #define ATOMIC_MIN(dest, value) atomic_min(dest, value)
+    #define FLOAT_AS_INT(value) as_int(value)
+#else
+    #define ATOMIC_CAS(dest, compare, value) atomicCAS(dest, compare, value)
+    #define ATOMIC_MIN(dest, value) atomicMin(dest, value)
+    #define FLOAT_AS_INT(value) __float_as_int(value)
+#endif
+
+#ifdef USE_PERIODIC
+    #define APPLY_PERIODIC(dx, dy, dz) { \
+        real scale3 = floor(dz*invPeriodicBoxSize.z+0.5f); \
+        dx -= scale3*periodicBoxVecZ.x; \
+        dy -= scale3*periodicBoxVecZ.y; \
+        dz -= scale3*periodicBoxVecZ.z; \
+        real scale2 = floor(dy*invPeriodicBoxSize.y+0.5f); \
+        dx -= scale2*periodicBoxVecY.x; \
+        dy -= scale2*periodicBoxVecY.y; \
+        real scale1 = floor(dx*invPeriodicBoxSize.x+0.5f); \
+        dx -= scale1*periodicBoxVecX.x; \
+    }
+#else
+    #define APPLY_PERIODIC(dx, dy, dz)
+#endif
+
+DEVICE int findRoot(GLOBAL volatile int* parent, int member) {
+    int current = parent[member];
+    if (current != member) {
+        // Halve the path as we walk it.  Other threads only ever lower a parent, so the
+        // path stays valid while they run.
+
+        int previous = member;
+        int next;
+        while (current > (next = parent[current])) {
+            parent[previous] = next;
+            previous = current;
+            current = next;
+        }
+    }
+    return current;
+}
+
+DEVICE void linkMembers(GLOBAL int* parent, GLOBAL int2* treeEdge, int member1, int member2) {
+    int root1 = findRoot(parent, member1);
+    int root2 = findRoot(parent, member2);
+    while (root1 != root2) {
+        if (root1 < root2) {
+            int temp = root1;
+            root1 = root2;
+            root2 = temp;
+        }
+
+        // Hook the higher root under the lower one.  If another thread changed it first,
+        // continue from whatever it now points to.
+
+        int old = ATOMIC_CAS(&parent[root1], root1, root2);
+        if (old == root1) {
+            treeEdge[root1] = make_int2(member1, member2);
+            break;
+        }
+        root1 = old;
+    }
+}
+
+/**
+ * Copy the position of every member's atom to memberPos.  If USE_CELL_OFFSETS is defined, the System is
+ * periodic but the force is not, and reordering the atoms may have moved each one into the periodic box
+ * on its own.  The offset of the cell it was moved from is subtracted, as the Context does, so a group
+ * is not torn apart where it crosses a face of the box.
+ */
+KERNEL void gatherPositions(GLOBAL const real4* RESTRICT posq, GLOBAL const int* RESTRICT sortedIndex,
+        GLOBAL const int4* RESTRICT memberCellOffset, GLOBAL real4* RESTRICT memberPos, int numMembers,
+        real4 invPeriodicBoxSize, real4 periodicBoxVecX, real4 periodicBoxVecY, real4 periodicBoxVecZ) {
+    for (int member = GLOBAL_ID; member < numMembers; member += GLOBAL_SIZE) {
+        real4 pos = posq[sortedIndex[member]];
+#ifdef USE_CELL_OFFSETS
+        int4 offset = memberCellOffset[member];
+        pos.x -= offset.x*periodicBoxVecX.x+offset.y*periodicBoxVecY.x+offset.z*periodicBoxVecZ.x;
+        pos.y -= offset.y*periodicBoxVecY.y+offset.z*periodicBoxVecZ.y;
+        pos.z -= offset.z*periodicBoxVecZ.z;
+#endif
+        memberPos[member] = pos;
+    }
+}
+
+/**
+ * Check the spanning tree of every group that was connected on the previous selection, and flag the
+ * group for labeling if any edge has become too long.
+ */
+KERNEL void checkSpanningTrees(GLOBAL const real4* RESTRICT memberPos, GLOBAL const int* RESTRICT memberGroup,
+        GLOBAL const real2* RESTRICT groupParams, GLOBAL const int2* RESTRICT treeEdge, GLOBAL int* RESTRICT needsLabel, int numMembers,
+        real4 invPeriodicBoxSize, real4 periodicBoxVecX, real4 periodicBoxVecY, real4 periodicBoxVecZ) {
+    for (int member = GLOBAL_ID; member < numMembers; member += GLOBAL_SIZE) {
+        int group = memberGroup[member];
+        if (group == -1)
+            continue;
+        int2 edge = treeEdge[member];
+        if (needsLabel[group] || edge.x == -1)
+            continue;
+        real4 pos1 = memberPos[edge.x];
+        real4 pos2 = memberPos[edge.y];
+        real dx = pos2.x-pos1.x;
+        real dy = pos2.y-pos1.y;
+        real dz = pos2.z-pos1.z;
+        APPLY_PERIODIC(dx, dy, dz)
+        real cutoff = groupParams[group].x;
+        if (!(dx*dx+dy*dy+dz*dz < cutoff*cutoff))
+            needsLabel[group] = 1;
+    }
+}
+
+KERNEL void initComponents(GLOBAL const int* RESTRICT memberGroup, GLOBAL const int* RESTRICT needsLabel, GLOBAL int* RESTRICT parent,
+        GLOBAL int2* RESTRICT treeEdge, GLOBAL int* RESTRICT bestDist, GLOBAL int* RESTRICT bestInside, GLOBAL int* RESTRICT componentCount,
+        int numMembers) {
+    for (int member = GLOBAL_ID; member < numMembers; member += GLOBAL_SIZE) {
+        int group = memberGroup[member];
+        if (group != -1 && needsLabel[group]) {
+            parent[member] = member;
+            treeEdge[member] = make_int2(-1, -1);
+        }
+        bestDist[member] = NO_PAIR;
+        bestInside[member] = NO_PAIR;
+    }
+    for (int group = GLOBAL_ID; group < NUM_BONDS; group += GLOBAL_SIZE)
+        if (needsLabel[group])
+            componentCount[group] = 0;
+}
+
+/**
+ * Link every pair of members that are closer than their group's cutoff.
+ */
+KERNEL void linkNeighbors(GLOBAL const real4* RESTRICT memberPos, GLOBAL const int* RESTRICT memberGroup,
+        GLOBAL const int* RESTRICT groupEnd, GLOBAL const real2* RESTRICT groupParams, GLOBAL const int* RESTRICT needsLabel,
+        GLOBAL int* RESTRICT parent, GLOBAL int2* RESTRICT treeEdge, int numMembers,
+        real4 invPeriodicBoxSize, real4 periodicBoxVecX, real4 periodicBoxVecY, real4 periodicBoxVecZ) {
+    for (int member = GLOBAL_ID; member < numMembers; member += GLOBAL_SIZE) {
+        int group = memberGroup[member];
+        if (group == -1 || !needsLabel[group])
+            continue;
+        int end = groupEnd[group];
+        real cutoff = groupParams[group].x;
+        real cutoff2 = cutoff*cutoff;
+        real4 pos1 = memberPos[member];
+        for (int other = member+1; other < end; other++) {
+            real4 pos2 = memberPos[other];
+            real dx = pos2.x-pos1.x;
+            real dy = pos2.y-pos1.y;
+            real dz = pos2.z-pos1.z;
+            APPLY_PERIODIC(dx, dy, dz)
+            if (dx*dx+dy*dy+dz*dz < cutoff2)
+                linkMembers(parent, treeEdge, member, other);
+        }
+    }
+}
+
+/**
+ * Point every member directly at the root of its component and count the components in each group.
+ */
+KERNEL void flattenComponents(GLOBAL int* RESTRICT parent, GLOBAL const int* RESTRICT memberGroup, GLOBAL const int* RESTRICT needsLabel,
+        GLOBAL int* RESTRICT componentCount, int numMembers) {
+    for (int member = GLOBAL_ID; member < numMembers; member += GLOBAL_SIZE) {
+        int group = memberGroup[member];
+        if (group == -1 || !needsLabel[group])
+            continue;
+        int root = member;
+        while (parent[root] != root)
+            root = parent[root];
+        parent[member] = root;
+        if (root == member)
+            ATOMIC_ADD(&componentCount[group], 1);
+    }
+}
+
+/**
+ * Find the closest member outside its own component for every member of a group that has more than
+ * one component, and reduce the squared distances to the shortest one per component.  Distances are
+ * compared as the bits of non-negative floats, which order the same way as the values.  This also
+ * decides which groups must be labeled on the next selection: those that are not connected now.
+ */
+KERNEL void findClosestPairs(GLOBAL const real4* RESTRICT memberPos, GLOBAL const int* RESTRICT memberGroup,
+        GLOBAL const int* RESTRICT groupStart, GLOBAL const int* RESTRICT groupEnd, GLOBAL const int* RESTRICT componentCount,
+        GLOBAL const int* RESTRICT parent, GLOBAL int* RESTRICT nearestOutside, GLOBAL int* RESTRICT nearestDist, GLOBAL int* RESTRICT bestDist,
+        GLOBAL int* RESTRICT needsLabel, int numMembers,
+        real4 invPeriodicBoxSize, real4 periodicBoxVecX, real4 periodicBoxVecY, real4 periodicBoxVecZ) {
+    for (int group = GLOBAL_ID; group < NUM_BONDS; group += GLOBAL_SIZE)
+        needsLabel[group] = (componentCount[group] != 1);
+    for (int member = GLOBAL_ID; member < numMembers; member += GLOBAL_SIZE) {
+        int group = memberGroup[member];
+        if (group == -1 || componentCount[group] < 2)
+            continue;
+        int root = parent[member];
+        int end = groupEnd[group];
+        real4 pos1 = memberPos[member];
+        real bestDist2 = 0;
+        int best = -1;
+        for (int other = groupStart[group]; other < end; other++) {
+            if (parent[other] == root)
+                continue;
+            real4 pos2 = memberPos[other];
+            real dx = pos2.x-pos1.x;
+            real dy = pos2.y-pos1.y;
+            real dz = pos2.z-pos1.z;
+            APPLY_PERIODIC(dx, dy, dz)
+            real r2 = dx*dx+dy*dy+dz*dz;
+            if (best == -1 || r2 < bestDist2) {
+                bestDist2 = r2;
+                best = other;
+            }
+        }
+        int dist = FLOAT_AS_INT((float) bestDist2);
+        nearestOutside[member] = best;
+        nearestDist[member] = dist;
+        ATOMIC_MIN(&bestDist[root], dist);
+    }
+}
+
+/**
+ * Among the members of each component at the shortest distance, pick the lowest one.
+ */
+KERNEL void findClosestInside(GLOBAL const int* RESTRICT memberGroup, GLOBAL const int* RESTRICT componentCount, GLOBAL const int* RESTRICT parent,
+        GLOBAL const int* RESTRICT nearestDist, GLOBAL const int* RESTRICT bestDist, GLOBAL int* RESTRICT bestInside, int numMembers) {
+    for (int member = GLOBAL_ID; member < numMembers; member += GLOBAL_SIZE) {
+        int group = memberGroup[member];
+        if (group == -1 || componentCount[group] < 2)
+            continue;
+        int root = parent[member];
+        if (nearestDist[member] == bestDist[root])
+            ATOMIC_MIN(&bestInside[root], member);
+    }
+}
+
+/**
+ * Apply the harmonic restraint to the pair selected by each component.  When two components select
+ * the same pair, only the one with the lower root applies it.  The forces and energy are only
+ * accumulated if requested.  The distance between the particles of the pair each root applies is
+ * recorded in pairDistance, and -1 for every other member.
+ */
+KERNEL void applyRestraints(GLOBAL const real4* RESTRICT memberPos, GLOBAL const int* RESTRICT sortedIndex, GLOBAL const int* RESTRICT memberGroup,
+        GLOBAL const real2* RESTRICT groupParams, GLOBAL const int* RESTRICT parent, GLOBAL const int* RESTRICT nearestOutside,
+        GLOBAL const int* RESTRICT bestInside, GLOBAL real* RESTRICT pairDistance, GLOBAL mm_ulong* RESTRICT forceBuffers,
+        GLOBAL mixed* RESTRICT energyBuffer, int includeForces, int includeEnergy, int numMembers,
+        real4 invPeriodicBoxSize, real4 periodicBoxVecX, real4 periodicBoxVecY, real4 periodicBoxVecZ) {
+    mixed energy = 0;
+    for (int member = GLOBAL_ID; member < numMembers; member += GLOBAL_SIZE) {
+        pairDistance[member] = -1;
+        int group = memberGroup[member];
+        int inside = bestInside[member];
+        if (group == -1 || inside == NO_PAIR)
+            continue;
+        int outside = nearestOutside[inside];
+        int otherRoot = parent[outside];
+        int otherInside = bestInside[otherRoot];
+        if (otherRoot < member && otherInside == outside && nearestOutside[otherInside] == inside)
+            continue;
+        int atom1 = sortedIndex[inside];
+        int atom2 = sortedIndex[outside];
+        real4 pos1 = memberPos[inside];
+        real4 pos2 = memberPos[outside];
+        real dx = pos1.x-pos2.x;
+        real dy = pos1.y-pos2.y;
+        real dz = pos1.z-pos2.z;
+        APPLY_PERIODIC(dx, dy, dz)
+        real r = SQRT(dx*dx+dy*dy+dz*dz);
+        pairDistance[member] = r;
+        real2 params = groupParams[group];
+        real dr = r-params.x;
+        energy += params.y*dr*dr;
+        if (!includeForces)
+            continue;
+        real dEdR = (r > 0 ? 2*params.y*dr/r : 0);
+        ATOMIC_ADD(&forceBuffers[atom1], (mm_ulong) realToFixedPoint(-dx*dEdR));
+        ATOMIC_ADD(&forceBuffers[atom1+PADDED_NUM_ATOMS], (mm_ulong) realToFixedPoint(-dy*dEdR));
+        ATOMIC_ADD(&forceBuffers[atom1+2*PADDED_NUM_ATOMS], (mm_ulong) realToFixedPoint(-dz*dEdR));
+        ATOMIC_ADD(&forceBuffers[atom2], (mm_ulong) realToFixedPoint(dx*dEdR));
+        ATOMIC_ADD(&forceBuffers[atom2+PADDED_NUM_ATOMS], (mm_ulong) realToFixedPoint(dy*dEdR));
+        ATOMIC_ADD(&forceBuffers[atom2+2*PADDED_NUM_ATOMS], (mm_ulong) realToFixedPoint(dz*dEdR));
+    }
+    if (includeEnergy)
+        energyBuffer[GLOBAL_ID] += energy;
+}
+
+/**
+ * Summarize every group for ContForce::getBondSummaries(): its number of components, the number of
+ * pairs applyRestraints() restrained in it, and the shortest of their distances, or -1 if there are
+ * none.  Each thread block reduces the members of one group at a time, so only these values need to
+ * be downloaded.  The block size must be a power of two no larger than SUMMARY_BLOCK_SIZE.
+ */
+KERNEL void summarizeGroups(GLOBAL const real* RESTRICT pairDistance, GLOBAL const int* RESTRICT groupStart,
+        GLOBAL const int* RESTRICT groupEnd, GLOBAL const int* RESTRICT componentCount, GLOBAL int2* RESTRICT groupSummary,
+        GLOBAL real* RESTRICT groupMinDistance) {
+    LOCAL int localCount[SUMMARY_BLOCK_SIZE];
+    LOCAL real localMin[SUMMARY_BLOCK_SIZE];
+    for (int group = GROUP_ID; group < NUM_BONDS; group += NUM_GROUPS) {
+        int numComponents = componentCount[group];
+        int count = 0;
+        real minDist = -1;
+        if (numComponents > 1) {
+            for (int member = groupStart[group]+LOCAL_ID; member < groupEnd[group]; member += LOCAL_SIZE) {
+                real r = pairDistance[member];
+                if (r >= 0) {
+                    count++;
+                    minDist = (minDist < 0 || r < minDist ? r : minDist);
+                }
+            }
+        }
+        localCount[LOCAL_ID] = count;
+        localMin[LOCAL_ID] = minDist;
+        SYNC_THREADS;
+        for (int step = LOCAL_SIZE/2; step > 0; step /= 2) {
+            if (LOCAL_ID < step) {
+                localCount[LOCAL_ID] += localCount[LOCAL_ID+step];
+                real other = localMin[LOCAL_ID+step];
+                if (other >= 0 && (localMin[LOCAL_ID] < 0 || other < localMin[LOCAL_ID]))
+                    localMin[LOCAL_ID] = other;
+            }
+            SYNC_THREADS;
+        }
+        if (LOCAL_ID == 0) {
+            groupSummary[group] = make_int2(numComponents, localCount[0]);
+            groupMinDistance[group] = localMin[0];
+        }
+        SYNC_THREADS;
+    }
+}
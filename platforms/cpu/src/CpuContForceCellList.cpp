@@ -0,0 +1,86 @@
+#include "CpuContForceCellList.h"
+#include "openmm/internal/vectorize.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace ContForcePlugin;
+using namespace OpenMM;
+using namespace std;
+
+// The number of particles compared at once.
+
+static const int TILE_SIZE = 4;
+
+ContForceCellList* CpuContForceCellList::clone() const {
+    return new CpuContForceCellList();
+}
+
+void CpuContForceCellList::reserve(int numParticles) {
+    ContForceCellList::reserve(numParticles);
+    x.reserve(numParticles+TILE_SIZE-1);
+    y.reserve(numParticles+TILE_SIZE-1);
+    z.reserve(numParticles+TILE_SIZE-1);
+}
+
+void CpuContForceCellList::findNeighbors(const vector<Vec3>& positions, const ContForcePeriodicBox& box, double cutoff, vector<pair<int, int> >& pairs) {
+    pairs.clear();
+    int numParticles = positions.size();
+    if (numParticles < 2 || cutoff <= 0)
+        return;
+    buildCells(positions, box, cutoff);
+
+    // Store the coordinates relative to the first particle, padded so a full tile can be loaded
+    // starting from any particle.
+
+    Vec3 origin = sortedPositions[0];
+    double extent = 0;
+    x.resize(numParticles+TILE_SIZE-1, 0.0f);
+    y.resize(numParticles+TILE_SIZE-1, 0.0f);
+    z.resize(numParticles+TILE_SIZE-1, 0.0f);
+    for (int i = 0; i < numParticles; i++) {
+        Vec3 pos = sortedPositions[i]-origin;
+        x[i] = (float) pos[0];
+        y[i] = (float) pos[1];
+        z[i] = (float) pos[2];
+        extent = max(extent, max(fabs(pos[0]), max(fabs(pos[1]), fabs(pos[2]))));
+    }
+    if (box.isPeriodic())
+        for (int j = 0; j < 3; j++)
+            for (int k = 0; k < 3; k++)
+                extent += fabs(box.getBoxVector(j)[k]);
+
+    // The single precision test uses a slightly larger cutoff than the real one, so rounding can
+    // never make it reject a pair that is within the cutoff.
+
+    float paddedCutoff = (float) (cutoff+1e-5*(extent+cutoff));
+    fvec4 paddedCutoff2(paddedCutoff*paddedCutoff);
+    double cutoff2 = cutoff*cutoff;
+    for (int k = 0; k < cellPairs.size(); k++) {
+        int cell = cellPairs[k].first;
+        int neighbor = cellPairs[k].second;
+        int end = cellStart[neighbor+1];
+        Vec3 shift = pairShifts[k];
+        bool sameImage = (neighbor == cell && shift == Vec3());
+        for (int i = cellStart[cell]; i < cellStart[cell+1]; i++) {
+            int p1 = sortedParticles[i].second;
+            fvec4 x1((float) (x[i]-shift[0])), y1((float) (y[i]-shift[1])), z1((float) (z[i]-shift[2]));
+            for (int j = (sameImage ? i+1 : cellStart[neighbor]); j < end; j += TILE_SIZE) {
+                fvec4 dx = fvec4(&x[j])-x1;
+                fvec4 dy = fvec4(&y[j])-y1;
+                fvec4 dz = fvec4(&z[j])-z1;
+                fvec4 r2 = dx*dx+dy*dy+dz*dz;
+                if (!any(r2 < paddedCutoff2))
+                    continue;
+                int tileEnd = min(j+TILE_SIZE, end);
+                for (int m = j; m < tileEnd; m++) {
+                    int p2 = sortedParticles[m].second;
+                    if (p1 == p2)
+                        continue;
+                    Vec3 delta = sortedPositions[i]-sortedPositions[m]-shift;
+                    if (delta.dot(delta) < cutoff2)
+                        pairs.push_back(p1 < p2 ? make_pair(p1, p2) : make_pair(p2, p1));
+                }
+            }
+        }
+    }
+}
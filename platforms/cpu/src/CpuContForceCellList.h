@@ -0,0 +1,30 @@
+#ifndef CPU_CONTFORCE_CELLLIST_H_
+#define CPU_CONTFORCE_CELLLIST_H_
+
+#include "internal/ContForceCellList.h"
+#include <vector>
+
+namespace ContForcePlugin {
+
+/**
+ * This is a cell list that compares particles in neighboring cells with SIMD instructions.  The
+ * particles' coordinates are stored in single precision, one array per axis in the order of the
+ * cells, so each particle can be tested against a tile of consecutive particles in the other cell
+ * at once.  Comparing squared distances to the squared cutoff avoids any square roots.  Tiles with
+ * a candidate are then checked in double precision, so the pairs found are exactly the same as
+ * those found by ContForceCellList.
+ */
+
+class CpuContForceCellList : public ContForceCellList {
+public:
+    ContForceCellList* clone() const;
+    void reserve(int numParticles);
+    void findNeighbors(const std::vector<OpenMM::Vec3>& positions, const ContForcePeriodicBox& box, double cutoff,
+                       std::vector<std::pair<int, int> >& pairs);
+private:
+    std::vector<float> x, y, z;
+};
+
+} // namespace ContForcePlugin
+
+#endif /*CPU_CONTFORCE_CELLLIST_H_*/
@@ -0,0 +1,66 @@
+#include "CpuContForceKernels.h"
+#include "CpuContForceCellList.h"
+#include "ContForce.h"
+#include "internal/ContForceCheckpoint.h"
+#include "openmm/OpenMMException.h"
+#include "openmm/internal/ContextImpl.h"
+#include "openmm/reference/RealVec.h"
+#include "openmm/reference/ReferencePlatform.h"
+
+using namespace ContForcePlugin;
+using namespace OpenMM;
+using namespace std;
+
+static vector<RealVec>& extractPositions(ContextImpl& context) {
+    ReferencePlatform::PlatformData* data = reinterpret_cast<ReferencePlatform::PlatformData*>(context.getPlatformData());
+    return *((vector<RealVec>*) data->positions);
+}
+
+static vector<RealVec>& extractForces(ContextImpl& context) {
+    ReferencePlatform::PlatformData* data = reinterpret_cast<ReferencePlatform::PlatformData*>(context.getPlatformData());
+    return *((vector<RealVec>*) data->forces);
+}
+
+static Vec3* extractBoxVectors(ContextImpl& context) {
+    ReferencePlatform::PlatformData* data = reinterpret_cast<ReferencePlatform::PlatformData*>(context.getPlatformData());
+    return (Vec3*) data->periodicBoxVectors;
+}
+
+void CpuCalcContForceKernel::initialize(const System& system, const ContForce& force) {
+    // Spread the groups over the platform's threads, and search for neighbors with vectorized tiles.
+
+    evaluator.initialize(force, data.threads.getNumThreads(), CpuContForceCellList());
+    updateInterval = force.getUpdateInterval();
+}
+
+double CpuCalcContForceKernel::execute(ContextImpl& context, bool includeForces, bool includeEnergy) {
+    vector<RealVec>& pos = extractPositions(context);
+    vector<RealVec>& force = extractForces(context);
+
+    // Decide whether to select new pairs or keep restraining the ones selected earlier.
+
+    long long step = context.getStepCount();
+    bool selectPairs = (updateInterval == 1 || lastSelectionStep < 0 || step < lastSelectionStep || step-lastSelectionStep >= updateInterval);
+    if (selectPairs)
+        lastSelectionStep = step;
+
+    double energy = evaluator.evaluate(pos, extractBoxVectors(context), selectPairs, includeForces, includeEnergy, data.threads, groupForces);
+    for (int i = 0; i < groupForces.size(); i++)
+        force[groupForces[i].first] += groupForces[i].second;
+    return energy;
+}
+
+void CpuCalcContForceKernel::copyParametersToContext(ContextImpl& context, const ContForce& force) {
+    evaluator.updateParameters(force);
+    updateInterval = force.getUpdateInterval();
+}
+
+void CpuCalcContForceKernel::createCheckpoint(ContextImpl& context, ostream& stream) {
+    ContForceCheckpoint::write(stream, lastSelectionStep);
+    evaluator.createCheckpoint(stream);
+}
+
+void CpuCalcContForceKernel::loadCheckpoint(ContextImpl& context, istream& stream) {
+    ContForceCheckpoint::read(stream, lastSelectionStep);
+    evaluator.loadCheckpoint(stream);
+}
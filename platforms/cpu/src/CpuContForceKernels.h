@@ -0,0 +1,82 @@
+#ifndef CPU_CONTFORCE_KERNELS_H_
+#define CPU_CONTFORCE_KERNELS_H_
+
+#include "ContForceKernels.h"
+#include "internal/ContForceEvaluator.h"
+#include "openmm/Platform.h"
+#include "openmm/cpu/CpuPlatform.h"
+#include <vector>
+
+namespace ContForcePlugin {
+
+class CpuCalcContForceKernel : public CalcContForceKernel {
+public:
+    CpuCalcContForceKernel(std::string name, const OpenMM::Platform& platform, OpenMM::CpuPlatform::PlatformData& data) : CalcContForceKernel(name, platform),
+            data(data), updateInterval(1), lastSelectionStep(-1) {
+    }
+    /**
+     * Initialize the kernel.
+     * 
+     * @param system     the System this kernel will be applied to
+     * @param force      the ContForce this kernel will be used for
+     */
+    void initialize(const OpenMM::System& system, const ContForce& force);
+    /**
+     * Execute the kernel to calculate the forces and/or energy.
+     *
+     * @param context        the context in which to execute this kernel
+     * @param includeForces  true if forces should be calculated
+     * @param includeEnergy  true if the energy should be calculated
+     * @return the potential energy due to the force
+     */
+    double execute(OpenMM::ContextImpl& context, bool includeForces, bool includeEnergy);
+    /**
+     * Copy changed parameters over to a context.
+     *
+     * @param context    the context to copy parameters to
+     * @param force      the ContForce to copy the parameters from
+     */
+    void copyParametersToContext(OpenMM::ContextImpl& context, const ContForce& force);
+    /**
+     * Get how many times a group's neighbor list has been reused instead of rebuilt.
+     */
+    long long getNumCacheHits() const {
+        return evaluator.getNumCacheHits();
+    }
+    /**
+     * Get statistics about a group from the last time the force was evaluated.
+     */
+    void getGroupStatistics(int group, int& numComponents, std::vector<int>& particle1, std::vector<int>& particle2,
+                            std::vector<double>& distances) {
+        evaluator.getGroupStatistics(group, numComponents, particle1, particle2, distances);
+    }
+    void getGroupSummaries(std::vector<int>& numComponents, std::vector<int>& numPairs, std::vector<double>& minDistances) {
+        evaluator.getGroupSummaries(numComponents, numPairs, minDistances);
+    }
+    /**
+     * Get the total time in seconds spent in each phase of the calculation.  Nothing is uploaded,
+     * so uploadTime is always 0.
+     */
+    void getPhaseTimes(double& distanceTime, double& labelingTime, double& selectionTime, double& uploadTime) {
+        evaluator.getPhaseTimes(distanceTime, labelingTime, selectionTime);
+        uploadTime = 0.0;
+    }
+    /**
+     * Write the step of the last selection and the state of the evaluator to a checkpoint.
+     */
+    void createCheckpoint(OpenMM::ContextImpl& context, std::ostream& stream);
+    /**
+     * Load the state written to a checkpoint by createCheckpoint().
+     */
+    void loadCheckpoint(OpenMM::ContextImpl& context, std::istream& stream);
+private:
+    OpenMM::CpuPlatform::PlatformData& data;
+    int updateInterval;
+    long long lastSelectionStep;
+    ContForceEvaluator evaluator;
+    std::vector<std::pair<int, OpenMM::Vec3> > groupForces;
+};
+
+} // namespace ContForcePlugin
+
+#endif /*CPU_CONTFORCE_KERNELS_H_*/
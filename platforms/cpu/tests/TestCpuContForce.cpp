@@ -0,0 +1,988 @@
+/**
+ * This tests the CPU implementation of ContForce.
+ */
+
+#include "ContForce.h"
+#include "openmm/internal/AssertionUtilities.h"
+#include "openmm/Context.h"
+#include "openmm/OpenMMException.h"
+#include "openmm/Platform.h"
+#include "openmm/System.h"
+#include "openmm/VerletIntegrator.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+using namespace ContForcePlugin;
+using namespace OpenMM;
+using namespace std;
+
+extern "C" OPENMM_EXPORT void registerContForceCpuKernelFactories();
+
+void testForce() {
+	// Create a system of 10 atoms connected with a continuity force
+
+	const int numParticles = 10;
+	System system;
+	vector<Vec3> positions(numParticles);
+	for (int i = 0; i < numParticles; i++) {
+		system.addParticle(1.0);
+		if (i != 9) {
+		  positions[i] = Vec3(i, 0.7, 0.5);
+		} else {
+		  positions[i] = Vec3(i, 0.7, 2.1);
+		}
+	}
+	ContForce* force = new ContForce();
+	system.addForce(force);
+	vector<int> idxs = {0,1,2,3,4,5,6,7,8,9};
+	force->addBond(idxs, 10, 1.0, 17);
+
+	// Compute the forces and energy.
+
+	VerletIntegrator integ(1.0);
+	Platform& platform = Platform::getPlatformByName("CPU");
+	Context context(system, integ, platform);
+	context.setPositions(positions);
+	State state = context.getState(State::Energy | State::Forces);
+
+	// See if the energy is correct.
+
+	double length = 1.0;
+	double k = 17;
+	Vec3 delta = positions[9]-positions[8];
+	double dr = sqrt(delta.dot(delta))-length;
+	double expectedEnergy = k*dr*dr;
+
+	ASSERT_EQUAL_TOL(expectedEnergy, state.getPotentialEnergy(), 1e-5);
+
+	// Validate the forces by moving each particle along each axis, and see if the energy changes by the correct amount.
+
+	double offset = 1e-3;
+	for (int i = 0; i < numParticles; i++)
+		for (int j = 0; j < 3; j++) {
+			vector<Vec3> offsetPos = positions;
+			offsetPos[i][j] = positions[i][j]-offset;
+			context.setPositions(offsetPos);
+			double e1 = context.getState(State::Energy).getPotentialEnergy();
+			offsetPos[i][j] = positions[i][j]+offset;
+			context.setPositions(offsetPos);
+			double e2 = context.getState(State::Energy).getPotentialEnergy();
+			ASSERT_EQUAL_TOL(state.getForces()[i][j], (e1-e2)/(2*offset), 1e-2);
+		}
+}
+
+void testChangingParameters() {
+	const double k = 1.5;
+	const double length = 0.5;
+	Platform& platform = Platform::getPlatformByName("CPU");
+
+	// Create a system with one bond.
+
+	System system;
+	system.addParticle(1.0);
+	system.addParticle(1.0);
+	ContForce* force = new ContForce();
+	vector<int> idxs = {0,1};
+	force->addBond(idxs, 2, length, k);
+	system.addForce(force);
+	vector<Vec3> positions(2);
+	positions[0] = Vec3(1, 0, 0);
+	positions[1] = Vec3(2, 0, 0);
+
+	// Check the energy.
+
+	VerletIntegrator integ(1.0);
+	Context context(system, integ, platform);
+	context.setPositions(positions);
+	State state = context.getState(State::Energy);
+	ASSERT_EQUAL_TOL(k*pow(1.0-length, 2), state.getPotentialEnergy(), 1e-5);
+
+	// Modify the parameters.
+
+	const double k2 = 2.2;
+	const double length2 = 0.9;
+	force->setBondParameters(0, idxs, 2, length2, k2);
+	force->updateParametersInContext(context);
+	state = context.getState(State::Energy);
+	ASSERT_EQUAL_TOL(k2*pow(1.0-length2, 2), state.getPotentialEnergy(), 1e-5);
+}
+
+void testMultipleBonds() {
+	// Create a system of 10 atoms connected with a continuity force
+
+	const int numParticles = 3;
+	System system;
+	vector<Vec3> positions(numParticles);
+	system.addParticle(1.0);
+	system.addParticle(1.0);
+	system.addParticle(1.0);
+
+	positions[0] = Vec3(0, 0, 0);
+	positions[1] = Vec3(-1, 0, 0);
+	positions[2] = Vec3(1, 0, 0);
+
+	ContForce* force = new ContForce();
+	system.addForce(force);
+	vector<int> idxs1 = {0,1};
+	vector<int> idxs2 = {0,2};
+	force->addBond(idxs1, 2, 0.5, 17);
+	force->addBond(idxs2, 2, 0.5, 17);
+
+	// Compute the forces and energy.
+
+	VerletIntegrator integ(1.0);
+	Platform& platform = Platform::getPlatformByName("CPU");
+	Context context(system, integ, platform);
+	context.setPositions(positions);
+	State state = context.getState(State::Energy | State::Forces);
+
+	// See if the energy is correct.
+
+	double length = 0.5;
+	double k = 17;
+	Vec3 delta1 = positions[1]-positions[0];
+	double dr1 = sqrt(delta1.dot(delta1))-length;
+	double expectedEnergy1 = k*dr1*dr1;
+
+	Vec3 delta2 = positions[2]-positions[0];
+	double dr2 = sqrt(delta2.dot(delta2))-length;
+	double expectedEnergy2 = k*dr2*dr2;
+
+	ASSERT_EQUAL_TOL(expectedEnergy1 + expectedEnergy2, state.getPotentialEnergy(), 1e-5);
+
+	// Force on atom 0 should be zero
+
+	ASSERT_EQUAL_TOL(state.getForces()[0][0], 0.0, 1e-5);
+	ASSERT_EQUAL_TOL(state.getForces()[0][1], 0.0, 1e-5);
+	ASSERT_EQUAL_TOL(state.getForces()[0][2], 0.0, 1e-5);
+
+}
+
+void testMultipleComponents() {
+	// Create three separated fragments, listing the particles out of order
+
+	const int numParticles = 8;
+	System system;
+	vector<Vec3> positions(numParticles);
+	double x[] = {0.0, 0.5, 1.0, 3.0, 3.5, 4.0, 7.0, 7.5};
+	for (int i = 0; i < numParticles; i++) {
+		system.addParticle(1.0);
+		positions[i] = Vec3(x[i], 0, 0);
+	}
+	ContForce* force = new ContForce();
+	system.addForce(force);
+	vector<int> idxs = {6,0,3,7,1,4,2,5};
+	const double length = 1.0;
+	const double k = 17;
+	force->addBond(idxs, numParticles, length, k);
+
+	// Compute the forces and energy.
+
+	VerletIntegrator integ(1.0);
+	Platform& platform = Platform::getPlatformByName("CPU");
+	Context context(system, integ, platform);
+	context.setPositions(positions);
+	State state = context.getState(State::Energy | State::Forces);
+
+	// Particles 2-3 and 5-6 should be restrained, and no others.
+
+	ASSERT_EQUAL_TOL(k*1.0*1.0 + k*2.0*2.0, state.getPotentialEnergy(), 1e-5);
+	vector<Vec3> expectedForces(numParticles);
+	expectedForces[2] = Vec3(2*k, 0, 0);
+	expectedForces[3] = Vec3(-2*k, 0, 0);
+	expectedForces[5] = Vec3(4*k, 0, 0);
+	expectedForces[6] = Vec3(-4*k, 0, 0);
+	for (int i = 0; i < numParticles; i++)
+		ASSERT_EQUAL_VEC(expectedForces[i], state.getForces()[i], 1e-5);
+}
+
+void testLargeGroup() {
+	// Create two slabs of particles on a lattice, separated by a gap along z
+
+	const int nx = 10, ny = 10, nz = 20;
+	const int numParticles = nx*ny*nz;
+	const double spacing = 0.5;
+	const double gap = 2.0;
+	System system;
+	vector<Vec3> positions;
+	vector<int> idxs;
+	for (int i = 0; i < nx; i++)
+		for (int j = 0; j < ny; j++)
+			for (int m = 0; m < nz; m++) {
+				system.addParticle(1.0);
+				double z = spacing*m + (m < nz/2 ? 0.0 : gap-spacing);
+				positions.push_back(Vec3(spacing*i, spacing*j, z));
+				idxs.push_back(idxs.size());
+			}
+	ContForce* force = new ContForce();
+	system.addForce(force);
+	const double length = 1.0;
+	const double k = 17;
+	force->addBond(idxs, numParticles, length, k);
+
+	// Only one pair should be restrained across the gap.
+
+	VerletIntegrator integ(1.0);
+	Platform& platform = Platform::getPlatformByName("CPU");
+	Context context(system, integ, platform);
+	context.setPositions(positions);
+	State state = context.getState(State::Energy | State::Forces);
+	ASSERT_EQUAL_TOL(k*(gap-length)*(gap-length), state.getPotentialEnergy(), 1e-5);
+	Vec3 totalForce;
+	for (int i = 0; i < numParticles; i++)
+		totalForce += state.getForces()[i];
+	ASSERT_EQUAL_VEC(Vec3(0, 0, 0), totalForce, 1e-5);
+}
+
+void testSkinDistance() {
+	// Move the particles a little at a time and check that reusing the neighbor list
+	// gives the same result as rebuilding it every step.
+
+	const int numParticles = 60;
+	System system;
+	vector<Vec3> positions(numParticles);
+	vector<int> idxs;
+	for (int i = 0; i < numParticles; i++) {
+		system.addParticle(1.0);
+		positions[i] = Vec3(0.37*(i%5) + 2.5*(i/20), 0.41*((i/5)%4) + 0.05*(i%3), 0.1*(i%7));
+		idxs.push_back(i);
+	}
+	ContForce* force = new ContForce();
+	force->addBond(idxs, numParticles, 0.5, 17);
+	system.addForce(force);
+	Platform& platform = Platform::getPlatformByName("CPU");
+	VerletIntegrator integ1(1.0);
+	Context context1(system, integ1, platform);
+	force->setSkinDistance(0.2);
+	VerletIntegrator integ2(1.0);
+	Context context2(system, integ2, platform);
+	for (int step = 0; step < 30; step++) {
+		for (int i = 0; i < numParticles; i++)
+			positions[i] += Vec3(0.02*sin(0.7*i+step), 0.02*cos(1.3*i+step), 0.01*sin(2.1*i-step));
+		context1.setPositions(positions);
+		context2.setPositions(positions);
+		State state1 = context1.getState(State::Energy | State::Forces);
+		State state2 = context2.getState(State::Energy | State::Forces);
+		ASSERT_EQUAL_TOL(state1.getPotentialEnergy(), state2.getPotentialEnergy(), 1e-10);
+		for (int i = 0; i < numParticles; i++)
+			ASSERT_EQUAL_VEC(state1.getForces()[i], state2.getForces()[i], 1e-10);
+	}
+	ASSERT_EQUAL(0, force->getNumCacheHits(context1));
+	ASSERT(force->getNumCacheHits(context2) > 0);
+	ASSERT(force->getNumCacheHits(context2) < 30);
+}
+
+void testHierarchicalLabeling() {
+	// Move the particles a little at a time and check that labeling the group with supernodes
+	// gives the same result as checking every pair in the neighbor list.
+
+	const int numParticles = 60;
+	System system;
+	vector<Vec3> positions(numParticles);
+	vector<int> idxs;
+	for (int i = 0; i < numParticles; i++) {
+		system.addParticle(1.0);
+		positions[i] = Vec3(0.37*(i%5) + 2.5*(i/20), 0.41*((i/5)%4) + 0.05*(i%3), 0.1*(i%7));
+		idxs.push_back(i);
+	}
+	ContForce* force = new ContForce();
+	force->addBond(idxs, numParticles, 0.5, 17);
+	force->setSkinDistance(0.2);
+	force->setHierarchicalGroupSize(0);
+	system.addForce(force);
+	Platform& platform = Platform::getPlatformByName("CPU");
+	VerletIntegrator integ1(1.0);
+	Context context1(system, integ1, platform);
+	force->setHierarchicalGroupSize(numParticles);
+	VerletIntegrator integ2(1.0);
+	Context context2(system, integ2, platform);
+	for (int step = 0; step < 30; step++) {
+		for (int i = 0; i < numParticles; i++)
+			positions[i] += Vec3(0.02*sin(0.7*i+step), 0.02*cos(1.3*i+step), 0.01*sin(2.1*i-step));
+		context1.setPositions(positions);
+		context2.setPositions(positions);
+		State state1 = context1.getState(State::Energy | State::Forces);
+		State state2 = context2.getState(State::Energy | State::Forces);
+		ASSERT_EQUAL_TOL(state1.getPotentialEnergy(), state2.getPotentialEnergy(), 1e-5);
+		for (int i = 0; i < numParticles; i++)
+			ASSERT_EQUAL_VEC(state1.getForces()[i], state2.getForces()[i], 1e-5);
+		int numComponents1, numComponents2;
+		vector<int> particle1, particle2, otherParticle1, otherParticle2;
+		vector<double> distances1, distances2;
+		force->getBondStatistics(context1, 0, numComponents1, particle1, particle2, distances1);
+		force->getBondStatistics(context2, 0, numComponents2, otherParticle1, otherParticle2, distances2);
+		ASSERT_EQUAL(numComponents1, numComponents2);
+		ASSERT_EQUAL(particle1.size(), otherParticle1.size());
+		for (int i = 0; i < particle1.size(); i++) {
+			ASSERT_EQUAL(particle1[i], otherParticle1[i]);
+			ASSERT_EQUAL(particle2[i], otherParticle2[i]);
+		}
+	}
+	ASSERT(force->getNumCacheHits(context2) > 0);
+	ASSERT(force->getNumCacheHits(context2) < 30);
+}
+
+void testOverlappingGroups(double skin) {
+	// Create nested groups with different cutoffs, which share their search for neighbors, and check
+	// that they give the same results as evaluating each group on its own.
+
+	const int numParticles = 60;
+	System system;
+	vector<Vec3> positions(numParticles);
+	vector<int> all, first;
+	for (int i = 0; i < numParticles; i++) {
+		system.addParticle(1.0);
+		positions[i] = Vec3(0.37*(i%5) + 2.5*(i/20), 0.41*((i/5)%4) + 0.05*(i%3), 0.1*(i%7));
+		all.push_back(i);
+		if (i < 40)
+			first.push_back(i);
+	}
+	ContForce* force = new ContForce();
+	force->addBond(all, all.size(), 0.5, 17);
+	force->addBond(all, all.size(), 0.42, 5);
+	force->addBond(first, first.size(), 0.5, 11);
+	force->setSkinDistance(skin);
+	system.addForce(force);
+	Platform& platform = Platform::getPlatformByName("CPU");
+	VerletIntegrator integ(1.0);
+	Context context(system, integ, platform);
+	vector<ContForce*> singleForces;
+	vector<System> singleSystems(force->getNumBonds());
+	vector<VerletIntegrator*> singleIntegrators;
+	vector<Context*> singleContexts;
+	for (int bond = 0; bond < force->getNumBonds(); bond++) {
+		vector<int> idxs;
+		int npart;
+		double length, k;
+		force->getBondParameters(bond, idxs, npart, length, k);
+		for (int i = 0; i < numParticles; i++)
+			singleSystems[bond].addParticle(1.0);
+		ContForce* single = new ContForce();
+		single->addBond(idxs, npart, length, k);
+		single->setSkinDistance(skin);
+		singleSystems[bond].addForce(single);
+		singleForces.push_back(single);
+		singleIntegrators.push_back(new VerletIntegrator(1.0));
+		singleContexts.push_back(new Context(singleSystems[bond], *singleIntegrators[bond], platform));
+	}
+	for (int step = 0; step < 30; step++) {
+		for (int i = 0; i < numParticles; i++)
+			positions[i] += Vec3(0.02*sin(0.7*i+step), 0.02*cos(1.3*i+step), 0.01*sin(2.1*i-step));
+		context.setPositions(positions);
+		State state = context.getState(State::Energy | State::Forces);
+		double expectedEnergy = 0;
+		vector<Vec3> expectedForces(numParticles);
+		for (int bond = 0; bond < force->getNumBonds(); bond++) {
+			singleContexts[bond]->setPositions(positions);
+			State singleState = singleContexts[bond]->getState(State::Energy | State::Forces);
+			expectedEnergy += singleState.getPotentialEnergy();
+			for (int i = 0; i < numParticles; i++)
+				expectedForces[i] += singleState.getForces()[i];
+			int numComponents1, numComponents2;
+			vector<int> particle1, particle2, otherParticle1, otherParticle2;
+			vector<double> distances1, distances2;
+			force->getBondStatistics(context, bond, numComponents1, particle1, particle2, distances1);
+			singleForces[bond]->getBondStatistics(*singleContexts[bond], 0, numComponents2, otherParticle1, otherParticle2, distances2);
+			ASSERT_EQUAL(numComponents2, numComponents1);
+			ASSERT_EQUAL(otherParticle1.size(), particle1.size());
+			for (int i = 0; i < particle1.size(); i++) {
+				ASSERT_EQUAL(otherParticle1[i], particle1[i]);
+				ASSERT_EQUAL(otherParticle2[i], particle2[i]);
+			}
+		}
+		ASSERT_EQUAL_TOL(expectedEnergy, state.getPotentialEnergy(), 1e-5);
+		for (int i = 0; i < numParticles; i++)
+			ASSERT_EQUAL_VEC(expectedForces[i], state.getForces()[i], 1e-5);
+	}
+	for (int bond = 0; bond < force->getNumBonds(); bond++) {
+		delete singleContexts[bond];
+		delete singleIntegrators[bond];
+	}
+}
+
+void testReconnecting() {
+	// A connected chain has no energy.  Pulling one end away must be noticed even though the
+	// chain was connected on the previous evaluation.
+
+	const int numParticles = 6;
+	System system;
+	vector<Vec3> positions(numParticles);
+	vector<int> idxs;
+	for (int i = 0; i < numParticles; i++) {
+		system.addParticle(1.0);
+		positions[i] = Vec3(0.8*i, 0.1*(i%2), 0);
+		idxs.push_back(i);
+	}
+	ContForce* force = new ContForce();
+	const double length = 1.0;
+	const double k = 3;
+	force->addBond(idxs, numParticles, length, k);
+	system.addForce(force);
+	VerletIntegrator integ(1.0);
+	Platform& platform = Platform::getPlatformByName("CPU");
+	Context context(system, integ, platform);
+	context.setPositions(positions);
+	ASSERT_EQUAL_TOL(0.0, context.getState(State::Energy).getPotentialEnergy(), 1e-10);
+	positions[5] = Vec3(6.0, 0.1, 0);
+	context.setPositions(positions);
+	double dist = sqrt((positions[5]-positions[4]).dot(positions[5]-positions[4]));
+	ASSERT_EQUAL_TOL(k*(dist-length)*(dist-length), context.getState(State::Energy).getPotentialEnergy(), 1e-10);
+	positions[5] = Vec3(4.0, 0.1, 0);
+	context.setPositions(positions);
+	ASSERT_EQUAL_TOL(0.0, context.getState(State::Energy).getPotentialEnergy(), 1e-10);
+}
+
+void testUpdateInterval() {
+	// Between selections the pair chosen earlier stays restrained, even after the particles
+	// move so another pair is closer and after the parameters are updated.
+
+	System system;
+	vector<Vec3> positions;
+	positions.push_back(Vec3(0, 0, 0));
+	positions.push_back(Vec3(0.5, 0, 0));
+	positions.push_back(Vec3(3, 0, 0));
+	positions.push_back(Vec3(3.5, 0, 0));
+	vector<int> idxs;
+	for (int i = 0; i < positions.size(); i++) {
+		system.addParticle(1.0);
+		idxs.push_back(i);
+	}
+	ContForce* force = new ContForce();
+	const double length = 1.0;
+	double k = 3;
+	force->addBond(idxs, idxs.size(), length, k);
+	force->setUpdateInterval(5);
+	system.addForce(force);
+	VerletIntegrator integ(1.0);
+	Platform& platform = Platform::getPlatformByName("CPU");
+	Context context(system, integ, platform);
+	context.setPositions(positions);
+	ASSERT_EQUAL_TOL(k*1.5*1.5, context.getState(State::Energy).getPotentialEnergy(), 1e-10);
+	positions[3] = Vec3(2.2, 0, 0);
+	context.setPositions(positions);
+	ASSERT_EQUAL_TOL(k*1.5*1.5, context.getState(State::Energy).getPotentialEnergy(), 1e-10);
+	k = 4;
+	force->setBondParameters(0, idxs, idxs.size(), length, k);
+	force->updateParametersInContext(context);
+	context.setStepCount(4);
+	State state = context.getState(State::Energy | State::Forces);
+	ASSERT_EQUAL_TOL(k*1.5*1.5, state.getPotentialEnergy(), 1e-10);
+	ASSERT_EQUAL_VEC(Vec3(2*k*1.5, 0, 0), state.getForces()[1], 1e-10);
+	ASSERT_EQUAL_VEC(Vec3(-2*k*1.5, 0, 0), state.getForces()[2], 1e-10);
+	context.setStepCount(5);
+	ASSERT_EQUAL_TOL(k*0.7*0.7, context.getState(State::Energy).getPotentialEnergy(), 1e-10);
+}
+
+void testChangingMembers() {
+	// Particles can be added to and removed from bonds in an existing Context.  The bonds whose
+	// particles change have their pairs selected again right away, even between selections, while
+	// the others keep the pairs selected earlier.
+
+	System system;
+	vector<Vec3> positions;
+	positions.push_back(Vec3(0, 0, 0));
+	positions.push_back(Vec3(0.5, 0, 0));
+	positions.push_back(Vec3(3, 0, 0));
+	positions.push_back(Vec3(3.5, 0, 0));
+	positions.push_back(Vec3(0, 10, 0));
+	positions.push_back(Vec3(0.5, 10, 0));
+	positions.push_back(Vec3(3, 10, 0));
+	for (int i = 0; i < positions.size(); i++)
+		system.addParticle(1.0);
+	ContForce* force = new ContForce();
+	const double length = 1.0;
+	const double k = 3;
+	vector<int> idxs1 = {0,1,2,3};
+	vector<int> idxs2 = {4,5};
+	force->addBond(idxs1, idxs1.size(), length, k);
+	force->addBond(idxs2, idxs2.size(), length, k);
+	force->setUpdateInterval(5);
+	system.addForce(force);
+	VerletIntegrator integ(1.0);
+	Platform& platform = Platform::getPlatformByName("CPU");
+	Context context(system, integ, platform);
+	context.setPositions(positions);
+	ASSERT_EQUAL_TOL(k*1.5*1.5, context.getState(State::Energy).getPotentialEnergy(), 1e-10);
+
+	// Add a particle to the second bond and move one in the first.  Only the second bond's pairs
+	// are selected again.
+
+	positions[3] = Vec3(2.2, 0, 0);
+	context.setPositions(positions);
+	idxs2.push_back(6);
+	force->setBondParameters(1, idxs2, idxs2.size(), length, k);
+	force->updateParametersInContext(context);
+	context.setStepCount(1);
+	State state = context.getState(State::Energy | State::Forces);
+	ASSERT_EQUAL_TOL(2*k*1.5*1.5, state.getPotentialEnergy(), 1e-10);
+	ASSERT_EQUAL_VEC(Vec3(2*k*1.5, 0, 0), state.getForces()[1], 1e-10);
+	ASSERT_EQUAL_VEC(Vec3(-2*k*1.5, 0, 0), state.getForces()[2], 1e-10);
+	ASSERT_EQUAL_VEC(Vec3(2*k*1.5, 0, 0), state.getForces()[5], 1e-10);
+	ASSERT_EQUAL_VEC(Vec3(-2*k*1.5, 0, 0), state.getForces()[6], 1e-10);
+	int numComponents;
+	vector<int> particle1, particle2;
+	vector<double> distances;
+	force->getBondStatistics(context, 1, numComponents, particle1, particle2, distances);
+	ASSERT_EQUAL(2, numComponents);
+	ASSERT_EQUAL(1, particle1.size());
+
+	// Remove particles from both bonds.  The results should match a new Context.
+
+	idxs1 = {0,1,3};
+	idxs2.pop_back();
+	force->setBondParameters(0, idxs1, idxs1.size(), length, k);
+	force->setBondParameters(1, idxs2, idxs2.size(), length, k);
+	force->updateParametersInContext(context);
+	context.setStepCount(2);
+	state = context.getState(State::Energy | State::Forces);
+	ASSERT_EQUAL_TOL(k*0.7*0.7, state.getPotentialEnergy(), 1e-10);
+	VerletIntegrator integ2(1.0);
+	Context context2(system, integ2, platform);
+	context2.setPositions(positions);
+	State state2 = context2.getState(State::Energy | State::Forces);
+	ASSERT_EQUAL_TOL(state2.getPotentialEnergy(), state.getPotentialEnergy(), 1e-10);
+	for (int i = 0; i < positions.size(); i++)
+		ASSERT_EQUAL_VEC(state2.getForces()[i], state.getForces()[i], 1e-10);
+
+}
+
+void testManyGroups() {
+	// Many groups of different sizes, each made of two separated rows of particles.  The groups
+	// are evaluated in parallel, so this checks that their results are combined correctly.
+
+	const int numGroups = 40;
+	const double length = 1.0;
+	const double k = 2.5;
+	System system;
+	vector<Vec3> positions;
+	ContForce* force = new ContForce();
+	double expectedEnergy = 0;
+	vector<Vec3> expectedForces;
+	for (int g = 0; g < numGroups; g++) {
+		int rowSize = 1+(g*7)%11;
+		double gap = length+0.02*(g+1);
+		vector<int> idxs;
+		for (int i = 0; i < 2*rowSize; i++) {
+			idxs.push_back(system.addParticle(1.0));
+			double x = (i < rowSize ? 0.5*i : 0.5*(rowSize-1)+gap+0.5*(i-rowSize));
+			positions.push_back(Vec3(x, 3.0*g, 0));
+			expectedForces.push_back(Vec3());
+		}
+		force->addBond(idxs, idxs.size(), length, k);
+		expectedEnergy += k*(gap-length)*(gap-length);
+		expectedForces[idxs[rowSize-1]] = Vec3(2*k*(gap-length), 0, 0);
+		expectedForces[idxs[rowSize]] = Vec3(-2*k*(gap-length), 0, 0);
+	}
+	system.addForce(force);
+	VerletIntegrator integ(1.0);
+	Platform& platform = Platform::getPlatformByName("CPU");
+	Context context(system, integ, platform);
+	context.setPositions(positions);
+	State state = context.getState(State::Energy | State::Forces);
+	ASSERT_EQUAL_TOL(expectedEnergy, state.getPotentialEnergy(), 1e-10);
+	for (int i = 0; i < positions.size(); i++)
+		ASSERT_EQUAL_VEC(expectedForces[i], state.getForces()[i], 1e-10);
+}
+
+void testReproducibility() {
+	// Many groups share particles and are evaluated in parallel.  Their results are combined in the
+	// order of the groups, so every Context gives exactly the same energy and forces.
+
+	const int numParticles = 300;
+	const int numGroups = 60;
+	System system;
+	vector<Vec3> positions;
+	for (int i = 0; i < numParticles; i++) {
+		system.addParticle(1.0);
+		positions.push_back(Vec3(0.37*i+0.1*sin(1.7*i), 2.0*sin(0.91*i), 2.0*cos(1.33*i)));
+	}
+	ContForce* force = new ContForce();
+	for (int g = 0; g < numGroups; g++) {
+		vector<int> idxs;
+		for (int i = g%7; i < numParticles; i += 1+g%5)
+			idxs.push_back(i);
+		force->addBond(idxs, idxs.size(), 0.8+0.01*g, 1.0+0.1*g);
+	}
+	system.addForce(force);
+	Platform& platform = Platform::getPlatformByName("CPU");
+	VerletIntegrator integ1(1.0);
+	Context context1(system, integ1, platform);
+	context1.setPositions(positions);
+	State state1 = context1.getState(State::Energy | State::Forces);
+	ASSERT(state1.getPotentialEnergy() > 0);
+	for (int attempt = 0; attempt < 5; attempt++) {
+		VerletIntegrator integ2(1.0);
+		Context context2(system, integ2, platform);
+		context2.setPositions(positions);
+		State state2 = context2.getState(State::Energy | State::Forces);
+		ASSERT(state1.getPotentialEnergy() == state2.getPotentialEnergy());
+		for (int i = 0; i < numParticles; i++)
+			ASSERT(state1.getForces()[i] == state2.getForces()[i]);
+	}
+}
+
+void testCutoffPrecision() {
+	// Far from the origin, pairs just inside and just outside the cutoff must still be told
+	// apart exactly, even though neighbors are found with single precision tiles.
+
+	const int numParticles = 9;
+	const double length = 0.5;
+	const double k = 17;
+	System system;
+	vector<Vec3> positions(numParticles);
+	vector<int> idxs;
+	for (int i = 0; i < numParticles; i++) {
+		system.addParticle(1.0);
+		positions[i] = Vec3(1000+i*(length-1e-9), 500, -200);
+		idxs.push_back(i);
+	}
+	ContForce* force = new ContForce();
+	force->addBond(idxs, numParticles, length, k);
+	system.addForce(force);
+	VerletIntegrator integ(1.0);
+	Platform& platform = Platform::getPlatformByName("CPU");
+	Context context(system, integ, platform);
+	context.setPositions(positions);
+	ASSERT_EQUAL(0.0, context.getState(State::Energy).getPotentialEnergy());
+	positions[numParticles-1][0] = positions[numParticles-2][0]+length+1e-6;
+	context.setPositions(positions);
+	State state = context.getState(State::Forces);
+	ASSERT(state.getForces()[numParticles-1][0] < 0);
+	ASSERT(state.getForces()[numParticles-2][0] > 0);
+}
+
+void testRepeatedEvaluation() {
+	// Evaluating the force again at the same positions, with energy and forces requested separately,
+	// gives the same results as evaluating it once.  Moving a particle gives new ones.
+
+	System system;
+	vector<Vec3> positions;
+	positions.push_back(Vec3(0, 0, 0));
+	positions.push_back(Vec3(0.5, 0, 0));
+	positions.push_back(Vec3(3, 0, 0));
+	positions.push_back(Vec3(3.5, 0, 0));
+	vector<int> idxs;
+	for (int i = 0; i < positions.size(); i++) {
+		system.addParticle(1.0);
+		idxs.push_back(i);
+	}
+	ContForce* force = new ContForce();
+	const double length = 1.0;
+	const double k = 3;
+	force->addBond(idxs, idxs.size(), length, k);
+	system.addForce(force);
+	VerletIntegrator integ(1.0);
+	Platform& platform = Platform::getPlatformByName("CPU");
+	Context context(system, integ, platform);
+	context.setPositions(positions);
+	for (int i = 0; i < 2; i++)
+		ASSERT_EQUAL_TOL(k*1.5*1.5, context.getState(State::Energy).getPotentialEnergy(), 1e-10);
+	for (int i = 0; i < 2; i++) {
+		State state = context.getState(State::Forces);
+		ASSERT_EQUAL_VEC(Vec3(2*k*1.5, 0, 0), state.getForces()[1], 1e-10);
+		ASSERT_EQUAL_VEC(Vec3(-2*k*1.5, 0, 0), state.getForces()[2], 1e-10);
+	}
+	positions[3] = Vec3(2.2, 0, 0);
+	context.setPositions(positions);
+	State state = context.getState(State::Energy | State::Forces);
+	ASSERT_EQUAL_TOL(k*0.7*0.7, state.getPotentialEnergy(), 1e-10);
+	ASSERT_EQUAL_VEC(Vec3(2*k*0.7, 0, 0), state.getForces()[1], 1e-10);
+	ASSERT_EQUAL_VEC(Vec3(0, 0, 0), state.getForces()[2], 1e-10);
+	ASSERT_EQUAL_VEC(Vec3(-2*k*0.7, 0, 0), state.getForces()[3], 1e-10);
+	force->setBondParameters(0, idxs, idxs.size(), length, 2*k);
+	force->updateParametersInContext(context);
+	ASSERT_EQUAL_TOL(2*k*0.7*0.7, context.getState(State::Energy).getPotentialEnergy(), 1e-10);
+}
+
+void testStatistics() {
+	// Create three separated fragments in one bond, and a connected pair in another.
+
+	const int numParticles = 8;
+	System system;
+	vector<Vec3> positions(numParticles);
+	double x[] = {0.0, 0.5, 1.0, 3.0, 3.5, 4.0, 7.0, 7.5};
+	for (int i = 0; i < numParticles; i++) {
+		system.addParticle(1.0);
+		positions[i] = Vec3(x[i], 0, 0);
+	}
+	ContForce* force = new ContForce();
+	system.addForce(force);
+	vector<int> idxs1 = {6,0,3,7,1,4,2,5};
+	vector<int> idxs2 = {0,1};
+	force->addBond(idxs1, idxs1.size(), 1.0, 17);
+	force->addBond(idxs2, idxs2.size(), 1.0, 17);
+	VerletIntegrator integ(1.0);
+	Platform& platform = Platform::getPlatformByName("CPU");
+	Context context(system, integ, platform);
+	int numComponents;
+	vector<int> particle1, particle2;
+	vector<double> distances;
+	force->getBondStatistics(context, 0, numComponents, particle1, particle2, distances);
+	ASSERT_EQUAL(0, numComponents);
+	ASSERT_EQUAL(0, particle1.size());
+	vector<int> bondComponents, numPairs;
+	vector<double> minDistances;
+	force->getBondSummaries(context, bondComponents, numPairs, minDistances);
+	ASSERT_EQUAL(2, bondComponents.size());
+	ASSERT_EQUAL(0, bondComponents[0]);
+	ASSERT_EQUAL(0, numPairs[0]);
+	ASSERT_EQUAL(-1.0, minDistances[0]);
+
+	// Once the force has been evaluated, the first bond should have three components restrained by
+	// the pairs 2-3 and 5-6.
+
+	context.setPositions(positions);
+	context.getState(State::Energy);
+	force->getBondStatistics(context, 0, numComponents, particle1, particle2, distances);
+	ASSERT_EQUAL(3, numComponents);
+	ASSERT_EQUAL(2, particle1.size());
+	ASSERT_EQUAL(2, particle2.size());
+	ASSERT_EQUAL(2, distances.size());
+	int first = (particle1[0]+particle2[0] == 5 ? 0 : 1);
+	ASSERT_EQUAL(2, min(particle1[first], particle2[first]));
+	ASSERT_EQUAL(3, max(particle1[first], particle2[first]));
+	ASSERT_EQUAL_TOL(2.0, distances[first], 1e-5);
+	ASSERT_EQUAL(5, min(particle1[1-first], particle2[1-first]));
+	ASSERT_EQUAL(6, max(particle1[1-first], particle2[1-first]));
+	ASSERT_EQUAL_TOL(3.0, distances[1-first], 1e-5);
+	force->getBondStatistics(context, 1, numComponents, particle1, particle2, distances);
+	ASSERT_EQUAL(1, numComponents);
+	ASSERT_EQUAL(0, particle1.size());
+	ASSERT_EQUAL(0, distances.size());
+
+	// The summaries should agree with the statistics.
+
+	force->getBondSummaries(context, bondComponents, numPairs, minDistances);
+	ASSERT_EQUAL(2, bondComponents.size());
+	ASSERT_EQUAL(2, numPairs.size());
+	ASSERT_EQUAL(2, minDistances.size());
+	ASSERT_EQUAL(3, bondComponents[0]);
+	ASSERT_EQUAL(2, numPairs[0]);
+	ASSERT_EQUAL_TOL(2.0, minDistances[0], 1e-5);
+	ASSERT_EQUAL(1, bondComponents[1]);
+	ASSERT_EQUAL(0, numPairs[1]);
+	ASSERT_EQUAL(-1.0, minDistances[1]);
+
+	// Moving a fragment closer should change the distance.
+
+	positions[6] = Vec3(5.5, 0, 0);
+	positions[7] = Vec3(6.0, 0, 0);
+	context.setPositions(positions);
+	context.getState(State::Forces);
+	force->getBondStatistics(context, 0, numComponents, particle1, particle2, distances);
+	ASSERT_EQUAL(3, numComponents);
+	ASSERT_EQUAL(2, distances.size());
+	first = (particle1[0]+particle2[0] == 5 ? 0 : 1);
+	ASSERT_EQUAL(11, particle1[1-first]+particle2[1-first]);
+	ASSERT_EQUAL_TOL(1.5, distances[1-first], 1e-5);
+	force->getBondSummaries(context, bondComponents, numPairs, minDistances);
+	ASSERT_EQUAL(3, bondComponents[0]);
+	ASSERT_EQUAL(2, numPairs[0]);
+	ASSERT_EQUAL_TOL(1.5, minDistances[0], 1e-5);
+	double distanceTime, labelingTime, selectionTime, uploadTime;
+	force->getPhaseTimes(context, distanceTime, labelingTime, selectionTime, uploadTime);
+	ASSERT(distanceTime >= 0.0);
+	ASSERT(labelingTime >= 0.0);
+	ASSERT(selectionTime >= 0.0);
+	ASSERT(uploadTime >= 0.0);
+}
+
+void testPeriodic(bool triclinic) {
+	// Build three fragments that fit well inside half the box, so every separation is its own nearest
+	// image, and find the energy and forces without periodic boundary conditions.
+
+	Vec3 a(5, 0, 0), b(0, 5, 0), c(0, 0, 5);
+	if (triclinic) {
+		b = Vec3(1, 5, 0);
+		c = Vec3(-1.5, 1, 5);
+	}
+	const double length = 0.5;
+	const double k = 4;
+	vector<Vec3> positions;
+	for (int fragment = 0; fragment < 3; fragment++)
+		for (int i = 0; i < 8; i++)
+			positions.push_back(Vec3(0.8*fragment+0.3*(i%2), 0.3*((i/2)%2), 0.5*fragment+0.3*(i/4)));
+
+	// Jitter the particles so no two pairs are equally close.
+
+	for (int i = 0; i < positions.size(); i++)
+		positions[i] += Vec3(0.02*sin(1.3*i), 0.02*sin(2.1*i+1), 0.02*sin(0.7*i+2));
+	int numParticles = positions.size();
+	vector<int> idxs;
+	for (int i = numParticles-1; i >= 0; i--)
+		idxs.push_back(i);
+	System system;
+	for (int i = 0; i < numParticles; i++)
+		system.addParticle(1.0);
+	system.setDefaultPeriodicBoxVectors(a, b, c);
+	ContForce* force = new ContForce();
+	force->addBond(idxs, numParticles, length, k);
+	system.addForce(force);
+	Platform& platform = Platform::getPlatformByName("CPU");
+	VerletIntegrator integ1(1.0);
+	Context context1(system, integ1, platform);
+	context1.setPositions(positions);
+	State state1 = context1.getState(State::Energy | State::Forces);
+	ASSERT(state1.getPotentialEnergy() > 0);
+
+	// Move every particle to a different periodic image, which splits the fragments across the faces
+	// of the box.  With periodic boundary conditions the results should not change.
+
+	vector<Vec3> shifted(numParticles);
+	for (int i = 0; i < numParticles; i++)
+		shifted[i] = positions[i]+a*((i%3)-1)+b*(((i/3)%3)-1)+c*(2*(i%2)-1);
+	force->setUsesPeriodicBoundaryConditions(true);
+	VerletIntegrator integ2(1.0);
+	Context context2(system, integ2, platform);
+	context2.setPositions(shifted);
+	State state2 = context2.getState(State::Energy | State::Forces);
+	ASSERT_EQUAL_TOL(state1.getPotentialEnergy(), state2.getPotentialEnergy(), 1e-5);
+	for (int i = 0; i < numParticles; i++)
+		ASSERT_EQUAL_VEC(state1.getForces()[i], state2.getForces()[i], 1e-5);
+
+	// A box less than twice the cutoff is an error.
+
+	context2.setPeriodicBoxVectors(Vec3(0.9, 0, 0), Vec3(0, 5, 0), Vec3(0, 0, 5));
+	bool thrown = false;
+	try {
+		context2.getState(State::Energy);
+	}
+	catch (const OpenMMException& e) {
+		thrown = true;
+	}
+	ASSERT(thrown);
+
+	// With a skin distance, the box must be at least twice the cutoff plus the skin, since the neighbor
+	// lists are built with that distance.
+
+	force->setSkinDistance(0.3);
+	force->updateParametersInContext(context2);
+	context2.setPeriodicBoxVectors(Vec3(1.59, 0, 0), Vec3(0, 5, 0), Vec3(0, 0, 5));
+	thrown = false;
+	try {
+		context2.getState(State::Energy);
+	}
+	catch (const OpenMMException& e) {
+		thrown = true;
+	}
+	ASSERT(thrown);
+	context2.setPeriodicBoxVectors(Vec3(1.61, 0, 0), Vec3(0, 5, 0), Vec3(0, 0, 5));
+	context2.getState(State::Energy);
+}
+
+void testCheckpoint() {
+	// A Context loaded from a checkpoint, along with the state of the force, keeps restraining the pair
+	// selected before the checkpoint was created until the next selection, just like the Context it was
+	// created from.
+
+	System system;
+	vector<Vec3> positions;
+	positions.push_back(Vec3(0, 0, 0));
+	positions.push_back(Vec3(0.5, 0, 0));
+	positions.push_back(Vec3(3, 0, 0));
+	positions.push_back(Vec3(3.5, 0, 0));
+	vector<int> idxs;
+	for (int i = 0; i < positions.size(); i++) {
+		system.addParticle(1.0);
+		idxs.push_back(i);
+	}
+	ContForce* force = new ContForce();
+	const double length = 1.0;
+	const double k = 3;
+	force->addBond(idxs, idxs.size(), length, k);
+	force->setUpdateInterval(5);
+	system.addForce(force);
+	VerletIntegrator integ1(1.0), integ2(1.0), integ3(1.0);
+	Platform& platform = Platform::getPlatformByName("CPU");
+	Context context1(system, integ1, platform);
+	context1.setPositions(positions);
+	context1.getState(State::Energy);
+	stringstream checkpoint;
+	context1.createCheckpoint(checkpoint);
+	force->createCheckpoint(context1, checkpoint);
+	positions[2] = Vec3(3.1, 0, 0);
+	positions[3] = Vec3(2.2, 0, 0);
+	context1.setPositions(positions);
+	State state1 = context1.getState(State::Energy | State::Forces);
+	ASSERT_EQUAL_TOL(k*1.6*1.6, state1.getPotentialEnergy(), 1e-5);
+	Context context2(system, integ2, platform);
+	context2.loadCheckpoint(checkpoint);
+	force->loadCheckpoint(context2, checkpoint);
+	context2.setPositions(positions);
+	State state2 = context2.getState(State::Energy | State::Forces);
+	ASSERT_EQUAL_TOL(state1.getPotentialEnergy(), state2.getPotentialEnergy(), 1e-5);
+	for (int i = 0; i < positions.size(); i++)
+		ASSERT_EQUAL_VEC(state1.getForces()[i], state2.getForces()[i], 1e-5);
+	int numComponents;
+	vector<int> particle1, particle2;
+	vector<double> distances;
+	force->getBondStatistics(context2, 0, numComponents, particle1, particle2, distances);
+	ASSERT_EQUAL(2, numComponents);
+	ASSERT_EQUAL(1, particle1.size());
+	ASSERT_EQUAL(1, min(particle1[0], particle2[0]));
+	ASSERT_EQUAL(2, max(particle1[0], particle2[0]));
+
+	// Without the checkpoint the closer pair is selected.
+
+	Context context3(system, integ3, platform);
+	context3.setPositions(positions);
+	ASSERT_EQUAL_TOL(k*0.7*0.7, context3.getState(State::Energy).getPotentialEnergy(), 1e-5);
+
+	// A checkpoint cannot be loaded into a Context whose force has different bonds.
+
+	System system2;
+	for (int i = 0; i < positions.size(); i++)
+		system2.addParticle(1.0);
+	ContForce* force2 = new ContForce();
+	force2->addBond({0, 1}, 2, length, k);
+	force2->addBond({2, 3}, 2, length, k);
+	system2.addForce(force2);
+	VerletIntegrator integ4(1.0);
+	Context context4(system2, integ4, platform);
+	checkpoint.clear();
+	checkpoint.seekg(0);
+	bool thrown = false;
+	try {
+		context4.loadCheckpoint(checkpoint);
+		force2->loadCheckpoint(context4, checkpoint);
+	}
+	catch (const OpenMMException& e) {
+		thrown = true;
+	}
+	ASSERT(thrown);
+}
+
+int main() {
+	try {
+		registerContForceCpuKernelFactories();
+		testForce();
+		testChangingParameters();
+		testMultipleBonds();
+		testMultipleComponents();
+		testLargeGroup();
+		testSkinDistance();
+		testHierarchicalLabeling();
+		testOverlappingGroups(0.0);
+		testOverlappingGroups(0.1);
+		testReconnecting();
+		testUpdateInterval();
+		testChangingMembers();
+		testManyGroups();
+		testReproducibility();
+		testRepeatedEvaluation();
+		testStatistics();
+		testPeriodic(false);
+		testPeriodic(true);
+		testCutoffPrecision();
+		testCheckpoint();
+	}
+	catch(const std::exception& e) {
+		std::cout << "exception: " << e.what() << std::endl;
+		return 1;
+	}
+	std::cout << "Done" << std::endl;
+	return 0;
+}
@@ -65,8 +65,15 @@ extern "C" OPENMM_EXPORT void registerContForceCudaKernelFactories() {
 }
 
 KernelImpl* CudaContForceKernelFactory::createKernelImpl(std::string name, const Platform& platform, ContextImpl& context) const {
-    CudaContext& cu = *static_cast<CudaPlatform::PlatformData*>(context.getPlatformData())->contexts[0];
+    CudaPlatform::PlatformData& data = *static_cast<CudaPlatform::PlatformData*>(context.getPlatformData());
+    if (data.contexts.size() > 1) {
+	  // The groups are divided between the devices.
+
+	  if (name == CalcContForceKernel::Name())
+		return new CudaParallelCalcContForceKernel(name, platform, data, context);
+    }
+    CudaContext& cu = *data.contexts[0];
     if (name == CalcContForceKernel::Name())
-	  return new CudaCalcContForceKernel(name, platform, cu);
+	  return new CudaCalcContForceKernel(name, platform, cu, context);
     throw OpenMMException((std::string("Tried to create kernel with illegal kernel name '")+name+"'").c_str());
 }
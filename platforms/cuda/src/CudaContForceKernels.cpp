@@ -31,49 +31,80 @@
 
 #include "CudaContForceKernels.h"
 #include "CudaContForceKernelSources.h"
+#include "internal/ContForceCheckpoint.h"
+#include "internal/ContForceProfiler.h"
+#include "openmm/NonbondedForce.h"
+#include "openmm/OpenMMException.h"
+#include "openmm/cuda/CudaNonbondedUtilities.h"
 #include "openmm/internal/ContextImpl.h"
 #include "openmm/internal/ThreadPool.h"
 #include "openmm/reference/RealVec.h"
 #include <map>
 #include <cuda_runtime_api.h>
+#include <vector_functions.h>
 #include<algorithm>
+#include <chrono>
+#include <cmath>
 #include <cstring>
 using namespace ContForcePlugin;
 using namespace OpenMM;
 using namespace std;
 
+// Groups with at most this many members are processed by one warp each, with a kernel specialized for
+// the size.  Larger groups are processed by kernels that spread every group over the whole device.
 
+const int CudaCalcContForceKernel::SMALL_GROUP_SIZES[NUM_SIZE_BUCKETS] = {32, 64};
+const int CudaCalcContForceKernel::SMALL_GROUP_BLOCK_SIZE = 128;
+const int CudaCalcContForceKernel::SUMMARY_BLOCK_SIZE = 128;
+const int CudaCalcContForceKernel::CELL_SCAN_BLOCK_SIZE = 512;
 
 
+/**
+ * Convert a force component to the 64 bit fixed point format of the force buffer.
+ */
+static long long toFixedPoint(double value) {
+	return (long long) (value*0x100000000);
+}
+
+/**
+ * Write the contents of an array to a checkpoint.
+ */
+static void writeArray(ostream& stream, CudaArray& array) {
+	vector<char> data(array.getSize()*array.getElementSize());
+	if (data.size() > 0)
+		array.download(&data[0]);
+	ContForceCheckpoint::write(stream, data);
+}
+
+/**
+ * Read the contents of an array written by writeArray().
+ */
+static void readArray(istream& stream, CudaArray& array) {
+	vector<char> data;
+	ContForceCheckpoint::read(stream, data);
+	if (data.size() != array.getSize()*array.getElementSize())
+		throw OpenMMException("ContForce: the checkpoint was created for a different force");
+	if (data.size() > 0)
+		array.upload(&data[0]);
+}
 
 class CudaCalcContForceKernel::CopyForcesTask : public ThreadPool::Task {
 public:
   CopyForcesTask(CudaContext& cu, vector<Vec3>& forces) : cu(cu), forces(forces) {
   }
   void execute(ThreadPool& threads, int threadIndex) {
-	// Copy the forces applied by PLUMED to a buffer for uploading.  This is done in parallel for speed.
+	// Convert the forces to fixed point in a buffer for uploading.  This is done in parallel for speed.
 
 	int numParticles = cu.getNumAtoms();
 	int numThreads = threads.getNumThreads();
 	int start = threadIndex*numParticles/numThreads;
 	int end = (threadIndex+1)*numParticles/numThreads;
-	if (cu.getUseDoublePrecision()) {
-	  double* buffer = (double*) cu.getPinnedBuffer();
-	  for (int i = start; i < end; ++i) {
-		const Vec3& p = forces[i];
-		buffer[3*i] = p[0];
-		buffer[3*i+1] = p[1];
-		buffer[3*i+2] = p[2];
-	  }
-	}
-	else {
-	  float* buffer = (float*) cu.getPinnedBuffer();
-	  for (int i = start; i < end; ++i) {
-		const Vec3& p = forces[i];
-		buffer[3*i] = (float) p[0];
-		buffer[3*i+1] = (float) p[1];
-		buffer[3*i+2] = (float) p[2];
-	  }
+	long long* buffer = (long long*) cu.getPinnedBuffer();
+	for (int i = start; i < end; ++i) {
+	  const Vec3& p = forces[i];
+	  buffer[3*i] = toFixedPoint(p[0]);
+	  buffer[3*i+1] = toFixedPoint(p[1]);
+	  buffer[3*i+2] = toFixedPoint(p[2]);
 	}
   }
   CudaContext& cu;
@@ -83,178 +114,1447 @@ public:
 
 
 
+class CudaCalcContForceKernel::StartCalculationPreComputation : public CudaContext::ForcePreComputation {
+public:
+  StartCalculationPreComputation(CudaCalcContForceKernel& owner) : owner(owner) {
+  }
+  void computeForceAndEnergy(bool includeForces, bool includeEnergy, int groups) {
+	owner.beginComputation(includeForces, includeEnergy, groups);
+  }
+  CudaCalcContForceKernel& owner;
+};
+
+class CudaCalcContForceKernel::ExecuteTask : public CudaContext::WorkTask {
+public:
+  ExecuteTask(CudaCalcContForceKernel& owner) : owner(owner) {
+  }
+  void execute() {
+	owner.executeOnWorkerThread();
+  }
+  CudaCalcContForceKernel& owner;
+};
+
+class CudaCalcContForceKernel::SelectPairsTask : public CudaContext::WorkTask {
+public:
+  SelectPairsTask(CudaCalcContForceKernel& owner) : owner(owner) {
+  }
+  void execute() {
+	owner.selectPairsOnWorkerThread();
+  }
+  CudaCalcContForceKernel& owner;
+};
+
+class CudaCalcContForceKernel::AddForcesPostComputation : public CudaContext::ForcePostComputation {
+public:
+  AddForcesPostComputation(CudaCalcContForceKernel& owner) : owner(owner) {
+  }
+  double computeForceAndEnergy(bool includeForces, bool includeEnergy, int groups) {
+	return owner.finishComputation(includeForces, includeEnergy, groups);
+  }
+  CudaCalcContForceKernel& owner;
+};
+
+class CudaCalcContForceKernel::ReorderListener : public CudaContext::ReorderListener {
+public:
+  ReorderListener(CudaCalcContForceKernel& owner) : owner(owner) {
+  }
+  void execute() {
+	owner.hasSortedIndices = false;
+  }
+private:
+  CudaCalcContForceKernel& owner;
+};
+
 CudaCalcContForceKernel::~CudaCalcContForceKernel() {
+	cu.setAsCurrent();
+	if (hasInitializedKernel) {
+		cuStreamDestroy(stream);
+		cuEventDestroy(syncEvent);
+	}
+	if (contForces != NULL)
+		delete contForces;
+	if (sparseForces != NULL) {
+		delete sparseForces;
+		delete sparseAtoms;
+	}
+	if (usePipelinedSelection) {
+		delete pairAtoms;
+		delete pairGroup;
+		if (pairCellOffset != NULL)
+			delete pairCellOffset;
+		delete groupParams;
+		delete selectionThreads;
+		cuMemFreeHost(pinnedPositions);
+		for (int i = 0; i < 2; i++) {
+			cuMemFreeHost(pinnedPairs[i]);
+			cuEventDestroy(pairsEvent[i]);
+		}
+		cuEventDestroy(positionsEvent);
+	}
+	if (deviceThreads != NULL)
+		delete deviceThreads;
+	if (sortedIndex != NULL) {
+		deleteDeviceArrays();
+		for (int i = 0; i < NUM_TIMING_SLOTS; i++)
+			for (int j = 0; j < 3; j++)
+				cuEventDestroy(timingEvents[i][j]);
+	}
 }
 
-/**
- * @brief
- *
- * @param system
- * @param force
- * @param nnModule
- */
 void CudaCalcContForceKernel::initialize(const System& system, const ContForce& force) {
+	// With several devices, each one computes its share of the force at the same time on its own
+	// worker thread, so each needs its own threads for the calculations on the host.
 
+	int numContexts = cu.getPlatformData().contexts.size();
+	useMultipleDevices = (numContexts > 1);
+	if (useMultipleDevices)
+		deviceThreads = new ThreadPool(max(1, cu.getPlatformData().threads.getNumThreads()/numContexts));
+	evaluator.initialize(force, getHostThreads().getNumThreads());
+	const ContForceGroups& groups = evaluator.getGroups();
+	int numBonds = groups.getNumGroups();
+	updateInterval = force.getUpdateInterval();
+	useDeviceKernels = force.getUseDeviceKernels();
+	forceGroupFlag = (1<<force.getForceGroup());
+	usePeriodic = force.usesPeriodicBoundaryConditions();
 
-	int numBonds = force.getNumBonds();
-	idxs.resize(numBonds);
-	npart.resize(numBonds);
-	length.resize(numBonds);
-	k.resize(numBonds);
-	for (int i = 0; i < numBonds; i++)
-		force.getBondParameters(i, idxs[i], npart[i], length[i], k[i]);
+	// If the System is periodic, reordering the atoms moves each one into the box on its own.  A force
+	// that is not periodic must undo that, or a group crossing a face of the box would be torn apart.
 
-	// Inititalize CUDA objects.
+	useCellOffsets = (system.usesPeriodicBoundaryConditions() && !usePeriodic);
+
+	// Inititalize CUDA objects.  The force is computed on its own stream, starting as soon as the
+	// positions are ready, and only joins the main stream when its forces are added.
 	cu.setAsCurrent();
 	cuStreamCreate(&stream, CU_STREAM_NON_BLOCKING);
 	cuEventCreate(&syncEvent, CU_EVENT_DISABLE_TIMING);
-	int elementSize = (cu.getUseDoublePrecision() ? sizeof(double) : sizeof(float));
-	contForces = new CudaArray(cu, 3*system.getNumParticles(), elementSize, "contForces");
+	hasInitializedKernel = true;
+	cu.addPreComputation(new StartCalculationPreComputation(*this));
+	cu.addPostComputation(new AddForcesPostComputation(*this));
 	map<string, string> defines;
 	defines["NUM_ATOMS"] = cu.intToString(cu.getNumAtoms());
 	defines["PADDED_NUM_ATOMS"] = cu.intToString(cu.getPaddedNumAtoms());
-	CUmodule module = cu.createModule(CudaContForceKernelSources::ContForce, defines);
-	addForcesKernel = cu.getKernel(module, "addForces");
+	if (usePeriodic)
+		defines["USE_PERIODIC"] = "1";
+	if (useCellOffsets)
+		defines["USE_CELL_OFFSETS"] = "1";
+	if (!useDeviceKernels) {
+		// The forces computed on the host are uploaded in the same 64 bit fixed point format as the force
+		// buffer, so they are not rounded to single precision first and the sums do not depend on the order
+		// in which they are added.
+
+		contForces = CudaArray::create<long long>(cu, 3*system.getNumParticles(), "contForces");
 
+		// Usually only a few atoms are restrained, so their forces are uploaded as a short list of
+		// entries.  Past a quarter of the atoms the dense upload is cheaper.
+
+		maxSparseEntries = max(1, system.getNumParticles()/4);
+		sparseForces = CudaArray::create<long long>(cu, 3*maxSparseEntries, "contSparseForces");
+		sparseAtoms = CudaArray::create<int>(cu, maxSparseEntries, "contSparseAtoms");
+		hostForces.resize(system.getNumParticles(), Vec3());
+		isForced.resize(system.getNumParticles(), 0);
+		CUmodule module = cu.createModule(CudaContForceKernelSources::ContForce, defines);
+		addForcesKernel = cu.getKernel(module, "addForces");
+		addSparseForcesKernel = cu.getKernel(module, "addSparseForces");
+		cu.addReorderListener(new ReorderListener(*this));
+		if (force.getUsePipelinedSelection()) {
+			// The pairs selected on the host are restrained on the device by applyPairRestraints().  Each
+			// component is joined to the others by at most one pair, so there are never more pairs than members.
+
+			usePipelinedSelection = true;
+			maxPairs = max(1, groups.getGroupStart(numBonds));
+			pairAtoms = CudaArray::create<int2>(cu, maxPairs, "contPairAtoms");
+			pairGroup = CudaArray::create<int>(cu, maxPairs, "contPairGroup");
+			if (useCellOffsets)
+				pairCellOffset = CudaArray::create<mm_int4>(cu, maxPairs, "contPairCellOffset");
+			if (cu.getUseDoublePrecision())
+				groupParams = CudaArray::create<double2>(cu, max(1, numBonds), "contGroupParams");
+			else
+				groupParams = CudaArray::create<float2>(cu, max(1, numBonds), "contGroupParams");
+			deviceGroup.resize(numBonds);
+			for (int i = 0; i < numBonds; i++)
+				deviceGroup[i] = i;
+			if (numBonds > 0)
+				uploadGroupParams();
+			cuMemHostAlloc(&pinnedPositions, cu.getPosq().getSize()*cu.getPosq().getElementSize(), 0);
+			for (int i = 0; i < 2; i++) {
+				cuMemHostAlloc((void**) &pinnedPairs[i], getPairBufferSize(), 0);
+				cuEventCreate(&pairsEvent[i], CU_EVENT_DISABLE_TIMING);
+			}
+			cuEventCreate(&positionsEvent, CU_EVENT_DISABLE_TIMING);
+			selectionThreads = new ThreadPool(getHostThreads().getNumThreads());
+			applyPairRestraintsKernel = cu.getKernel(module, "applyPairRestraints");
+		}
+		return;
+	}
+
+	// The members of all groups are stored in one flat list, as in ContForceGroups.  Groups small
+	// enough to be processed by a single warp are stored after the others, sorted by the size of the
+	// kernel that processes them, so each kernel works on a contiguous range of groups.
+
+	if (numBonds == 0)
+		return;
+	layoutGroups();
+
+	// If the System has a NonbondedForce with a cutoff, the pairs of members of large groups that are
+	// closer than the cutoff can be taken from the neighbor list built for it.  Whether the list's
+	// cutoff is large enough is checked on every step, since the cutoffs of the groups can change.
+	// With several devices, each device's list only holds the tiles it computes, so it is not used.
+
+	if (force.getUseNonbondedNeighborList() && !useMultipleDevices) {
+		for (int i = 0; i < system.getNumForces(); i++) {
+			const NonbondedForce* nonbonded = dynamic_cast<const NonbondedForce*>(&system.getForce(i));
+			if (nonbonded != NULL && nonbonded->getNonbondedMethod() != NonbondedForce::NoCutoff) {
+				useNeighborList = true;
+				nonbondedGroupFlag = (1<<nonbonded->getForceGroup());
+				nonbondedCutoff = nonbonded->getCutoffDistance();
+			}
+		}
+	}
+	allocateDeviceArrays();
+
+	// The selection kernels are timed by recording events around them.  Several sets of events are
+	// used in turn, so reading the times of one selection rarely has to wait for it.
+
+	for (int i = 0; i < NUM_TIMING_SLOTS; i++) {
+		for (int j = 0; j < 3; j++)
+			cuEventCreate(&timingEvents[i][j], CU_EVENT_DEFAULT);
+		isTimingPending[i] = false;
+	}
+	cu.addReorderListener(new ReorderListener(*this));
+
+	// The sizes of the slots are passed to the kernels as arguments rather than compiled into them, so
+	// the groups can be laid out again when their members change.
+
+	defines["NO_PAIR"] = "0xFFFFFFFFFFFFFFFFULL";
+	defines["SMALL_GROUP_BLOCK_SIZE"] = cu.intToString(SMALL_GROUP_BLOCK_SIZE);
+	defines["SUMMARY_BLOCK_SIZE"] = cu.intToString(SUMMARY_BLOCK_SIZE);
+	defines["CELL_SCAN_BLOCK_SIZE"] = cu.intToString(CELL_SCAN_BLOCK_SIZE);
+	defines["TILE_SIZE"] = cu.intToString(CudaContext::TileSize);
+#ifdef CONTFORCE_NONBONDED_SINGLE_PAIRS
+	defines["USE_SINGLE_PAIRS"] = "1";
+#endif
+	CUmodule module = cu.createModule(CudaContForceKernelSources::ContForceConnectivity, defines);
+	gatherPositionsKernel = cu.getKernel(module, "gatherPositions");
+	findMovedGroupsKernel = cu.getKernel(module, "findMovedGroups");
+	checkSpanningTreesKernel = cu.getKernel(module, "checkSpanningTrees");
+	initComponentsKernel = cu.getKernel(module, "initComponents");
+	countCellsKernel = cu.getKernel(module, "countCells");
+	findCellStartsKernel = cu.getKernel(module, "findCellStarts");
+	fillCellsKernel = cu.getKernel(module, "fillCells");
+	linkNeighborsKernel = cu.getKernel(module, "linkNeighbors");
+	flattenComponentsKernel = cu.getKernel(module, "flattenComponents");
+	findClosestPairsKernel = cu.getKernel(module, "findClosestPairs");
+	findDistantPairsKernel = cu.getKernel(module, "findDistantPairs");
+	for (int bucket = 0; bucket < NUM_SIZE_BUCKETS; bucket++)
+		selectSmallGroupPairsKernel[bucket] = cu.getKernel(module, "selectSmallGroupPairs"+cu.intToString(SMALL_GROUP_SIZES[bucket]));
+	applyRestraintsKernel = cu.getKernel(module, "applyRestraints");
+	summarizeGroupsKernel = cu.getKernel(module, "summarizeGroups");
+	if (useNeighborList)
+		linkListedNeighborsKernel = cu.getKernel(module, "linkListedNeighbors");
+}
+
+void CudaCalcContForceKernel::layoutGroups() {
+	const ContForceGroups& groups = evaluator.getGroups();
+	int numBonds = groups.getNumGroups();
+	vector<vector<int> > bucketGroups(NUM_SIZE_BUCKETS+1);
+	for (int i = 0; i < numBonds; i++) {
+		int bucket = 0;
+		while (bucket < NUM_SIZE_BUCKETS && groups.getGroupSize(i) > SMALL_GROUP_SIZES[bucket])
+			bucket++;
+		bucketGroups[bucket == NUM_SIZE_BUCKETS ? 0 : bucket+1].push_back(i);
+	}
+	deviceGroup.clear();
+	for (int bucket = 0; bucket <= NUM_SIZE_BUCKETS; bucket++) {
+		bucketStart[bucket] = deviceGroup.size();
+		deviceGroup.insert(deviceGroup.end(), bucketGroups[bucket].begin(), bucketGroups[bucket].end());
+	}
+	bucketStart[NUM_SIZE_BUCKETS+1] = numBonds;
+	deviceIndex.resize(numBonds);
+	deviceGroupStart.resize(numBonds+1);
+	deviceGroupEnd.resize(numBonds);
+	deviceGroupStart[0] = 0;
+	for (int i = 0; i < numBonds; i++) {
+		deviceIndex[deviceGroup[i]] = i;
+		deviceGroupStart[i+1] = deviceGroupStart[i]+getSlotSize(i, groups.getGroupSize(deviceGroup[i]));
+	}
+	numMembers = deviceGroupStart[numBonds];
+	numLargeMembers = deviceGroupStart[bucketStart[1]];
+	memberAtom.resize(numMembers);
+	memberGroupIndex.resize(numMembers);
+	for (int i = 0; i < numBonds; i++)
+		fillSlot(i);
+}
+
+int CudaCalcContForceKernel::getSlotSize(int index, int size) const {
+	// A small group cannot grow past the largest size its kernel handles.
+
+	if (index < bucketStart[1])
+		return size+max(16, size/8);
+	int bucket = (index < bucketStart[2] ? 0 : 1);
+	return min(SMALL_GROUP_SIZES[bucket], size+max(4, size/4));
+}
+
+void CudaCalcContForceKernel::fillSlot(int index) {
+	// The unused part of the slot is marked with a group of -1, which every kernel skips.
+
+	const ContForceGroups& groups = evaluator.getGroups();
+	int group = deviceGroup[index];
+	int start = deviceGroupStart[index];
+	int size = groups.getGroupSize(group);
+	const int* atoms = &groups.getAtoms()[groups.getGroupStart(group)];
+	for (int i = start; i < deviceGroupStart[index+1]; i++) {
+		bool isMember = (i-start < size);
+		memberAtom[i] = (isMember ? atoms[i-start] : -1);
+		memberGroupIndex[i] = (isMember ? index : -1);
+	}
+	deviceGroupEnd[index] = start+size;
+}
+
+void CudaCalcContForceKernel::allocateDeviceArrays() {
+	int numBonds = deviceGroup.size();
+	if (sortedIndex != NULL)
+		deleteDeviceArrays();
+	if (useNeighborList) {
+		atomMemberStart = CudaArray::create<int>(cu, cu.getNumAtoms()+1, "contAtomMemberStart");
+		atomMembers = CudaArray::create<int>(cu, max(1, numLargeMembers), "contAtomMembers");
+	}
+	sortedIndex = CudaArray::create<int>(cu, numMembers, "contSortedIndex");
+	memberGroup = CudaArray::create<int>(cu, numMembers, "contMemberGroup");
+	if (useCellOffsets) {
+		memberCellOffset = CudaArray::create<mm_int4>(cu, numMembers, "contMemberCellOffset");
+		memberCellOffsets.clear();
+	}
+	groupStart = CudaArray::create<int>(cu, numBonds+1, "contGroupStart");
+	groupEnd = CudaArray::create<int>(cu, numBonds, "contGroupEnd");
+	parent = CudaArray::create<int>(cu, numMembers, "contParent");
+	nearestOutside = CudaArray::create<int>(cu, numMembers, "contNearestOutside");
+	bestPair = CudaArray::create<unsigned long long>(cu, numMembers, "contBestPair");
+	componentCount = CudaArray::create<int>(cu, numBonds, "contComponentCount");
+	treeEdge = CudaArray::create<int2>(cu, numMembers, "contTreeEdge");
+	needsLabel = CudaArray::create<int>(cu, numBonds, "contNeedsLabel");
+	groupMoved = CudaArray::create<int>(cu, numBonds, "contGroupMoved");
+	groupSummary = CudaArray::create<int2>(cu, numBonds, "contGroupSummary");
+	memberCell = CudaArray::create<int>(cu, max(1, numLargeMembers), "contMemberCell");
+	cellCount = CudaArray::create<int>(cu, max(1, numLargeMembers), "contCellCount");
+	cellStart = CudaArray::create<int>(cu, numLargeMembers+1, "contCellStart");
+	cellMembers = CudaArray::create<int>(cu, max(1, numLargeMembers), "contCellMembers");
+	if (cu.getUseDoublePrecision()) {
+		groupParams = CudaArray::create<double2>(cu, numBonds, "contGroupParams");
+		memberPos = CudaArray::create<double4>(cu, numMembers, "contMemberPos");
+		lastPosition = CudaArray::create<double4>(cu, numMembers, "contLastPosition");
+		pairDistance = CudaArray::create<double>(cu, numMembers, "contPairDistance");
+		groupMinDistance = CudaArray::create<double>(cu, numBonds, "contGroupMinDistance");
+	}
+	else {
+		groupParams = CudaArray::create<float2>(cu, numBonds, "contGroupParams");
+		memberPos = CudaArray::create<float4>(cu, numMembers, "contMemberPos");
+		lastPosition = CudaArray::create<float4>(cu, numMembers, "contLastPosition");
+		pairDistance = CudaArray::create<float>(cu, numMembers, "contPairDistance");
+		groupMinDistance = CudaArray::create<float>(cu, numBonds, "contGroupMinDistance");
+	}
+	memberGroup->upload(memberGroupIndex);
+	groupStart->upload(deviceGroupStart);
+	groupEnd->upload(deviceGroupEnd);
+	needsLabel->upload(vector<int>(numBonds, 1));
+	groupMoved->upload(vector<int>(numBonds, 1));
+	componentCount->upload(vector<int>(numBonds, 0));
+	cu.clearBuffer(*lastPosition);
+	cu.clearBuffer(*cellCount);
+
+	// No component has selected a pair yet, so getGroupSummaries() can apply the restraints before
+	// the first selection.
+
+	bestPair->upload(vector<unsigned long long>(numMembers, 0xFFFFFFFFFFFFFFFFULL));
+	uploadGroupParams();
+	hasSortedIndices = false;
+	hasPairDistances = false;
+}
+
+void CudaCalcContForceKernel::deleteDeviceArrays() {
+	delete sortedIndex;
+	delete memberGroup;
+	delete memberPos;
+	delete groupStart;
+	delete groupEnd;
+	delete groupParams;
+	delete parent;
+	delete nearestOutside;
+	delete bestPair;
+	delete componentCount;
+	delete treeEdge;
+	delete needsLabel;
+	delete lastPosition;
+	delete groupMoved;
+	delete pairDistance;
+	delete groupSummary;
+	delete groupMinDistance;
+	delete memberCell;
+	delete cellCount;
+	delete cellStart;
+	delete cellMembers;
+	if (atomMemberStart != NULL) {
+		delete atomMemberStart;
+		delete atomMembers;
+		atomMemberStart = NULL;
+	}
+	if (memberCellOffset != NULL) {
+		delete memberCellOffset;
+		memberCellOffset = NULL;
+	}
+	sortedIndex = NULL;
+}
+
+void CudaCalcContForceKernel::uploadGroupParams() {
+	const ContForceGroups& groups = evaluator.getGroups();
+	if (cu.getUseDoublePrecision()) {
+		vector<double2> params(groups.getNumGroups());
+		for (int i = 0; i < groups.getNumGroups(); i++)
+			params[i] = make_double2(groups.getCutoff(deviceGroup[i]), groups.getForceConstant(deviceGroup[i]));
+		groupParams->upload(params);
+	}
+	else {
+		vector<float2> params(groups.getNumGroups());
+		for (int i = 0; i < groups.getNumGroups(); i++)
+			params[i] = make_float2((float) groups.getCutoff(deviceGroup[i]), (float) groups.getForceConstant(deviceGroup[i]));
+		groupParams->upload(params);
+	}
+	if (useNeighborList) {
+		maxLargeGroupCutoff = 0.0;
+		for (int i = 0; i < bucketStart[1]; i++)
+			maxLargeGroupCutoff = max(maxLargeGroupCutoff, groups.getCutoff(deviceGroup[i]));
+	}
+}
+
+void CudaCalcContForceKernel::updateSortedIndices() {
+	// Find where each member's atom is stored now that the atoms may have been reordered.
+
+	const vector<int>& order = cu.getAtomIndex();
+	atomPosition.resize(order.size());
+	for (int i = 0; i < order.size(); i++)
+		atomPosition[order[i]] = i;
+	if (sortedIndex != NULL) {
+		vector<int> sorted(numMembers);
+		for (int i = 0; i < numMembers; i++)
+			sorted[i] = (memberAtom[i] == -1 ? 0 : atomPosition[memberAtom[i]]);
+		sortedIndex->upload(sorted);
+	}
+	if (useNeighborList && numLargeMembers > 0) {
+		// List the members of large groups stored at each atom position, for looking them up from the
+		// atoms in the neighbor list.
+
+		int numAtoms = cu.getNumAtoms();
+		vector<int> start(numAtoms+1, 0), members(atomMembers->getSize());
+		for (int i = 0; i < numLargeMembers; i++)
+			if (memberAtom[i] != -1)
+				start[atomPosition[memberAtom[i]]+1]++;
+		for (int i = 0; i < numAtoms; i++)
+			start[i+1] += start[i];
+		vector<int> next(start.begin(), start.end()-1);
+		for (int i = 0; i < numLargeMembers; i++)
+			if (memberAtom[i] != -1)
+				members[next[atomPosition[memberAtom[i]]]++] = i;
+		atomMemberStart->upload(start);
+		atomMembers->upload(members);
+	}
+	hasSortedIndices = true;
+}
+
+void CudaCalcContForceKernel::updateCellOffsets() {
+	// Setting the positions resets the offsets without reordering the atoms, so they are compared on
+	// every step instead of only being updated by updateSortedIndices().
+
+	const vector<mm_int4>& offsets = cu.getPosCellOffsets();
+	bool changed = (memberCellOffsets.size() != numMembers);
+	memberCellOffsets.resize(numMembers);
+	for (int i = 0; i < numMembers; i++) {
+		mm_int4 offset = {0, 0, 0, 0};
+		if (memberAtom[i] != -1)
+			offset = offsets[atomPosition[memberAtom[i]]];
+		mm_int4& current = memberCellOffsets[i];
+		if (offset.x != current.x || offset.y != current.y || offset.z != current.z) {
+			current = offset;
+			changed = true;
+		}
+	}
+	if (changed)
+		memberCellOffset->upload(memberCellOffsets);
+}
+
+bool CudaCalcContForceKernel::canUseNeighborList(int groups) {
+	// The list is only built when the NonbondedForce is computed.  Its cutoff may be larger than the
+	// NonbondedForce's if other forces use the nonbonded utilities too.  It only lists the pairs this
+	// force needs if it measures separations with the same periodicity.
+
+	if (!useNeighborList || numLargeMembers == 0 || (groups&nonbondedGroupFlag) == 0 || maxLargeGroupCutoff > nonbondedCutoff)
+		return false;
+	CudaNonbondedUtilities& nb = cu.getNonbondedUtilities();
+	return (nb.getUseCutoff() && nb.getUsePeriodic() == usePeriodic && maxLargeGroupCutoff <= nb.getMaxCutoffDistance());
+}
+
+bool CudaCalcContForceKernel::shouldSelectPairs(ContextImpl& context) {
+	long long step = context.getStepCount();
+	if (updateInterval == 1 || lastSelectionStep < 0 || step < lastSelectionStep || step-lastSelectionStep >= updateInterval) {
+		lastSelectionStep = step;
+		return true;
+	}
+	return false;
 }
 
 double CudaCalcContForceKernel::execute(ContextImpl& context, bool includeForces, bool includeEnergy) {
+	// The actual calculation is started by the pre-computation, continued on the worker thread or this
+	// force's stream, and finished by the post-computation.  The nonbonded neighbor list has been built
+	// on the main stream by now, so a selection that uses it can start.
 
-	vector<Vec3> pos, forces;
-	context.getPositions(pos);
-	int numParticles = cu.getNumAtoms();
-	//context.getForces(forces);
-	forces.resize(numParticles);
-	memset(&forces[0], 0, numParticles*sizeof(Vec3));
+	if (isSelectionDeferred) {
+		isSelectionDeferred = false;
+		startSelectionOnDevice(true);
+	}
+	return 0.0;
+}
 
-	int numBonds = npart.size();
-	double energy = 0;
+void CudaCalcContForceKernel::beginComputation(bool includeForces, bool includeEnergy, int groups) {
+	isComputing = ((groups&forceGroupFlag) != 0);
+	if (!isComputing)
+		return;
+	this->includeForces = includeForces;
+	this->includeEnergy = includeEnergy;
+	selectPairs = shouldSelectPairs(contextImpl);
 
-	for (int i = 0; i < numBonds; i++) {
-	  // initialize distance nxn matrix with zeros
-	  vector<vector<double>> dmat( npart[i], vector<double> ( npart[i], 0));
-
-	  // calculate distances
-	  for (int at1 = 0; at1 < npart[i]-1; at1++) {
-		for (int at2 = at1+1; at2 < npart[i]; at2++) {
-		  // ignore periodic boundaries for now
-		  RealVec delta = pos[idxs[i][at1]]-pos[idxs[i][at2]];
-		  RealOpenMM r2 = delta.dot(delta);
-		  dmat[at1][at2] = dmat[at2][at1] = sqrt(r2);
+	// The selection started on the last step uses the current atom order, so it must finish first.
+	// With several devices this is invoked on the worker thread, which has finished it already.
+
+	if (usePipelinedSelection && !useMultipleDevices)
+		cu.getWorkThread().flush();
+	if (!hasSortedIndices)
+		updateSortedIndices();
+	if (usePipelinedSelection)
+		beginPipelinedComputation();
+	else if (useDeviceKernels) {
+		// Groups whose members have changed are processed right away, even between selections.
+
+		selectChangedGroupsOnly = (!selectPairs && hasChangedGroups);
+		selectPairs = (selectPairs || hasChangedGroups);
+		hasChangedGroups = false;
+		if (numMembers == 0)
+			return;
+		if (selectPairs || includeForces || includeEnergy)
+			gatherPositionsOnDevice();
+		if (!selectPairs)
+			return;
+
+		// The nonbonded neighbor list is built after the pre-computations, so a selection that uses it
+		// is started by execute() instead.
+
+		isSelectionDeferred = canUseNeighborList(groups);
+		if (!isSelectionDeferred)
+			startSelectionOnDevice(false);
+	}
+	else {
+		// With several devices this is invoked on the worker thread, where a new task might only run
+		// after finishComputation(), so the force is computed right away.
+
+		ContForceProfiler::pushRange("ContForce positions");
+		contextImpl.getPeriodicBoxVectors(boxVectors[0], boxVectors[1], boxVectors[2]);
+		if (useMultipleDevices)
+			downloadPositions();
+		else
+			contextImpl.getPositions(pos);
+		ContForceProfiler::popRange();
+		if (useMultipleDevices)
+			executeOnWorkerThread();
+		else
+			cu.getWorkThread().addTask(new ExecuteTask(*this));
+	}
+}
+
+void CudaCalcContForceKernel::startSelectionOnDevice(bool fromNeighborList) {
+	cuEventRecord(syncEvent, cu.getCurrentStream());
+	cuStreamWaitEvent(stream, syncEvent, 0);
+	cu.setCurrentStream(stream);
+	ContForceProfiler::pushRange("ContForce select pairs on device");
+	selectPairsOnDevice(fromNeighborList);
+	ContForceProfiler::popRange();
+	cu.restoreDefaultStream();
+	cuEventRecord(syncEvent, stream);
+}
+
+void CudaCalcContForceKernel::executeOnWorkerThread() {
+	hostEnergy = evaluator.evaluate(pos, boxVectors, selectPairs, includeForces, includeEnergy, getHostThreads(), groupForces);
+	for (int i = 0; i < groupForces.size(); i++)
+	  addHostForce(groupForces[i].first, groupForces[i].second);
+	numUploadedEntries = 0;
+	if (includeForces)
+	  uploadHostForces();
+}
+
+void CudaCalcContForceKernel::beginPipelinedComputation() {
+	// The first time no pairs have been selected yet, so they are selected from the current positions.
+
+	bool selectedNow = false;
+	contextImpl.getPeriodicBoxVectors(boxVectors[0], boxVectors[1], boxVectors[2]);
+	if (!hasLaggedPairs) {
+		ContForceProfiler::pushRange("ContForce positions");
+		if (useMultipleDevices)
+			downloadPositions();
+		else
+			contextImpl.getPositions(pos);
+		ContForceProfiler::popRange();
+		selectLaggedPairs(getHostThreads());
+		hasLaggedPairs = true;
+		selectedNow = true;
+	}
+
+	// Upload the pairs selected on the last step once the main stream has finished using the previous
+	// ones, then download the positions to select the pairs for the next step on the worker thread.
+
+	cuEventRecord(syncEvent, cu.getCurrentStream());
+	cuStreamWaitEvent(stream, syncEvent, 0);
+	uploadLaggedPairs();
+	if (selectPairs && !selectedNow) {
+		cuMemcpyDtoHAsync(pinnedPositions, cu.getPosq().getDevicePointer(), cu.getPosq().getSize()*cu.getPosq().getElementSize(), stream);
+		cuEventRecord(positionsEvent, stream);
+		laggedCellOffsets = cu.getPosCellOffsets();
+		cu.getWorkThread().addTask(new SelectPairsTask(*this));
+	}
+	cuEventRecord(syncEvent, stream);
+}
+
+void CudaCalcContForceKernel::selectPairsOnWorkerThread() {
+	cu.setAsCurrent();
+	ContForceProfiler::pushRange("ContForce positions");
+	cuEventSynchronize(positionsEvent);
+	readPositions(pinnedPositions);
+	removeCellOffsets(laggedCellOffsets);
+	ContForceProfiler::popRange();
+	selectLaggedPairs(*selectionThreads);
+}
+
+void CudaCalcContForceKernel::readPositions(const void* posq) {
+	int numAtoms = atomPosition.size();
+	pos.resize(numAtoms);
+	if (cu.getUseDoublePrecision()) {
+		const double4* posqDouble = (const double4*) posq;
+		for (int i = 0; i < numAtoms; i++) {
+			double4 p = posqDouble[atomPosition[i]];
+			pos[i] = Vec3(p.x, p.y, p.z);
 		}
-	  }
+	}
+	else {
+		const float4* posqFloat = (const float4*) posq;
+		for (int i = 0; i < numAtoms; i++) {
+			float4 p = posqFloat[atomPosition[i]];
+			pos[i] = Vec3(p.x, p.y, p.z);
+		}
+	}
+}
+
+void CudaCalcContForceKernel::downloadPositions() {
+	cu.setAsCurrent();
+	cu.getPosq().download(cu.getPinnedBuffer());
+	readPositions(cu.getPinnedBuffer());
+	removeCellOffsets(cu.getPosCellOffsets());
+}
+
+void CudaCalcContForceKernel::removeCellOffsets(const vector<mm_int4>& offsets) {
+	// Reordering the atoms may have moved them into the periodic box.  Undo that, so the positions
+	// are the same as the Context's.  This needs the box vectors of the step they were taken on.
+
+	for (int i = 0; i < pos.size(); i++) {
+		mm_int4 offset = offsets[atomPosition[i]];
+		pos[i] -= boxVectors[0]*offset.x+boxVectors[1]*offset.y+boxVectors[2]*offset.z;
+	}
+}
 
-	  // define list of component indexes
-	  vector<int> comp_idxs( npart[i], -1);
-
-	  int curr_comp = 0;
-	  while (*std::min_element(comp_idxs.begin(), comp_idxs.end()) == -1) {
-		// assign the first -1 index element to curr_comp
-		for (int at = 0; at < npart[i]; at++) {
-		  if (comp_idxs[at] == -1) {
-			comp_idxs[at] = curr_comp;
-			break;
-		  }
+int CudaCalcContForceKernel::getPairBufferSize() const {
+	// Each pair's atoms and group are followed by the difference between the cell offsets of its atoms.
+
+	return (useCellOffsets ? 7 : 3)*maxPairs*sizeof(int);
+}
+
+ThreadPool& CudaCalcContForceKernel::getHostThreads() {
+	if (deviceThreads != NULL)
+		return *deviceThreads;
+	return cu.getPlatformData().threads;
+}
+
+void CudaCalcContForceKernel::selectLaggedPairs(ThreadPool& threads) {
+	evaluator.evaluate(pos, boxVectors, true, false, false, threads, groupForces);
+	const ContForceGroups& groups = evaluator.getGroups();
+	laggedPairs.clear();
+	laggedPairGroups.clear();
+	for (int group = 0; group < groups.getNumGroups(); group++) {
+		const int* atoms = &groups.getAtoms()[groups.getGroupStart(group)];
+		const vector<pair<int, int> >& pairs = evaluator.getRestrainedPairs(group);
+		for (int i = 0; i < pairs.size(); i++) {
+			laggedPairs.push_back(atoms[pairs[i].first]);
+			laggedPairs.push_back(atoms[pairs[i].second]);
+			laggedPairGroups.push_back(group);
 		}
+	}
+}
 
-		bool updated = true;
-		while (updated) {
-		  updated = false;
-
-		  // see if any of the -1 elements can be assigned to curr_comp
-		  for (int at = 0; at < npart[i]; at++) {
-			if (comp_idxs[at] == -1) {
-			  for (int at2 = 0; at2 < npart[i]; at2++) {
-				if (comp_idxs[at2] == curr_comp) {
-				  if (dmat[at][at2] < length[i]) {
-					comp_idxs[at] = curr_comp;
-					updated = true;
-				  }
-				}
-			  }
-			}
-		  }
+void CudaCalcContForceKernel::uploadLaggedPairs() {
+	numLaggedPairs = laggedPairGroups.size();
+	if (numLaggedPairs == 0)
+		return;
+
+	// Wait until the last upload from this buffer is finished before overwriting it.
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	int* buffer = pinnedPairs[currentPairBuffer];
+	cuEventSynchronize(pairsEvent[currentPairBuffer]);
+	for (int i = 0; i < numLaggedPairs; i++) {
+		buffer[2*i] = atomPosition[laggedPairs[2*i]];
+		buffer[2*i+1] = atomPosition[laggedPairs[2*i+1]];
+		buffer[2*maxPairs+i] = laggedPairGroups[i];
+	}
+	if (useCellOffsets) {
+		// The offsets are those of the current step, when the pairs are restrained.
+
+		const vector<mm_int4>& offsets = cu.getPosCellOffsets();
+		int* offsetBuffer = buffer+3*maxPairs;
+		for (int i = 0; i < numLaggedPairs; i++) {
+			mm_int4 offset1 = offsets[buffer[2*i]];
+			mm_int4 offset2 = offsets[buffer[2*i+1]];
+			offsetBuffer[4*i] = offset1.x-offset2.x;
+			offsetBuffer[4*i+1] = offset1.y-offset2.y;
+			offsetBuffer[4*i+2] = offset1.z-offset2.z;
+			offsetBuffer[4*i+3] = 0;
 		}
-		curr_comp++;
-	  } // all comp_idxs assigned! (curr_comp holds the number of components)
-
-	  // if more than one component exists:  for each component, find the closest
-	  //   outside node and introduce an attractive force between them
-	  if (curr_comp > 1) {
-		// force_mat will mark which atom pairs will be restrained, to
-		// avoid double counting
-		vector<vector<int>> force_mat( npart[i], vector<int> ( npart[i], 0));
-
-		for (int comp_idx = 0; comp_idx < curr_comp; comp_idx++) {
-		  int c_atom_in = -1;
-		  int c_atom_out = -1;
-		  double c_dist = -1.0;
-
-		  // find closest atom pair
-		  for (int in_idx = 0; in_idx < npart[i]; in_idx++) {
-			if (comp_idxs[in_idx] == comp_idx) {
-			  for (int out_idx = 0; out_idx < npart[i]; out_idx++) {
-				if (comp_idxs[out_idx] != comp_idx) {
-				  if (dmat[in_idx][out_idx] < c_dist | c_dist == -1.0) {
-					c_dist = dmat[in_idx][out_idx];
-					c_atom_in = in_idx;
-					c_atom_out = out_idx;
-				  }
-				}
-			  }
-			}
-		  }
-		  // mark this pair to be restrained in force_mat
-		  force_mat[c_atom_in][c_atom_out] = force_mat[c_atom_out][c_atom_in] = 1;
+	}
+	ContForceProfiler::pushRange("ContForce upload");
+	cuMemcpyHtoDAsync(pairAtoms->getDevicePointer(), buffer, 2*numLaggedPairs*sizeof(int), stream);
+	cuMemcpyHtoDAsync(pairGroup->getDevicePointer(), buffer+2*maxPairs, numLaggedPairs*sizeof(int), stream);
+	if (useCellOffsets)
+		cuMemcpyHtoDAsync(pairCellOffset->getDevicePointer(), buffer+3*maxPairs, 4*numLaggedPairs*sizeof(int), stream);
+	ContForceProfiler::popRange();
+	cuEventRecord(pairsEvent[currentPairBuffer], stream);
+	currentPairBuffer = 1-currentPairBuffer;
+	uploadTime += chrono::duration<double>(chrono::steady_clock::now()-start).count();
+}
+
+double CudaCalcContForceKernel::finishComputation(bool includeForces, bool includeEnergy, int groups) {
+	if (!isComputing)
+		return 0.0;
+	isComputing = false;
+	if (usePipelinedSelection) {
+		// The selection for the next step is left running on the worker thread.
+
+		cuStreamWaitEvent(cu.getCurrentStream(), syncEvent, 0);
+		if (numLaggedPairs > 0 && (includeForces || includeEnergy)) {
+			int forcesFlag = includeForces, energyFlag = includeEnergy;
+			CUdeviceptr cellOffsets = (useCellOffsets ? pairCellOffset->getDevicePointer() : 0);
+			void* args[] = {&cu.getPosq().getDevicePointer(), &pairAtoms->getDevicePointer(), &pairGroup->getDevicePointer(),
+					&cellOffsets, &groupParams->getDevicePointer(), &numLaggedPairs, &cu.getForce().getDevicePointer(), &cu.getEnergyBuffer().getDevicePointer(),
+					&forcesFlag, &energyFlag,
+					cu.getInvPeriodicBoxSizePointer(), cu.getPeriodicBoxVecXPointer(), cu.getPeriodicBoxVecYPointer(), cu.getPeriodicBoxVecZPointer()};
+			cu.executeKernel(applyPairRestraintsKernel, args, numLaggedPairs);
+		}
+		return 0.0;
+	}
+	if (useDeviceKernels) {
+		if (numMembers == 0)
+			return 0.0;
+		if (isSelectionDeferred) {
+			isSelectionDeferred = false;
+			startSelectionOnDevice(true);
 		}
+		if (selectPairs)
+			cuStreamWaitEvent(cu.getCurrentStream(), syncEvent, 0);
+		if (includeForces || includeEnergy)
+			applyRestraintsOnDevice();
+		return 0.0;
+	}
 
-		// add restraint force to designated atom pairs
-		for (int at1 = 0; at1 < npart[i]-1; at1++) {
-		  for (int at2 = at1+1; at2 < npart[i]; at2++) {
-			if (force_mat[at1][at2] == 1) {
-			  RealOpenMM dr = (dmat[at1][at2]-length[i]);
-			  RealOpenMM dr2 = dr*dr;
-			  if (includeEnergy) {
-				energy += k[i]*dr2;
-			  }
-				RealOpenMM dEdR = 2*k[i]*dr;
-				dEdR = (dmat[at1][at2] > 0) ? (dEdR/dmat[at1][at2]) : 0;
-				RealVec delta = pos[idxs[i][at1]]-pos[idxs[i][at2]];
-
-				forces[idxs[i][at1]] -= delta*dEdR;
-				forces[idxs[i][at2]] += delta*dEdR;
+	// Wait until executeOnWorkerThread() is finished.  With several devices it was invoked by
+	// beginComputation() on this thread.
 
-			}
-		  }
+	if (!useMultipleDevices)
+		cu.getWorkThread().flush();
+	addHostForces();
+	return hostEnergy;
+}
+
+void CudaCalcContForceKernel::selectPairsOnDevice(bool fromNeighborList) {
+	int slot = currentTimingSlot;
+	currentTimingSlot = (currentTimingSlot+1)%NUM_TIMING_SLOTS;
+	if (isTimingPending[slot])
+		accumulateTiming(slot);
+	cuEventRecord(timingEvents[slot][0], stream);
+	isTimingPending[slot] = true;
+	hasPairDistances = false;
+
+	// Only the groups in which some member has moved since the last selection are processed.  Between
+	// selections, only the groups whose members have changed are, which have been flagged already.
+
+	if (!selectChangedGroupsOnly) {
+		void* movedArgs[] = {&memberPos->getDevicePointer(), &memberGroup->getDevicePointer(),
+				&lastPosition->getDevicePointer(), &groupMoved->getDevicePointer(), &numMembers};
+		cu.executeKernel(findMovedGroupsKernel, movedArgs, numMembers);
+	}
+	int numLargeGroups = bucketStart[1];
+	if (numLargeGroups > 0) {
+		void* checkArgs[] = {&memberPos->getDevicePointer(), &memberGroup->getDevicePointer(),
+				&groupParams->getDevicePointer(), &treeEdge->getDevicePointer(), &groupMoved->getDevicePointer(), &needsLabel->getDevicePointer(),
+				&numLargeMembers,
+				cu.getInvPeriodicBoxSizePointer(), cu.getPeriodicBoxVecXPointer(), cu.getPeriodicBoxVecYPointer(), cu.getPeriodicBoxVecZPointer()};
+		cu.executeKernel(checkSpanningTreesKernel, checkArgs, numLargeMembers);
+		void* initArgs[] = {&memberGroup->getDevicePointer(), &groupMoved->getDevicePointer(), &needsLabel->getDevicePointer(),
+				&parent->getDevicePointer(), &treeEdge->getDevicePointer(), &bestPair->getDevicePointer(), &componentCount->getDevicePointer(),
+				&numLargeMembers, &numLargeGroups};
+		cu.executeKernel(initComponentsKernel, initArgs, max(numLargeMembers, numLargeGroups));
+
+		// Bin the members of the groups being labeled into cells, so only nearby members need to be compared.
+
+		void* countArgs[] = {&memberPos->getDevicePointer(), &memberGroup->getDevicePointer(), &groupStart->getDevicePointer(),
+				&groupParams->getDevicePointer(), &groupMoved->getDevicePointer(), &needsLabel->getDevicePointer(),
+				&memberCell->getDevicePointer(), &cellCount->getDevicePointer(), &numLargeMembers,
+				cu.getInvPeriodicBoxSizePointer(), cu.getPeriodicBoxVecXPointer(), cu.getPeriodicBoxVecYPointer(), cu.getPeriodicBoxVecZPointer()};
+		cu.executeKernel(countCellsKernel, countArgs, numLargeMembers);
+		void* startArgs[] = {&cellCount->getDevicePointer(), &cellStart->getDevicePointer(), &numLargeMembers};
+		cu.executeKernel(findCellStartsKernel, startArgs, CELL_SCAN_BLOCK_SIZE, CELL_SCAN_BLOCK_SIZE);
+		void* fillArgs[] = {&memberCell->getDevicePointer(), &cellStart->getDevicePointer(), &cellCount->getDevicePointer(),
+				&cellMembers->getDevicePointer(), &numLargeMembers};
+		cu.executeKernel(fillCellsKernel, fillArgs, numLargeMembers);
+		CUdeviceptr listedTileCount = 0;
+		unsigned int maxListedTiles = 0;
+		if (fromNeighborList) {
+			// The list is read on the device, so if it overflowed linkNeighbors() searches the groups instead.
+
+			CudaNonbondedUtilities& nb = cu.getNonbondedUtilities();
+			listedTileCount = nb.getInteractionCount().getDevicePointer();
+			maxListedTiles = nb.getInteractingTiles().getSize();
+			int numExclusionTiles = nb.getExclusionTiles().getSize();
+#ifdef CONTFORCE_NONBONDED_SINGLE_PAIRS
+			unsigned int maxSinglePairs = nb.getSinglePairs().getSize();
+			void* listArgs[] = {&cu.getPosq().getDevicePointer(), &atomMemberStart->getDevicePointer(), &atomMembers->getDevicePointer(),
+					&memberGroup->getDevicePointer(), &groupParams->getDevicePointer(), &groupMoved->getDevicePointer(),
+					&needsLabel->getDevicePointer(), &parent->getDevicePointer(), &treeEdge->getDevicePointer(),
+					&nb.getExclusionTiles().getDevicePointer(), &numExclusionTiles, &nb.getInteractingTiles().getDevicePointer(),
+					&nb.getInteractingAtoms().getDevicePointer(), &listedTileCount, &maxListedTiles,
+					cu.getInvPeriodicBoxSizePointer(), cu.getPeriodicBoxVecXPointer(), cu.getPeriodicBoxVecYPointer(), cu.getPeriodicBoxVecZPointer(),
+					&nb.getSinglePairs().getDevicePointer(), &maxSinglePairs};
+#else
+			void* listArgs[] = {&cu.getPosq().getDevicePointer(), &atomMemberStart->getDevicePointer(), &atomMembers->getDevicePointer(),
+					&memberGroup->getDevicePointer(), &groupParams->getDevicePointer(), &groupMoved->getDevicePointer(),
+					&needsLabel->getDevicePointer(), &parent->getDevicePointer(), &treeEdge->getDevicePointer(),
+					&nb.getExclusionTiles().getDevicePointer(), &numExclusionTiles, &nb.getInteractingTiles().getDevicePointer(),
+					&nb.getInteractingAtoms().getDevicePointer(), &listedTileCount, &maxListedTiles,
+					cu.getInvPeriodicBoxSizePointer(), cu.getPeriodicBoxVecXPointer(), cu.getPeriodicBoxVecYPointer(), cu.getPeriodicBoxVecZPointer()};
+#endif
+			cu.executeKernel(linkListedNeighborsKernel, listArgs, cu.getNumThreadBlocks()*CudaContext::ThreadBlockSize);
 		}
-	  }
+		void* linkArgs[] = {&memberPos->getDevicePointer(), &memberGroup->getDevicePointer(),
+				&groupStart->getDevicePointer(), &groupParams->getDevicePointer(), &groupMoved->getDevicePointer(),
+				&needsLabel->getDevicePointer(), &cellStart->getDevicePointer(), &cellMembers->getDevicePointer(),
+				&parent->getDevicePointer(), &treeEdge->getDevicePointer(),
+				&listedTileCount, &maxListedTiles, &numLargeMembers,
+				cu.getInvPeriodicBoxSizePointer(), cu.getPeriodicBoxVecXPointer(), cu.getPeriodicBoxVecYPointer(), cu.getPeriodicBoxVecZPointer()};
+		cu.executeKernel(linkNeighborsKernel, linkArgs, numLargeMembers);
+		void* flattenArgs[] = {&parent->getDevicePointer(), &memberGroup->getDevicePointer(), &groupMoved->getDevicePointer(),
+				&needsLabel->getDevicePointer(), &componentCount->getDevicePointer(), &numLargeMembers};
+		cu.executeKernel(flattenComponentsKernel, flattenArgs, numLargeMembers);
+		void* closestArgs[] = {&memberPos->getDevicePointer(), &memberGroup->getDevicePointer(),
+				&groupStart->getDevicePointer(), &groupParams->getDevicePointer(), &componentCount->getDevicePointer(),
+				&parent->getDevicePointer(), &groupMoved->getDevicePointer(), &cellStart->getDevicePointer(), &cellMembers->getDevicePointer(),
+				&nearestOutside->getDevicePointer(), &bestPair->getDevicePointer(), &needsLabel->getDevicePointer(), &numLargeMembers, &numLargeGroups,
+				cu.getInvPeriodicBoxSizePointer(), cu.getPeriodicBoxVecXPointer(), cu.getPeriodicBoxVecYPointer(), cu.getPeriodicBoxVecZPointer()};
+		cu.executeKernel(findClosestPairsKernel, closestArgs, max(numLargeMembers, numLargeGroups));
+		void* distantArgs[] = {&memberPos->getDevicePointer(), &memberGroup->getDevicePointer(),
+				&groupStart->getDevicePointer(), &groupEnd->getDevicePointer(), &componentCount->getDevicePointer(), &parent->getDevicePointer(),
+				&groupMoved->getDevicePointer(), &nearestOutside->getDevicePointer(), &bestPair->getDevicePointer(), &numLargeMembers,
+				cu.getInvPeriodicBoxSizePointer(), cu.getPeriodicBoxVecXPointer(), cu.getPeriodicBoxVecYPointer(), cu.getPeriodicBoxVecZPointer()};
+		cu.executeKernel(findDistantPairsKernel, distantArgs, numLargeMembers);
+	}
+	cuEventRecord(timingEvents[slot][1], stream);
+
+	// The kernels for small groups label the components and select the pairs in one pass, so they
+	// are timed as part of selection.
+
+	for (int bucket = 0; bucket < NUM_SIZE_BUCKETS; bucket++) {
+		int firstGroup = bucketStart[bucket+1];
+		int lastGroup = bucketStart[bucket+2];
+		if (firstGroup == lastGroup)
+			continue;
+		void* smallArgs[] = {&memberPos->getDevicePointer(), &groupStart->getDevicePointer(),
+				&groupEnd->getDevicePointer(), &groupParams->getDevicePointer(), &groupMoved->getDevicePointer(), &firstGroup, &lastGroup, &parent->getDevicePointer(),
+				&nearestOutside->getDevicePointer(), &bestPair->getDevicePointer(), &componentCount->getDevicePointer(),
+				cu.getInvPeriodicBoxSizePointer(), cu.getPeriodicBoxVecXPointer(), cu.getPeriodicBoxVecYPointer(), cu.getPeriodicBoxVecZPointer()};
+		cu.executeKernel(selectSmallGroupPairsKernel[bucket], smallArgs, 32*(lastGroup-firstGroup), SMALL_GROUP_BLOCK_SIZE);
+	}
+	cuEventRecord(timingEvents[slot][2], stream);
+	cu.clearBuffer(*groupMoved);
+}
+
+void CudaCalcContForceKernel::accumulateTiming(int slot) {
+	float labelingMs, selectionMs;
+	cuEventSynchronize(timingEvents[slot][2]);
+	cuEventElapsedTime(&labelingMs, timingEvents[slot][0], timingEvents[slot][1]);
+	cuEventElapsedTime(&selectionMs, timingEvents[slot][1], timingEvents[slot][2]);
+	labelingTime += 0.001*labelingMs;
+	selectionTime += 0.001*selectionMs;
+	isTimingPending[slot] = false;
+}
+
+void CudaCalcContForceKernel::gatherPositionsOnDevice() {
+	if (!hasSortedIndices)
+		updateSortedIndices();
+	if (useCellOffsets)
+		updateCellOffsets();
+	CUdeviceptr cellOffsets = (useCellOffsets ? memberCellOffset->getDevicePointer() : 0);
+	void* gatherArgs[] = {&cu.getPosq().getDevicePointer(), &sortedIndex->getDevicePointer(), &cellOffsets, &memberPos->getDevicePointer(),
+			&numMembers, cu.getPeriodicBoxVecXPointer(), cu.getPeriodicBoxVecYPointer(), cu.getPeriodicBoxVecZPointer()};
+	cu.executeKernel(gatherPositionsKernel, gatherArgs, numMembers);
+}
+
+void CudaCalcContForceKernel::applyRestraintsOnDevice() {
+	ContForceProfileRange range("ContForce restraints on device");
+	int forcesFlag = includeForces, energyFlag = includeEnergy;
+	void* restraintArgs[] = {&memberPos->getDevicePointer(), &sortedIndex->getDevicePointer(), &memberGroup->getDevicePointer(),
+			&groupParams->getDevicePointer(), &parent->getDevicePointer(), &nearestOutside->getDevicePointer(),
+			&bestPair->getDevicePointer(), &pairDistance->getDevicePointer(), &cu.getForce().getDevicePointer(),
+			&cu.getEnergyBuffer().getDevicePointer(), &forcesFlag, &energyFlag, &numMembers,
+			cu.getInvPeriodicBoxSizePointer(), cu.getPeriodicBoxVecXPointer(), cu.getPeriodicBoxVecYPointer(), cu.getPeriodicBoxVecZPointer()};
+	cu.executeKernel(applyRestraintsKernel, restraintArgs, numMembers);
+	hasPairDistances = true;
+}
+
+void CudaCalcContForceKernel::addHostForce(int atom, const Vec3& force) {
+	if (!isForced[atom]) {
+	  isForced[atom] = 1;
+	  forcedAtoms.push_back(atom);
 	}
+	hostForces[atom] += force;
+}
+
+void CudaCalcContForceKernel::uploadHostForces() {
+	int numEntries = forcedAtoms.size();
+	numUploadedEntries = numEntries;
+	if (numEntries == 0)
+	  return;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	cu.setAsCurrent();
+	bool sparse = (numEntries <= maxSparseEntries);
+	if (sparse) {
+	  // Pack the forces followed by the positions of their atoms in the force buffer.
 
-	if (includeForces) {
-	  CopyForcesTask task(cu, forces);
-	  cu.getPlatformData().threads.execute(task);
-	  cu.getPlatformData().threads.waitForThreads();
+	  int forceBytes = 3*numEntries*sparseForces->getElementSize();
+	  char* buffer = (char*) cu.getPinnedBuffer();
+	  long long* forceBuffer = (long long*) buffer;
+	  int* atoms = (int*) (buffer+3*maxSparseEntries*sparseForces->getElementSize());
+	  for (int i = 0; i < numEntries; i++) {
+		const Vec3& f = hostForces[forcedAtoms[i]];
+		forceBuffer[3*i] = toFixedPoint(f[0]);
+		forceBuffer[3*i+1] = toFixedPoint(f[1]);
+		forceBuffer[3*i+2] = toFixedPoint(f[2]);
+		atoms[i] = atomPosition[forcedAtoms[i]];
+	  }
+	  ContForceProfiler::pushRange("ContForce upload");
+	  cuMemcpyHtoDAsync(sparseForces->getDevicePointer(), buffer, forceBytes, stream);
+	  cuMemcpyHtoDAsync(sparseAtoms->getDevicePointer(), atoms, numEntries*sizeof(int), stream);
+	  ContForceProfiler::popRange();
+	}
+	else {
+	  ContForceProfiler::pushRange("ContForce copy forces");
+	  CopyForcesTask task(cu, hostForces);
+	  getHostThreads().execute(task);
+	  getHostThreads().waitForThreads();
+	  ContForceProfiler::popRange();
 	  cu.setAsCurrent();
+	  ContForceProfileRange range("ContForce upload");
 	  cuMemcpyHtoDAsync(contForces->getDevicePointer(), cu.getPinnedBuffer(), contForces->getSize()*contForces->getElementSize(), stream);
-	  cuEventRecord(syncEvent, stream);
-	  // Wait until executeOnWorkerThread() is finished.
+	}
+	cuEventRecord(syncEvent, stream);
+
+	// Clear the forces for the next step while the upload runs.
 
-	  cu.getWorkThread().flush();
-	  cuStreamWaitEvent(cu.getCurrentStream(), syncEvent, 0);
+	for (int i = 0; i < numEntries; i++) {
+	  hostForces[forcedAtoms[i]] = Vec3();
+	  isForced[forcedAtoms[i]] = 0;
+	}
+	forcedAtoms.clear();
+	uploadTime += chrono::duration<double>(chrono::steady_clock::now()-start).count();
+}
+
+void CudaCalcContForceKernel::addHostForces() {
+	int numEntries = numUploadedEntries;
+	if (numEntries == 0)
+	  return;
+	cuStreamWaitEvent(cu.getCurrentStream(), syncEvent, 0);
+	ContForceProfileRange range("ContForce add forces");
+	if (numEntries <= maxSparseEntries) {
+	  void* args[] = {&sparseForces->getDevicePointer(), &sparseAtoms->getDevicePointer(), &numEntries, &cu.getForce().getDevicePointer()};
+	  cu.executeKernel(addSparseForcesKernel, args, numEntries);
+	}
+	else {
 	  void* args[] = {&contForces->getDevicePointer(), &cu.getForce().getDevicePointer(), &cu.getAtomIndexArray().getDevicePointer()};
 	  cu.executeKernel(addForcesKernel, args, cu.getNumAtoms());
 	}
-	return energy;
 }
 
 void CudaCalcContForceKernel::copyParametersToContext(ContextImpl& context, const ContForce& force) {
-	if (force.getNumBonds() != npart.size())
+	// Make sure the worker thread is no longer using the evaluator.
+
+	cu.getWorkThread().flush();
+	evaluator.updateParameters(force);
+	updateInterval = force.getUpdateInterval();
+	const ContForceGroups& groups = evaluator.getGroups();
+	int numBonds = groups.getNumGroups();
+	const vector<int>& changedGroups = evaluator.getChangedGroups();
+	cu.setAsCurrent();
+	if (usePipelinedSelection && numBonds > 0) {
+		uploadGroupParams();
+		if (changedGroups.size() > 0) {
+			// The pairs selected last time may join particles that are no longer in the same group, so
+			// new ones are selected from the current positions on the next step.
+
+			hasLaggedPairs = false;
+			int numPairs = groups.getGroupStart(numBonds);
+			if (numPairs > maxPairs) {
+				cuStreamSynchronize(cu.getCurrentStream());
+				cuStreamSynchronize(stream);
+				maxPairs = numPairs;
+				delete pairAtoms;
+				delete pairGroup;
+				pairAtoms = CudaArray::create<int2>(cu, maxPairs, "contPairAtoms");
+				pairGroup = CudaArray::create<int>(cu, maxPairs, "contPairGroup");
+				if (useCellOffsets) {
+					delete pairCellOffset;
+					pairCellOffset = CudaArray::create<mm_int4>(cu, maxPairs, "contPairCellOffset");
+				}
+				for (int i = 0; i < 2; i++) {
+					cuMemFreeHost(pinnedPairs[i]);
+					cuMemHostAlloc((void**) &pinnedPairs[i], getPairBufferSize(), 0);
+				}
+			}
+		}
+	}
+	if (!useDeviceKernels || numMembers == 0)
+		return;
+
+	// Wait until the selection is no longer using the arrays on this force's stream.  If any group has
+	// outgrown its slot, all of them are laid out again.  Otherwise only the slots of the groups that
+	// changed are uploaded, and the other groups keep their components and spanning trees.
+
+	cuStreamSynchronize(stream);
+	bool fitsSlots = true;
+	for (int i = 0; i < changedGroups.size(); i++) {
+		int index = deviceIndex[changedGroups[i]];
+		if (groups.getGroupSize(changedGroups[i]) > deviceGroupStart[index+1]-deviceGroupStart[index])
+			fitsSlots = false;
+	}
+	if (!fitsSlots) {
+		layoutGroups();
+		allocateDeviceArrays();
+	}
+	else {
+		uploadGroupParams();
+
+		// The cutoffs may have changed, so every group must be processed again on the next selection.
+		// Forgetting the positions of the members makes findMovedGroups() flag all of them.
+
+		cu.clearBuffer(*lastPosition);
+		int one = 1, zero = 0;
+		for (int i = 0; i < changedGroups.size(); i++) {
+			int index = deviceIndex[changedGroups[i]];
+			int start = deviceGroupStart[index];
+			int slotSize = deviceGroupStart[index+1]-start;
+			fillSlot(index);
+			memberGroup->uploadSubArray(&memberGroupIndex[start], start, slotSize);
+			groupEnd->uploadSubArray(&deviceGroupEnd[index], index, 1);
+			needsLabel->uploadSubArray(&one, index, 1);
+			groupMoved->uploadSubArray(&one, index, 1);
+			componentCount->uploadSubArray(&zero, index, 1);
+			if (hasSortedIndices && !useNeighborList) {
+				vector<int> sorted(slotSize);
+				for (int j = 0; j < slotSize; j++)
+					sorted[j] = (memberAtom[start+j] == -1 ? 0 : atomPosition[memberAtom[start+j]]);
+				sortedIndex->uploadSubArray(&sorted[0], start, slotSize);
+			}
+		}
+
+		// The members stored at each atom position are listed all together, so the list is rebuilt.
+
+		if (changedGroups.size() > 0 && useNeighborList)
+			hasSortedIndices = false;
+		hasPairDistances = false;
+	}
+	if (changedGroups.size() > 0)
+		hasChangedGroups = true;
+}
+
+void CudaCalcContForceKernel::getGroupStatistics(int group, int& numComponents, vector<int>& particle1, vector<int>& particle2,
+						 vector<double>& distances) {
+	if (!useDeviceKernels || numMembers == 0) {
+		// Make sure the worker thread is no longer using the evaluator.
+
+		cu.getWorkThread().flush();
+		evaluator.getGroupStatistics(group, numComponents, particle1, particle2, distances);
+		return;
+	}
+	cu.setAsCurrent();
+	cuStreamSynchronize(stream);
+	vector<int> counts;
+	componentCount->download(counts);
+	int index = deviceIndex[group];
+	numComponents = counts[index];
+	particle1.clear();
+	particle2.clear();
+	distances.clear();
+	if (numComponents < 2)
+		return;
+
+	// If the restraints were not applied since the pairs were last selected, compute the distances
+	// without accumulating any forces or energy.
+
+	if (!hasPairDistances) {
+		bool forces = includeForces, energy = includeEnergy;
+		includeForces = includeEnergy = false;
+		gatherPositionsOnDevice();
+		applyRestraintsOnDevice();
+		includeForces = forces;
+		includeEnergy = energy;
+	}
+
+	// Every root that applies a pair has recorded its distance.  Download what is needed to find
+	// those pairs in the group.
+
+	vector<int> outside;
+	vector<unsigned long long> pairs;
+	vector<double> r;
+	nearestOutside->download(outside);
+	bestPair->download(pairs);
+	if (cu.getUseDoublePrecision())
+		pairDistance->download(r);
+	else {
+		vector<float> rFloat;
+		pairDistance->download(rFloat);
+		r.assign(rFloat.begin(), rFloat.end());
+	}
+	for (int member = deviceGroupStart[index]; member < deviceGroupEnd[index]; member++) {
+		if (r[member] < 0)
+			continue;
+		int member1 = (int) (pairs[member] & 0xFFFFFFFF);
+		int member2 = outside[member1];
+		particle1.push_back(memberAtom[min(member1, member2)]);
+		particle2.push_back(memberAtom[max(member1, member2)]);
+		distances.push_back(r[member]);
+	}
+}
+
+void CudaCalcContForceKernel::getGroupSummaries(vector<int>& numComponents, vector<int>& numPairs, vector<double>& minDistances) {
+	if (!useDeviceKernels || numMembers == 0) {
+		cu.getWorkThread().flush();
+		evaluator.getGroupSummaries(numComponents, numPairs, minDistances);
+		return;
+	}
+	cu.setAsCurrent();
+	cuStreamSynchronize(stream);
+	if (!hasPairDistances) {
+		bool forces = includeForces, energy = includeEnergy;
+		includeForces = includeEnergy = false;
+		gatherPositionsOnDevice();
+		applyRestraintsOnDevice();
+		includeForces = forces;
+		includeEnergy = energy;
+	}
+	int numBonds = deviceGroup.size();
+	void* summaryArgs[] = {&pairDistance->getDevicePointer(), &groupStart->getDevicePointer(), &groupEnd->getDevicePointer(),
+			&componentCount->getDevicePointer(), &groupSummary->getDevicePointer(), &groupMinDistance->getDevicePointer(), &numBonds};
+	cu.executeKernel(summarizeGroupsKernel, summaryArgs, min(numBonds, cu.getNumThreadBlocks())*SUMMARY_BLOCK_SIZE, SUMMARY_BLOCK_SIZE);
+
+	// The summaries are stored by slot.  Put them back in the order of the groups.
+
+	vector<int2> summary;
+	vector<double> r;
+	groupSummary->download(summary);
+	if (cu.getUseDoublePrecision())
+		groupMinDistance->download(r);
+	else {
+		vector<float> rFloat;
+		groupMinDistance->download(rFloat);
+		r.assign(rFloat.begin(), rFloat.end());
+	}
+	numComponents.resize(numBonds);
+	numPairs.resize(numBonds);
+	minDistances.resize(numBonds);
+	for (int group = 0; group < numBonds; group++) {
+		int index = deviceIndex[group];
+		numComponents[group] = summary[index].x;
+		numPairs[group] = summary[index].y;
+		minDistances[group] = r[index];
+	}
+}
+
+void CudaCalcContForceKernel::getPhaseTimes(double& distanceTime, double& labelingTime, double& selectionTime, double& uploadTime) {
+	if (useDeviceKernels && numMembers > 0) {
+		cu.setAsCurrent();
+		for (int i = 0; i < NUM_TIMING_SLOTS; i++)
+			if (isTimingPending[i])
+				accumulateTiming(i);
+		distanceTime = 0.0;
+		labelingTime = this->labelingTime;
+		selectionTime = this->selectionTime;
+	}
+	else {
+		cu.getWorkThread().flush();
+		evaluator.getPhaseTimes(distanceTime, labelingTime, selectionTime);
+	}
+	uploadTime = this->uploadTime;
+}
+
+void CudaCalcContForceKernel::createCheckpoint(ContextImpl& context, ostream& checkpoint) {
+	// Make sure the worker thread is no longer using the evaluator or the pairs selected on it.
+
+	cu.getWorkThread().flush();
+	ContForceCheckpoint::write(checkpoint, lastSelectionStep);
+	evaluator.createCheckpoint(checkpoint);
+	if (usePipelinedSelection) {
+		ContForceCheckpoint::write(checkpoint, hasLaggedPairs);
+		ContForceCheckpoint::write(checkpoint, laggedPairs);
+		ContForceCheckpoint::write(checkpoint, laggedPairGroups);
+	}
+	if (!useDeviceKernels || numMembers == 0)
+		return;
+
+	// The arrays are indexed by the slots of the groups and their members, so the layout is written too.
+
+	cu.setAsCurrent();
+	cuStreamSynchronize(stream);
+	vector<int> buckets(bucketStart, bucketStart+NUM_SIZE_BUCKETS+2);
+	ContForceCheckpoint::write(checkpoint, hasChangedGroups);
+	ContForceCheckpoint::write(checkpoint, deviceGroup);
+	ContForceCheckpoint::write(checkpoint, deviceGroupStart);
+	ContForceCheckpoint::write(checkpoint, buckets);
+	writeArray(checkpoint, *parent);
+	writeArray(checkpoint, *nearestOutside);
+	writeArray(checkpoint, *bestPair);
+	writeArray(checkpoint, *componentCount);
+	writeArray(checkpoint, *treeEdge);
+	writeArray(checkpoint, *needsLabel);
+	writeArray(checkpoint, *lastPosition);
+	writeArray(checkpoint, *groupMoved);
+}
+
+void CudaCalcContForceKernel::loadCheckpoint(ContextImpl& context, istream& checkpoint) {
+	cu.getWorkThread().flush();
+	ContForceCheckpoint::read(checkpoint, lastSelectionStep);
+	evaluator.loadCheckpoint(checkpoint);
+	const ContForceGroups& groups = evaluator.getGroups();
+	int numBonds = groups.getNumGroups();
+	if (usePipelinedSelection) {
+		ContForceCheckpoint::read(checkpoint, hasLaggedPairs);
+		ContForceCheckpoint::read(checkpoint, laggedPairs);
+		ContForceCheckpoint::read(checkpoint, laggedPairGroups);
+		if (laggedPairs.size() != 2*laggedPairGroups.size() || laggedPairGroups.size() > maxPairs)
+			throw OpenMMException("ContForce: the checkpoint was created for a different force");
+	}
+	if (!useDeviceKernels || numMembers == 0)
+		return;
+
+	// The groups may have been laid out differently if their members changed before the checkpoint
+	// was created, so they are moved to the slots recorded in it.
+
+	cu.setAsCurrent();
+	cuStreamSynchronize(stream);
+	vector<int> savedGroup, savedGroupStart, savedBuckets;
+	ContForceCheckpoint::read(checkpoint, hasChangedGroups);
+	ContForceCheckpoint::read(checkpoint, savedGroup);
+	ContForceCheckpoint::read(checkpoint, savedGroupStart);
+	ContForceCheckpoint::read(checkpoint, savedBuckets);
+	bool isValid = (savedGroup.size() == numBonds && savedGroupStart.size() == numBonds+1 && savedBuckets.size() == NUM_SIZE_BUCKETS+2);
+	vector<char> isLaidOut(numBonds, 0);
+	for (int i = 0; isValid && i < numBonds; i++) {
+		int group = savedGroup[i];
+		isValid = (group >= 0 && group < numBonds && !isLaidOut[group] && groups.getGroupSize(group) <= savedGroupStart[i+1]-savedGroupStart[i]);
+		if (isValid)
+			isLaidOut[group] = 1;
+	}
+	if (!isValid)
+		throw OpenMMException("ContForce: the checkpoint was created for a different force");
+	if (savedGroup != deviceGroup || savedGroupStart != deviceGroupStart || !equal(savedBuckets.begin(), savedBuckets.end(), bucketStart)) {
+		deviceGroup = savedGroup;
+		deviceGroupStart = savedGroupStart;
+		copy(savedBuckets.begin(), savedBuckets.end(), bucketStart);
+		for (int i = 0; i < numBonds; i++)
+			deviceIndex[deviceGroup[i]] = i;
+		numMembers = deviceGroupStart[numBonds];
+		numLargeMembers = deviceGroupStart[bucketStart[1]];
+		memberAtom.resize(numMembers);
+		memberGroupIndex.resize(numMembers);
+		for (int i = 0; i < numBonds; i++)
+			fillSlot(i);
+		allocateDeviceArrays();
+	}
+	readArray(checkpoint, *parent);
+	readArray(checkpoint, *nearestOutside);
+	readArray(checkpoint, *bestPair);
+	readArray(checkpoint, *componentCount);
+	readArray(checkpoint, *treeEdge);
+	readArray(checkpoint, *needsLabel);
+	readArray(checkpoint, *lastPosition);
+	readArray(checkpoint, *groupMoved);
+	hasPairDistances = false;
+}
+
+class CudaParallelCalcContForceKernel::Task : public CudaContext::WorkTask {
+public:
+	Task(ContextImpl& context, CudaCalcContForceKernel& kernel, bool includeForces, bool includeEnergy, double& energy) :
+		context(context), kernel(kernel), includeForces(includeForces), includeEnergy(includeEnergy), energy(energy) {
+	}
+	void execute() {
+		energy += kernel.execute(context, includeForces, includeEnergy);
+	}
+private:
+	ContextImpl& context;
+	CudaCalcContForceKernel& kernel;
+	bool includeForces, includeEnergy;
+	double& energy;
+};
+
+CudaParallelCalcContForceKernel::CudaParallelCalcContForceKernel(string name, const Platform& platform, CudaPlatform::PlatformData& data,
+								 ContextImpl& contextImpl) : CalcContForceKernel(name, platform), data(data) {
+	for (int i = 0; i < (int) data.contexts.size(); i++)
+		kernels.push_back(Kernel(new CudaCalcContForceKernel(name, platform, *data.contexts[i], contextImpl)));
+}
+
+double CudaParallelCalcContForceKernel::estimateGroupCost(int size, bool useDeviceKernels) {
+	// On the host the pairs are found from a cell list and the members are sorted.  On the device a
+	// group that fits in a warp is processed by one warp, which compares all its pairs at once, so its
+	// cost grows with the number of members.  The kernels for larger groups compare every pair of
+	// members, since the nonbonded neighbor list is not used with several devices.
+
+	if (!useDeviceKernels)
+		return size*log((double) size+1);
+	if (size <= CudaCalcContForceKernel::getMaxSmallGroupSize())
+		return size;
+	return (double) size*size;
+}
+
+void CudaParallelCalcContForceKernel::initialize(const System& system, const ContForce& force) {
+	// Assign the groups to devices starting with the most expensive one, each to the device with the
+	// least work so far.  The groups stay on the same devices when their parameters change.
+
+	int numBonds = force.getNumBonds();
+	int numDevices = kernels.size();
+	vector<pair<double, int> > costs(numBonds);
+	vector<int> idxs;
+	int npart;
+	double length, k;
+	for (int i = 0; i < numBonds; i++) {
+		force.getBondParameters(i, idxs, npart, length, k);
+		costs[i] = make_pair(-estimateGroupCost(npart, force.getUseDeviceKernels()), i);
+	}
+	sort(costs.begin(), costs.end());
+	vector<double> load(numDevices, 0.0);
+	bondDevice.resize(numBonds);
+	for (int i = 0; i < numBonds; i++) {
+		int device = min_element(load.begin(), load.end())-load.begin();
+		bondDevice[costs[i].second] = device;
+		load[device] -= costs[i].first;
+	}
+	deviceBonds.clear();
+	deviceBonds.resize(numDevices);
+	bondIndex.resize(numBonds);
+	for (int i = 0; i < numBonds; i++) {
+		bondIndex[i] = deviceBonds[bondDevice[i]].size();
+		deviceBonds[bondDevice[i]].push_back(i);
+	}
+	for (int i = 0; i < numDevices; i++) {
+		ContForce deviceForce;
+		createDeviceForce(force, i, deviceForce);
+		getKernel(i).initialize(system, deviceForce);
+	}
+}
+
+void CudaParallelCalcContForceKernel::createDeviceForce(const ContForce& force, int device, ContForce& deviceForce) const {
+	vector<int> idxs;
+	int npart;
+	double length, k;
+	for (int i = 0; i < deviceBonds[device].size(); i++) {
+		force.getBondParameters(deviceBonds[device][i], idxs, npart, length, k);
+		deviceForce.addBond(idxs, npart, length, k);
+	}
+	deviceForce.setUseDeviceKernels(force.getUseDeviceKernels());
+	deviceForce.setUsePipelinedSelection(force.getUsePipelinedSelection());
+	deviceForce.setUseNonbondedNeighborList(force.getUseNonbondedNeighborList());
+	deviceForce.setSkinDistance(force.getSkinDistance());
+	deviceForce.setHierarchicalGroupSize(force.getHierarchicalGroupSize());
+	deviceForce.setUpdateInterval(force.getUpdateInterval());
+	deviceForce.setUsesPeriodicBoundaryConditions(force.usesPeriodicBoundaryConditions());
+	deviceForce.setForceGroup(force.getForceGroup());
+}
+
+double CudaParallelCalcContForceKernel::execute(ContextImpl& context, bool includeForces, bool includeEnergy) {
+	for (int i = 0; i < (int) data.contexts.size(); i++) {
+		CudaContext& cu = *data.contexts[i];
+		cu.getWorkThread().addTask(new Task(context, getKernel(i), includeForces, includeEnergy, data.contextEnergy[i]));
+	}
+	return 0.0;
+}
+
+void CudaParallelCalcContForceKernel::copyParametersToContext(ContextImpl& context, const ContForce& force) {
+	if (force.getNumBonds() != bondDevice.size())
 		throw OpenMMException("updateParametersInContext: The number of bonds has changed");
-	for (int i = 0; i < force.getNumBonds(); i++) {
-		vector<int> test_idxs;
-		int test_npart;
-		force.getBondParameters(i, test_idxs, test_npart, length[i], k[i]);
-		if (test_npart != npart[i] || test_idxs != idxs[i])
-			throw OpenMMException("updateParametersInContext: A particle index has changed");
+	for (int i = 0; i < (int) kernels.size(); i++) {
+		ContForce deviceForce;
+		createDeviceForce(force, i, deviceForce);
+		getKernel(i).copyParametersToContext(context, deviceForce);
+	}
+}
+
+long long CudaParallelCalcContForceKernel::getNumCacheHits() const {
+	long long hits = 0;
+	for (int i = 0; i < (int) kernels.size(); i++)
+		hits += kernels[i].getAs<CudaCalcContForceKernel>().getNumCacheHits();
+	return hits;
+}
+
+void CudaParallelCalcContForceKernel::getGroupStatistics(int group, int& numComponents, vector<int>& particle1, vector<int>& particle2,
+							 vector<double>& distances) {
+	getKernel(bondDevice[group]).getGroupStatistics(bondIndex[group], numComponents, particle1, particle2, distances);
+}
+
+void CudaParallelCalcContForceKernel::getGroupSummaries(vector<int>& numComponents, vector<int>& numPairs, vector<double>& minDistances) {
+	int numBonds = bondDevice.size();
+	numComponents.resize(numBonds);
+	numPairs.resize(numBonds);
+	minDistances.resize(numBonds);
+	vector<int> deviceComponents, devicePairs;
+	vector<double> deviceDistances;
+	for (int device = 0; device < (int) kernels.size(); device++) {
+		getKernel(device).getGroupSummaries(deviceComponents, devicePairs, deviceDistances);
+		for (int i = 0; i < (int) deviceBonds[device].size(); i++) {
+			int group = deviceBonds[device][i];
+			numComponents[group] = deviceComponents[i];
+			numPairs[group] = devicePairs[i];
+			minDistances[group] = deviceDistances[i];
+		}
+	}
+}
+
+void CudaParallelCalcContForceKernel::getPhaseTimes(double& distanceTime, double& labelingTime, double& selectionTime, double& uploadTime) {
+	distanceTime = labelingTime = selectionTime = uploadTime = 0.0;
+	for (int i = 0; i < (int) kernels.size(); i++) {
+		double distance, labeling, selection, upload;
+		getKernel(i).getPhaseTimes(distance, labeling, selection, upload);
+		distanceTime += distance;
+		labelingTime += labeling;
+		selectionTime += selection;
+		uploadTime += upload;
 	}
 }
+
+void CudaParallelCalcContForceKernel::createCheckpoint(ContextImpl& context, ostream& stream) {
+	int numDevices = kernels.size();
+	ContForceCheckpoint::write(stream, numDevices);
+	for (int i = 0; i < numDevices; i++)
+		getKernel(i).createCheckpoint(context, stream);
+}
+
+void CudaParallelCalcContForceKernel::loadCheckpoint(ContextImpl& context, istream& stream) {
+	int numDevices = kernels.size();
+	ContForceCheckpoint::readExpected(stream, numDevices);
+	for (int i = 0; i < numDevices; i++)
+		getKernel(i).loadCheckpoint(context, stream);
+}
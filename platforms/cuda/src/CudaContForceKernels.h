@@ -33,8 +33,11 @@
  * -------------------------------------------------------------------------- */
 
 #include "ContForceKernels.h"
+#include "internal/ContForceEvaluator.h"
 #include "openmm/cuda/CudaContext.h"
 #include "openmm/cuda/CudaArray.h"
+#include "openmm/cuda/CudaPlatform.h"
+#include "openmm/Kernel.h"
 
 namespace ContForcePlugin {
 
@@ -43,8 +46,17 @@ namespace ContForcePlugin {
  */
 class CudaCalcContForceKernel : public CalcContForceKernel {
 public:
-    CudaCalcContForceKernel(std::string name, const OpenMM::Platform& platform, OpenMM::CudaContext& cu) :
-	    CalcContForceKernel(name, platform), hasInitializedKernel(false), cu(cu) {
+    CudaCalcContForceKernel(std::string name, const OpenMM::Platform& platform, OpenMM::CudaContext& cu, OpenMM::ContextImpl& contextImpl) :
+	    CalcContForceKernel(name, platform), hasInitializedKernel(false), cu(cu), contextImpl(contextImpl), isComputing(false), usePeriodic(false), contForces(NULL), sparseForces(NULL),
+	    sparseAtoms(NULL), maxSparseEntries(0), usePipelinedSelection(false), hasLaggedPairs(false), maxPairs(0), numLaggedPairs(0),
+	    currentPairBuffer(0), pairAtoms(NULL), pairGroup(NULL), pairCellOffset(NULL), selectionThreads(NULL), pinnedPositions(NULL), numMembers(0),
+	    hasSortedIndices(false), useCellOffsets(false), sortedIndex(NULL), memberGroup(NULL), memberPos(NULL), memberCellOffset(NULL), groupStart(NULL), groupEnd(NULL), groupParams(NULL), parent(NULL),
+	    nearestOutside(NULL), bestPair(NULL), componentCount(NULL), treeEdge(NULL), needsLabel(NULL),
+	    lastPosition(NULL), groupMoved(NULL), pairDistance(NULL), groupSummary(NULL), groupMinDistance(NULL), memberCell(NULL), cellCount(NULL),
+	    cellStart(NULL), cellMembers(NULL), hasPairDistances(false), useNeighborList(false), isSelectionDeferred(false),
+		    atomMemberStart(NULL), atomMembers(NULL), numLargeMembers(0), hasChangedGroups(false), selectChangedGroupsOnly(false),
+	    updateInterval(1), lastSelectionStep(-1), useMultipleDevices(false), deviceThreads(NULL),
+	    currentTimingSlot(0), labelingTime(0.0), selectionTime(0.0), uploadTime(0.0) {
     }
     ~CudaCalcContForceKernel();
     /**
@@ -56,7 +68,10 @@ public:
      */
     void initialize(const OpenMM::System& system, const ContForce& force);
     /**
-     * Execute the kernel to calculate the forces and/or energy.
+     * Execute the kernel to calculate the forces and/or energy.  The calculation is done by
+     * beginComputation(), executeOnWorkerThread() and finishComputation() so it can overlap the other
+     * forces.  The only thing done here is launching a selection that uses the nonbonded neighbor list,
+     * which is not built until after beginComputation().
      *
      * @param context        the context in which to execute this kernel
      * @param includeForces  true if forces should be calculated
@@ -65,20 +80,337 @@ public:
      */
     double execute(OpenMM::ContextImpl& context, bool includeForces, bool includeEnergy);
     void copyParametersToContext(OpenMM::ContextImpl& context, const ContForce& force);
+    /**
+     * Start the calculation as soon as the positions are ready.  On the host this downloads the
+     * positions and queues the calculation on the worker thread.  On the device it launches the
+     * kernels that select the pairs on this force's own stream.
+     */
+    void beginComputation(bool includeForces, bool includeEnergy, int groups);
+    /**
+     * Compute the force on the host and start uploading it.  This is invoked on the worker thread.
+     */
+    void executeOnWorkerThread();
+    /**
+     * Select the pairs to restrain on the next step from the positions downloaded by beginComputation().
+     * This is invoked on the worker thread when the selection is pipelined.
+     */
+    void selectPairsOnWorkerThread();
+    /**
+     * Wait for the calculation to finish, add the forces to the force buffer and return the energy.
+     */
+    double finishComputation(bool includeForces, bool includeEnergy, int groups);
+    /**
+     * Get how many times a group's neighbor list has been reused instead of rebuilt.
+     */
+    long long getNumCacheHits() const {
+        return evaluator.getNumCacheHits();
+    }
+    /**
+     * Get statistics about a group from the last time the force was evaluated.  When the force is
+     * computed on the device, they are downloaded from it.  When the selection is pipelined, they
+     * describe the pairs selected most recently, which are restrained on the following step.
+     */
+    void getGroupStatistics(int group, int& numComponents, std::vector<int>& particle1, std::vector<int>& particle2,
+                            std::vector<double>& distances);
+    /**
+     * Get a summary of every group from the last time the force was evaluated.  When the force is
+     * computed on the device, the summaries are reduced there and only they are downloaded.  Like
+     * getGroupStatistics(), they describe the pairs selected most recently.
+     */
+    void getGroupSummaries(std::vector<int>& numComponents, std::vector<int>& numPairs, std::vector<double>& minDistances);
+    /**
+     * Get the total time in seconds spent in each phase of the calculation.  The device kernels are
+     * timed with events, so distanceTime is always 0 for them: the distances are computed by the
+     * kernels that label the components.
+     */
+    void getPhaseTimes(double& distanceTime, double& labelingTime, double& selectionTime, double& uploadTime);
+    /**
+     * Write the state kept between steps to a checkpoint.  When the force is computed on the device,
+     * this includes the component labels, spanning trees and selected pairs stored there.  When the
+     * selection is pipelined, it includes the pairs to restrain on the next step.
+     */
+    void createCheckpoint(OpenMM::ContextImpl& context, std::ostream& checkpoint);
+    /**
+     * Load the state written to a checkpoint by createCheckpoint().  The groups are laid out on the
+     * device the same way they were when it was created.
+     */
+    void loadCheckpoint(OpenMM::ContextImpl& context, std::istream& checkpoint);
+    /**
+     * Get the number of members of the largest groups that are processed by a single warp.
+     */
+    static int getMaxSmallGroupSize() {
+        return SMALL_GROUP_SIZES[NUM_SIZE_BUCKETS-1];
+    }
 private:
     class CopyForcesTask;
+    class StartCalculationPreComputation;
+    class ExecuteTask;
+    class SelectPairsTask;
+    class AddForcesPostComputation;
+    class ReorderListener;
+    /**
+     * Wait for the positions on the main stream, then launch the selection on this force's stream so it
+     * runs while the other forces are computed.
+     */
+    void startSelectionOnDevice(bool fromNeighborList);
+    /**
+     * Launch the kernels that find the components of every group and their closest pairs.  If
+     * fromNeighborList is true, the pairs closer than the cutoff are taken from the nonbonded neighbor list.
+     */
+    void selectPairsOnDevice(bool fromNeighborList);
+    /**
+     * Decide whether the nonbonded neighbor list can be used to find the pairs closer than the cutoff
+     * when the given force groups are computed.
+     */
+    bool canUseNeighborList(int groups);
+    /**
+     * Launch the kernel that copies the current positions of the members to memberPos.
+     */
+    void gatherPositionsOnDevice();
+    /**
+     * Launch the kernel that adds the restraints between the selected pairs to the force buffer.
+     */
+    void applyRestraintsOnDevice();
+    /**
+     * Upload the pairs selected on the last step and start selecting the ones for the next step.
+     */
+    void beginPipelinedComputation();
+    /**
+     * Select pairs from the positions in pos and record them, with atoms in their original order.
+     */
+    void selectLaggedPairs(OpenMM::ThreadPool& threads);
+    /**
+     * Start uploading the recorded pairs on this force's stream, with atoms in their current order.
+     */
+    void uploadLaggedPairs();
+    /**
+     * Add a force computed on the host to an atom, recording the atom the first time it receives one.
+     */
+    void addHostForce(int atom, const OpenMM::Vec3& force);
+    /**
+     * Start uploading the host forces to the device on this force's stream.  Only the atoms that
+     * received a force are uploaded unless there are too many of them.
+     */
+    void uploadHostForces();
+    /**
+     * Make the main stream wait for the upload and add the uploaded forces to the force buffer.
+     */
+    void addHostForces();
+    /**
+     * Get the thread pool used for the calculations on the host.  With several devices each one has
+     * its own, since their calculations run at the same time.
+     */
+    OpenMM::ThreadPool& getHostThreads();
+    /**
+     * Download the positions from the device.  This is used when the calculation runs on the device's
+     * worker thread, where the Context cannot be asked for them.
+     */
+    void downloadPositions();
+    /**
+     * Copy positions downloaded from the device to pos, with atoms in their original order.
+     */
+    void readPositions(const void* posq);
+    /**
+     * Undo the moves of the atoms into the periodic box in pos, given the offsets of the cells they
+     * were moved from, indexed by their current positions.
+     */
+    void removeCellOffsets(const std::vector<OpenMM::mm_int4>& offsets);
+    /**
+     * Get the size in bytes of each buffer the pairs selected on the host are uploaded from.
+     */
+    int getPairBufferSize() const;
+    /**
+     * Decide whether new pairs should be selected on this step, or the ones selected earlier
+     * restrained again.
+     */
+    bool shouldSelectPairs(OpenMM::ContextImpl& context);
+    /**
+     * Wait for the kernels timed by one set of events to finish and add their times to the totals.
+     */
+    void accumulateTiming(int slot);
+    /**
+     * Choose where every group is stored in the flat list of members.  Each group gets a slot with room
+     * for it to grow, which is filled by fillSlot().
+     */
+    void layoutGroups();
+    /**
+     * Get how many members to leave room for in the slot of a group, given its device index and size.
+     */
+    int getSlotSize(int index, int size) const;
+    /**
+     * Copy the members of a group to its slot in memberAtom and memberGroupIndex.
+     */
+    void fillSlot(int index);
+    /**
+     * Allocate the arrays used by the device kernels to match the layout of the groups, and reset
+     * the state of every group so all of them are processed on the next selection.
+     */
+    void allocateDeviceArrays();
+    void deleteDeviceArrays();
+    void uploadGroupParams();
+    void updateSortedIndices();
+    /**
+     * Upload the offsets of the cells the members' atoms were moved from into the periodic box if any
+     * of them has changed.
+     */
+    void updateCellOffsets();
+    static const int NUM_SIZE_BUCKETS = 2;
+    static const int NUM_TIMING_SLOTS = 4;
+    static const int SMALL_GROUP_SIZES[NUM_SIZE_BUCKETS];
+    static const int SMALL_GROUP_BLOCK_SIZE;
+    static const int SUMMARY_BLOCK_SIZE;
+    static const int CELL_SCAN_BLOCK_SIZE;
     bool hasInitializedKernel;
     OpenMM::CudaContext& cu;
+    OpenMM::ContextImpl& contextImpl;
+    int forceGroupFlag;
+    bool isComputing, includeForces, includeEnergy, selectPairs;
+    double hostEnergy;
+    int numUploadedEntries;
     bool usePeriodic;
-    CUfunction addForcesKernel;
-    int numBonds;
-    std::vector<std::vector<int>> idxs;
-    std::vector<int> npart;
-    std::vector<double> length, k;
+    CUfunction addForcesKernel, addSparseForcesKernel;
     CUstream stream;
     CUevent syncEvent;
     OpenMM::CudaArray* contForces;
+    OpenMM::CudaArray* sparseForces;
+    OpenMM::CudaArray* sparseAtoms;
+    int maxSparseEntries;
+    std::vector<OpenMM::Vec3> hostForces;
+    std::vector<int> forcedAtoms;
+    std::vector<char> isForced;
+    std::vector<int> atomPosition;
+    bool usePipelinedSelection, hasLaggedPairs;
+    int maxPairs, numLaggedPairs, currentPairBuffer;
+    std::vector<int> laggedPairs;
+    std::vector<int> laggedPairGroups;
+    OpenMM::CudaArray* pairAtoms;
+    OpenMM::CudaArray* pairGroup;
+    OpenMM::CudaArray* pairCellOffset;
+    std::vector<OpenMM::mm_int4> laggedCellOffsets;
+    OpenMM::ThreadPool* selectionThreads;
+    void* pinnedPositions;
+    int* pinnedPairs[2];
+    CUevent positionsEvent;
+    CUevent pairsEvent[2];
+    CUfunction applyPairRestraintsKernel;
+    bool useDeviceKernels;
+    int numMembers;
+    bool hasSortedIndices, useCellOffsets;
+    OpenMM::CudaArray* sortedIndex;
+    OpenMM::CudaArray* memberGroup;
+    OpenMM::CudaArray* memberPos;
+    OpenMM::CudaArray* memberCellOffset;
+    std::vector<OpenMM::mm_int4> memberCellOffsets;
+    OpenMM::CudaArray* groupStart;
+    OpenMM::CudaArray* groupEnd;
+    OpenMM::CudaArray* groupParams;
+    OpenMM::CudaArray* parent;
+    OpenMM::CudaArray* nearestOutside;
+    OpenMM::CudaArray* bestPair;
+    OpenMM::CudaArray* componentCount;
+    OpenMM::CudaArray* treeEdge;
+    OpenMM::CudaArray* needsLabel;
+    OpenMM::CudaArray* lastPosition;
+    OpenMM::CudaArray* groupMoved;
+    OpenMM::CudaArray* pairDistance;
+    OpenMM::CudaArray* groupSummary;
+    OpenMM::CudaArray* groupMinDistance;
+    OpenMM::CudaArray* memberCell;
+    OpenMM::CudaArray* cellCount;
+    OpenMM::CudaArray* cellStart;
+    OpenMM::CudaArray* cellMembers;
+    bool hasPairDistances;
+    bool useNeighborList, isSelectionDeferred;
+    int nonbondedGroupFlag;
+    double nonbondedCutoff, maxLargeGroupCutoff;
+    OpenMM::CudaArray* atomMemberStart;
+    OpenMM::CudaArray* atomMembers;
+    std::vector<int> deviceGroup;
+    std::vector<int> deviceIndex;
+    std::vector<int> deviceGroupStart;
+    std::vector<int> deviceGroupEnd;
+    std::vector<int> memberAtom;
+    std::vector<int> memberGroupIndex;
+    int bucketStart[NUM_SIZE_BUCKETS+2];
+    int numLargeMembers;
+    bool hasChangedGroups, selectChangedGroupsOnly;
+    CUfunction gatherPositionsKernel, findMovedGroupsKernel, checkSpanningTreesKernel, initComponentsKernel, linkNeighborsKernel, flattenComponentsKernel, findClosestPairsKernel, applyRestraintsKernel;
+    CUfunction countCellsKernel, findCellStartsKernel, fillCellsKernel, findDistantPairsKernel;
+    CUfunction linkListedNeighborsKernel, summarizeGroupsKernel;
+    CUfunction selectSmallGroupPairsKernel[NUM_SIZE_BUCKETS];
+    int updateInterval;
+    long long lastSelectionStep;
+    bool useMultipleDevices;
+    OpenMM::ThreadPool* deviceThreads;
+    ContForceEvaluator evaluator;
+    std::vector<OpenMM::Vec3> pos;
+    OpenMM::Vec3 boxVectors[3];
+    std::vector<std::pair<int, OpenMM::Vec3> > groupForces;
+    CUevent timingEvents[NUM_TIMING_SLOTS][3];
+    bool isTimingPending[NUM_TIMING_SLOTS];
+    int currentTimingSlot;
+    double labelingTime, selectionTime, uploadTime;
+};
 
+/**
+ * This kernel is used when the CUDA platform runs on several devices.  The groups are divided between
+ * the devices by their estimated cost, and a CudaCalcContForceKernel on each device handles its share
+ * of them.  The forces it adds to its device's force buffer are summed with the other devices' ones
+ * by the platform.
+ */
+class CudaParallelCalcContForceKernel : public CalcContForceKernel {
+public:
+    CudaParallelCalcContForceKernel(std::string name, const OpenMM::Platform& platform, OpenMM::CudaPlatform::PlatformData& data,
+                                    OpenMM::ContextImpl& contextImpl);
+    CudaCalcContForceKernel& getKernel(int index) {
+        return dynamic_cast<CudaCalcContForceKernel&>(kernels[index].getImpl());
+    }
+    /**
+     * Initialize the kernel.
+     *
+     * @param system         the System this kernel will be applied to
+     * @param force          the ContForce this kernel will be used for
+     */
+    void initialize(const OpenMM::System& system, const ContForce& force);
+    /**
+     * Execute the kernel to calculate the forces and/or energy.
+     *
+     * @param context        the context in which to execute this kernel
+     * @param includeForces  true if forces should be calculated
+     * @param includeEnergy  true if the energy should be calculated
+     * @return the potential energy due to the force
+     */
+    double execute(OpenMM::ContextImpl& context, bool includeForces, bool includeEnergy);
+    void copyParametersToContext(OpenMM::ContextImpl& context, const ContForce& force);
+    long long getNumCacheHits() const;
+    void getGroupStatistics(int group, int& numComponents, std::vector<int>& particle1, std::vector<int>& particle2,
+                            std::vector<double>& distances);
+    void getGroupSummaries(std::vector<int>& numComponents, std::vector<int>& numPairs, std::vector<double>& minDistances);
+    /**
+     * Get the total time in seconds spent in each phase of the calculation, summed over all devices.
+     */
+    void getPhaseTimes(double& distanceTime, double& labelingTime, double& selectionTime, double& uploadTime);
+    /**
+     * Write the state of every device's kernel to a checkpoint.  It can only be loaded on the same
+     * number of devices.
+     */
+    void createCheckpoint(OpenMM::ContextImpl& context, std::ostream& stream);
+    void loadCheckpoint(OpenMM::ContextImpl& context, std::istream& stream);
+private:
+    class Task;
+    /**
+     * Estimate the relative cost of processing a group with the given number of members.
+     */
+    static double estimateGroupCost(int size, bool useDeviceKernels);
+    /**
+     * Create a ContForce with the settings of force and the bonds assigned to one device.
+     */
+    void createDeviceForce(const ContForce& force, int device, ContForce& deviceForce) const;
+    OpenMM::CudaPlatform::PlatformData& data;
+    std::vector<OpenMM::Kernel> kernels;
+    std::vector<std::vector<int> > deviceBonds;
+    std::vector<int> bondDevice;
+    std::vector<int> bondIndex;
 };
 
 } // namespace ContForcePlugin
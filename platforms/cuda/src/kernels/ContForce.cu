@@ -1,9 +1,84 @@
 extern "C" __global__
-void addForces(const real* __restrict__ forces, long long* __restrict__ forceBuffers, int* __restrict__ atomIndex) {
+void addForces(const long long* __restrict__ forces, long long* __restrict__ forceBuffers, int* __restrict__ atomIndex) {
   for (int atom = blockIdx.x*blockDim.x+threadIdx.x; atom < NUM_ATOMS; atom += blockDim.x*gridDim.x) {
 	int index = atomIndex[atom];
-	forceBuffers[atom] += (long long) (forces[3*index]*0x100000000);
-	forceBuffers[atom+PADDED_NUM_ATOMS] += (long long) (forces[3*index+1]*0x100000000);
-	forceBuffers[atom+2*PADDED_NUM_ATOMS] += (long long) (forces[3*index+2]*0x100000000);
+	forceBuffers[atom] += forces[3*index];
+	forceBuffers[atom+PADDED_NUM_ATOMS] += forces[3*index+1];
+	forceBuffers[atom+2*PADDED_NUM_ATOMS] += forces[3*index+2];
   }
 }
+
+/**
+ * Add the forces on a short list of atoms.  Each entry holds the force on one atom, and atoms[entry]
+ * is the position of that atom in the force buffer.  No atom appears in more than one entry.
+ */
+extern "C" __global__
+void addSparseForces(const long long* __restrict__ forces, const int* __restrict__ atoms, int numEntries, long long* __restrict__ forceBuffers) {
+  for (int entry = blockIdx.x*blockDim.x+threadIdx.x; entry < numEntries; entry += blockDim.x*gridDim.x) {
+	int atom = atoms[entry];
+	forceBuffers[atom] += forces[3*entry];
+	forceBuffers[atom+PADDED_NUM_ATOMS] += forces[3*entry+1];
+	forceBuffers[atom+2*PADDED_NUM_ATOMS] += forces[3*entry+2];
+  }
+}
+
+#ifdef USE_PERIODIC
+#define APPLY_PERIODIC(dx, dy, dz) { \
+  real scale3 = floor(dz*invPeriodicBoxSize.z+0.5f); \
+  dx -= scale3*periodicBoxVecZ.x; \
+  dy -= scale3*periodicBoxVecZ.y; \
+  dz -= scale3*periodicBoxVecZ.z; \
+  real scale2 = floor(dy*invPeriodicBoxSize.y+0.5f); \
+  dx -= scale2*periodicBoxVecY.x; \
+  dy -= scale2*periodicBoxVecY.y; \
+  real scale1 = floor(dx*invPeriodicBoxSize.x+0.5f); \
+  dx -= scale1*periodicBoxVecX.x; \
+}
+#else
+#define APPLY_PERIODIC(dx, dy, dz)
+#endif
+
+/**
+ * Restrain pairs selected on the host at their current separations.  pairAtoms holds the positions
+ * of the two atoms in posq, and pairGroup the group whose parameters apply to the pair.  The forces
+ * and energy are only accumulated if requested.  If USE_PERIODIC is defined, the separations are
+ * measured to the nearest periodic image.  If USE_CELL_OFFSETS is defined, the System is periodic but
+ * the force is not, and pairCellOffset holds the difference between the offsets of the cells the two
+ * atoms were moved from when they were put into the box, which is undone.
+ */
+extern "C" __global__
+void applyPairRestraints(const real4* __restrict__ posq, const int2* __restrict__ pairAtoms, const int* __restrict__ pairGroup,
+		const int4* __restrict__ pairCellOffset, const real2* __restrict__ groupParams, int numPairs, unsigned long long* __restrict__ forceBuffers, mixed* __restrict__ energyBuffer,
+		int includeForces, int includeEnergy, real4 invPeriodicBoxSize, real4 periodicBoxVecX, real4 periodicBoxVecY, real4 periodicBoxVecZ) {
+  mixed energy = 0;
+  for (int pair = blockIdx.x*blockDim.x+threadIdx.x; pair < numPairs; pair += blockDim.x*gridDim.x) {
+	int2 atoms = pairAtoms[pair];
+	real4 pos1 = posq[atoms.x];
+	real4 pos2 = posq[atoms.y];
+	real dx = pos1.x-pos2.x;
+	real dy = pos1.y-pos2.y;
+	real dz = pos1.z-pos2.z;
+#ifdef USE_CELL_OFFSETS
+	int4 offset = pairCellOffset[pair];
+	dx -= offset.x*periodicBoxVecX.x+offset.y*periodicBoxVecY.x+offset.z*periodicBoxVecZ.x;
+	dy -= offset.y*periodicBoxVecY.y+offset.z*periodicBoxVecZ.y;
+	dz -= offset.z*periodicBoxVecZ.z;
+#endif
+	APPLY_PERIODIC(dx, dy, dz)
+	real r = SQRT(dx*dx+dy*dy+dz*dz);
+	real2 params = groupParams[pairGroup[pair]];
+	real dr = r-params.x;
+	energy += params.y*dr*dr;
+	if (!includeForces)
+	  continue;
+	real dEdR = (r > 0 ? 2*params.y*dr/r : 0);
+	atomicAdd(&forceBuffers[atoms.x], (unsigned long long) ((long long) (-dx*dEdR*0x100000000)));
+	atomicAdd(&forceBuffers[atoms.x+PADDED_NUM_ATOMS], (unsigned long long) ((long long) (-dy*dEdR*0x100000000)));
+	atomicAdd(&forceBuffers[atoms.x+2*PADDED_NUM_ATOMS], (unsigned long long) ((long long) (-dz*dEdR*0x100000000)));
+	atomicAdd(&forceBuffers[atoms.y], (unsigned long long) ((long long) (dx*dEdR*0x100000000)));
+	atomicAdd(&forceBuffers[atoms.y+PADDED_NUM_ATOMS], (unsigned long long) ((long long) (dy*dEdR*0x100000000)));
+	atomicAdd(&forceBuffers[atoms.y+2*PADDED_NUM_ATOMS], (unsigned long long) ((long long) (dz*dEdR*0x100000000)));
+  }
+  if (includeEnergy)
+	energyBuffer[blockIdx.x*blockDim.x+threadIdx.x] += energy;
+}
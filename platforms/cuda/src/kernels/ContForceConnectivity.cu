@@ -0,0 +1,839 @@
+/**
+ * These kernels evaluate the continuity force without leaving the device.  The members
+ * of all groups are stored one after another, so a member is identified by its index
+ * into that flat list.  Every group has a slot from groupStart[g] to groupStart[g+1] with
+ * room for more members than it has, so its members can change without moving the other
+ * groups.  Its members occupy the range groupStart[g] to groupEnd[g], and the rest of the
+ * slot is marked by a memberGroup of -1.
+ *
+ * Components are tracked with a concurrent union-find forest in which a member's parent
+ * never has a higher index than the member itself.  The root of a component is therefore
+ * its lowest member once all links have been made.
+ *
+ * Every successful link is recorded as an edge of a spanning tree, stored on the root that was
+ * hooked.  If a group ends up with a single component, the next step only checks that those edges
+ * are still shorter than the cutoff.  needsLabel flags the groups for which that check failed or
+ * that were not connected, and only those groups are labeled again.
+ *
+ * The members of the groups being labeled are binned into cells at least as wide as their group's cutoff,
+ * so linkNeighbors() only compares members in adjacent cells and findClosestPairs() only searches a few cells
+ * around each member.  When the nonbonded utilities build a neighbor list with a large enough cutoff,
+ * linkListedNeighbors() takes the pairs closer than the cutoff from it, and linkNeighbors() only searches the
+ * cells if the list overflowed.
+ *
+ * Before pairs are selected, findMovedGroups() flags the groups in which some member has moved since
+ * the last selection.  The others keep the components and pairs selected for them then.
+ *
+ * Groups small enough to fit in a warp are stored after all the others and handled by the kernels at
+ * the end of this file instead, one warp per group.  The kernels above only process the first
+ * numLargeGroups groups, whose slots hold the first numLargeMembers members.
+ *
+ * If USE_PERIODIC is defined, every separation is measured to the nearest periodic image.  The box
+ * is passed to every kernel that measures one, and ignored otherwise.
+ *
+ * Each step starts with gatherPositions(), which copies the position of every member to memberPos.
+ * The other kernels read that instead of the atoms' positions, except for linkListedNeighbors(),
+ * which looks up the members from the atoms.
+ */
+
+#ifdef USE_PERIODIC
+#define APPLY_PERIODIC(dx, dy, dz) { \
+    real scale3 = floor(dz*invPeriodicBoxSize.z+0.5f); \
+    dx -= scale3*periodicBoxVecZ.x; \
+    dy -= scale3*periodicBoxVecZ.y; \
+    dz -= scale3*periodicBoxVecZ.z; \
+    real scale2 = floor(dy*invPeriodicBoxSize.y+0.5f); \
+    dx -= scale2*periodicBoxVecY.x; \
+    dy -= scale2*periodicBoxVecY.y; \
+    real scale1 = floor(dx*invPeriodicBoxSize.x+0.5f); \
+    dx -= scale1*periodicBoxVecX.x; \
+}
+#else
+#define APPLY_PERIODIC(dx, dy, dz)
+#endif
+
+inline __device__ int findRoot(volatile int* parent, int member) {
+    int current = parent[member];
+    if (current != member) {
+        // Halve the path as we walk it.  Other threads only ever lower a parent, so the
+        // path stays valid while they run.
+
+        int previous = member;
+        int next;
+        while (current > (next = parent[current])) {
+            parent[previous] = next;
+            previous = current;
+            current = next;
+        }
+    }
+    return current;
+}
+
+inline __device__ void linkMembers(int* parent, int2* treeEdge, int member1, int member2) {
+    int root1 = findRoot(parent, member1);
+    int root2 = findRoot(parent, member2);
+    while (root1 != root2) {
+        if (root1 < root2) {
+            int temp = root1;
+            root1 = root2;
+            root2 = temp;
+        }
+
+        // Hook the higher root under the lower one.  If another thread changed it first,
+        // continue from whatever it now points to.
+
+        int old = atomicCAS(&parent[root1], root1, root2);
+        if (old == root1) {
+            treeEdge[root1] = make_int2(member1, member2);
+            break;
+        }
+        root1 = old;
+    }
+}
+
+/**
+ * Copy the position of every member's atom to memberPos.  If USE_CELL_OFFSETS is defined, the System is
+ * periodic but the force is not, and reordering the atoms may have moved each one into the periodic box
+ * on its own.  The offset of the cell it was moved from is subtracted, as the Context does, so a group
+ * is not torn apart where it crosses a face of the box.
+ */
+extern "C" __global__ void gatherPositions(const real4* __restrict__ posq, const int* __restrict__ sortedIndex,
+        const int4* __restrict__ memberCellOffset, real4* __restrict__ memberPos, int numMembers,
+        real4 periodicBoxVecX, real4 periodicBoxVecY, real4 periodicBoxVecZ) {
+    for (int member = blockIdx.x*blockDim.x+threadIdx.x; member < numMembers; member += blockDim.x*gridDim.x) {
+        real4 pos = posq[sortedIndex[member]];
+#ifdef USE_CELL_OFFSETS
+        int4 offset = memberCellOffset[member];
+        pos.x -= offset.x*periodicBoxVecX.x+offset.y*periodicBoxVecY.x+offset.z*periodicBoxVecZ.x;
+        pos.y -= offset.y*periodicBoxVecY.y+offset.z*periodicBoxVecZ.y;
+        pos.z -= offset.z*periodicBoxVecZ.z;
+#endif
+        memberPos[member] = pos;
+    }
+}
+
+/**
+ * Flag every group in which some member is not where it was the last time pairs were selected, and
+ * record the members' new positions.  The flags are cleared again once the pairs have been selected.
+ */
+extern "C" __global__ void findMovedGroups(const real4* __restrict__ memberPos, const int* __restrict__ memberGroup,
+        real4* __restrict__ lastPosition, int* __restrict__ groupMoved, int numMembers) {
+    for (int member = blockIdx.x*blockDim.x+threadIdx.x; member < numMembers; member += blockDim.x*gridDim.x) {
+        int group = memberGroup[member];
+        if (group == -1)
+            continue;
+        real4 pos = memberPos[member];
+        real4 last = lastPosition[member];
+        if (pos.x != last.x || pos.y != last.y || pos.z != last.z) {
+            lastPosition[member] = pos;
+            groupMoved[group] = 1;
+        }
+    }
+}
+
+/**
+ * Check the spanning tree of every group that was connected on the previous step, and flag the group
+ * for labeling if any edge has become too long.
+ */
+extern "C" __global__ void checkSpanningTrees(const real4* __restrict__ memberPos, const int* __restrict__ memberGroup,
+        const real2* __restrict__ groupParams, const int2* __restrict__ treeEdge, const int* __restrict__ groupMoved, int* __restrict__ needsLabel,
+        int numLargeMembers, real4 invPeriodicBoxSize, real4 periodicBoxVecX, real4 periodicBoxVecY, real4 periodicBoxVecZ) {
+    for (int member = blockIdx.x*blockDim.x+threadIdx.x; member < numLargeMembers; member += blockDim.x*gridDim.x) {
+        int group = memberGroup[member];
+        if (group == -1)
+            continue;
+        int2 edge = treeEdge[member];
+        if (!groupMoved[group] || needsLabel[group] || edge.x == -1)
+            continue;
+        real4 pos1 = memberPos[edge.x];
+        real4 pos2 = memberPos[edge.y];
+        real dx = pos2.x-pos1.x;
+        real dy = pos2.y-pos1.y;
+        real dz = pos2.z-pos1.z;
+        APPLY_PERIODIC(dx, dy, dz)
+        real cutoff = groupParams[group].x;
+        if (!(dx*dx+dy*dy+dz*dz < cutoff*cutoff))
+            needsLabel[group] = 1;
+    }
+}
+
+extern "C" __global__ void initComponents(const int* __restrict__ memberGroup, const int* __restrict__ groupMoved, const int* __restrict__ needsLabel,
+        int* __restrict__ parent, int2* __restrict__ treeEdge, unsigned long long* __restrict__ bestPair, int* __restrict__ componentCount,
+        int numLargeMembers, int numLargeGroups) {
+    for (int member = blockIdx.x*blockDim.x+threadIdx.x; member < numLargeMembers; member += blockDim.x*gridDim.x) {
+        int group = memberGroup[member];
+        if (group == -1 || !groupMoved[group])
+            continue;
+        if (needsLabel[group]) {
+            parent[member] = member;
+            treeEdge[member] = make_int2(-1, -1);
+        }
+        bestPair[member] = NO_PAIR;
+    }
+    for (int group = blockIdx.x*blockDim.x+threadIdx.x; group < numLargeGroups; group += blockDim.x*gridDim.x)
+        if (groupMoved[group] && needsLabel[group])
+            componentCount[group] = 0;
+}
+
+/**
+ * Every labeled group has its members binned into cells slightly wider than its cutoff along each axis,
+ * so two members closer than the cutoff are always in the same or adjacent cells, even after rounding.
+ * If USE_PERIODIC is defined, each axis of the reduced box is divided into a whole number of cells.
+ * Otherwise the grid is unbounded.  Each cell is hashed to a bucket in the group's own slot, so the
+ * buckets of different groups never collide.
+ */
+#define CELL_MARGIN 1.01f
+
+/**
+ * findClosestPairs() searches the cells up to this many away from a member.  The components for which
+ * no member finds a pair there are searched by findDistantPairs() instead, and the keys of the pairs
+ * it finds carry the flag DISTANT_PAIR.
+ */
+#define CLOSEST_PAIR_CELLS 2
+#define DISTANT_PAIR 0x8000000000000000ULL
+
+inline __device__ int floorDivide(int value, int divisor) {
+    return (value >= 0 ? value/divisor : -((divisor-1-value)/divisor));
+}
+
+inline __device__ int3 getNumCells(real cutoff, real4 periodicBoxVecX, real4 periodicBoxVecY, real4 periodicBoxVecZ) {
+#ifdef USE_PERIODIC
+    if (cutoff > 0) {
+        real width = CELL_MARGIN*cutoff;
+        return make_int3(max(1, (int) (periodicBoxVecX.x/width)), max(1, (int) (periodicBoxVecY.y/width)), max(1, (int) (periodicBoxVecZ.z/width)));
+    }
+#endif
+    return make_int3(1, 1, 1);
+}
+
+/**
+ * Find the cell containing a member.  The position it was binned at, wrapped into the box if USE_PERIODIC
+ * is defined, is stored in wrapped.
+ */
+inline __device__ int3 getMemberCell(real4 pos, real cutoff, int3 numCells, real3* wrapped,
+        real4 invPeriodicBoxSize, real4 periodicBoxVecX, real4 periodicBoxVecY, real4 periodicBoxVecZ) {
+#ifdef USE_PERIODIC
+    real scale3 = floor(pos.z*invPeriodicBoxSize.z);
+    pos.x -= scale3*periodicBoxVecZ.x;
+    pos.y -= scale3*periodicBoxVecZ.y;
+    pos.z -= scale3*periodicBoxVecZ.z;
+    real scale2 = floor(pos.y*invPeriodicBoxSize.y);
+    pos.x -= scale2*periodicBoxVecY.x;
+    pos.y -= scale2*periodicBoxVecY.y;
+    real scale1 = floor(pos.x*invPeriodicBoxSize.x);
+    pos.x -= scale1*periodicBoxVecX.x;
+    *wrapped = make_real3(pos.x, pos.y, pos.z);
+    return make_int3(min((int) (pos.x*invPeriodicBoxSize.x*numCells.x), numCells.x-1),
+            min((int) (pos.y*invPeriodicBoxSize.y*numCells.y), numCells.y-1),
+            min((int) (pos.z*invPeriodicBoxSize.z*numCells.z), numCells.z-1));
+#else
+    real scale = (cutoff > 0 ? 1/(CELL_MARGIN*cutoff) : 0);
+    *wrapped = make_real3(pos.x, pos.y, pos.z);
+    return make_int3((int) floor(pos.x*scale), (int) floor(pos.y*scale), (int) floor(pos.z*scale));
+#endif
+}
+
+inline __device__ int getCellBucket(int x, int y, int z, int slotStart, int slotSize) {
+    unsigned int hash = (((unsigned int) x)*73856093u)^(((unsigned int) y)*19349663u)^(((unsigned int) z)*83492791u);
+    return slotStart+(int) (hash%slotSize);
+}
+
+/**
+ * Find the bucket of the cell offset by (dx, dy, dz) from the one containing a member.  In a triclinic
+ * box, the cells below and above along z are an image apart whenever they lie across a face of the box,
+ * so the member is shifted by that image before the cells along y are counted from it, and likewise
+ * for y and x.  Every member within (dx, dy, dz) cells of the member is in one of the cells found this
+ * way, under the image that separates them.
+ */
+inline __device__ int getNeighborBucket(real3 pos, int3 cell, int3 numCells, int dx, int dy, int dz, int slotStart, int slotSize,
+        real4 invPeriodicBoxSize, real4 periodicBoxVecX, real4 periodicBoxVecY, real4 periodicBoxVecZ) {
+#ifdef USE_PERIODIC
+    int z = cell.z+dz;
+    int imageZ = floorDivide(z, numCells.z);
+    real shiftedY = pos.y-imageZ*periodicBoxVecZ.y;
+    int y = (int) floor(shiftedY*invPeriodicBoxSize.y*numCells.y)+dy;
+    int imageY = floorDivide(y, numCells.y);
+    real shiftedX = pos.x-imageZ*periodicBoxVecZ.x-imageY*periodicBoxVecY.x;
+    int x = (int) floor(shiftedX*invPeriodicBoxSize.x*numCells.x)+dx;
+    int imageX = floorDivide(x, numCells.x);
+    return getCellBucket(x-imageX*numCells.x, y-imageY*numCells.y, z-imageZ*numCells.z, slotStart, slotSize);
+#else
+    return getCellBucket(cell.x+dx, cell.y+dy, cell.z+dz, slotStart, slotSize);
+#endif
+}
+
+/**
+ * Bin the members of every group labeled on this step, recording the bucket of each member and counting
+ * the members hashed to each bucket.  The other members get a bucket of -1.
+ */
+extern "C" __global__ void countCells(const real4* __restrict__ memberPos, const int* __restrict__ memberGroup,
+        const int* __restrict__ groupStart, const real2* __restrict__ groupParams, const int* __restrict__ groupMoved,
+        const int* __restrict__ needsLabel, int* __restrict__ memberCell, int* __restrict__ cellCount, int numLargeMembers,
+        real4 invPeriodicBoxSize, real4 periodicBoxVecX, real4 periodicBoxVecY, real4 periodicBoxVecZ) {
+    for (int member = blockIdx.x*blockDim.x+threadIdx.x; member < numLargeMembers; member += blockDim.x*gridDim.x) {
+        int group = memberGroup[member];
+        if (group == -1 || !groupMoved[group] || !needsLabel[group]) {
+            memberCell[member] = -1;
+            continue;
+        }
+        real cutoff = groupParams[group].x;
+        int slotStart = groupStart[group];
+        real3 pos;
+        int3 cell = getMemberCell(memberPos[member], cutoff, getNumCells(cutoff, periodicBoxVecX, periodicBoxVecY, periodicBoxVecZ), &pos,
+                invPeriodicBoxSize, periodicBoxVecX, periodicBoxVecY, periodicBoxVecZ);
+        int bucket = getCellBucket(cell.x, cell.y, cell.z, slotStart, groupStart[group+1]-slotStart);
+        memberCell[member] = bucket;
+        atomicAdd(&cellCount[bucket], 1);
+    }
+}
+
+/**
+ * Compute the index in cellMembers at which the members of every bucket start.  This runs in a single
+ * block of CELL_SCAN_BLOCK_SIZE threads, each of which sums a contiguous range of buckets.
+ */
+extern "C" __global__ void findCellStarts(const int* __restrict__ cellCount, int* __restrict__ cellStart, int numLargeMembers) {
+    __shared__ int rangeSum[CELL_SCAN_BLOCK_SIZE];
+    int thread = threadIdx.x;
+    int rangeSize = (numLargeMembers+CELL_SCAN_BLOCK_SIZE-1)/CELL_SCAN_BLOCK_SIZE;
+    int first = min(thread*rangeSize, numLargeMembers);
+    int last = min(first+rangeSize, numLargeMembers);
+    int sum = 0;
+    for (int i = first; i < last; i++)
+        sum += cellCount[i];
+    rangeSum[thread] = sum;
+    __syncthreads();
+    for (int step = 1; step < CELL_SCAN_BLOCK_SIZE; step *= 2) {
+        int add = (thread >= step ? rangeSum[thread-step] : 0);
+        __syncthreads();
+        rangeSum[thread] += add;
+        __syncthreads();
+    }
+    int start = rangeSum[thread]-sum;
+    for (int i = first; i < last; i++) {
+        cellStart[i] = start;
+        start += cellCount[i];
+    }
+    if (thread == CELL_SCAN_BLOCK_SIZE-1)
+        cellStart[numLargeMembers] = rangeSum[thread];
+}
+
+/**
+ * List the members of every bucket in cellMembers.  Each member takes a place by counting its bucket
+ * back down, which leaves cellCount zeroed for the next step.
+ */
+extern "C" __global__ void fillCells(const int* __restrict__ memberCell, const int* __restrict__ cellStart, int* __restrict__ cellCount,
+        int* __restrict__ cellMembers, int numLargeMembers) {
+    for (int member = blockIdx.x*blockDim.x+threadIdx.x; member < numLargeMembers; member += blockDim.x*gridDim.x) {
+        int bucket = memberCell[member];
+        if (bucket != -1)
+            cellMembers[cellStart[bucket]+atomicAdd(&cellCount[bucket], -1)-1] = member;
+    }
+}
+
+/**
+ * Link every pair of members that are closer than their group's cutoff, comparing each member to those
+ * after it in its own and the adjacent cells.  If the pairs were already linked from the nonbonded
+ * neighbor list, listedTileCount points to the number of tiles in it and this does nothing unless the
+ * list overflowed.  Otherwise it is NULL.
+ */
+extern "C" __global__ void linkNeighbors(const real4* __restrict__ memberPos, const int* __restrict__ memberGroup,
+        const int* __restrict__ groupStart, const real2* __restrict__ groupParams, const int* __restrict__ groupMoved,
+        const int* __restrict__ needsLabel, const int* __restrict__ cellStart, const int* __restrict__ cellMembers,
+        int* __restrict__ parent, int2* __restrict__ treeEdge, const unsigned int* __restrict__ listedTileCount,
+        unsigned int maxListedTiles, int numLargeMembers,
+        real4 invPeriodicBoxSize, real4 periodicBoxVecX, real4 periodicBoxVecY, real4 periodicBoxVecZ) {
+    if (listedTileCount != NULL && listedTileCount[0] <= maxListedTiles)
+        return;
+    for (int member = blockIdx.x*blockDim.x+threadIdx.x; member < numLargeMembers; member += blockDim.x*gridDim.x) {
+        int group = memberGroup[member];
+        if (group == -1 || !groupMoved[group] || !needsLabel[group])
+            continue;
+        real cutoff = groupParams[group].x;
+        real cutoff2 = cutoff*cutoff;
+        int slotStart = groupStart[group];
+        int slotSize = groupStart[group+1]-slotStart;
+        real4 pos1 = memberPos[member];
+        int3 numCells = getNumCells(cutoff, periodicBoxVecX, periodicBoxVecY, periodicBoxVecZ);
+        real3 wrapped;
+        int3 cell = getMemberCell(pos1, cutoff, numCells, &wrapped, invPeriodicBoxSize, periodicBoxVecX, periodicBoxVecY, periodicBoxVecZ);
+        for (int z = -1; z <= 1; z++)
+            for (int y = -1; y <= 1; y++)
+                for (int x = -1; x <= 1; x++) {
+                    int bucket = getNeighborBucket(wrapped, cell, numCells, x, y, z, slotStart, slotSize,
+                            invPeriodicBoxSize, periodicBoxVecX, periodicBoxVecY, periodicBoxVecZ);
+                    for (int i = cellStart[bucket]; i < cellStart[bucket+1]; i++) {
+                        int other = cellMembers[i];
+                        if (other <= member)
+                            continue;
+                        real4 pos2 = memberPos[other];
+                        real dx = pos2.x-pos1.x;
+                        real dy = pos2.y-pos1.y;
+                        real dz = pos2.z-pos1.z;
+                        APPLY_PERIODIC(dx, dy, dz)
+                        if (dx*dx+dy*dy+dz*dz < cutoff2)
+                            linkMembers(parent, treeEdge, member, other);
+                    }
+                }
+    }
+}
+
+/**
+ * Link the members of two atoms that belong to the same group and are closer than its cutoff.  The
+ * members of each atom are listed in atomMembers, from atomMemberStart[atom] to atomMemberStart[atom+1].
+ */
+inline __device__ void linkAtomMembers(const real4* __restrict__ posq, const int* __restrict__ atomMemberStart,
+        const int* __restrict__ atomMembers, const int* __restrict__ memberGroup, const real2* __restrict__ groupParams,
+        const int* __restrict__ groupMoved, const int* __restrict__ needsLabel, int* __restrict__ parent, int2* __restrict__ treeEdge,
+        int atom1, int atom2, real4 invPeriodicBoxSize, real4 periodicBoxVecX, real4 periodicBoxVecY, real4 periodicBoxVecZ) {
+    int first2 = atomMemberStart[atom2];
+    int end2 = atomMemberStart[atom2+1];
+    if (first2 == end2)
+        return;
+    real4 pos1 = posq[atom1];
+    real4 pos2 = posq[atom2];
+    real dx = pos2.x-pos1.x;
+    real dy = pos2.y-pos1.y;
+    real dz = pos2.z-pos1.z;
+    APPLY_PERIODIC(dx, dy, dz)
+    real r2 = dx*dx+dy*dy+dz*dz;
+    for (int i = atomMemberStart[atom1]; i < atomMemberStart[atom1+1]; i++) {
+        int member1 = atomMembers[i];
+        int group = memberGroup[member1];
+        if (!groupMoved[group] || !needsLabel[group])
+            continue;
+        real cutoff = groupParams[group].x;
+        if (!(r2 < cutoff*cutoff))
+            continue;
+        for (int j = first2; j < end2; j++) {
+            int member2 = atomMembers[j];
+            if (memberGroup[member2] == group)
+                linkMembers(parent, treeEdge, member1, member2);
+        }
+    }
+}
+
+/**
+ * Link every pair of members that are closer than their group's cutoff, taking the pairs from the neighbor
+ * list the nonbonded utilities built for this step instead of searching the cells of each group.
+ * The list includes every pair of atoms closer than its cutoff, which is at least as large as the cutoff of
+ * every group processed here.  The atoms are tiled in blocks of TILE_SIZE.  Each tile with exclusions
+ * covers every pair in two blocks, and each of the other tiles covers one block and the TILE_SIZE atoms
+ * listed for it in interactingAtoms.  One thread processes one atom of the first block in a tile.  If the
+ * list overflowed it is incomplete, so nothing is done here and linkNeighbors() searches the groups instead.
+ */
+extern "C" __global__ void linkListedNeighbors(const real4* __restrict__ posq, const int* __restrict__ atomMemberStart,
+        const int* __restrict__ atomMembers, const int* __restrict__ memberGroup, const real2* __restrict__ groupParams,
+        const int* __restrict__ groupMoved, const int* __restrict__ needsLabel, int* __restrict__ parent, int2* __restrict__ treeEdge,
+        const int2* __restrict__ exclusionTiles, int numExclusionTiles, const int* __restrict__ interactingTiles,
+        const int* __restrict__ interactingAtoms, const unsigned int* __restrict__ listedTileCount, unsigned int maxListedTiles,
+        real4 invPeriodicBoxSize, real4 periodicBoxVecX, real4 periodicBoxVecY, real4 periodicBoxVecZ
+#ifdef USE_SINGLE_PAIRS
+        , const int2* __restrict__ singlePairs, unsigned int maxSinglePairs
+#endif
+        ) {
+    unsigned int numListedTiles = listedTileCount[0];
+    if (numListedTiles > maxListedTiles)
+        return;
+#ifdef USE_SINGLE_PAIRS
+    // Pairs from tiles with few interactions are listed individually.
+
+    unsigned int numSinglePairs = listedTileCount[1];
+    if (numSinglePairs > maxSinglePairs)
+        return;
+    for (int index = blockIdx.x*blockDim.x+threadIdx.x; index < numSinglePairs; index += blockDim.x*gridDim.x) {
+        int2 pair = singlePairs[index];
+        if (atomMemberStart[pair.x] != atomMemberStart[pair.x+1])
+            linkAtomMembers(posq, atomMemberStart, atomMembers, memberGroup, groupParams, groupMoved, needsLabel, parent, treeEdge, pair.x, pair.y,
+                        invPeriodicBoxSize, periodicBoxVecX, periodicBoxVecY, periodicBoxVecZ);
+    }
+#endif
+    int numTiles = numExclusionTiles+numListedTiles;
+    for (int index = blockIdx.x*blockDim.x+threadIdx.x; index < numTiles*TILE_SIZE; index += blockDim.x*gridDim.x) {
+        int tile = index/TILE_SIZE;
+        int lane = index%TILE_SIZE;
+        bool isExclusionTile = (tile < numExclusionTiles);
+        int2 blocks = (isExclusionTile ? exclusionTiles[tile] : make_int2(interactingTiles[tile-numExclusionTiles], -1));
+        int atom1 = blocks.x*TILE_SIZE+lane;
+        if (atom1 >= NUM_ATOMS || atomMemberStart[atom1] == atomMemberStart[atom1+1])
+            continue;
+        for (int j = 0; j < TILE_SIZE; j++) {
+            int atom2 = (isExclusionTile ? blocks.y*TILE_SIZE+j : interactingAtoms[(tile-numExclusionTiles)*TILE_SIZE+j]);
+            if (atom2 >= NUM_ATOMS || (blocks.x == blocks.y && j <= lane))
+                continue;
+            linkAtomMembers(posq, atomMemberStart, atomMembers, memberGroup, groupParams, groupMoved, needsLabel, parent, treeEdge, atom1, atom2,
+                    invPeriodicBoxSize, periodicBoxVecX, periodicBoxVecY, periodicBoxVecZ);
+        }
+    }
+}
+
+/**
+ * Point every member directly at the root of its component and count the components in each group.
+ */
+extern "C" __global__ void flattenComponents(int* __restrict__ parent, const int* __restrict__ memberGroup, const int* __restrict__ groupMoved,
+        const int* __restrict__ needsLabel, int* __restrict__ componentCount, int numLargeMembers) {
+    for (int member = blockIdx.x*blockDim.x+threadIdx.x; member < numLargeMembers; member += blockDim.x*gridDim.x) {
+        int group = memberGroup[member];
+        if (group == -1 || !groupMoved[group] || !needsLabel[group])
+            continue;
+        int root = member;
+        while (parent[root] != root)
+            root = parent[root];
+        parent[member] = root;
+        if (root == member)
+            atomicAdd(&componentCount[group], 1);
+    }
+}
+
+/**
+ * Find the closest member outside its own component for every member of a group that has more than
+ * one component, and reduce them to the closest pair per component.  The pair is stored on the root as a
+ * key whose high bits are the squared distance and whose low bits are the inside member, so the minimum
+ * key picks the lowest inside member among equally close pairs.  Only the members in the cells up to
+ * CLOSEST_PAIR_CELLS away are compared, and only those closer than the width of that many cells are
+ * accepted, since a closer member might have been in a cell that was not searched.  This also decides
+ * which groups must be labeled on the next step: those that are not connected now.
+ */
+extern "C" __global__ void findClosestPairs(const real4* __restrict__ memberPos, const int* __restrict__ memberGroup,
+        const int* __restrict__ groupStart, const real2* __restrict__ groupParams, const int* __restrict__ componentCount,
+        const int* __restrict__ parent, const int* __restrict__ groupMoved, const int* __restrict__ cellStart, const int* __restrict__ cellMembers,
+        int* __restrict__ nearestOutside, unsigned long long* __restrict__ bestPair, int* __restrict__ needsLabel,
+        int numLargeMembers, int numLargeGroups, real4 invPeriodicBoxSize, real4 periodicBoxVecX, real4 periodicBoxVecY, real4 periodicBoxVecZ) {
+    for (int group = blockIdx.x*blockDim.x+threadIdx.x; group < numLargeGroups; group += blockDim.x*gridDim.x)
+        if (groupMoved[group])
+            needsLabel[group] = (componentCount[group] != 1);
+    for (int member = blockIdx.x*blockDim.x+threadIdx.x; member < numLargeMembers; member += blockDim.x*gridDim.x) {
+        int group = memberGroup[member];
+        if (group == -1 || !groupMoved[group] || componentCount[group] < 2)
+            continue;
+        int root = parent[member];
+        real cutoff = groupParams[group].x;
+        int slotStart = groupStart[group];
+        int slotSize = groupStart[group+1]-slotStart;
+        real4 pos1 = memberPos[member];
+        int3 numCells = getNumCells(cutoff, periodicBoxVecX, periodicBoxVecY, periodicBoxVecZ);
+        real3 wrapped;
+        int3 cell = getMemberCell(pos1, cutoff, numCells, &wrapped, invPeriodicBoxSize, periodicBoxVecX, periodicBoxVecY, periodicBoxVecZ);
+#ifdef USE_PERIODIC
+        real width = min(periodicBoxVecX.x/numCells.x, min(periodicBoxVecY.y/numCells.y, periodicBoxVecZ.z/numCells.z))/CELL_MARGIN;
+#else
+        real width = cutoff;
+#endif
+        real maxDist2 = CLOSEST_PAIR_CELLS*CLOSEST_PAIR_CELLS*width*width;
+        real bestDist2 = 0;
+        int best = -1;
+        for (int z = -CLOSEST_PAIR_CELLS; z <= CLOSEST_PAIR_CELLS; z++)
+            for (int y = -CLOSEST_PAIR_CELLS; y <= CLOSEST_PAIR_CELLS; y++)
+                for (int x = -CLOSEST_PAIR_CELLS; x <= CLOSEST_PAIR_CELLS; x++) {
+                    int bucket = getNeighborBucket(wrapped, cell, numCells, x, y, z, slotStart, slotSize,
+                            invPeriodicBoxSize, periodicBoxVecX, periodicBoxVecY, periodicBoxVecZ);
+                    for (int i = cellStart[bucket]; i < cellStart[bucket+1]; i++) {
+                        int other = cellMembers[i];
+                        if (parent[other] == root)
+                            continue;
+                        real4 pos2 = memberPos[other];
+                        real dx = pos2.x-pos1.x;
+                        real dy = pos2.y-pos1.y;
+                        real dz = pos2.z-pos1.z;
+                        APPLY_PERIODIC(dx, dy, dz)
+                        real r2 = dx*dx+dy*dy+dz*dz;
+                        if (r2 < maxDist2 && (best == -1 || r2 < bestDist2 || (r2 == bestDist2 && other < best))) {
+                            bestDist2 = r2;
+                            best = other;
+                        }
+                    }
+                }
+        nearestOutside[member] = best;
+        if (best != -1) {
+            unsigned long long key = (((unsigned long long) __float_as_uint((float) bestDist2)) << 32) | (unsigned int) member;
+            atomicMin(&bestPair[root], key);
+        }
+    }
+}
+
+/**
+ * Compare every pair of members for the components findClosestPairs() found no pair for.  Their roots
+ * still hold NO_PAIR, and every key stored here carries DISTANT_PAIR, so a component is recognized the
+ * same way by all its members however many of them have stored a key already.
+ */
+extern "C" __global__ void findDistantPairs(const real4* __restrict__ memberPos, const int* __restrict__ memberGroup,
+        const int* __restrict__ groupStart, const int* __restrict__ groupEnd, const int* __restrict__ componentCount, const int* __restrict__ parent,
+        const int* __restrict__ groupMoved, int* __restrict__ nearestOutside, unsigned long long* __restrict__ bestPair,
+        int numLargeMembers, real4 invPeriodicBoxSize, real4 periodicBoxVecX, real4 periodicBoxVecY, real4 periodicBoxVecZ) {
+    for (int member = blockIdx.x*blockDim.x+threadIdx.x; member < numLargeMembers; member += blockDim.x*gridDim.x) {
+        int group = memberGroup[member];
+        if (group == -1 || !groupMoved[group] || componentCount[group] < 2)
+            continue;
+        int root = parent[member];
+        if (bestPair[root] < DISTANT_PAIR)
+            continue;
+        int end = groupEnd[group];
+        real4 pos1 = memberPos[member];
+        real bestDist2 = 0;
+        int best = -1;
+        for (int other = groupStart[group]; other < end; other++) {
+            if (parent[other] == root)
+                continue;
+            real4 pos2 = memberPos[other];
+            real dx = pos2.x-pos1.x;
+            real dy = pos2.y-pos1.y;
+            real dz = pos2.z-pos1.z;
+            APPLY_PERIODIC(dx, dy, dz)
+            real r2 = dx*dx+dy*dy+dz*dz;
+            if (best == -1 || r2 < bestDist2) {
+                bestDist2 = r2;
+                best = other;
+            }
+        }
+        nearestOutside[member] = best;
+        unsigned long long key = DISTANT_PAIR | (((unsigned long long) __float_as_uint((float) bestDist2)) << 32) | (unsigned int) member;
+        atomicMin(&bestPair[root], key);
+    }
+}
+
+/**
+ * Apply the harmonic restraint to the pair selected by each component.  When two components select
+ * the same pair, only the one with the lower root applies it.  The forces and energy are only
+ * accumulated if requested.  The distance between the particles of the pair each root applies is
+ * recorded in pairDistance, and -1 for every other member.
+ */
+extern "C" __global__ void applyRestraints(const real4* __restrict__ memberPos, const int* __restrict__ sortedIndex, const int* __restrict__ memberGroup,
+        const real2* __restrict__ groupParams, const int* __restrict__ parent, const int* __restrict__ nearestOutside,
+        const unsigned long long* __restrict__ bestPair, real* __restrict__ pairDistance, unsigned long long* __restrict__ forceBuffers,
+        mixed* __restrict__ energyBuffer, int includeForces, int includeEnergy, int numMembers, real4 invPeriodicBoxSize, real4 periodicBoxVecX, real4 periodicBoxVecY, real4 periodicBoxVecZ) {
+    mixed energy = 0;
+    for (int member = blockIdx.x*blockDim.x+threadIdx.x; member < numMembers; member += blockDim.x*gridDim.x) {
+        pairDistance[member] = -1;
+        int group = memberGroup[member];
+        unsigned long long key = bestPair[member];
+        if (group == -1 || key == NO_PAIR)
+            continue;
+        int inside = (int) (key & 0xFFFFFFFF);
+        int outside = nearestOutside[inside];
+        int otherRoot = parent[outside];
+        int otherInside = (int) (bestPair[otherRoot] & 0xFFFFFFFF);
+        if (otherRoot < member && otherInside == outside && nearestOutside[otherInside] == inside)
+            continue;
+        int atom1 = sortedIndex[inside];
+        int atom2 = sortedIndex[outside];
+        real4 pos1 = memberPos[inside];
+        real4 pos2 = memberPos[outside];
+        real dx = pos1.x-pos2.x;
+        real dy = pos1.y-pos2.y;
+        real dz = pos1.z-pos2.z;
+        APPLY_PERIODIC(dx, dy, dz)
+        real r = SQRT(dx*dx+dy*dy+dz*dz);
+        pairDistance[member] = r;
+        real2 params = groupParams[group];
+        real dr = r-params.x;
+        energy += params.y*dr*dr;
+        if (!includeForces)
+            continue;
+        real dEdR = (r > 0 ? 2*params.y*dr/r : 0);
+        atomicAdd(&forceBuffers[atom1], (unsigned long long) ((long long) (-dx*dEdR*0x100000000)));
+        atomicAdd(&forceBuffers[atom1+PADDED_NUM_ATOMS], (unsigned long long) ((long long) (-dy*dEdR*0x100000000)));
+        atomicAdd(&forceBuffers[atom1+2*PADDED_NUM_ATOMS], (unsigned long long) ((long long) (-dz*dEdR*0x100000000)));
+        atomicAdd(&forceBuffers[atom2], (unsigned long long) ((long long) (dx*dEdR*0x100000000)));
+        atomicAdd(&forceBuffers[atom2+PADDED_NUM_ATOMS], (unsigned long long) ((long long) (dy*dEdR*0x100000000)));
+        atomicAdd(&forceBuffers[atom2+2*PADDED_NUM_ATOMS], (unsigned long long) ((long long) (dz*dEdR*0x100000000)));
+    }
+    if (includeEnergy)
+        energyBuffer[blockIdx.x*blockDim.x+threadIdx.x] += energy;
+}
+
+/**
+ * Summarize every slot for ContForce::getBondSummaries(): its number of components, the number of
+ * pairs applyRestraints() restrained in it, and the shortest of their distances, or -1 if there are
+ * none.  Each block of SUMMARY_BLOCK_SIZE threads reduces one slot at a time, so only these values
+ * need to be downloaded.
+ */
+extern "C" __global__ void summarizeGroups(const real* __restrict__ pairDistance, const int* __restrict__ groupStart,
+        const int* __restrict__ groupEnd, const int* __restrict__ componentCount, int2* __restrict__ groupSummary,
+        real* __restrict__ groupMinDistance, int numGroups) {
+    __shared__ int localCount[SUMMARY_BLOCK_SIZE];
+    __shared__ real localMin[SUMMARY_BLOCK_SIZE];
+    for (int group = blockIdx.x; group < numGroups; group += gridDim.x) {
+        int numComponents = componentCount[group];
+        int count = 0;
+        real minDist = -1;
+        if (numComponents > 1) {
+            for (int member = groupStart[group]+threadIdx.x; member < groupEnd[group]; member += blockDim.x) {
+                real r = pairDistance[member];
+                if (r >= 0) {
+                    count++;
+                    minDist = (minDist < 0 || r < minDist ? r : minDist);
+                }
+            }
+        }
+        localCount[threadIdx.x] = count;
+        localMin[threadIdx.x] = minDist;
+        __syncthreads();
+        for (int step = blockDim.x/2; step > 0; step /= 2) {
+            if (threadIdx.x < step) {
+                localCount[threadIdx.x] += localCount[threadIdx.x+step];
+                real other = localMin[threadIdx.x+step];
+                if (other >= 0 && (localMin[threadIdx.x] < 0 || other < localMin[threadIdx.x]))
+                    localMin[threadIdx.x] = other;
+            }
+            __syncthreads();
+        }
+        if (threadIdx.x == 0) {
+            groupSummary[group] = make_int2(numComponents, localCount[0]);
+            groupMinDistance[group] = localMin[0];
+        }
+        __syncthreads();
+    }
+}
+
+/**
+ * Label the components of small groups and find the closest pair for each one, with one warp per group.
+ * Each lane holds MEMBERS_PER_LANE members, so groups of up to 32*MEMBERS_PER_LANE members are supported.
+ * The lanes first record which members are within the cutoff of theirs as bit masks, so no distance
+ * is computed twice.  Every member then repeatedly takes the lowest label of its neighbors until no
+ * label changes, which leaves each component labeled by its lowest member.  This writes the same
+ * parent, nearestOutside, bestPair and componentCount values as the kernels above.
+ */
+template <int MEMBERS_PER_LANE>
+__device__ void selectSmallGroupPairs(const real4* __restrict__ memberPos, const int* __restrict__ groupStart,
+        const int* __restrict__ groupEnd, const real2* __restrict__ groupParams, const int* __restrict__ groupMoved, int firstGroup, int lastGroup, int* __restrict__ parent,
+        int* __restrict__ nearestOutside, unsigned long long* __restrict__ bestPair, int* __restrict__ componentCount,
+        real4 invPeriodicBoxSize, real4 periodicBoxVecX, real4 periodicBoxVecY, real4 periodicBoxVecZ) {
+    const int MAX_SIZE = 32*MEMBERS_PER_LANE;
+    const int WARPS_PER_BLOCK = SMALL_GROUP_BLOCK_SIZE/32;
+    __shared__ real3 localPos[WARPS_PER_BLOCK][MAX_SIZE];
+    __shared__ int localLabel[WARPS_PER_BLOCK][MAX_SIZE];
+    __shared__ unsigned long long localKey[WARPS_PER_BLOCK][MAX_SIZE];
+    const int warp = threadIdx.x/32;
+    const int lane = threadIdx.x%32;
+    real3* pos = localPos[warp];
+    volatile int* label = localLabel[warp];
+    unsigned long long* key = localKey[warp];
+    for (int group = firstGroup+(blockIdx.x*blockDim.x+threadIdx.x)/32; group < lastGroup; group += (blockDim.x*gridDim.x)/32) {
+        if (!groupMoved[group])
+            continue;
+        int start = groupStart[group];
+        int size = groupEnd[group]-start;
+        real cutoff = groupParams[group].x;
+        real cutoff2 = cutoff*cutoff;
+        for (int k = 0; k < MEMBERS_PER_LANE; k++) {
+            int i = lane+32*k;
+            if (i < size) {
+                real4 p = memberPos[start+i];
+                pos[i] = make_real3(p.x, p.y, p.z);
+                label[i] = i;
+            }
+        }
+        __syncwarp();
+
+        // Find the neighbors of each member.
+
+        unsigned long long neighbors[MEMBERS_PER_LANE];
+        for (int k = 0; k < MEMBERS_PER_LANE; k++) {
+            int i = lane+32*k;
+            neighbors[k] = 0;
+            if (i < size)
+                for (int j = 0; j < size; j++) {
+                    real dx = pos[j].x-pos[i].x;
+                    real dy = pos[j].y-pos[i].y;
+                    real dz = pos[j].z-pos[i].z;
+                    APPLY_PERIODIC(dx, dy, dz)
+                    if (j != i && dx*dx+dy*dy+dz*dz < cutoff2)
+                        neighbors[k] |= 1ULL<<j;
+                }
+        }
+
+        // Propagate the lowest label through each component.  Labels only ever decrease and always
+        // name a member of the same component, so reading one while it changes is harmless.
+
+        bool changed = true;
+        while (__any_sync(0xFFFFFFFF, changed)) {
+            changed = false;
+            for (int k = 0; k < MEMBERS_PER_LANE; k++) {
+                int i = lane+32*k;
+                if (i >= size)
+                    continue;
+                int lowest = label[i];
+                unsigned long long remaining = neighbors[k];
+                while (remaining != 0) {
+                    int j = __ffsll(remaining)-1;
+                    remaining &= remaining-1;
+                    lowest = min(lowest, label[j]);
+                }
+                lowest = min(lowest, label[lowest]);
+                if (lowest < label[i]) {
+                    label[i] = lowest;
+                    changed = true;
+                }
+            }
+            __syncwarp();
+        }
+        int numComponents = 0;
+        for (int k = 0; k < MEMBERS_PER_LANE; k++) {
+            int i = lane+32*k;
+            numComponents += __popc(__ballot_sync(0xFFFFFFFF, i < size && label[i] == i));
+        }
+        for (int k = 0; k < MEMBERS_PER_LANE; k++) {
+            int i = lane+32*k;
+            if (i < size) {
+                parent[start+i] = start+label[i];
+                bestPair[start+i] = NO_PAIR;
+            }
+        }
+        if (lane == 0)
+            componentCount[group] = numComponents;
+        if (numComponents > 1) {
+            // Find the closest member outside each member's component, then reduce them to the closest
+            // pair for each component, exactly as findClosestPairs() does.
+
+            for (int k = 0; k < MEMBERS_PER_LANE; k++) {
+                int i = lane+32*k;
+                if (i >= size)
+                    continue;
+                real bestDist2 = 0;
+                int best = -1;
+                for (int j = 0; j < size; j++) {
+                    if (label[j] == label[i])
+                        continue;
+                    real dx = pos[j].x-pos[i].x;
+                    real dy = pos[j].y-pos[i].y;
+                    real dz = pos[j].z-pos[i].z;
+                    APPLY_PERIODIC(dx, dy, dz)
+                    real r2 = dx*dx+dy*dy+dz*dz;
+                    if (best == -1 || r2 < bestDist2) {
+                        bestDist2 = r2;
+                        best = j;
+                    }
+                }
+                nearestOutside[start+i] = start+best;
+                key[i] = (((unsigned long long) __float_as_uint((float) bestDist2)) << 32) | (unsigned int) (start+i);
+            }
+            __syncwarp();
+            for (int k = 0; k < MEMBERS_PER_LANE; k++) {
+                int i = lane+32*k;
+                if (i >= size || label[i] != i)
+                    continue;
+                unsigned long long lowestKey = NO_PAIR;
+                for (int j = i; j < size; j++)
+                    if (label[j] == i)
+                        lowestKey = min(lowestKey, key[j]);
+                bestPair[start+i] = lowestKey;
+            }
+        }
+        __syncwarp();
+    }
+}
+
+extern "C" __global__ void selectSmallGroupPairs32(const real4* __restrict__ memberPos, const int* __restrict__ groupStart,
+        const int* __restrict__ groupEnd, const real2* __restrict__ groupParams, const int* __restrict__ groupMoved, int firstGroup, int lastGroup, int* __restrict__ parent,
+        int* __restrict__ nearestOutside, unsigned long long* __restrict__ bestPair, int* __restrict__ componentCount,
+        real4 invPeriodicBoxSize, real4 periodicBoxVecX, real4 periodicBoxVecY, real4 periodicBoxVecZ) {
+    selectSmallGroupPairs<1>(memberPos, groupStart, groupEnd, groupParams, groupMoved, firstGroup, lastGroup, parent, nearestOutside, bestPair, componentCount,
+            invPeriodicBoxSize, periodicBoxVecX, periodicBoxVecY, periodicBoxVecZ);
+}
+
+extern "C" __global__ void selectSmallGroupPairs64(const real4* __restrict__ memberPos, const int* __restrict__ groupStart,
+        const int* __restrict__ groupEnd, const real2* __restrict__ groupParams, const int* __restrict__ groupMoved, int firstGroup, int lastGroup, int* __restrict__ parent,
+        int* __restrict__ nearestOutside, unsigned long long* __restrict__ bestPair, int* __restrict__ componentCount,
+        real4 invPeriodicBoxSize, real4 periodicBoxVecX, real4 periodicBoxVecY, real4 periodicBoxVecZ) {
+    selectSmallGroupPairs<2>(memberPos, groupStart, groupEnd, groupParams, groupMoved, firstGroup, lastGroup, parent, nearestOutside, bestPair, componentCount,
+            invPeriodicBoxSize, periodicBoxVecX, periodicBoxVecY, periodicBoxVecZ);
+}
@@ -36,11 +36,17 @@
 #include "ContForce.h"
 #include "openmm/internal/AssertionUtilities.h"
 #include "openmm/Context.h"
+#include "openmm/HarmonicBondForce.h"
+#include "openmm/NonbondedForce.h"
+#include "openmm/OpenMMException.h"
 #include "openmm/Platform.h"
 #include "openmm/System.h"
 #include "openmm/VerletIntegrator.h"
+#include <algorithm>
 #include <cmath>
 #include <iostream>
+#include <sstream>
+#include <map>
 #include <vector>
 
 using namespace ContForcePlugin;
@@ -189,6 +195,853 @@ void testMultipleBonds() {
 
 }
 
+void testMultipleComponents() {
+	// Create three separated fragments, listing the particles out of order
+
+	const int numParticles = 8;
+	System system;
+	vector<Vec3> positions(numParticles);
+	double x[] = {0.0, 0.5, 1.0, 3.0, 3.5, 4.0, 7.0, 7.5};
+	for (int i = 0; i < numParticles; i++) {
+		system.addParticle(1.0);
+		positions[i] = Vec3(x[i], 0, 0);
+	}
+	ContForce* force = new ContForce();
+	system.addForce(force);
+	vector<int> idxs = {6,0,3,7,1,4,2,5};
+	const double length = 1.0;
+	const double k = 17;
+	force->addBond(idxs, numParticles, length, k);
+
+	// Compute the forces and energy.
+
+	VerletIntegrator integ(1.0);
+	Platform& platform = Platform::getPlatformByName("CUDA");
+	Context context(system, integ, platform);
+	context.setPositions(positions);
+	State state = context.getState(State::Energy | State::Forces);
+
+	// Particles 2-3 and 5-6 should be restrained, and no others.
+
+	ASSERT_EQUAL_TOL(k*1.0*1.0 + k*2.0*2.0, state.getPotentialEnergy(), 1e-5);
+	vector<Vec3> expectedForces(numParticles);
+	expectedForces[2] = Vec3(2*k, 0, 0);
+	expectedForces[3] = Vec3(-2*k, 0, 0);
+	expectedForces[5] = Vec3(4*k, 0, 0);
+	expectedForces[6] = Vec3(-4*k, 0, 0);
+	for (int i = 0; i < numParticles; i++)
+		ASSERT_EQUAL_VEC(expectedForces[i], state.getForces()[i], 1e-5);
+}
+
+void testLargeGroup() {
+	// Create two slabs of particles on a lattice, separated by a gap along z
+
+	const int nx = 10, ny = 10, nz = 20;
+	const int numParticles = nx*ny*nz;
+	const double spacing = 0.5;
+	const double gap = 2.0;
+	System system;
+	vector<Vec3> positions;
+	vector<int> idxs;
+	for (int i = 0; i < nx; i++)
+		for (int j = 0; j < ny; j++)
+			for (int m = 0; m < nz; m++) {
+				system.addParticle(1.0);
+				double z = spacing*m + (m < nz/2 ? 0.0 : gap-spacing);
+				positions.push_back(Vec3(spacing*i, spacing*j, z));
+				idxs.push_back(idxs.size());
+			}
+	ContForce* force = new ContForce();
+	system.addForce(force);
+	const double length = 1.0;
+	const double k = 17;
+	force->addBond(idxs, numParticles, length, k);
+
+	// Only one pair should be restrained across the gap.
+
+	VerletIntegrator integ(1.0);
+	Platform& platform = Platform::getPlatformByName("CUDA");
+	Context context(system, integ, platform);
+	context.setPositions(positions);
+	State state = context.getState(State::Energy | State::Forces);
+	ASSERT_EQUAL_TOL(k*(gap-length)*(gap-length), state.getPotentialEnergy(), 1e-5);
+	Vec3 totalForce;
+	for (int i = 0; i < numParticles; i++)
+		totalForce += state.getForces()[i];
+	ASSERT_EQUAL_VEC(Vec3(0, 0, 0), totalForce, 1e-5);
+}
+
+void testNonbondedNeighborList(double nonbondedCutoff, bool useNeighborList) {
+	// Create the same slabs as testLargeGroup(), along with a NonbondedForce that has no effect on them.  When
+	// its cutoff is large enough, the neighbor list built for it is used to find the components.
+
+	const int nx = 10, ny = 10, nz = 20;
+	const int numParticles = nx*ny*nz;
+	const double spacing = 0.5;
+	const double gap = 2.0;
+	System system;
+	NonbondedForce* nonbonded = new NonbondedForce();
+	nonbonded->setNonbondedMethod(NonbondedForce::CutoffNonPeriodic);
+	nonbonded->setCutoffDistance(nonbondedCutoff);
+	system.addForce(nonbonded);
+	vector<Vec3> positions;
+	vector<int> idxs;
+	for (int i = 0; i < nx; i++)
+		for (int j = 0; j < ny; j++)
+			for (int m = 0; m < nz; m++) {
+				system.addParticle(1.0);
+				nonbonded->addParticle(0.0, 0.1, 0.0);
+				double z = spacing*m + (m < nz/2 ? 0.0 : gap-spacing);
+				positions.push_back(Vec3(spacing*i, spacing*j, z));
+				idxs.push_back(idxs.size());
+			}
+	ContForce* force = new ContForce();
+	force->setUseNonbondedNeighborList(useNeighborList);
+	system.addForce(force);
+	const double length = 1.0;
+	const double k = 17;
+	force->addBond(idxs, numParticles, length, k);
+	VerletIntegrator integ(1.0);
+	Platform& platform = Platform::getPlatformByName("CUDA");
+	Context context(system, integ, platform);
+
+	// Only one pair should be restrained across the gap, and it should still be found after the
+	// slabs have moved.
+
+	for (int step = 0; step < 3; step++) {
+		if (step > 0)
+			for (int i = 0; i < numParticles; i++)
+				positions[i] += Vec3(0.3, 0.2, 0.1);
+		context.setPositions(positions);
+		State state = context.getState(State::Energy | State::Forces);
+		ASSERT_EQUAL_TOL(k*(gap-length)*(gap-length), state.getPotentialEnergy(), 1e-5);
+		Vec3 totalForce;
+		for (int i = 0; i < numParticles; i++)
+			totalForce += state.getForces()[i];
+		ASSERT_EQUAL_VEC(Vec3(0, 0, 0), totalForce, 1e-5);
+		int numComponents;
+		vector<int> particle1, particle2;
+		vector<double> distances;
+		force->getBondStatistics(context, 0, numComponents, particle1, particle2, distances);
+		ASSERT_EQUAL(2, numComponents);
+		ASSERT_EQUAL(1, distances.size());
+	}
+}
+
+void testWrappedGroups(bool useDeviceKernels, bool usePipelinedSelection) {
+	// The System is periodic because of a NonbondedForce with PME, but the ContForce is not.  A small and
+	// a large group are rows of particles that cross the faces of the box, with a gap in each.  When the
+	// atoms are reordered each one is moved into the box on its own, which must not split the rows,
+	// whether the positions are read on the device, downloaded or downloaded for the next step.
+
+	const double boxSize = 3.0;
+	System system;
+	system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+	NonbondedForce* nonbonded = new NonbondedForce();
+	nonbonded->setNonbondedMethod(NonbondedForce::PME);
+	nonbonded->setCutoffDistance(1.0);
+	system.addForce(nonbonded);
+	ContForce* force = new ContForce();
+	force->setUseDeviceKernels(useDeviceKernels);
+	force->setUsePipelinedSelection(usePipelinedSelection);
+	force->setForceGroup(1);
+	system.addForce(force);
+	vector<Vec3> positions;
+	const int numGroups = 2;
+	const int rowSize[] = {5, 50};
+	const double spacing[] = {0.1, 0.04};
+	const double gap[] = {0.4, 0.54};
+	const double length[] = {0.15, 0.1};
+	const double k[] = {3.0, 5.0};
+	vector<int> lastOfRow(numGroups);
+	for (int g = 0; g < numGroups; g++) {
+		vector<int> idxs;
+		for (int i = 0; i < 2*rowSize[g]; i++) {
+			idxs.push_back(system.addParticle(1.0));
+			nonbonded->addParticle(0.0, 0.1, 0.0);
+			double x = 2.7-0.7*g+spacing[g]*i+(i < rowSize[g] ? 0.0 : gap[g]-spacing[g]);
+			positions.push_back(Vec3(x, 0.5+g, 0.5+g));
+		}
+		force->addBond(idxs, idxs.size(), length[g], k[g]);
+		lastOfRow[g] = idxs[rowSize[g]-1];
+	}
+	VerletIntegrator integ(1.0);
+	Platform& platform = Platform::getPlatformByName("CUDA");
+	Context context(system, integ, platform);
+
+	// Moving all the particles changes which of them cross the faces.
+
+	for (int step = 0; step < 4; step++) {
+		context.setPositions(positions);
+		State state = context.getState(State::Energy | State::Forces, false, 1<<1);
+		double expectedEnergy = 0;
+		for (int g = 0; g < numGroups; g++) {
+			double dr = gap[g]-length[g];
+			expectedEnergy += k[g]*dr*dr;
+			ASSERT_EQUAL_VEC(Vec3(2*k[g]*dr, 0, 0), state.getForces()[lastOfRow[g]], 1e-5);
+			ASSERT_EQUAL_VEC(Vec3(-2*k[g]*dr, 0, 0), state.getForces()[lastOfRow[g]+1], 1e-5);
+		}
+		ASSERT_EQUAL_TOL(expectedEnergy, state.getPotentialEnergy(), 1e-5);
+		for (int i = 0; i < positions.size(); i++)
+			positions[i] += Vec3(0.37, 0.8, -0.3);
+	}
+}
+
+void testPeriodic(bool triclinic, bool useDeviceKernels, bool usePipelinedSelection) {
+	// Build two groups of three fragments that fit well inside half the box, so every separation is its
+	// own nearest image, and find the energy and forces without periodic boundary conditions.  The first
+	// group is small enough for one warp, and the second is processed like any large group.
+
+	Vec3 a(5, 0, 0), b(0, 5, 0), c(0, 0, 5);
+	if (triclinic) {
+		b = Vec3(1, 5, 0);
+		c = Vec3(-1.5, 1, 5);
+	}
+	const double length = 0.5;
+	const double k = 4;
+	const int gridSize[2][3] = {{2, 2, 2}, {4, 3, 2}};
+	const double spacing[] = {0.3, 0.1};
+	System system;
+	system.setDefaultPeriodicBoxVectors(a, b, c);
+	ContForce* force = new ContForce();
+	force->setUseDeviceKernels(useDeviceKernels);
+	force->setUsePipelinedSelection(usePipelinedSelection);
+	system.addForce(force);
+	vector<Vec3> positions;
+	for (int g = 0; g < 2; g++) {
+		vector<int> idxs;
+		for (int fragment = 0; fragment < 3; fragment++)
+			for (int i = 0; i < gridSize[g][2]; i++)
+				for (int j = 0; j < gridSize[g][1]; j++)
+					for (int m = 0; m < gridSize[g][0]; m++) {
+						idxs.push_back(system.addParticle(1.0));
+						positions.push_back(Vec3(0.8*fragment+spacing[g]*m, spacing[g]*j, 0.5*fragment+spacing[g]*i));
+					}
+		force->addBond(idxs, idxs.size(), length, k);
+	}
+
+	// Jitter the particles so no two pairs are equally close.
+
+	int numParticles = positions.size();
+	for (int i = 0; i < numParticles; i++)
+		positions[i] += Vec3(0.02*sin(1.3*i), 0.02*sin(2.1*i+1), 0.02*sin(0.7*i+2));
+	Platform& platform = Platform::getPlatformByName("CUDA");
+	VerletIntegrator integ1(1.0);
+	Context context1(system, integ1, platform);
+	context1.setPositions(positions);
+	State state1 = context1.getState(State::Energy | State::Forces);
+	ASSERT(state1.getPotentialEnergy() > 0);
+
+	// Move every particle to a different periodic image, which splits the fragments across the faces
+	// of the box.  With periodic boundary conditions the results should not change.
+
+	vector<Vec3> shifted(numParticles);
+	for (int i = 0; i < numParticles; i++)
+		shifted[i] = positions[i]+a*((i%3)-1)+b*(((i/3)%3)-1)+c*(2*(i%2)-1);
+	force->setUsesPeriodicBoundaryConditions(true);
+	VerletIntegrator integ2(1.0);
+	Context context2(system, integ2, platform);
+	context2.setPositions(shifted);
+	State state2 = context2.getState(State::Energy | State::Forces);
+	ASSERT_EQUAL_TOL(state1.getPotentialEnergy(), state2.getPotentialEnergy(), 1e-4);
+	for (int i = 0; i < numParticles; i++)
+		ASSERT_EQUAL_VEC(state1.getForces()[i], state2.getForces()[i], 1e-4);
+}
+
+void testHostComputation() {
+	// Compute the same fragmented system on the device and on the host, and check that they agree.
+
+	const int numParticles = 60;
+	System system;
+	vector<Vec3> positions(numParticles);
+	for (int i = 0; i < numParticles; i++) {
+		system.addParticle(1.0);
+		positions[i] = Vec3(0.37*(i%5) + 2.5*(i/20), 0.41*((i/5)%4) + 0.05*(i%3), 0.1*(i%7));
+	}
+	vector<int> idxs1, idxs2;
+	for (int i = 0; i < numParticles; i++) {
+		idxs1.push_back(i);
+		if (i%2 == 1)
+			idxs2.push_back(i);
+	}
+	ContForce* force = new ContForce();
+	force->addBond(idxs1, idxs1.size(), 0.5, 17);
+	force->addBond(idxs2, idxs2.size(), 0.6, 11);
+	system.addForce(force);
+	Platform& platform = Platform::getPlatformByName("CUDA");
+	VerletIntegrator integ1(1.0);
+	Context context1(system, integ1, platform);
+	context1.setPositions(positions);
+	State state1 = context1.getState(State::Energy | State::Forces);
+	force->setUseDeviceKernels(false);
+	VerletIntegrator integ2(1.0);
+	Context context2(system, integ2, platform);
+	context2.setPositions(positions);
+	State state2 = context2.getState(State::Energy | State::Forces);
+	ASSERT(state1.getPotentialEnergy() > 0);
+	ASSERT_EQUAL_TOL(state2.getPotentialEnergy(), state1.getPotentialEnergy(), 1e-5);
+	for (int i = 0; i < numParticles; i++)
+		ASSERT_EQUAL_VEC(state2.getForces()[i], state1.getForces()[i], 1e-4);
+}
+
+void testHostForcePrecision() {
+	// Forces computed on the host are uploaded in fixed point, so in every precision mode they should
+	// only be rounded to the resolution of the force buffer, not to single precision.  The positions
+	// are exactly representable in single precision.
+
+	System system;
+	vector<Vec3> positions;
+	positions.push_back(Vec3(0, 0, 0));
+	positions.push_back(Vec3(0.5, 0, 0));
+	positions.push_back(Vec3(3.25, 0, 0));
+	vector<int> idxs;
+	for (int i = 0; i < positions.size(); i++) {
+		system.addParticle(1.0);
+		idxs.push_back(i);
+	}
+	ContForce* force = new ContForce();
+	const double length = 1.0;
+	const double k = 123.456789;
+	force->addBond(idxs, idxs.size(), length, k);
+	force->setUseDeviceKernels(false);
+	system.addForce(force);
+	VerletIntegrator integ(1.0);
+	Platform& platform = Platform::getPlatformByName("CUDA");
+	Context context(system, integ, platform);
+	context.setPositions(positions);
+	State state = context.getState(State::Energy | State::Forces);
+	double f = 2*k*(2.75-length);
+	ASSERT_EQUAL_TOL(k*1.75*1.75, state.getPotentialEnergy(), 1e-10);
+	ASSERT(fabs(state.getForces()[1][0]-f) < 1e-8);
+	ASSERT(fabs(state.getForces()[2][0]+f) < 1e-8);
+}
+
+void testHostManyRestraints() {
+	// Every particle is restrained, so the host forces are too many to upload as a sparse list.
+
+	const int numParticles = 12;
+	System system;
+	vector<Vec3> positions(numParticles);
+	vector<int> idxs;
+	for (int i = 0; i < numParticles; i++) {
+		system.addParticle(1.0);
+		positions[i] = Vec3(1.5*i+0.1*i*i, 0, 0);
+		idxs.push_back(i);
+	}
+	ContForce* force = new ContForce();
+	force->addBond(idxs, idxs.size(), 1.0, 5);
+	system.addForce(force);
+	Platform& platform = Platform::getPlatformByName("CUDA");
+	VerletIntegrator integ1(1.0);
+	Context context1(system, integ1, platform);
+	context1.setPositions(positions);
+	State state1 = context1.getState(State::Energy | State::Forces);
+	force->setUseDeviceKernels(false);
+	VerletIntegrator integ2(1.0);
+	Context context2(system, integ2, platform);
+	context2.setPositions(positions);
+	State state2 = context2.getState(State::Energy | State::Forces);
+	ASSERT_EQUAL_TOL(state2.getPotentialEnergy(), state1.getPotentialEnergy(), 1e-5);
+	for (int i = 0; i < numParticles; i++) {
+		ASSERT(state2.getForces()[i].dot(state2.getForces()[i]) > 0);
+		ASSERT_EQUAL_VEC(state2.getForces()[i], state1.getForces()[i], 1e-4);
+	}
+}
+
+void testUpdateInterval() {
+	// Between selections the pair chosen earlier stays restrained, even after the particles
+	// move so another pair is closer and after the parameters are updated.
+
+	System system;
+	vector<Vec3> positions;
+	positions.push_back(Vec3(0, 0, 0));
+	positions.push_back(Vec3(0.5, 0, 0));
+	positions.push_back(Vec3(3, 0, 0));
+	positions.push_back(Vec3(3.5, 0, 0));
+	vector<int> idxs;
+	for (int i = 0; i < positions.size(); i++) {
+		system.addParticle(1.0);
+		idxs.push_back(i);
+	}
+	ContForce* force = new ContForce();
+	const double length = 1.0;
+	double k = 3;
+	force->addBond(idxs, idxs.size(), length, k);
+	force->setUpdateInterval(5);
+	system.addForce(force);
+	VerletIntegrator integ(1.0);
+	Platform& platform = Platform::getPlatformByName("CUDA");
+	Context context(system, integ, platform);
+	context.setPositions(positions);
+	ASSERT_EQUAL_TOL(k*1.5*1.5, context.getState(State::Energy).getPotentialEnergy(), 1e-5);
+	positions[3] = Vec3(2.2, 0, 0);
+	context.setPositions(positions);
+	ASSERT_EQUAL_TOL(k*1.5*1.5, context.getState(State::Energy).getPotentialEnergy(), 1e-5);
+	k = 4;
+	force->setBondParameters(0, idxs, idxs.size(), length, k);
+	force->updateParametersInContext(context);
+	context.setStepCount(4);
+	State state = context.getState(State::Energy | State::Forces);
+	ASSERT_EQUAL_TOL(k*1.5*1.5, state.getPotentialEnergy(), 1e-5);
+	ASSERT_EQUAL_VEC(Vec3(2*k*1.5, 0, 0), state.getForces()[1], 1e-5);
+	ASSERT_EQUAL_VEC(Vec3(-2*k*1.5, 0, 0), state.getForces()[2], 1e-5);
+	context.setStepCount(5);
+	ASSERT_EQUAL_TOL(k*0.7*0.7, context.getState(State::Energy).getPotentialEnergy(), 1e-5);
+}
+
+void testChangingMembers(bool useDeviceKernels) {
+	// Particles can be added to and removed from bonds in an existing Context.  The bonds whose
+	// particles change have their pairs selected again right away, even between selections, while
+	// the others keep the pairs selected earlier.
+
+	System system;
+	vector<Vec3> positions;
+	positions.push_back(Vec3(0, 0, 0));
+	positions.push_back(Vec3(0.5, 0, 0));
+	positions.push_back(Vec3(3, 0, 0));
+	positions.push_back(Vec3(3.5, 0, 0));
+	positions.push_back(Vec3(0, 10, 0));
+	positions.push_back(Vec3(0.5, 10, 0));
+	positions.push_back(Vec3(3, 10, 0));
+	for (int i = 0; i < positions.size(); i++)
+		system.addParticle(1.0);
+	ContForce* force = new ContForce();
+	const double length = 1.0;
+	const double k = 3;
+	vector<int> idxs1 = {0,1,2,3};
+	vector<int> idxs2 = {4,5};
+	force->addBond(idxs1, idxs1.size(), length, k);
+	force->addBond(idxs2, idxs2.size(), length, k);
+	force->setUpdateInterval(5);
+	force->setUseDeviceKernels(useDeviceKernels);
+	system.addForce(force);
+	VerletIntegrator integ(1.0);
+	Platform& platform = Platform::getPlatformByName("CUDA");
+	Context context(system, integ, platform);
+	context.setPositions(positions);
+	ASSERT_EQUAL_TOL(k*1.5*1.5, context.getState(State::Energy).getPotentialEnergy(), 1e-5);
+
+	// Add a particle to the second bond and move one in the first.  Only the second bond's pairs
+	// are selected again.
+
+	positions[3] = Vec3(2.2, 0, 0);
+	context.setPositions(positions);
+	idxs2.push_back(6);
+	force->setBondParameters(1, idxs2, idxs2.size(), length, k);
+	force->updateParametersInContext(context);
+	context.setStepCount(1);
+	State state = context.getState(State::Energy | State::Forces);
+	ASSERT_EQUAL_TOL(2*k*1.5*1.5, state.getPotentialEnergy(), 1e-5);
+	ASSERT_EQUAL_VEC(Vec3(2*k*1.5, 0, 0), state.getForces()[1], 1e-5);
+	ASSERT_EQUAL_VEC(Vec3(-2*k*1.5, 0, 0), state.getForces()[2], 1e-5);
+	ASSERT_EQUAL_VEC(Vec3(2*k*1.5, 0, 0), state.getForces()[5], 1e-5);
+	ASSERT_EQUAL_VEC(Vec3(-2*k*1.5, 0, 0), state.getForces()[6], 1e-5);
+	int numComponents;
+	vector<int> particle1, particle2;
+	vector<double> distances;
+	force->getBondStatistics(context, 1, numComponents, particle1, particle2, distances);
+	ASSERT_EQUAL(2, numComponents);
+	ASSERT_EQUAL(1, particle1.size());
+
+	// Remove particles from both bonds.  The results should match a new Context.
+
+	idxs1 = {0,1,3};
+	idxs2.pop_back();
+	force->setBondParameters(0, idxs1, idxs1.size(), length, k);
+	force->setBondParameters(1, idxs2, idxs2.size(), length, k);
+	force->updateParametersInContext(context);
+	context.setStepCount(2);
+	state = context.getState(State::Energy | State::Forces);
+	ASSERT_EQUAL_TOL(k*0.7*0.7, state.getPotentialEnergy(), 1e-5);
+	VerletIntegrator integ2(1.0);
+	Context context2(system, integ2, platform);
+	context2.setPositions(positions);
+	State state2 = context2.getState(State::Energy | State::Forces);
+	ASSERT_EQUAL_TOL(state2.getPotentialEnergy(), state.getPotentialEnergy(), 1e-5);
+	for (int i = 0; i < positions.size(); i++)
+		ASSERT_EQUAL_VEC(state2.getForces()[i], state.getForces()[i], 1e-5);
+
+	// Grow the second bond past the room left for it, so the members must be laid out again.
+
+	idxs2 = {4,5,6,0,1,2,3};
+	force->setBondParameters(1, idxs2, idxs2.size(), length, k);
+	force->updateParametersInContext(context);
+	context.setStepCount(3);
+	state = context.getState(State::Energy | State::Forces);
+	VerletIntegrator integ3(1.0);
+	Context context3(system, integ3, platform);
+	context3.setPositions(positions);
+	State state3 = context3.getState(State::Energy | State::Forces);
+	ASSERT_EQUAL_TOL(state3.getPotentialEnergy(), state.getPotentialEnergy(), 1e-5);
+	for (int i = 0; i < positions.size(); i++)
+		ASSERT_EQUAL_VEC(state3.getForces()[i], state.getForces()[i], 1e-5);
+}
+
+void testManyGroups() {
+	// Groups of every size from 2 to 80 members, so each is processed by one of the kernels for
+	// small groups or by the ones for large groups.  Each is made of two separated rows of particles.
+	// Changing the force constants checks that the parameters are matched to the right groups.
+
+	const int numGroups = 40;
+	const double length = 1.0;
+	System system;
+	vector<Vec3> positions;
+	ContForce* force = new ContForce();
+	vector<vector<int> > groupIdxs;
+	vector<double> gaps;
+	for (int g = 0; g < numGroups; g++) {
+		int rowSize = 1+(g*7)%numGroups;
+		double gap = length+0.02*(g+1);
+		vector<int> idxs;
+		for (int i = 0; i < 2*rowSize; i++) {
+			idxs.push_back(system.addParticle(1.0));
+			double x = (i < rowSize ? 0.5*i : 0.5*(rowSize-1)+gap+0.5*(i-rowSize));
+			positions.push_back(Vec3(x, 3.0*g, 0));
+		}
+		force->addBond(idxs, idxs.size(), length, 2.5);
+		groupIdxs.push_back(idxs);
+		gaps.push_back(gap);
+	}
+	system.addForce(force);
+	VerletIntegrator integ(1.0);
+	Platform& platform = Platform::getPlatformByName("CUDA");
+	Context context(system, integ, platform);
+	context.setPositions(positions);
+	for (int iteration = 0; iteration < 2; iteration++) {
+		double expectedEnergy = 0;
+		vector<Vec3> expectedForces(positions.size());
+		for (int g = 0; g < numGroups; g++) {
+			double k = (iteration == 0 ? 2.5 : 1.0+0.1*g);
+			int rowSize = groupIdxs[g].size()/2;
+			double dr = gaps[g]-length;
+			expectedEnergy += k*dr*dr;
+			expectedForces[groupIdxs[g][rowSize-1]] = Vec3(2*k*dr, 0, 0);
+			expectedForces[groupIdxs[g][rowSize]] = Vec3(-2*k*dr, 0, 0);
+		}
+		State state = context.getState(State::Energy | State::Forces);
+		ASSERT_EQUAL_TOL(expectedEnergy, state.getPotentialEnergy(), 1e-5);
+		for (int i = 0; i < positions.size(); i++)
+			ASSERT_EQUAL_VEC(expectedForces[i], state.getForces()[i], 1e-5);
+		for (int g = 0; g < numGroups; g++)
+			force->setBondParameters(g, groupIdxs[g], groupIdxs[g].size(), length, 1.0+0.1*g);
+		force->updateParametersInContext(context);
+	}
+}
+
+void testForceGroups() {
+	// The force is computed alongside a HarmonicBondForce in another force group, on both the device
+	// and the host, and only contributes when its own group is requested.
+
+	System system;
+	vector<Vec3> positions;
+	positions.push_back(Vec3(0, 0, 0));
+	positions.push_back(Vec3(0.5, 0, 0));
+	positions.push_back(Vec3(2, 0, 0));
+	vector<int> idxs;
+	for (int i = 0; i < positions.size(); i++) {
+		system.addParticle(1.0);
+		idxs.push_back(i);
+	}
+	const double length = 1.0;
+	const double k = 3;
+	ContForce* force = new ContForce();
+	force->addBond(idxs, idxs.size(), length, k);
+	force->setForceGroup(1);
+	system.addForce(force);
+	HarmonicBondForce* bonds = new HarmonicBondForce();
+	bonds->addBond(0, 1, 0.4, 100.0);
+	system.addForce(bonds);
+	Platform& platform = Platform::getPlatformByName("CUDA");
+	for (int host = 0; host < 2; host++) {
+		force->setUseDeviceKernels(host == 0);
+		VerletIntegrator integ(1.0);
+		Context context(system, integ, platform);
+		context.setPositions(positions);
+		double bondEnergy = 0.5*100.0*0.1*0.1;
+		ASSERT_EQUAL_TOL(bondEnergy, context.getState(State::Energy, false, 1<<0).getPotentialEnergy(), 1e-5);
+		State state = context.getState(State::Energy | State::Forces, false, 1<<1);
+		ASSERT_EQUAL_TOL(k*0.5*0.5, state.getPotentialEnergy(), 1e-5);
+		ASSERT_EQUAL_VEC(Vec3(2*k*0.5, 0, 0), state.getForces()[1], 1e-5);
+		ASSERT_EQUAL_VEC(Vec3(-2*k*0.5, 0, 0), state.getForces()[2], 1e-5);
+		ASSERT_EQUAL_TOL(bondEnergy+k*0.5*0.5, context.getState(State::Energy).getPotentialEnergy(), 1e-5);
+	}
+}
+
+void testPipelinedSelection() {
+	// With pipelined selection the pairs are chosen from the positions of the previous evaluation, but
+	// restrained at their current separations.
+
+	System system;
+	vector<Vec3> positions;
+	positions.push_back(Vec3(0, 0, 0));
+	positions.push_back(Vec3(0.5, 0, 0));
+	positions.push_back(Vec3(3, 0, 0));
+	positions.push_back(Vec3(3.5, 0, 0));
+	vector<int> idxs;
+	for (int i = 0; i < positions.size(); i++) {
+		system.addParticle(1.0);
+		idxs.push_back(i);
+	}
+	ContForce* force = new ContForce();
+	const double length = 1.0;
+	const double k = 3;
+	force->addBond(idxs, idxs.size(), length, k);
+	force->setUseDeviceKernels(false);
+	force->setUsePipelinedSelection(true);
+	system.addForce(force);
+	VerletIntegrator integ(1.0);
+	Platform& platform = Platform::getPlatformByName("CUDA");
+	Context context(system, integ, platform);
+	context.setPositions(positions);
+	ASSERT_EQUAL_TOL(k*1.5*1.5, context.getState(State::Energy).getPotentialEnergy(), 1e-5);
+
+	// Moving the last particle makes it the closest to the first component, but the pair between
+	// particles 1 and 2 is still restrained once more, at its current separation.
+
+	positions[2] = Vec3(3.1, 0, 0);
+	positions[3] = Vec3(2.2, 0, 0);
+	context.setPositions(positions);
+	State state = context.getState(State::Energy | State::Forces);
+	ASSERT_EQUAL_TOL(k*1.6*1.6, state.getPotentialEnergy(), 1e-5);
+	ASSERT_EQUAL_VEC(Vec3(2*k*1.6, 0, 0), state.getForces()[1], 1e-5);
+	ASSERT_EQUAL_VEC(Vec3(-2*k*1.6, 0, 0), state.getForces()[2], 1e-5);
+	ASSERT_EQUAL_VEC(Vec3(0, 0, 0), state.getForces()[3], 1e-5);
+	state = context.getState(State::Energy | State::Forces);
+	ASSERT_EQUAL_TOL(k*0.7*0.7, state.getPotentialEnergy(), 1e-5);
+	ASSERT_EQUAL_VEC(Vec3(2*k*0.7, 0, 0), state.getForces()[1], 1e-5);
+	ASSERT_EQUAL_VEC(Vec3(-2*k*0.7, 0, 0), state.getForces()[3], 1e-5);
+}
+
+void testMultipleDevices(bool useDeviceKernels) {
+	// Listing the same device twice creates two contexts, so the groups are divided between them.
+	// Groups of different sizes, each made of two separated rows of particles, should give the same
+	// forces, energy and statistics as with a single context.
+
+	const int numGroups = 12;
+	const double length = 1.0;
+	System system;
+	vector<Vec3> positions;
+	ContForce* force = new ContForce();
+	for (int g = 0; g < numGroups; g++) {
+		int rowSize = 1+(g*5)%numGroups;
+		double gap = length+0.03*(g+1);
+		vector<int> idxs;
+		for (int i = 0; i < 2*rowSize; i++) {
+			idxs.push_back(system.addParticle(1.0));
+			double x = (i < rowSize ? 0.5*i : 0.5*(rowSize-1)+gap+0.5*(i-rowSize));
+			positions.push_back(Vec3(x, 3.0*g, 0));
+		}
+		force->addBond(idxs, idxs.size(), length, 1.0+0.2*g);
+	}
+	force->setUseDeviceKernels(useDeviceKernels);
+	system.addForce(force);
+	Platform& platform = Platform::getPlatformByName("CUDA");
+	VerletIntegrator integ1(1.0), integ2(1.0);
+	Context context1(system, integ1, platform);
+	map<string, string> properties;
+	properties["DeviceIndex"] = "0,0";
+	Context context2(system, integ2, platform, properties);
+	context1.setPositions(positions);
+	context2.setPositions(positions);
+	State state1 = context1.getState(State::Energy | State::Forces);
+	State state2 = context2.getState(State::Energy | State::Forces);
+	ASSERT_EQUAL_TOL(state1.getPotentialEnergy(), state2.getPotentialEnergy(), 1e-5);
+	for (int i = 0; i < positions.size(); i++)
+		ASSERT_EQUAL_VEC(state1.getForces()[i], state2.getForces()[i], 1e-5);
+	for (int g = 0; g < numGroups; g++) {
+		int numComponents1, numComponents2;
+		vector<int> particle1, particle2, otherParticle1, otherParticle2;
+		vector<double> distances1, distances2;
+		force->getBondStatistics(context1, g, numComponents1, particle1, particle2, distances1);
+		force->getBondStatistics(context2, g, numComponents2, otherParticle1, otherParticle2, distances2);
+		ASSERT_EQUAL(numComponents1, numComponents2);
+		ASSERT_EQUAL(particle1.size(), otherParticle1.size());
+		for (int i = 0; i < particle1.size(); i++) {
+			ASSERT_EQUAL(particle1[i], otherParticle1[i]);
+			ASSERT_EQUAL(particle2[i], otherParticle2[i]);
+			ASSERT_EQUAL_TOL(distances1[i], distances2[i], 1e-5);
+		}
+	}
+}
+
+void testStatistics(bool useDeviceKernels) {
+	// Create three separated fragments in one bond, and a connected pair in another.
+
+	const int numParticles = 8;
+	System system;
+	vector<Vec3> positions(numParticles);
+	double x[] = {0.0, 0.5, 1.0, 3.0, 3.5, 4.0, 7.0, 7.5};
+	for (int i = 0; i < numParticles; i++) {
+		system.addParticle(1.0);
+		positions[i] = Vec3(x[i], 0, 0);
+	}
+	ContForce* force = new ContForce();
+	system.addForce(force);
+	vector<int> idxs1 = {6,0,3,7,1,4,2,5};
+	vector<int> idxs2 = {0,1};
+	force->addBond(idxs1, idxs1.size(), 1.0, 17);
+	force->addBond(idxs2, idxs2.size(), 1.0, 17);
+	force->setUseDeviceKernels(useDeviceKernels);
+	VerletIntegrator integ(1.0);
+	Platform& platform = Platform::getPlatformByName("CUDA");
+	Context context(system, integ, platform);
+	int numComponents;
+	vector<int> particle1, particle2;
+	vector<double> distances;
+	force->getBondStatistics(context, 0, numComponents, particle1, particle2, distances);
+	ASSERT_EQUAL(0, numComponents);
+	ASSERT_EQUAL(0, particle1.size());
+	vector<int> bondComponents, numPairs;
+	vector<double> minDistances;
+	force->getBondSummaries(context, bondComponents, numPairs, minDistances);
+	ASSERT_EQUAL(2, bondComponents.size());
+	ASSERT_EQUAL(0, bondComponents[0]);
+	ASSERT_EQUAL(0, numPairs[0]);
+	ASSERT_EQUAL(-1.0, minDistances[0]);
+
+	// Once the force has been evaluated, the first bond should have three components restrained by
+	// the pairs 2-3 and 5-6.
+
+	context.setPositions(positions);
+	context.getState(State::Energy);
+	force->getBondStatistics(context, 0, numComponents, particle1, particle2, distances);
+	ASSERT_EQUAL(3, numComponents);
+	ASSERT_EQUAL(2, particle1.size());
+	ASSERT_EQUAL(2, particle2.size());
+	ASSERT_EQUAL(2, distances.size());
+	int first = (particle1[0]+particle2[0] == 5 ? 0 : 1);
+	ASSERT_EQUAL(2, min(particle1[first], particle2[first]));
+	ASSERT_EQUAL(3, max(particle1[first], particle2[first]));
+	ASSERT_EQUAL_TOL(2.0, distances[first], 1e-5);
+	ASSERT_EQUAL(5, min(particle1[1-first], particle2[1-first]));
+	ASSERT_EQUAL(6, max(particle1[1-first], particle2[1-first]));
+	ASSERT_EQUAL_TOL(3.0, distances[1-first], 1e-5);
+	force->getBondStatistics(context, 1, numComponents, particle1, particle2, distances);
+	ASSERT_EQUAL(1, numComponents);
+	ASSERT_EQUAL(0, particle1.size());
+	ASSERT_EQUAL(0, distances.size());
+
+	// The summaries should agree with the statistics.
+
+	force->getBondSummaries(context, bondComponents, numPairs, minDistances);
+	ASSERT_EQUAL(2, bondComponents.size());
+	ASSERT_EQUAL(2, numPairs.size());
+	ASSERT_EQUAL(2, minDistances.size());
+	ASSERT_EQUAL(3, bondComponents[0]);
+	ASSERT_EQUAL(2, numPairs[0]);
+	ASSERT_EQUAL_TOL(2.0, minDistances[0], 1e-5);
+	ASSERT_EQUAL(1, bondComponents[1]);
+	ASSERT_EQUAL(0, numPairs[1]);
+	ASSERT_EQUAL(-1.0, minDistances[1]);
+
+	// Moving a fragment closer should change the distance.
+
+	positions[6] = Vec3(5.5, 0, 0);
+	positions[7] = Vec3(6.0, 0, 0);
+	context.setPositions(positions);
+	context.getState(State::Forces);
+	force->getBondStatistics(context, 0, numComponents, particle1, particle2, distances);
+	ASSERT_EQUAL(3, numComponents);
+	ASSERT_EQUAL(2, distances.size());
+	first = (particle1[0]+particle2[0] == 5 ? 0 : 1);
+	ASSERT_EQUAL(11, particle1[1-first]+particle2[1-first]);
+	ASSERT_EQUAL_TOL(1.5, distances[1-first], 1e-5);
+	force->getBondSummaries(context, bondComponents, numPairs, minDistances);
+	ASSERT_EQUAL(3, bondComponents[0]);
+	ASSERT_EQUAL(2, numPairs[0]);
+	ASSERT_EQUAL_TOL(1.5, minDistances[0], 1e-5);
+	double distanceTime, labelingTime, selectionTime, uploadTime;
+	force->getPhaseTimes(context, distanceTime, labelingTime, selectionTime, uploadTime);
+	ASSERT(distanceTime >= 0.0);
+	ASSERT(labelingTime >= 0.0);
+	ASSERT(selectionTime >= 0.0);
+	ASSERT(uploadTime >= 0.0);
+}
+
+void testCheckpoint(bool useDeviceKernels) {
+	// A Context loaded from a checkpoint, along with the state of the force, keeps restraining the pair
+	// selected before the checkpoint was created until the next selection, just like the Context it was
+	// created from.
+
+	System system;
+	vector<Vec3> positions;
+	positions.push_back(Vec3(0, 0, 0));
+	positions.push_back(Vec3(0.5, 0, 0));
+	positions.push_back(Vec3(3, 0, 0));
+	positions.push_back(Vec3(3.5, 0, 0));
+	vector<int> idxs;
+	for (int i = 0; i < positions.size(); i++) {
+		system.addParticle(1.0);
+		idxs.push_back(i);
+	}
+	ContForce* force = new ContForce();
+	const double length = 1.0;
+	const double k = 3;
+	force->addBond(idxs, idxs.size(), length, k);
+	force->setUpdateInterval(5);
+	force->setUseDeviceKernels(useDeviceKernels);
+	system.addForce(force);
+	VerletIntegrator integ1(1.0), integ2(1.0), integ3(1.0);
+	Platform& platform = Platform::getPlatformByName("CUDA");
+	Context context1(system, integ1, platform);
+	context1.setPositions(positions);
+	context1.getState(State::Energy);
+	stringstream checkpoint;
+	context1.createCheckpoint(checkpoint);
+	force->createCheckpoint(context1, checkpoint);
+	positions[2] = Vec3(3.1, 0, 0);
+	positions[3] = Vec3(2.2, 0, 0);
+	context1.setPositions(positions);
+	State state1 = context1.getState(State::Energy | State::Forces);
+	ASSERT_EQUAL_TOL(k*1.6*1.6, state1.getPotentialEnergy(), 1e-5);
+	Context context2(system, integ2, platform);
+	context2.loadCheckpoint(checkpoint);
+	force->loadCheckpoint(context2, checkpoint);
+	context2.setPositions(positions);
+	State state2 = context2.getState(State::Energy | State::Forces);
+	ASSERT_EQUAL_TOL(state1.getPotentialEnergy(), state2.getPotentialEnergy(), 1e-5);
+	for (int i = 0; i < positions.size(); i++)
+		ASSERT_EQUAL_VEC(state1.getForces()[i], state2.getForces()[i], 1e-5);
+	int numComponents;
+	vector<int> particle1, particle2;
+	vector<double> distances;
+	force->getBondStatistics(context2, 0, numComponents, particle1, particle2, distances);
+	ASSERT_EQUAL(2, numComponents);
+	ASSERT_EQUAL(1, particle1.size());
+	ASSERT_EQUAL(1, min(particle1[0], particle2[0]));
+	ASSERT_EQUAL(2, max(particle1[0], particle2[0]));
+
+	// Without the checkpoint the closer pair is selected.
+
+	Context context3(system, integ3, platform);
+	context3.setPositions(positions);
+	ASSERT_EQUAL_TOL(k*0.7*0.7, context3.getState(State::Energy).getPotentialEnergy(), 1e-5);
+
+	// A checkpoint cannot be loaded into a Context whose force has different bonds.
+
+	System system2;
+	for (int i = 0; i < positions.size(); i++)
+		system2.addParticle(1.0);
+	ContForce* force2 = new ContForce();
+	force2->addBond({0, 1}, 2, length, k);
+	force2->addBond({2, 3}, 2, length, k);
+	force2->setUseDeviceKernels(useDeviceKernels);
+	system2.addForce(force2);
+	VerletIntegrator integ4(1.0);
+	Context context4(system2, integ4, platform);
+	checkpoint.clear();
+	checkpoint.seekg(0);
+	bool thrown = false;
+	try {
+		context4.loadCheckpoint(checkpoint);
+		force2->loadCheckpoint(context4, checkpoint);
+	}
+	catch (const OpenMMException& e) {
+		thrown = true;
+	}
+	ASSERT(thrown);
+}
+
 int main(int argc, char* argv[]) {
 	try {
 		registerContForceCudaKernelFactories();
@@ -197,6 +1050,35 @@ int main(int argc, char* argv[]) {
 		testForce();
 		testChangingParameters();
 		testMultipleBonds();
+		testMultipleComponents();
+		testLargeGroup();
+		testNonbondedNeighborList(1.2, true);
+		testNonbondedNeighborList(0.8, true);
+		testNonbondedNeighborList(1.2, false);
+		testWrappedGroups(true, false);
+		testWrappedGroups(false, false);
+		testWrappedGroups(false, true);
+		testPeriodic(false, true, false);
+		testPeriodic(true, true, false);
+		testPeriodic(false, false, false);
+		testPeriodic(true, false, false);
+		testPeriodic(false, false, true);
+		testPeriodic(true, false, true);
+		testHostComputation();
+		testHostForcePrecision();
+		testHostManyRestraints();
+		testUpdateInterval();
+		testChangingMembers(true);
+		testChangingMembers(false);
+		testManyGroups();
+		testForceGroups();
+		testPipelinedSelection();
+		testStatistics(true);
+		testStatistics(false);
+		testMultipleDevices(true);
+		testMultipleDevices(false);
+		testCheckpoint(true);
+		testCheckpoint(false);
 	}
 	catch(const std::exception& e) {
 		std::cout << "exception: " << e.what() << std::endl;
@@ -1,5 +1,5 @@
-#ifndef OPENMM_OPENCLEXAMPLEKERNELFACTORY_H_
-#define OPENMM_OPENCLEXAMPLEKERNELFACTORY_H_
+#ifndef OPENMM_OPENCLCONTFORCEKERNELFACTORY_H_
+#define OPENMM_OPENCLCONTFORCEKERNELFACTORY_H_
 
 /* -------------------------------------------------------------------------- *
  *                                   OpenMM                                   *
@@ -32,19 +32,20 @@
  * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
  * -------------------------------------------------------------------------- */
 
+
 #include "openmm/KernelFactory.h"
 
-namespace ExamplePlugin {
+namespace ContForcePlugin {
 
 /**
- * This KernelFactory creates kernels for the OpenCL implementation of the Example plugin.
+ * This KernelFactory creates kernels for the OpenCL implementation of the ContForce plugin.
  */
 
-class OpenCLExampleKernelFactory : public OpenMM::KernelFactory {
+class OpenCLContForceKernelFactory : public OpenMM::KernelFactory {
 public:
     OpenMM::KernelImpl* createKernelImpl(std::string name, const OpenMM::Platform& platform, OpenMM::ContextImpl& context) const;
 };
 
-} // namespace ExamplePlugin
+} // namespace ContForcePlugin
 
-#endif /*OPENMM_OPENCLEXAMPLEKERNELFACTORY_H_*/
+#endif /*OPENMM_OPENCLCONTFORCEKERNELFACTORY_H_*/
@@ -1,5 +1,5 @@
 /* -------------------------------------------------------------------------- *
- *                              OpenMMExample                                   *
+ *                                   OpenMM                                   *
  * -------------------------------------------------------------------------- *
  * This is part of the OpenMM molecular simulation toolkit originating from   *
  * Simbios, the NIH National Center for Physics-Based Simulation of           *
@@ -29,16 +29,17 @@
  * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
  * -------------------------------------------------------------------------- */
 
+
 #include <exception>
 
-#include "OpenCLExampleKernelFactory.h"
-#include "CommonExampleKernels.h"
+#include "OpenCLContForceKernelFactory.h"
+#include "CommonContForceKernels.h"
 #include "openmm/opencl/OpenCLContext.h"
 #include "openmm/internal/windowsExport.h"
 #include "openmm/internal/ContextImpl.h"
 #include "openmm/OpenMMException.h"
 
-using namespace ExamplePlugin;
+using namespace ContForcePlugin;
 using namespace OpenMM;
 
 extern "C" OPENMM_EXPORT void registerPlatforms() {
@@ -47,15 +48,15 @@ extern "C" OPENMM_EXPORT void registerPlatforms() {
 extern "C" OPENMM_EXPORT void registerKernelFactories() {
     try {
         Platform& platform = Platform::getPlatformByName("OpenCL");
-        OpenCLExampleKernelFactory* factory = new OpenCLExampleKernelFactory();
-        platform.registerKernelFactory(CalcExampleForceKernel::Name(), factory);
+        OpenCLContForceKernelFactory* factory = new OpenCLContForceKernelFactory();
+        platform.registerKernelFactory(CalcContForceKernel::Name(), factory);
     }
     catch (std::exception ex) {
         // Ignore
     }
 }
 
-extern "C" OPENMM_EXPORT void registerExampleOpenCLKernelFactories() {
+extern "C" OPENMM_EXPORT void registerContForceOpenCLKernelFactories() {
     try {
         Platform::getPlatformByName("OpenCL");
     }
@@ -65,9 +66,9 @@ extern "C" OPENMM_EXPORT void registerExampleOpenCLKernelFactories() {
     registerKernelFactories();
 }
 
-KernelImpl* OpenCLExampleKernelFactory::createKernelImpl(std::string name, const Platform& platform, ContextImpl& context) const {
+KernelImpl* OpenCLContForceKernelFactory::createKernelImpl(std::string name, const Platform& platform, ContextImpl& context) const {
     OpenCLContext& cl = *static_cast<OpenCLPlatform::PlatformData*>(context.getPlatformData())->contexts[0];
-    if (name == CalcExampleForceKernel::Name())
-        return new CommonCalcExampleForceKernel(name, platform, cl, context.getSystem());
+    if (name == CalcContForceKernel::Name())
+        return new CommonCalcContForceKernel(name, platform, cl);
     throw OpenMMException((std::string("Tried to create kernel with illegal kernel name '")+name+"'").c_str());
 }
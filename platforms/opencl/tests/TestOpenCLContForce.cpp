@@ -0,0 +1,666 @@
+/* -------------------------------------------------------------------------- *
+ *                                   OpenMM                                   *
+ * -------------------------------------------------------------------------- *
+ * This is part of the OpenMM molecular simulation toolkit originating from   *
+ * Simbios, the NIH National Center for Physics-Based Simulation of           *
+ * Biological Structures at Stanford, funded under the NIH Roadmap for        *
+ * Medical Research, grant U54 GM072970. See https://simtk.org.               *
+ *                                                                            *
+ * Portions copyright (c) 2014 Stanford University and the Authors.           *
+ * Authors: Peter Eastman                                                     *
+ * Contributors:                                                              *
+ *                                                                            *
+ * Permission is hereby granted, free of charge, to any person obtaining a    *
+ * copy of this software and associated documentation files (the "Software"), *
+ * to deal in the Software without restriction, including without limitation  *
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,   *
+ * and/or sell copies of the Software, and to permit persons to whom the      *
+ * Software is furnished to do so, subject to the following conditions:       *
+ *                                                                            *
+ * The above copyright notice and this permission notice shall be included in *
+ * all copies or substantial portions of the Software.                        *
+ *                                                                            *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR *
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,   *
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL    *
+ * THE AUTHORS, CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,    *
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR      *
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE  *
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.                                     *
+ * -------------------------------------------------------------------------- */
+
+/**
+ * This tests the OpenCL implementation of ContForce.
+ */
+
+#include "ContForce.h"
+#include "openmm/internal/AssertionUtilities.h"
+#include "openmm/Context.h"
+#include "openmm/NonbondedForce.h"
+#include "openmm/OpenMMException.h"
+#include "openmm/Platform.h"
+#include "openmm/System.h"
+#include "openmm/VerletIntegrator.h"
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+using namespace ContForcePlugin;
+using namespace OpenMM;
+using namespace std;
+
+extern "C" OPENMM_EXPORT void registerContForceOpenCLKernelFactories();
+
+void testForce() {
+	// Create a system of 10 atoms connected with a continuity force
+
+	const int numParticles = 10;
+	System system;
+	vector<Vec3> positions(numParticles);
+	for (int i = 0; i < numParticles; i++) {
+		system.addParticle(1.0);
+		if (i != 9) {
+		  positions[i] = Vec3(i, 0.7, 0.5);
+		} else {
+		  positions[i] = Vec3(i, 0.7, 2.1);
+		}
+	}
+	ContForce* force = new ContForce();
+	system.addForce(force);
+	vector<int> idxs = {0,1,2,3,4,5,6,7,8,9};
+	force->addBond(idxs, 10, 1.0, 17);
+
+	// Compute the forces and energy.
+
+	VerletIntegrator integ(1.0);
+	Platform& platform = Platform::getPlatformByName("OpenCL");
+	Context context(system, integ, platform);
+	context.setPositions(positions);
+	State state = context.getState(State::Energy | State::Forces);
+
+	// See if the energy is correct.
+
+	double length = 1.0;
+	double k = 17;
+	Vec3 delta = positions[9]-positions[8];
+	double dr = sqrt(delta.dot(delta))-length;
+	double expectedEnergy = k*dr*dr;
+
+	ASSERT_EQUAL_TOL(expectedEnergy, state.getPotentialEnergy(), 1e-5);
+
+	// Validate the forces by moving each particle along each axis, and see if the energy changes by the correct amount.
+
+	double offset = 1e-3;
+	for (int i = 0; i < numParticles; i++)
+		for (int j = 0; j < 3; j++) {
+			vector<Vec3> offsetPos = positions;
+			offsetPos[i][j] = positions[i][j]-offset;
+			context.setPositions(offsetPos);
+			double e1 = context.getState(State::Energy).getPotentialEnergy();
+			offsetPos[i][j] = positions[i][j]+offset;
+			context.setPositions(offsetPos);
+			double e2 = context.getState(State::Energy).getPotentialEnergy();
+			ASSERT_EQUAL_TOL(state.getForces()[i][j], (e1-e2)/(2*offset), 1e-2);
+		}
+}
+
+void testChangingParameters() {
+	const double k = 1.5;
+	const double length = 0.5;
+	Platform& platform = Platform::getPlatformByName("OpenCL");
+
+	// Create a system with one bond.
+
+	System system;
+	system.addParticle(1.0);
+	system.addParticle(1.0);
+	ContForce* force = new ContForce();
+	vector<int> idxs = {0,1};
+	force->addBond(idxs, 2, length, k);
+	system.addForce(force);
+	vector<Vec3> positions(2);
+	positions[0] = Vec3(1, 0, 0);
+	positions[1] = Vec3(2, 0, 0);
+
+	// Check the energy.
+
+	VerletIntegrator integ(1.0);
+	Context context(system, integ, platform);
+	context.setPositions(positions);
+	State state = context.getState(State::Energy);
+	ASSERT_EQUAL_TOL(k*pow(1.0-length, 2), state.getPotentialEnergy(), 1e-5);
+
+	// Modify the parameters.
+
+	const double k2 = 2.2;
+	const double length2 = 0.9;
+	force->setBondParameters(0, idxs, 2, length2, k2);
+	force->updateParametersInContext(context);
+	state = context.getState(State::Energy);
+	ASSERT_EQUAL_TOL(k2*pow(1.0-length2, 2), state.getPotentialEnergy(), 1e-5);
+}
+
+void testMultipleBonds() {
+	// Create a system of 10 atoms connected with a continuity force
+
+	const int numParticles = 3;
+	System system;
+	vector<Vec3> positions(numParticles);
+	system.addParticle(1.0);
+	system.addParticle(1.0);
+	system.addParticle(1.0);
+
+	positions[0] = Vec3(0, 0, 0);
+	positions[1] = Vec3(-1, 0, 0);
+	positions[2] = Vec3(1, 0, 0);
+
+	ContForce* force = new ContForce();
+	system.addForce(force);
+	vector<int> idxs1 = {0,1};
+	vector<int> idxs2 = {0,2};
+	force->addBond(idxs1, 2, 0.5, 17);
+	force->addBond(idxs2, 2, 0.5, 17);
+
+	// Compute the forces and energy.
+
+	VerletIntegrator integ(1.0);
+	Platform& platform = Platform::getPlatformByName("OpenCL");
+	Context context(system, integ, platform);
+	context.setPositions(positions);
+	State state = context.getState(State::Energy | State::Forces);
+
+	// See if the energy is correct.
+
+	double length = 0.5;
+	double k = 17;
+	Vec3 delta1 = positions[1]-positions[0];
+	double dr1 = sqrt(delta1.dot(delta1))-length;
+	double expectedEnergy1 = k*dr1*dr1;
+
+	Vec3 delta2 = positions[2]-positions[0];
+	double dr2 = sqrt(delta2.dot(delta2))-length;
+	double expectedEnergy2 = k*dr2*dr2;
+
+	ASSERT_EQUAL_TOL(expectedEnergy1 + expectedEnergy2, state.getPotentialEnergy(), 1e-5);
+
+	// Force on atom 0 should be zero
+
+	ASSERT_EQUAL_TOL(state.getForces()[0][0], 0.0, 1e-5);
+	ASSERT_EQUAL_TOL(state.getForces()[0][1], 0.0, 1e-5);
+	ASSERT_EQUAL_TOL(state.getForces()[0][2], 0.0, 1e-5);
+
+}
+
+void testMultipleComponents() {
+	// Create three separated fragments, listing the particles out of order
+
+	const int numParticles = 8;
+	System system;
+	vector<Vec3> positions(numParticles);
+	double x[] = {0.0, 0.5, 1.0, 3.0, 3.5, 4.0, 7.0, 7.5};
+	for (int i = 0; i < numParticles; i++) {
+		system.addParticle(1.0);
+		positions[i] = Vec3(x[i], 0, 0);
+	}
+	ContForce* force = new ContForce();
+	system.addForce(force);
+	vector<int> idxs = {6,0,3,7,1,4,2,5};
+	const double length = 1.0;
+	const double k = 17;
+	force->addBond(idxs, numParticles, length, k);
+
+	// Compute the forces and energy.
+
+	VerletIntegrator integ(1.0);
+	Platform& platform = Platform::getPlatformByName("OpenCL");
+	Context context(system, integ, platform);
+	context.setPositions(positions);
+	State state = context.getState(State::Energy | State::Forces);
+
+	// Particles 2-3 and 5-6 should be restrained, and no others.
+
+	ASSERT_EQUAL_TOL(k*1.0*1.0 + k*2.0*2.0, state.getPotentialEnergy(), 1e-5);
+	vector<Vec3> expectedForces(numParticles);
+	expectedForces[2] = Vec3(2*k, 0, 0);
+	expectedForces[3] = Vec3(-2*k, 0, 0);
+	expectedForces[5] = Vec3(4*k, 0, 0);
+	expectedForces[6] = Vec3(-4*k, 0, 0);
+	for (int i = 0; i < numParticles; i++)
+		ASSERT_EQUAL_VEC(expectedForces[i], state.getForces()[i], 1e-5);
+}
+
+void testLargeGroup() {
+	// Create two slabs of particles on a lattice, separated by a gap along z
+
+	const int nx = 10, ny = 10, nz = 20;
+	const int numParticles = nx*ny*nz;
+	const double spacing = 0.5;
+	const double gap = 2.0;
+	System system;
+	vector<Vec3> positions;
+	vector<int> idxs;
+	for (int i = 0; i < nx; i++)
+		for (int j = 0; j < ny; j++)
+			for (int m = 0; m < nz; m++) {
+				system.addParticle(1.0);
+				double z = spacing*m + (m < nz/2 ? 0.0 : gap-spacing);
+				positions.push_back(Vec3(spacing*i, spacing*j, z));
+				idxs.push_back(idxs.size());
+			}
+	ContForce* force = new ContForce();
+	system.addForce(force);
+	const double length = 1.0;
+	const double k = 17;
+	force->addBond(idxs, numParticles, length, k);
+
+	// Only one pair should be restrained across the gap.
+
+	VerletIntegrator integ(1.0);
+	Platform& platform = Platform::getPlatformByName("OpenCL");
+	Context context(system, integ, platform);
+	context.setPositions(positions);
+	State state = context.getState(State::Energy | State::Forces);
+	ASSERT_EQUAL_TOL(k*(gap-length)*(gap-length), state.getPotentialEnergy(), 1e-5);
+	Vec3 totalForce;
+	for (int i = 0; i < numParticles; i++)
+		totalForce += state.getForces()[i];
+	ASSERT_EQUAL_VEC(Vec3(0, 0, 0), totalForce, 1e-5);
+}
+
+void testWrappedGroups(bool useDeviceKernels) {
+	// The System is periodic because of a NonbondedForce with PME, but the ContForce is not.  Two groups
+	// are rows of particles that cross the faces of the box, with a gap in each.  When the atoms are
+	// reordered each one is moved into the box on its own, which must not split the rows.
+
+	const double boxSize = 3.0;
+	System system;
+	system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+	NonbondedForce* nonbonded = new NonbondedForce();
+	nonbonded->setNonbondedMethod(NonbondedForce::PME);
+	nonbonded->setCutoffDistance(1.0);
+	system.addForce(nonbonded);
+	ContForce* force = new ContForce();
+	force->setUseDeviceKernels(useDeviceKernels);
+	force->setForceGroup(1);
+	system.addForce(force);
+	vector<Vec3> positions;
+	const int numGroups = 2;
+	const int rowSize[] = {5, 50};
+	const double spacing[] = {0.1, 0.04};
+	const double gap[] = {0.4, 0.54};
+	const double length[] = {0.15, 0.1};
+	const double k[] = {3.0, 5.0};
+	vector<int> lastOfRow(numGroups);
+	for (int g = 0; g < numGroups; g++) {
+		vector<int> idxs;
+		for (int i = 0; i < 2*rowSize[g]; i++) {
+			idxs.push_back(system.addParticle(1.0));
+			nonbonded->addParticle(0.0, 0.1, 0.0);
+			double x = 2.7-0.7*g+spacing[g]*i+(i < rowSize[g] ? 0.0 : gap[g]-spacing[g]);
+			positions.push_back(Vec3(x, 0.5+g, 0.5+g));
+		}
+		force->addBond(idxs, idxs.size(), length[g], k[g]);
+		lastOfRow[g] = idxs[rowSize[g]-1];
+	}
+	VerletIntegrator integ(1.0);
+	Platform& platform = Platform::getPlatformByName("OpenCL");
+	Context context(system, integ, platform);
+
+	// Moving all the particles changes which of them cross the faces.
+
+	for (int step = 0; step < 4; step++) {
+		context.setPositions(positions);
+		State state = context.getState(State::Energy | State::Forces, false, 1<<1);
+		double expectedEnergy = 0;
+		for (int g = 0; g < numGroups; g++) {
+			double dr = gap[g]-length[g];
+			expectedEnergy += k[g]*dr*dr;
+			ASSERT_EQUAL_VEC(Vec3(2*k[g]*dr, 0, 0), state.getForces()[lastOfRow[g]], 1e-5);
+			ASSERT_EQUAL_VEC(Vec3(-2*k[g]*dr, 0, 0), state.getForces()[lastOfRow[g]+1], 1e-5);
+		}
+		ASSERT_EQUAL_TOL(expectedEnergy, state.getPotentialEnergy(), 1e-5);
+		for (int i = 0; i < positions.size(); i++)
+			positions[i] += Vec3(0.37, 0.8, -0.3);
+	}
+}
+
+void testPeriodic(bool triclinic) {
+	// Build two groups of three fragments that fit well inside half the box, so every separation is its
+	// own nearest image, and find the energy and forces on the device without periodic boundary conditions.
+
+	Vec3 a(5, 0, 0), b(0, 5, 0), c(0, 0, 5);
+	if (triclinic) {
+		b = Vec3(1, 5, 0);
+		c = Vec3(-1.5, 1, 5);
+	}
+	const double length = 0.5;
+	const double k = 4;
+	const int gridSize[2][3] = {{2, 2, 2}, {4, 3, 2}};
+	const double spacing[] = {0.3, 0.1};
+	System system;
+	system.setDefaultPeriodicBoxVectors(a, b, c);
+	ContForce* force = new ContForce();
+	force->setUseDeviceKernels(true);
+	system.addForce(force);
+	vector<Vec3> positions;
+	for (int g = 0; g < 2; g++) {
+		vector<int> idxs;
+		for (int fragment = 0; fragment < 3; fragment++)
+			for (int i = 0; i < gridSize[g][2]; i++)
+				for (int j = 0; j < gridSize[g][1]; j++)
+					for (int m = 0; m < gridSize[g][0]; m++) {
+						idxs.push_back(system.addParticle(1.0));
+						positions.push_back(Vec3(0.8*fragment+spacing[g]*m, spacing[g]*j, 0.5*fragment+spacing[g]*i));
+					}
+		force->addBond(idxs, idxs.size(), length, k);
+	}
+
+	// Jitter the particles so no two pairs are equally close.
+
+	int numParticles = positions.size();
+	for (int i = 0; i < numParticles; i++)
+		positions[i] += Vec3(0.02*sin(1.3*i), 0.02*sin(2.1*i+1), 0.02*sin(0.7*i+2));
+	Platform& platform = Platform::getPlatformByName("OpenCL");
+	VerletIntegrator integ1(1.0);
+	Context context1(system, integ1, platform);
+	context1.setPositions(positions);
+	State state1 = context1.getState(State::Energy | State::Forces);
+	ASSERT(state1.getPotentialEnergy() > 0);
+
+	// Move every particle to a different periodic image, which splits the fragments across the faces
+	// of the box.  With periodic boundary conditions the results should not change.
+
+	vector<Vec3> shifted(numParticles);
+	for (int i = 0; i < numParticles; i++)
+		shifted[i] = positions[i]+a*((i%3)-1)+b*(((i/3)%3)-1)+c*(2*(i%2)-1);
+	force->setUsesPeriodicBoundaryConditions(true);
+	VerletIntegrator integ2(1.0);
+	Context context2(system, integ2, platform);
+	context2.setPositions(shifted);
+	State state2 = context2.getState(State::Energy | State::Forces);
+	ASSERT_EQUAL_TOL(state1.getPotentialEnergy(), state2.getPotentialEnergy(), 1e-4);
+	for (int i = 0; i < numParticles; i++)
+		ASSERT_EQUAL_VEC(state1.getForces()[i], state2.getForces()[i], 1e-4);
+}
+
+void testHostComputation() {
+	// Compute the same fragmented system on the device and on the host, and check that they agree.
+
+	const int numParticles = 60;
+	System system;
+	vector<Vec3> positions(numParticles);
+	for (int i = 0; i < numParticles; i++) {
+		system.addParticle(1.0);
+		positions[i] = Vec3(0.37*(i%5) + 2.5*(i/20), 0.41*((i/5)%4) + 0.05*(i%3), 0.1*(i%7));
+	}
+	vector<int> idxs1, idxs2;
+	for (int i = 0; i < numParticles; i++) {
+		idxs1.push_back(i);
+		if (i%2 == 1)
+			idxs2.push_back(i);
+	}
+	ContForce* force = new ContForce();
+	force->addBond(idxs1, idxs1.size(), 0.5, 17);
+	force->addBond(idxs2, idxs2.size(), 0.6, 11);
+	system.addForce(force);
+	Platform& platform = Platform::getPlatformByName("OpenCL");
+	VerletIntegrator integ1(1.0);
+	Context context1(system, integ1, platform);
+	context1.setPositions(positions);
+	State state1 = context1.getState(State::Energy | State::Forces);
+	force->setUseDeviceKernels(false);
+	VerletIntegrator integ2(1.0);
+	Context context2(system, integ2, platform);
+	context2.setPositions(positions);
+	State state2 = context2.getState(State::Energy | State::Forces);
+	ASSERT(state1.getPotentialEnergy() > 0);
+	ASSERT_EQUAL_TOL(state2.getPotentialEnergy(), state1.getPotentialEnergy(), 1e-5);
+	for (int i = 0; i < numParticles; i++)
+		ASSERT_EQUAL_VEC(state2.getForces()[i], state1.getForces()[i], 1e-4);
+}
+
+void testUpdateInterval() {
+	// Between selections the pair chosen earlier stays restrained, even after the particles
+	// move so another pair is closer and after the parameters are updated.
+
+	System system;
+	vector<Vec3> positions;
+	positions.push_back(Vec3(0, 0, 0));
+	positions.push_back(Vec3(0.5, 0, 0));
+	positions.push_back(Vec3(3, 0, 0));
+	positions.push_back(Vec3(3.5, 0, 0));
+	vector<int> idxs;
+	for (int i = 0; i < positions.size(); i++) {
+		system.addParticle(1.0);
+		idxs.push_back(i);
+	}
+	ContForce* force = new ContForce();
+	const double length = 1.0;
+	double k = 3;
+	force->addBond(idxs, idxs.size(), length, k);
+	force->setUpdateInterval(5);
+	system.addForce(force);
+	VerletIntegrator integ(1.0);
+	Platform& platform = Platform::getPlatformByName("OpenCL");
+	Context context(system, integ, platform);
+	context.setPositions(positions);
+	ASSERT_EQUAL_TOL(k*1.5*1.5, context.getState(State::Energy).getPotentialEnergy(), 1e-5);
+	positions[3] = Vec3(2.2, 0, 0);
+	context.setPositions(positions);
+	ASSERT_EQUAL_TOL(k*1.5*1.5, context.getState(State::Energy).getPotentialEnergy(), 1e-5);
+	k = 4;
+	force->setBondParameters(0, idxs, idxs.size(), length, k);
+	force->updateParametersInContext(context);
+	context.setStepCount(4);
+	State state = context.getState(State::Energy | State::Forces);
+	ASSERT_EQUAL_TOL(k*1.5*1.5, state.getPotentialEnergy(), 1e-5);
+	ASSERT_EQUAL_VEC(Vec3(2*k*1.5, 0, 0), state.getForces()[1], 1e-5);
+	ASSERT_EQUAL_VEC(Vec3(-2*k*1.5, 0, 0), state.getForces()[2], 1e-5);
+	context.setStepCount(5);
+	ASSERT_EQUAL_TOL(k*0.7*0.7, context.getState(State::Energy).getPotentialEnergy(), 1e-5);
+}
+
+void testChangingMembers() {
+	// Particles can be added to and removed from bonds in an existing Context.  The bonds whose
+	// particles change have their pairs selected again right away, even between selections.  The
+	// positions do not change until the end of the test, so the results do not depend on whether
+	// the other bonds are selected again too.
+
+	System system;
+	vector<Vec3> positions;
+	positions.push_back(Vec3(0, 0, 0));
+	positions.push_back(Vec3(0.5, 0, 0));
+	positions.push_back(Vec3(3, 0, 0));
+	positions.push_back(Vec3(3.5, 0, 0));
+	positions.push_back(Vec3(0, 10, 0));
+	positions.push_back(Vec3(0.5, 10, 0));
+	positions.push_back(Vec3(3, 10, 0));
+	for (int i = 0; i < positions.size(); i++)
+		system.addParticle(1.0);
+	ContForce* force = new ContForce();
+	const double length = 1.0;
+	const double k = 3;
+	vector<int> idxs1 = {0,1,2,3};
+	vector<int> idxs2 = {4,5};
+	force->addBond(idxs1, idxs1.size(), length, k);
+	force->addBond(idxs2, idxs2.size(), length, k);
+	force->setUpdateInterval(5);
+	system.addForce(force);
+	VerletIntegrator integ(1.0);
+	Platform& platform = Platform::getPlatformByName("OpenCL");
+	Context context(system, integ, platform);
+	context.setPositions(positions);
+	ASSERT_EQUAL_TOL(k*1.5*1.5, context.getState(State::Energy).getPotentialEnergy(), 1e-5);
+
+	// Add a particle to the second bond.
+
+	idxs2.push_back(6);
+	force->setBondParameters(1, idxs2, idxs2.size(), length, k);
+	force->updateParametersInContext(context);
+	context.setStepCount(1);
+	State state = context.getState(State::Energy | State::Forces);
+	ASSERT_EQUAL_TOL(2*k*1.5*1.5, state.getPotentialEnergy(), 1e-5);
+	ASSERT_EQUAL_VEC(Vec3(2*k*1.5, 0, 0), state.getForces()[1], 1e-5);
+	ASSERT_EQUAL_VEC(Vec3(-2*k*1.5, 0, 0), state.getForces()[2], 1e-5);
+	ASSERT_EQUAL_VEC(Vec3(2*k*1.5, 0, 0), state.getForces()[5], 1e-5);
+	ASSERT_EQUAL_VEC(Vec3(-2*k*1.5, 0, 0), state.getForces()[6], 1e-5);
+	int numComponents;
+	vector<int> particle1, particle2;
+	vector<double> distances;
+	force->getBondStatistics(context, 1, numComponents, particle1, particle2, distances);
+	ASSERT_EQUAL(2, numComponents);
+	ASSERT_EQUAL(1, particle1.size());
+	vector<int> bondComponents, numPairs;
+	vector<double> minDistances;
+	force->getBondSummaries(context, bondComponents, numPairs, minDistances);
+	for (int i = 0; i < 2; i++) {
+		ASSERT_EQUAL(2, bondComponents[i]);
+		ASSERT_EQUAL(1, numPairs[i]);
+		ASSERT_EQUAL_TOL(2.5, minDistances[i], 1e-5);
+	}
+
+	// Remove particles from both bonds.  The results should match a new Context.
+
+	positions[3] = Vec3(2.2, 0, 0);
+	context.setPositions(positions);
+	idxs1 = {0,1,3};
+	idxs2.pop_back();
+	force->setBondParameters(0, idxs1, idxs1.size(), length, k);
+	force->setBondParameters(1, idxs2, idxs2.size(), length, k);
+	force->updateParametersInContext(context);
+	context.setStepCount(2);
+	state = context.getState(State::Energy | State::Forces);
+	ASSERT_EQUAL_TOL(k*0.7*0.7, state.getPotentialEnergy(), 1e-5);
+	VerletIntegrator integ2(1.0);
+	Context context2(system, integ2, platform);
+	context2.setPositions(positions);
+	State state2 = context2.getState(State::Energy | State::Forces);
+	ASSERT_EQUAL_TOL(state2.getPotentialEnergy(), state.getPotentialEnergy(), 1e-5);
+	for (int i = 0; i < positions.size(); i++)
+		ASSERT_EQUAL_VEC(state2.getForces()[i], state.getForces()[i], 1e-5);
+
+	// Grow the second bond past the room left for it, so the members must be laid out again.
+
+	idxs2 = {4,5,6,0,1,2,3};
+	force->setBondParameters(1, idxs2, idxs2.size(), length, k);
+	force->updateParametersInContext(context);
+	context.setStepCount(3);
+	state = context.getState(State::Energy | State::Forces);
+	VerletIntegrator integ3(1.0);
+	Context context3(system, integ3, platform);
+	context3.setPositions(positions);
+	State state3 = context3.getState(State::Energy | State::Forces);
+	ASSERT_EQUAL_TOL(state3.getPotentialEnergy(), state.getPotentialEnergy(), 1e-5);
+	for (int i = 0; i < positions.size(); i++)
+		ASSERT_EQUAL_VEC(state3.getForces()[i], state.getForces()[i], 1e-5);
+}
+
+void testCheckpoint() {
+	// A Context loaded from a checkpoint, along with the state of the force, keeps restraining the pair
+	// selected before the checkpoint was created until the next selection, just like the Context it was
+	// created from.
+
+	System system;
+	vector<Vec3> positions;
+	positions.push_back(Vec3(0, 0, 0));
+	positions.push_back(Vec3(0.5, 0, 0));
+	positions.push_back(Vec3(3, 0, 0));
+	positions.push_back(Vec3(3.5, 0, 0));
+	vector<int> idxs;
+	for (int i = 0; i < positions.size(); i++) {
+		system.addParticle(1.0);
+		idxs.push_back(i);
+	}
+	ContForce* force = new ContForce();
+	const double length = 1.0;
+	const double k = 3;
+	force->addBond(idxs, idxs.size(), length, k);
+	force->setUpdateInterval(5);
+	system.addForce(force);
+	VerletIntegrator integ1(1.0), integ2(1.0), integ3(1.0);
+	Platform& platform = Platform::getPlatformByName("OpenCL");
+	Context context1(system, integ1, platform);
+	context1.setPositions(positions);
+	context1.getState(State::Energy);
+	stringstream checkpoint;
+	context1.createCheckpoint(checkpoint);
+	force->createCheckpoint(context1, checkpoint);
+	positions[2] = Vec3(3.1, 0, 0);
+	positions[3] = Vec3(2.2, 0, 0);
+	context1.setPositions(positions);
+	State state1 = context1.getState(State::Energy | State::Forces);
+	ASSERT_EQUAL_TOL(k*1.6*1.6, state1.getPotentialEnergy(), 1e-5);
+	Context context2(system, integ2, platform);
+	context2.loadCheckpoint(checkpoint);
+	force->loadCheckpoint(context2, checkpoint);
+	context2.setPositions(positions);
+	State state2 = context2.getState(State::Energy | State::Forces);
+	ASSERT_EQUAL_TOL(state1.getPotentialEnergy(), state2.getPotentialEnergy(), 1e-5);
+	for (int i = 0; i < positions.size(); i++)
+		ASSERT_EQUAL_VEC(state1.getForces()[i], state2.getForces()[i], 1e-5);
+	int numComponents;
+	vector<int> particle1, particle2;
+	vector<double> distances;
+	force->getBondStatistics(context2, 0, numComponents, particle1, particle2, distances);
+	ASSERT_EQUAL(2, numComponents);
+	ASSERT_EQUAL(1, particle1.size());
+	ASSERT_EQUAL(1, min(particle1[0], particle2[0]));
+	ASSERT_EQUAL(2, max(particle1[0], particle2[0]));
+
+	// Without the checkpoint the closer pair is selected.
+
+	Context context3(system, integ3, platform);
+	context3.setPositions(positions);
+	ASSERT_EQUAL_TOL(k*0.7*0.7, context3.getState(State::Energy).getPotentialEnergy(), 1e-5);
+
+	// A checkpoint cannot be loaded into a Context whose force has different bonds.
+
+	System system2;
+	for (int i = 0; i < positions.size(); i++)
+		system2.addParticle(1.0);
+	ContForce* force2 = new ContForce();
+	force2->addBond({0, 1}, 2, length, k);
+	force2->addBond({2, 3}, 2, length, k);
+	system2.addForce(force2);
+	VerletIntegrator integ4(1.0);
+	Context context4(system2, integ4, platform);
+	checkpoint.clear();
+	checkpoint.seekg(0);
+	bool thrown = false;
+	try {
+		context4.loadCheckpoint(checkpoint);
+		force2->loadCheckpoint(context4, checkpoint);
+	}
+	catch (const OpenMMException& e) {
+		thrown = true;
+	}
+	ASSERT(thrown);
+}
+
+int main(int argc, char* argv[]) {
+	try {
+		registerContForceOpenCLKernelFactories();
+		if (argc > 1)
+			Platform::getPlatformByName("OpenCL").setPropertyDefaultValue("Precision", string(argv[1]));
+		testForce();
+		testChangingParameters();
+		testMultipleBonds();
+		testMultipleComponents();
+		testLargeGroup();
+		testWrappedGroups(true);
+		testWrappedGroups(false);
+		testPeriodic(false);
+		testPeriodic(true);
+		testHostComputation();
+		testUpdateInterval();
+		testChangingMembers();
+		testCheckpoint();
+	}
+	catch(const std::exception& e) {
+		std::cout << "exception: " << e.what() << std::endl;
+		return 1;
+	}
+	std::cout << "Done" << std::endl;
+	return 0;
+}
@@ -6,6 +6,7 @@
 
 using namespace ContForcePlugin;
 using namespace OpenMM;
+using namespace std;
 
 extern "C" OPENMM_EXPORT void registerPlatforms() {
 }
@@ -13,7 +14,10 @@ extern "C" OPENMM_EXPORT void registerPlatforms() {
 extern "C" OPENMM_EXPORT void registerKernelFactories() {
     for (int i = 0; i < Platform::getNumPlatforms(); i++) {
         Platform& platform = Platform::getPlatform(i);
-        if (dynamic_cast<ReferencePlatform*>(&platform) != NULL) {
+        // Platforms derived from ReferencePlatform, such as CPU, can use these kernels unless they
+        // have their own.
+
+        if (platform.getName() == "Reference" || (dynamic_cast<ReferencePlatform*>(&platform) != NULL && !platform.supportsKernels(vector<string>(1, CalcContForceKernel::Name())))) {
             ReferenceContForceKernelFactory* factory = new ReferenceContForceKernelFactory();
             platform.registerKernelFactory(CalcContForceKernel::Name(), factory);
         }
@@ -2,14 +2,17 @@
 #define REFERENCE_CONTFORCE_KERNELS_H_
 
 #include "ContForceKernels.h"
+#include "internal/ContForceEvaluator.h"
 #include "openmm/Platform.h"
+#include "openmm/internal/ThreadPool.h"
 #include <vector>
 
 namespace ContForcePlugin {
 
 class ReferenceCalcContForceKernel : public CalcContForceKernel {
 public:
-    ReferenceCalcContForceKernel(std::string name, const OpenMM::Platform& platform) : CalcContForceKernel(name, platform) {
+    ReferenceCalcContForceKernel(std::string name, const OpenMM::Platform& platform) : CalcContForceKernel(name, platform),
+            updateInterval(1), lastSelectionStep(-1) {
     }
     /**
      * Initialize the kernel.
@@ -34,11 +37,44 @@ public:
      * @param force      the ContForce to copy the parameters from
      */
     void copyParametersToContext(OpenMM::ContextImpl& context, const ContForce& force);
+    /**
+     * Get how many times a group's neighbor list has been reused instead of rebuilt.
+     */
+    long long getNumCacheHits() const {
+        return evaluator.getNumCacheHits();
+    }
+    /**
+     * Get statistics about a group from the last time the force was evaluated.
+     */
+    void getGroupStatistics(int group, int& numComponents, std::vector<int>& particle1, std::vector<int>& particle2,
+                            std::vector<double>& distances) {
+        evaluator.getGroupStatistics(group, numComponents, particle1, particle2, distances);
+    }
+    void getGroupSummaries(std::vector<int>& numComponents, std::vector<int>& numPairs, std::vector<double>& minDistances) {
+        evaluator.getGroupSummaries(numComponents, numPairs, minDistances);
+    }
+    /**
+     * Get the total time in seconds spent in each phase of the calculation.  Nothing is uploaded,
+     * so uploadTime is always 0.
+     */
+    void getPhaseTimes(double& distanceTime, double& labelingTime, double& selectionTime, double& uploadTime) {
+        evaluator.getPhaseTimes(distanceTime, labelingTime, selectionTime);
+        uploadTime = 0.0;
+    }
+    /**
+     * Write the step of the last selection and the state of the evaluator to a checkpoint.
+     */
+    void createCheckpoint(OpenMM::ContextImpl& context, std::ostream& stream);
+    /**
+     * Load the state written to a checkpoint by createCheckpoint().
+     */
+    void loadCheckpoint(OpenMM::ContextImpl& context, std::istream& stream);
 private:
-    int numBonds;
-    std::vector<std::vector<int>> idxs;
-    std::vector<int> npart;
-    std::vector<double> length, k;
+    int updateInterval;
+    long long lastSelectionStep;
+    OpenMM::ThreadPool threads;
+    ContForceEvaluator evaluator;
+    std::vector<std::pair<int, OpenMM::Vec3> > groupForces;
 };
 
 } // namespace ContForcePlugin
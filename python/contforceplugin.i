@@ -22,6 +22,14 @@ namespace std {
 #include "OpenMMDrude.h"
 #include "openmm/RPMDIntegrator.h"
 #include "openmm/RPMDMonteCarloBarostat.h"
+#define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
+#include <numpy/arrayobject.h>
+#include <cstring>
+#include <sstream>
+%}
+
+%init %{
+    import_array();
 %}
 
 %pythoncode %{
@@ -38,6 +46,64 @@ import simtk.unit as unit
     val[3] = unit.Quantity(val[3], unit.kilojoule_per_mole/unit.nanometer**4)
 %}
 
+/*
+ * Accept any array or sequence for vector arguments.  NumPy arrays that are already contiguous
+ * and of the right type are copied directly, and anything else is converted by NumPy in one call,
+ * so no element is converted through Python.  Only arrays of the kinds accepted by IS_VALID_KIND
+ * are converted, so that for example floating point indices raise a TypeError instead of being
+ * truncated.  Empty sequences are accepted whatever type NumPy gives them.
+*/
+%define %numpy_vector_in(TYPE, NPY_TYPE, IS_VALID_KIND)
+%typemap(in) const std::vector<TYPE>& (std::vector<TYPE> temp) {
+    PyArrayObject* input = (PyArrayObject*) PyArray_FromAny($input, NULL, 1, 1, 0, NULL);
+    if (input == NULL)
+        SWIG_fail;
+    if (PyArray_SIZE(input) > 0 && !IS_VALID_KIND(input)) {
+        Py_DECREF(input);
+        PyErr_SetString(PyExc_TypeError, "ContForce: expected a sequence of " #TYPE " values");
+        SWIG_fail;
+    }
+    PyArrayObject* array = (PyArrayObject*) PyArray_FROMANY((PyObject*) input, NPY_TYPE, 1, 1, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST);
+    Py_DECREF(input);
+    if (array == NULL)
+        SWIG_fail;
+    TYPE* data = (TYPE*) PyArray_DATA(array);
+    temp.assign(data, data+PyArray_SIZE(array));
+    Py_DECREF(array);
+    $1 = &temp;
+}
+%typemap(typecheck, precedence=SWIG_TYPECHECK_POINTER) const std::vector<TYPE>& {
+    $1 = (PyArray_Check($input) || PySequence_Check($input)) ? 1 : 0;
+}
+%enddef
+%{
+static bool isIntegerArray(PyArrayObject* array) {
+    return PyArray_ISINTEGER(array);
+}
+
+static bool isRealArray(PyArrayObject* array) {
+    return PyArray_ISINTEGER(array) || PyArray_ISFLOAT(array);
+}
+%}
+%numpy_vector_in(int, NPY_INT, isIntegerArray)
+%numpy_vector_in(double, NPY_DOUBLE, isRealArray)
+
+/*
+ * Return the particles in a bond as a NumPy array.
+*/
+%typemap(in, numinputs=0) std::vector<int>& idxs (std::vector<int> temp) {
+    $1 = &temp;
+}
+%typemap(argout) std::vector<int>& idxs {
+    npy_intp size = $1->size();
+    PyObject* array = PyArray_SimpleNew(1, &size, NPY_INT);
+    if (array == NULL)
+        SWIG_fail;
+    if (size > 0)
+        memcpy(PyArray_DATA((PyArrayObject*) array), &(*$1)[0], size*sizeof(int));
+    $result = SWIG_Python_AppendOutput($result, array);
+}
+
 /*
  * Convert C++ exceptions to Python exceptions.
 */
@@ -59,22 +125,88 @@ public:
 
     int getNumBonds() const;
 
-    int addBond(std::vector<int> idxs, int npart, double length, double k);
+    int addBond(const std::vector<int>& idxs, int npart, double length, double k);
+
+    int addBonds(const std::vector<int>& idxs, const std::vector<int>& npart, const std::vector<double>& length,
+                 const std::vector<double>& k);
+
+    void setBondParameters(int index, const std::vector<int>& idxs, int npart, double length, double k);
 
-    void setBondParameters(int index, std::vector<int> idxs, int npart, double length, double k);
+    void setBondParametersBulk(const std::vector<int>& indices, const std::vector<int>& idxs, const std::vector<int>& npart,
+                               const std::vector<double>& length, const std::vector<double>& k);
 
     void updateParametersInContext(OpenMM::Context& context);
 
+    bool getUseDeviceKernels() const;
+
+    void setUseDeviceKernels(bool use);
+
+    bool getUsePipelinedSelection() const;
+
+    void setUsePipelinedSelection(bool use);
+
+    bool getUseNonbondedNeighborList() const;
+
+    void setUseNonbondedNeighborList(bool use);
+
+    double getSkinDistance() const;
+
+    void setSkinDistance(double distance);
+
+    int getHierarchicalGroupSize() const;
+
+    void setHierarchicalGroupSize(int size);
+
+    int getUpdateInterval() const;
+
+    void setUpdateInterval(int interval);
+
+    long long getNumCacheHits(OpenMM::Context& context);
+
+    %apply int& OUTPUT {int& numComponents};
+    %apply std::vector<int>& OUTPUT {std::vector<int>& particle1};
+    %apply std::vector<int>& OUTPUT {std::vector<int>& particle2};
+    %apply std::vector<double>& OUTPUT {std::vector<double>& distances};
+    void getBondStatistics(OpenMM::Context& context, int index, int& numComponents, std::vector<int>& particle1,
+                           std::vector<int>& particle2, std::vector<double>& distances);
+    %clear int& numComponents;
+    %clear std::vector<int>& particle1;
+    %clear std::vector<int>& particle2;
+    %clear std::vector<double>& distances;
+
+    %apply std::vector<int>& OUTPUT {std::vector<int>& numComponents};
+    %apply std::vector<int>& OUTPUT {std::vector<int>& numPairs};
+    %apply std::vector<double>& OUTPUT {std::vector<double>& minDistances};
+    void getBondSummaries(OpenMM::Context& context, std::vector<int>& numComponents, std::vector<int>& numPairs,
+                          std::vector<double>& minDistances);
+    %clear std::vector<int>& numComponents;
+    %clear std::vector<int>& numPairs;
+    %clear std::vector<double>& minDistances;
+
+    %apply double& OUTPUT {double& distanceTime};
+    %apply double& OUTPUT {double& labelingTime};
+    %apply double& OUTPUT {double& selectionTime};
+    %apply double& OUTPUT {double& uploadTime};
+    void getPhaseTimes(OpenMM::Context& context, double& distanceTime, double& labelingTime, double& selectionTime,
+                       double& uploadTime);
+    %clear double& distanceTime;
+    %clear double& labelingTime;
+    %clear double& selectionTime;
+    %clear double& uploadTime;
+
+    void setUsesPeriodicBoundaryConditions(bool periodic);
+
+    bool usesPeriodicBoundaryConditions() const;
+
     /*
      * The reference parameters to this function are output values.
-     * Marking them as such will cause swig to return a tuple.
+     * Marking them as such will cause swig to return a tuple.  The
+     * particles are returned as a NumPy array by the typemap above.
     */
-    %apply std::vector<int>& OUTPUT {std::vector<int>& idxs};
     %apply int& OUTPUT {int& npart};
     %apply double& OUTPUT {double& length};
     %apply double& OUTPUT {double& k};
     void getBondParameters(int index, std::vector<int>& idxs, int& npart, double& length, double& k) const;
-    %clear std::vector<int>& idxs;
     %clear int& npart;
     %clear double& length;
     %clear double& k;
@@ -90,7 +222,153 @@ public:
         static bool isinstance(OpenMM::Force& force) {
             return (dynamic_cast<ContForcePlugin::ContForce*>(&force) != NULL);
         }
+
+        /*
+         * The state of the force is returned as bytes, like Context.createCheckpoint().
+        */
+        PyObject* createCheckpoint(OpenMM::Context& context) {
+            std::stringstream stream(std::ios_base::out | std::ios_base::binary);
+            self->createCheckpoint(context, stream);
+            std::string str = stream.str();
+            return PyBytes_FromStringAndSize(str.c_str(), str.size());
+        }
+
+        void loadCheckpoint(OpenMM::Context& context, PyObject* checkpoint) {
+            char* data;
+            Py_ssize_t size;
+            if (PyBytes_AsStringAndSize(checkpoint, &data, &size) != 0)
+                throw OpenMM::OpenMMException("ContForce: the checkpoint must be bytes");
+            std::stringstream stream(std::string(data, size), std::ios_base::in | std::ios_base::binary);
+            self->loadCheckpoint(context, stream);
+        }
     }
 };
 
 }
+
+/*
+ * A reporter that logs the summary of every bond while a Simulation runs.
+*/
+%pythoncode %{
+import struct
+import threading
+try:
+    import queue
+except ImportError:
+    import Queue as queue
+
+_RECORD_HEADER = struct.Struct('<qdi')
+
+
+class ContinuityReporter(object):
+    """ContinuityReporter writes a summary of every bond of a ContForce to a binary file.
+
+    To use it, create a ContinuityReporter and add it to the Simulation's list of reporters.  Each
+    report reads only the number of components, the number of restrained pairs and the shortest
+    restrained distance of every bond from ContForce.getBondSummaries(), which reduces them on the
+    device, so no positions are downloaded.  The records are written to the file by a background
+    thread, so the simulation does not wait for it.  Call close() when the simulation is done to
+    write the remaining records, and read the file with readContinuityLog().
+
+    Each record is little endian: the step (int64), the time in ps (float64), the number of bonds n
+    (int32), then n numbers of components (int32), n numbers of restrained pairs (int32) and n
+    shortest distances in nm (float64), which are -1 for bonds without restrained pairs.
+    """
+
+    def __init__(self, file, reportInterval, force):
+        """Create a ContinuityReporter.
+
+        Parameters
+        ----------
+        file : string or file
+            The file to write to, specified as a file name or a file object opened in binary mode
+        reportInterval : int
+            The interval (in time steps) at which to write records
+        force : ContForce
+            The force to summarize.  It must be part of the Simulation's System.
+        """
+        if not isinstance(force, ContForce):
+            force = ContForce.cast(force)
+        self._force = force
+        self._reportInterval = reportInterval
+        self._ownsFile = isinstance(file, str)
+        self._out = open(file, 'wb') if self._ownsFile else file
+        self._records = queue.Queue()
+        self._writer = threading.Thread(target=self._writeRecords)
+        self._writer.daemon = True
+        self._writer.start()
+
+    def describeNextReport(self, simulation):
+        steps = self._reportInterval - simulation.currentStep%self._reportInterval
+        return (steps, False, False, False, False)
+
+    def report(self, simulation, state):
+        numComponents, numPairs, minDistances = self._force.getBondSummaries(simulation.context)
+        n = len(numComponents)
+        time = state.getTime().value_in_unit(unit.picosecond)
+        record = _RECORD_HEADER.pack(simulation.currentStep, time, n)
+        record += struct.pack('<%di' % n, *numComponents)
+        record += struct.pack('<%di' % n, *numPairs)
+        record += struct.pack('<%dd' % n, *minDistances)
+        self._records.put(record)
+
+    def close(self):
+        """Write the remaining records and close the file if the reporter opened it."""
+        if self._writer is None:
+            return
+        self._records.put(None)
+        self._writer.join()
+        self._writer = None
+        if self._ownsFile:
+            self._out.close()
+        else:
+            self._out.flush()
+
+    def __del__(self):
+        try:
+            self.close()
+        except Exception:
+            pass
+
+    def _writeRecords(self):
+        while True:
+            record = self._records.get()
+            if record is None:
+                break
+            self._out.write(record)
+
+
+def readContinuityLog(file):
+    """Read a file written by ContinuityReporter.
+
+    Parameters
+    ----------
+    file : string or file
+        The file to read, specified as a file name or a file object opened in binary mode
+
+    Returns
+    -------
+    A list with one tuple (step, time, numComponents, numPairs, minDistances) for every record,
+    where time is in ps and the last three are lists with one element for every bond.
+    """
+    ownsFile = isinstance(file, str)
+    stream = open(file, 'rb') if ownsFile else file
+    try:
+        data = stream.read()
+    finally:
+        if ownsFile:
+            stream.close()
+    records = []
+    offset = 0
+    while offset < len(data):
+        step, time, n = _RECORD_HEADER.unpack_from(data, offset)
+        offset += _RECORD_HEADER.size
+        numComponents = list(struct.unpack_from('<%di' % n, data, offset))
+        offset += 4*n
+        numPairs = list(struct.unpack_from('<%di' % n, data, offset))
+        offset += 4*n
+        minDistances = list(struct.unpack_from('<%dd' % n, data, offset))
+        offset += 8*n
+        records.append((step, time, numComponents, numPairs, minDistances))
+    return records
+%}
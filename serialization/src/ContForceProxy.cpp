@@ -1,6 +1,9 @@
 #include "ContForceProxy.h"
 #include "ContForce.h"
+#include "openmm/OpenMMException.h"
 #include "openmm/serialization/SerializationNode.h"
+#include <climits>
+#include <cstdlib>
 #include <sstream>
 
 using namespace ContForcePlugin;
@@ -10,9 +13,73 @@ using namespace std;
 ContForceProxy::ContForceProxy() : SerializationProxy("ContForce") {
 }
 
+/**
+ * Encode a list of particle indices as a comma separated list, in which every run of consecutive
+ * increasing indices is written as "first-last".
+ */
+static string encodeIndices(const vector<int>& idxs, int npart) {
+    string encoded;
+    int i = 0;
+    while (i < npart) {
+        int end = i+1;
+        while (end < npart && idxs[end] == idxs[end-1]+1)
+            end++;
+        if (i > 0)
+            encoded += ',';
+        encoded += to_string(idxs[i]);
+        if (end-i > 1)
+            encoded += '-'+to_string(idxs[end-1]);
+        i = end;
+    }
+    return encoded;
+}
+
+/**
+ * Decode a list of particle indices written by encodeIndices(), which holds exactly npart indices.
+ * Every index must lie in [0, INT_MAX], and the number of indices is checked before any of them is
+ * stored, so a corrupt file cannot make this store more indices than the bond declares.
+ */
+static void decodeIndices(const string& encoded, int npart, vector<int>& idxs) {
+    idxs.clear();
+    if (npart < 0)
+        throw OpenMMException("ContForce: invalid number of particles in a bond: "+to_string(npart));
+    const char* text = encoded.c_str();
+    while (*text != 0) {
+        char* end;
+        long long first = strtoll(text, &end, 10);
+        long long last = first;
+        bool valid = (end != text && first >= 0 && first <= INT_MAX);
+        if (valid && *end == '-') {
+            text = end+1;
+            last = strtoll(text, &end, 10);
+            valid = (end != text && last >= first && last <= INT_MAX);
+        }
+        if (!valid)
+            throw OpenMMException("ContForce: invalid list of particle indices: "+encoded);
+        if (last-first+1 > npart-(long long) idxs.size())
+            throw OpenMMException("ContForce: a bond lists more than its "+to_string(npart)+" particles");
+        for (long long idx = first; idx <= last; idx++)
+            idxs.push_back((int) idx);
+        if (*end == ',')
+            end++;
+        else if (*end != 0)
+            throw OpenMMException("ContForce: invalid list of particle indices: "+encoded);
+        text = end;
+    }
+    if (idxs.size() != npart)
+        throw OpenMMException("ContForce: a bond lists fewer than its "+to_string(npart)+" particles");
+}
+
 void ContForceProxy::serialize(const void* object, SerializationNode& node) const {
-    node.setIntProperty("version", 1);
+    node.setIntProperty("version", 2);
     const ContForce& force = *reinterpret_cast<const ContForce*>(object);
+    node.setBoolProperty("useDeviceKernels", force.getUseDeviceKernels());
+    node.setBoolProperty("usePipelinedSelection", force.getUsePipelinedSelection());
+    node.setBoolProperty("useNonbondedNeighborList", force.getUseNonbondedNeighborList());
+    node.setDoubleProperty("skinDistance", force.getSkinDistance());
+    node.setIntProperty("hierarchicalGroupSize", force.getHierarchicalGroupSize());
+    node.setIntProperty("updateInterval", force.getUpdateInterval());
+    node.setBoolProperty("usesPeriodic", force.usesPeriodicBoundaryConditions());
     SerializationNode& bonds = node.createChildNode("Bonds");
     for (int i = 0; i < force.getNumBonds(); i++) {
 	  vector<int> idxs;
@@ -21,26 +88,39 @@ void ContForceProxy::serialize(const void* object, SerializationNode& node) cons
 	  force.getBondParameters(i, idxs, npart, distance, k);
 	  SerializationNode& bond = bonds.createChildNode("Bond");
 	  bond.setIntProperty("npart", npart).setDoubleProperty("d", distance).setDoubleProperty("k", k);
-	  for (int idx = 0; idx < npart; idx++) {
-		bond.createChildNode("Index").setIntProperty("idx",idxs[idx]);
-	  }
+	  bond.setStringProperty("idxs", encodeIndices(idxs, npart));
     }
 }
 
 void* ContForceProxy::deserialize(const SerializationNode& node) const {
-    if (node.getIntProperty("version") != 1)
+    // Version 1 stored every index as a separate child node.  Version 2 packs them into one
+    // attribute of the bond.
+
+    int version = node.getIntProperty("version");
+    if (version < 1 || version > 2)
         throw OpenMMException("Unsupported version number");
     ContForce* force = new ContForce();
     try {
+        force->setUseDeviceKernels(node.getBoolProperty("useDeviceKernels", true));
+        force->setUsePipelinedSelection(node.getBoolProperty("usePipelinedSelection", false));
+        force->setUseNonbondedNeighborList(node.getBoolProperty("useNonbondedNeighborList", true));
+        force->setSkinDistance(node.getDoubleProperty("skinDistance", 0.0));
+        force->setHierarchicalGroupSize(node.getIntProperty("hierarchicalGroupSize", 100000));
+        force->setUpdateInterval(node.getIntProperty("updateInterval", 1));
+        force->setUsesPeriodicBoundaryConditions(node.getBoolProperty("usesPeriodic", false));
         const SerializationNode& bonds = node.getChildNode("Bonds");
         for (int i = 0; i < (int) bonds.getChildren().size(); i++) {
             const SerializationNode& bond = bonds.getChildren()[i];
-			vector<int> idxs ((int) bond.getChildren().size(), -1);
-			for (int idx = 0; idx < (int) bond.getChildren().size(); idx++) {
-			  const SerializationNode& at_idx = bond.getChildren()[idx];
-			  idxs[idx] = at_idx.getIntProperty("idx");
-			}
-            force->addBond(idxs, bond.getIntProperty("npart"), bond.getDoubleProperty("d"), bond.getDoubleProperty("k"));
+            vector<int> idxs;
+            int npart = bond.getIntProperty("npart");
+            if (version == 1) {
+                idxs.resize(bond.getChildren().size());
+                for (int idx = 0; idx < (int) bond.getChildren().size(); idx++)
+                    idxs[idx] = bond.getChildren()[idx].getIntProperty("idx");
+            }
+            else
+                decodeIndices(bond.getStringProperty("idxs"), npart, idxs);
+            force->addBond(idxs, npart, bond.getDoubleProperty("d"), bond.getDoubleProperty("k"));
         }
     }
     catch (...) {
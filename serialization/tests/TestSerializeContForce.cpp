@@ -23,6 +23,13 @@ void testSerialization() {
     force.addBond(idxs3, 5, 3.0, 2.2);
 	vector<int> idxs4 = {29,300,301,5,3,0};
     force.addBond(idxs4, 6, 4.0, 2.3);
+    force.setUseDeviceKernels(false);
+    force.setUsePipelinedSelection(true);
+    force.setUseNonbondedNeighborList(false);
+    force.setSkinDistance(0.15);
+    force.setHierarchicalGroupSize(5000);
+    force.setUpdateInterval(4);
+    force.setUsesPeriodicBoundaryConditions(true);
 
     // Serialize and then deserialize it.
 
@@ -34,6 +41,13 @@ void testSerialization() {
 
     ContForce& force2 = *copy;
     ASSERT_EQUAL(force.getNumBonds(), force2.getNumBonds());
+    ASSERT_EQUAL(force.getUseDeviceKernels(), force2.getUseDeviceKernels());
+    ASSERT_EQUAL(force.getUsePipelinedSelection(), force2.getUsePipelinedSelection());
+    ASSERT_EQUAL(force.getUseNonbondedNeighborList(), force2.getUseNonbondedNeighborList());
+    ASSERT_EQUAL(force.getSkinDistance(), force2.getSkinDistance());
+    ASSERT_EQUAL(force.getHierarchicalGroupSize(), force2.getHierarchicalGroupSize());
+    ASSERT_EQUAL(force.getUpdateInterval(), force2.getUpdateInterval());
+    ASSERT_EQUAL(force.usesPeriodicBoundaryConditions(), force2.usesPeriodicBoundaryConditions());
     for (int i = 0; i < force.getNumBonds(); i++) {
 	  vector<int> a1, b1;
 	  int a2, b2;
@@ -50,10 +64,94 @@ void testSerialization() {
     }
 }
 
+void testVersion1() {
+    // Files written in the original format, with one child node for every index, can still be read.
+
+    string xml = "<Force type=\"ContForce\" version=\"1\" updateInterval=\"3\">"
+                 "<Bonds>"
+                 "<Bond npart=\"3\" d=\"1.5\" k=\"2\"><Index idx=\"4\"/><Index idx=\"2\"/><Index idx=\"3\"/></Bond>"
+                 "<Bond npart=\"2\" d=\"0.5\" k=\"7\"><Index idx=\"0\"/><Index idx=\"9\"/></Bond>"
+                 "</Bonds>"
+                 "</Force>";
+    stringstream buffer(xml);
+    ContForce* force = XmlSerializer::deserialize<ContForce>(buffer);
+    ASSERT_EQUAL(2, force->getNumBonds());
+    ASSERT_EQUAL(3, force->getUpdateInterval());
+    ASSERT(!force->usesPeriodicBoundaryConditions());
+    vector<int> idxs;
+    int npart;
+    double d, k;
+    force->getBondParameters(0, idxs, npart, d, k);
+    ASSERT_EQUAL(3, npart);
+    ASSERT_EQUAL(4, idxs[0]);
+    ASSERT_EQUAL(2, idxs[1]);
+    ASSERT_EQUAL(3, idxs[2]);
+    ASSERT_EQUAL(1.5, d);
+    ASSERT_EQUAL(2.0, k);
+    force->getBondParameters(1, idxs, npart, d, k);
+    ASSERT_EQUAL(2, npart);
+    ASSERT_EQUAL(0, idxs[0]);
+    ASSERT_EQUAL(9, idxs[1]);
+    ASSERT_EQUAL(0.5, d);
+    ASSERT_EQUAL(7.0, k);
+    delete force;
+}
+
+void testCompactIndices() {
+    // A large bond made mostly of ranges of consecutive particles should be stored compactly.
+
+    ContForce force;
+    vector<int> idxs;
+    for (int i = 0; i < 100000; i++)
+        idxs.push_back(i);
+    idxs.push_back(200000);
+    idxs.push_back(150000);
+    for (int i = 150001; i < 150100; i++)
+        idxs.push_back(i);
+    idxs.push_back(7);
+    force.addBond(idxs, idxs.size(), 1.0, 2.0);
+    stringstream buffer;
+    XmlSerializer::serialize<ContForce>(&force, "Force", buffer);
+    ASSERT(buffer.str().size() < 1000);
+    ContForce* copy = XmlSerializer::deserialize<ContForce>(buffer);
+    vector<int> idxs2;
+    int npart;
+    double d, k;
+    copy->getBondParameters(0, idxs2, npart, d, k);
+    ASSERT_EQUAL(idxs.size(), npart);
+    for (int i = 0; i < npart; i++)
+        ASSERT_EQUAL(idxs[i], idxs2[i]);
+    delete copy;
+}
+
+void testInvalidIndices() {
+    // Lists of indices that are malformed, out of range, or hold a different number of indices than
+    // the bond's npart are rejected before they are expanded.
+
+    vector<string> invalid = {"0-2000000000", "0-1,5", "3", "-1,0", "0,2147483648", "0-4294967297", "2-1", "0,,1"};
+    for (const string& idxs : invalid) {
+        string xml = "<Force type=\"ContForce\" version=\"2\"><Bonds>"
+                     "<Bond npart=\"2\" d=\"1\" k=\"1\" idxs=\""+idxs+"\"/>"
+                     "</Bonds></Force>";
+        stringstream buffer(xml);
+        bool thrown = false;
+        try {
+            delete XmlSerializer::deserialize<ContForce>(buffer);
+        }
+        catch (const OpenMMException& e) {
+            thrown = true;
+        }
+        ASSERT(thrown);
+    }
+}
+
 int main() {
     try {
         registerExampleSerializationProxies();
         testSerialization();
+        testVersion1();
+        testCompactIndices();
+        testInvalidIndices();
     }
     catch(const exception& e) {
         cout << "exception: " << e.what() << endl;